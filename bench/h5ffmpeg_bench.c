@@ -0,0 +1,633 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Benchmark harness: encodes and decodes a volume chunk by chunk with
+ * ffmpeg_native_ex over a sweep of codec parameters and prints one JSON
+ * report to stdout.  The python counterpart is h5ffmpeg-bench.
+ *
+ *   h5ffmpeg_bench [--enc 2,4] [--preset 0,15] [--crf 18,23] [--bit-mode 0]
+ *                  [--threads 0,4] [--chunk 100x512x512,32x256x256]
+ *                  [--size 100x512x512] [--pattern stripes|gradient|random]
+ *                  [--input file.h5:/data] [--dec id] [--tune id]
+ *                  [--gpu id] [--repeat 3]
+ *
+ * Lists are swept as a cartesian product; shapes are depth x height x
+ * width.  The decoder defaults to the software decoder of each encoder.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#include "ffmpeg_h5filter.h"
+
+#define BENCH_MAX_LIST 32
+#define BENCH_CD_NELMTS 13
+#define BENCH_PI 3.14159265358979323846
+
+typedef struct BenchList
+{
+    unsigned int v[BENCH_MAX_LIST][3];
+    int n;
+} BenchList;
+
+typedef struct BenchVolume
+{
+    void *data;
+    size_t shape[3]; /* depth, height, width */
+    size_t sample;   /* bytes per sample */
+} BenchVolume;
+
+typedef struct BenchStages
+{
+    double gather;
+    double encode;
+    double decode;
+    double scatter;
+} BenchStages;
+
+static double bench_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static unsigned long long bench_peak_rss(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (unsigned long long)pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (unsigned long long)usage.ru_maxrss;
+#else
+    return (unsigned long long)usage.ru_maxrss * 1024ULL;
+#endif
+#endif
+}
+
+static unsigned int default_decoder(unsigned int enc_id)
+{
+    switch (enc_id)
+    {
+    case FFH5_ENC_MPEG4:
+    case FFH5_ENC_XVID:
+        return FFH5_DEC_MPEG4;
+    case FFH5_ENC_X264:
+    case FFH5_ENC_H264_NV:
+        return FFH5_DEC_H264;
+    case FFH5_ENC_X265:
+    case FFH5_ENC_HEVC_NV:
+        return FFH5_DEC_HEVC;
+    default:
+        return FFH5_DEC_DAV1D;
+    }
+}
+
+/*
+ * Function:  parse_list
+ * --------------------
+ * Parse a comma separated list of numbers, or of DxHxW shapes when dims
+ * is 3
+ *
+ *  text: option value
+ *  dims: 1 for numbers, 3 for shapes
+ *  list: parsed values
+ *
+ *  return: 0 on success, -1 on malformed input
+ *
+ */
+static int parse_list(const char *text, int dims, BenchList *list)
+{
+    const char *p = text;
+
+    list->n = 0;
+    while (*p)
+    {
+        char *end = NULL;
+        int d;
+
+        if (list->n == BENCH_MAX_LIST)
+            return -1;
+
+        for (d = 0; d < dims; d++)
+        {
+            unsigned long value = strtoul(p, &end, 10);
+            if (end == p)
+                return -1;
+            list->v[list->n][d] = (unsigned int)value;
+            p = end;
+            if (d < dims - 1)
+            {
+                if (*p != 'x' && *p != 'X')
+                    return -1;
+                p++;
+            }
+        }
+        list->n++;
+
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return -1;
+    }
+
+    return list->n > 0 ? 0 : -1;
+}
+
+/*
+ * Function:  synth_volume
+ * --------------------
+ * Fill vol with the patterns of h5ffmpeg.utils.generate_3d_sample_vol,
+ * scaled to the range of bit_mode
+ *
+ *  vol: volume with shape set
+ *  pattern: stripes, gradient or random
+ *  bit_mode: 0 (8 bit), 1 (10 bit), 2 (12 bit)
+ *
+ *  return: 0 on success
+ *
+ */
+static int synth_volume(BenchVolume *vol, const char *pattern, unsigned int bit_mode)
+{
+    size_t d = vol->shape[0], h = vol->shape[1], w = vol->shape[2];
+    size_t z, y, x, i = 0;
+    double maxval = bit_mode == 0 ? 255.0 : (double)((1u << (8 + 2 * bit_mode)) - 1);
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+
+    vol->sample = bit_mode == 0 ? 1 : 2;
+    vol->data = malloc(d * h * w * vol->sample);
+    if (!vol->data)
+        return -1;
+
+    for (z = 0; z < d; z++)
+        for (y = 0; y < h; y++)
+            for (x = 0; x < w; x++, i++)
+            {
+                double v;
+                if (strcmp(pattern, "random") == 0)
+                {
+                    state ^= state << 13;
+                    state ^= state >> 7;
+                    state ^= state << 17;
+                    v = (double)(state >> 11) / 9007199254740992.0;
+                }
+                else if (strcmp(pattern, "gradient") == 0)
+                    v = ((w > 1 ? (double)x / (w - 1) : 0.0) + (h > 1 ? (double)y / (h - 1) : 0.0) +
+                         (d > 1 ? (double)z / (d - 1) : 0.0)) / 3.0;
+                else
+                    v = (sin((double)x * 8.0 * BENCH_PI / (double)w) + 1.0) / 2.0;
+
+                if (vol->sample == 1)
+                    ((uint8_t *)vol->data)[i] = (uint8_t)(v * maxval);
+                else
+                    ((uint16_t *)vol->data)[i] = (uint16_t)(v * maxval);
+            }
+
+    return 0;
+}
+
+/*
+ * Function:  load_volume
+ * --------------------
+ * Read a 3D uint8/uint16 dataset ("file.h5:/path") through the filter
+ * and convert it to the sample size of bit_mode
+ *
+ *  vol: loaded volume
+ *  spec: file and dataset separated by a colon
+ *  bit_mode: 0 (8 bit), 1 (10 bit), 2 (12 bit)
+ *
+ *  return: 0 on success
+ *
+ */
+static int load_volume(BenchVolume *vol, const char *spec, unsigned int bit_mode)
+{
+    char path[4096];
+    const char *colon = strrchr(spec, ':');
+    const char *name = colon ? colon + 1 : "/data";
+    hid_t file = H5I_INVALID_HID, dset = H5I_INVALID_HID, space = H5I_INVALID_HID, type = H5I_INVALID_HID;
+    hsize_t dims[3];
+    size_t stored, n, i;
+    unsigned int want = 8 + 2 * bit_mode;
+    void *raw = NULL;
+    int ret = -1;
+
+    /* a colon followed by a backslash is a windows drive, not a dataset */
+    if (colon && (colon[1] == '\\' || colon[1] == '/') && colon - spec == 1)
+        colon = NULL, name = "/data";
+
+    snprintf(path, sizeof(path), "%.*s", colon ? (int)(colon - spec) : (int)strlen(spec), spec);
+
+    file = H5Fopen(path, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file < 0)
+        goto Finish;
+    dset = H5Dopen2(file, name, H5P_DEFAULT);
+    if (dset < 0)
+        goto Finish;
+    space = H5Dget_space(dset);
+    type = H5Dget_type(dset);
+    if (H5Sget_simple_extent_ndims(space) != 3)
+    {
+        fprintf(stderr, "%s: expected a 3D dataset\n", spec);
+        goto Finish;
+    }
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    stored = H5Tget_size(type) == 1 ? 1 : 2;
+
+    vol->shape[0] = (size_t)dims[0];
+    vol->shape[1] = (size_t)dims[1];
+    vol->shape[2] = (size_t)dims[2];
+    vol->sample = bit_mode == 0 ? 1 : 2;
+    n = vol->shape[0] * vol->shape[1] * vol->shape[2];
+
+    raw = malloc(n * stored);
+    vol->data = malloc(n * vol->sample);
+    if (!raw || !vol->data)
+        goto Finish;
+    if (H5Dread(dset, stored == 1 ? H5T_NATIVE_UINT8 : H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, raw) < 0)
+        goto Finish;
+
+    /* keep the most significant bits when the stored depth differs */
+    for (i = 0; i < n; i++)
+    {
+        unsigned int v = stored == 1 ? ((uint8_t *)raw)[i] : ((uint16_t *)raw)[i];
+        unsigned int bits = stored == 1 ? 8 : 16;
+        v = bits > want ? v >> (bits - want) : v << (want - bits);
+        if (vol->sample == 1)
+            ((uint8_t *)vol->data)[i] = (uint8_t)v;
+        else
+            ((uint16_t *)vol->data)[i] = (uint16_t)v;
+    }
+    ret = 0;
+
+Finish:
+    if (ret < 0)
+    {
+        free(vol->data);
+        vol->data = NULL;
+    }
+    free(raw);
+    if (type >= 0)
+        H5Tclose(type);
+    if (space >= 0)
+        H5Sclose(space);
+    if (dset >= 0)
+        H5Dclose(dset);
+    if (file >= 0)
+        H5Fclose(file);
+    return ret;
+}
+
+/* copy the box at origin between a volume and a zero padded chunk */
+static void copy_box(const BenchVolume *vol, uint8_t *chunk, const size_t origin[3], const size_t cshape[3],
+                     int to_chunk)
+{
+    size_t rows = cshape[0] * cshape[1];
+    size_t r, span = vol->shape[2] - origin[2];
+
+    if (span > cshape[2])
+        span = cshape[2];
+
+    if (to_chunk)
+        memset(chunk, 0, rows * cshape[2] * vol->sample);
+
+    for (r = 0; r < rows; r++)
+    {
+        size_t z = origin[0] + r / cshape[1], y = origin[1] + r % cshape[1];
+        uint8_t *row;
+        if (z >= vol->shape[0] || y >= vol->shape[1])
+            continue;
+        row = (uint8_t *)vol->data + ((z * vol->shape[1] + y) * vol->shape[2] + origin[2]) * vol->sample;
+        if (to_chunk)
+            memcpy(chunk + r * cshape[2] * vol->sample, row, span * vol->sample);
+        else
+            memcpy(row, chunk + r * cshape[2] * vol->sample, span * vol->sample);
+    }
+}
+
+static double psnr(const BenchVolume *a, const BenchVolume *b)
+{
+    size_t n = a->shape[0] * a->shape[1] * a->shape[2], i;
+    double se = 0.0, peak = a->sample == 1 ? 255.0 : 65535.0;
+
+    for (i = 0; i < n; i++)
+    {
+        double d = a->sample == 1 ? (double)((uint8_t *)a->data)[i] - ((uint8_t *)b->data)[i]
+                                  : (double)((uint16_t *)a->data)[i] - ((uint16_t *)b->data)[i];
+        se += d * d;
+    }
+    if (se == 0.0)
+        return INFINITY;
+    return 20.0 * log10(peak / sqrt(se / (double)n));
+}
+
+/*
+ * Function:  run_case
+ * --------------------
+ * Encode and decode vol in chunks of cshape repeat times, keeping the
+ * fastest time of every stage
+ *
+ *  vol: input volume
+ *  cd_values: parameters with the size fields filled in per chunk
+ *  cshape: chunk shape
+ *  repeat: number of runs
+ *  stages: best time of each stage (seconds)
+ *  compressed: total compressed bytes
+ *  quality: psnr of the decoded volume
+ *
+ *  return: 0 on success
+ *
+ */
+static int run_case(const BenchVolume *vol, unsigned int cd_values[], const size_t cshape[3], int repeat,
+                    BenchStages *stages, size_t *compressed, double *quality)
+{
+    size_t grid[3], n_chunks, c, chunk_bytes = cshape[0] * cshape[1] * cshape[2] * vol->sample;
+    size_t raw_bytes = vol->shape[0] * vol->shape[1] * vol->shape[2] * vol->sample;
+    void **blobs = NULL;
+    size_t *sizes = NULL;
+    BenchVolume out = *vol;
+    int d, r, ret = -1;
+
+    for (d = 0; d < 3; d++)
+        grid[d] = (vol->shape[d] + cshape[d] - 1) / cshape[d];
+    n_chunks = grid[0] * grid[1] * grid[2];
+
+    cd_values[2] = (unsigned int)cshape[2];
+    cd_values[3] = (unsigned int)cshape[1];
+    cd_values[4] = (unsigned int)cshape[0];
+
+    blobs = calloc(n_chunks, sizeof(*blobs));
+    sizes = calloc(n_chunks, sizeof(*sizes));
+    out.data = malloc(raw_bytes);
+    if (!blobs || !sizes || !out.data)
+        goto Finish;
+
+    stages->gather = stages->encode = stages->decode = stages->scatter = INFINITY;
+
+    for (r = 0; r < repeat; r++)
+    {
+        BenchStages run = {0.0, 0.0, 0.0, 0.0};
+        double t;
+
+        *compressed = 0;
+        for (c = 0; c < n_chunks; c++)
+        {
+            size_t origin[3] = {(c / (grid[1] * grid[2])) * cshape[0], (c / grid[2] % grid[1]) * cshape[1],
+                                (c % grid[2]) * cshape[2]};
+
+            t = bench_now();
+            blobs[c] = malloc(chunk_bytes);
+            if (!blobs[c])
+                goto Finish;
+            copy_box(vol, blobs[c], origin, cshape, 1);
+            run.gather += bench_now() - t;
+
+            t = bench_now();
+            sizes[c] = ffmpeg_native_ex(0, BENCH_CD_NELMTS, cd_values, chunk_bytes, &blobs[c]);
+            run.encode += bench_now() - t;
+            if (sizes[c] == 0)
+            {
+                fprintf(stderr, "encoding chunk %zu failed\n", c);
+                goto Finish;
+            }
+            *compressed += sizes[c];
+        }
+
+        for (c = 0; c < n_chunks; c++)
+        {
+            size_t origin[3] = {(c / (grid[1] * grid[2])) * cshape[0], (c / grid[2] % grid[1]) * cshape[1],
+                                (c % grid[2]) * cshape[2]};
+            size_t size;
+
+            t = bench_now();
+            size = ffmpeg_native_ex(1, BENCH_CD_NELMTS, cd_values, sizes[c], &blobs[c]);
+            run.decode += bench_now() - t;
+            if (size != chunk_bytes)
+            {
+                fprintf(stderr, "decoding chunk %zu failed\n", c);
+                goto Finish;
+            }
+
+            t = bench_now();
+            copy_box(&out, blobs[c], origin, cshape, 0);
+            free(blobs[c]);
+            blobs[c] = NULL;
+            run.scatter += bench_now() - t;
+        }
+
+        stages->gather = fmin(stages->gather, run.gather);
+        stages->encode = fmin(stages->encode, run.encode);
+        stages->decode = fmin(stages->decode, run.decode);
+        stages->scatter = fmin(stages->scatter, run.scatter);
+    }
+
+    *quality = psnr(vol, &out);
+    ret = 0;
+
+Finish:
+    if (blobs)
+        for (c = 0; c < n_chunks; c++)
+            free(blobs[c]);
+    free(blobs);
+    free(sizes);
+    free(out.data);
+    return ret;
+}
+
+static void print_number(double v)
+{
+    if (isinf(v) || isnan(v))
+        printf("null");
+    else
+        printf("%.4f", v);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--enc ids] [--dec id] [--preset ids] [--tune id] [--crf values]\n"
+            "          [--bit-mode modes] [--threads counts] [--chunk DxHxW,...] [--size DxHxW]\n"
+            "          [--pattern stripes|gradient|random] [--input file.h5:/dataset]\n"
+            "          [--gpu id] [--repeat n]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    BenchList enc, preset, crf, bit_mode, threads, chunk, size;
+    const char *pattern = "stripes", *input = NULL;
+    int dec = -1, tune = 0, gpu = 0, repeat = 3, first = 1, i;
+    unsigned int ie, ip, ic, ib, it, ik;
+
+    parse_list("2", 1, &enc);
+    parse_list("0", 1, &preset);
+    parse_list("23", 1, &crf);
+    parse_list("0", 1, &bit_mode);
+    parse_list("0", 1, &threads);
+    parse_list("100x512x512", 3, &size);
+    chunk.n = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+        int bad = 0;
+
+        if (strcmp(opt, "-h") == 0 || strcmp(opt, "--help") == 0)
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        if (!val)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+
+        if (strcmp(opt, "--enc") == 0)
+            bad = parse_list(val, 1, &enc);
+        else if (strcmp(opt, "--preset") == 0)
+            bad = parse_list(val, 1, &preset);
+        else if (strcmp(opt, "--crf") == 0)
+            bad = parse_list(val, 1, &crf);
+        else if (strcmp(opt, "--bit-mode") == 0)
+            bad = parse_list(val, 1, &bit_mode);
+        else if (strcmp(opt, "--threads") == 0)
+            bad = parse_list(val, 1, &threads);
+        else if (strcmp(opt, "--chunk") == 0)
+            bad = parse_list(val, 3, &chunk);
+        else if (strcmp(opt, "--size") == 0)
+            bad = parse_list(val, 3, &size) || size.n != 1;
+        else if (strcmp(opt, "--pattern") == 0)
+            pattern = val;
+        else if (strcmp(opt, "--input") == 0)
+            input = val;
+        else if (strcmp(opt, "--dec") == 0)
+            dec = atoi(val);
+        else if (strcmp(opt, "--tune") == 0)
+            tune = atoi(val);
+        else if (strcmp(opt, "--gpu") == 0)
+            gpu = atoi(val);
+        else if (strcmp(opt, "--repeat") == 0)
+            bad = (repeat = atoi(val)) < 1;
+        else
+            bad = 1;
+
+        if (bad)
+        {
+            fprintf(stderr, "invalid value for %s: %s\n", opt, val);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (input)
+        ffmpeg_register_h5filter();
+    /* every decode has to run, not come from a warm cache */
+    ffmpeg_h5_set_chunk_cache(0, 0);
+
+    printf("{\n  \"harness\": \"h5ffmpeg_bench\",\n  \"repeat\": %d,\n  \"cases\": [", repeat);
+
+    for (ib = 0; ib < (unsigned int)bit_mode.n; ib++)
+    {
+        BenchVolume vol = {NULL, {size.v[0][0], size.v[0][1], size.v[0][2]}, 1};
+        int loaded = input ? load_volume(&vol, input, bit_mode.v[ib][0])
+                           : synth_volume(&vol, pattern, bit_mode.v[ib][0]);
+        size_t raw_bytes;
+
+        if (loaded < 0)
+        {
+            fprintf(stderr, "cannot load %s\n", input ? input : pattern);
+            return 1;
+        }
+        raw_bytes = vol.shape[0] * vol.shape[1] * vol.shape[2] * vol.sample;
+
+        for (ie = 0; ie < (unsigned int)enc.n; ie++)
+            for (ip = 0; ip < (unsigned int)preset.n; ip++)
+                for (ic = 0; ic < (unsigned int)crf.n; ic++)
+                    for (it = 0; it < (unsigned int)threads.n; it++)
+                        for (ik = 0; ik < (unsigned int)(chunk.n ? chunk.n : 1); ik++)
+                        {
+                            unsigned int cd_values[BENCH_CD_NELMTS] = {
+                                enc.v[ie][0], dec >= 0 ? (unsigned int)dec : default_decoder(enc.v[ie][0]),
+                                0, 0, 0, bit_mode.v[ib][0], preset.v[ip][0], (unsigned int)tune,
+                                crf.v[ic][0], 0, (unsigned int)gpu, threads.v[it][0], 0};
+                            size_t cshape[3];
+                            BenchStages st;
+                            size_t compressed = 0;
+                            double quality = 0.0;
+                            int d, failed;
+
+                            for (d = 0; d < 3; d++)
+                            {
+                                cshape[d] = chunk.n ? chunk.v[ik][d] : vol.shape[d];
+                                if (cshape[d] == 0 || cshape[d] > vol.shape[d])
+                                    cshape[d] = vol.shape[d];
+                            }
+
+                            failed = run_case(&vol, cd_values, cshape, repeat, &st, &compressed, &quality);
+
+                            printf("%s\n    {\"enc\": %u, \"dec\": %u, \"preset\": %u, \"tune\": %u, \"crf\": %u, "
+                                   "\"bit_mode\": %u, \"threads\": %u, \"shape\": [%zu, %zu, %zu], "
+                                   "\"chunks\": [%zu, %zu, %zu], \"raw_bytes\": %zu, ",
+                                   first ? "" : ",", cd_values[0], cd_values[1], cd_values[6], cd_values[7],
+                                   cd_values[8], cd_values[5], cd_values[11], vol.shape[0], vol.shape[1],
+                                   vol.shape[2], cshape[0], cshape[1], cshape[2], raw_bytes);
+                            first = 0;
+
+                            if (failed)
+                            {
+                                printf("\"error\": \"encode/decode failed\"}");
+                                continue;
+                            }
+
+                            printf("\"compressed_bytes\": %zu, \"ratio\": ", compressed);
+                            print_number((double)raw_bytes / (double)compressed);
+                            printf(", \"encode_mbps\": ");
+                            print_number((double)raw_bytes / 1e6 / st.encode);
+                            printf(", \"decode_mbps\": ");
+                            print_number((double)raw_bytes / 1e6 / st.decode);
+                            printf(", \"psnr\": ");
+                            print_number(quality);
+                            printf(", \"peak_rss_bytes\": %llu, \"stages\": {\"gather\": ", bench_peak_rss());
+                            print_number(st.gather);
+                            printf(", \"encode\": ");
+                            print_number(st.encode);
+                            printf(", \"decode\": ");
+                            print_number(st.decode);
+                            printf(", \"scatter\": ");
+                            print_number(st.scatter);
+                            printf("}}");
+                            fflush(stdout);
+                        }
+
+        free(vol.data);
+    }
+
+    printf("\n  ]\n}\n");
+    ffmpeg_h5_clear_context_cache();
+    return 0;
+}
@@ -78,6 +78,21 @@ add_library(h5ffmpeg_shared SHARED
     src/ffmpeg_h5plugin.c
     src/ffmpeg_native.c
     src/ffmpeg_utils.c
+    src/ffmpeg_cache.c
+    src/ffmpeg_codec.c
+    src/ffmpeg_pool.c
+    src/ffmpeg_h5parallel.c
+    src/ffmpeg_pixconv.c
+    src/ffmpeg_ratio.c
+    src/ffmpeg_hw.c
+    src/ffmpeg_sched.c
+    src/ffmpeg_stream.c
+    src/ffmpeg_chunkcache.c
+    src/ffmpeg_stats.c
+    src/ffmpeg_quant.c
+    src/ffmpeg_caps.c
+    src/ffmpeg_downsample.c
+    src/ffmpeg_rdcc.c
 )
 
 target_include_directories(h5ffmpeg_shared
@@ -169,12 +169,20 @@ from .constants import (
     Preset,
     Tune,
     BitMode,
+    SampleLayout,
+    Feature,
+    ThreadType,
 )
 
 from .gpu_utils import (
     has_nvidia_gpu,
     has_intel_gpu,
+    has_codec,
+    capabilities,
     detect_available_gpus,
+    configure_gpu_scheduler,
+    disable_gpu_scheduler,
+    gpu_scheduler_stats,
 )
 
 from .ffmpeg_filter import (
@@ -190,15 +198,48 @@ from .ffmpeg_filter import (
     hevc_nvenc,
     av1_nvenc,
     av1_qsv,
+    ffv1,
+    x264_lossless,
     # Native functions
     ffmpeg_native,
     compress_native,
     decompress_native,
+    compress_many,
+    decompress_many,
+    seed_compression_ratio,
+    expected_compression_ratio,
+    size_stats,
+    configure_chunk_cache,
+    chunk_cache_stats,
+    clear_chunk_cache,
+    enable_stats,
+    stats,
+    reset_stats,
+    write_trace,
+    quantize_intensity,
     NATIVE_AVAILABLE,
     # Filter class
     FFMPEG,
 )
 
+from .chunking import plan_chunks
+from .parallel import write_dataset_parallel, read_dataset_parallel, read_frames
+from .pyramid import downsample, pyramid_levels
+from .prefetch import PrefetchedDataset, prefetch, iter_slices
+from .rdcc import (
+    chunk_cache_settings as hdf5_chunk_cache_settings,
+    open_dataset,
+    set_default_access as set_chunk_cache_access,
+)
+from .stream import (
+    StreamEncoder,
+    StreamDecoder,
+    compress_stream,
+    decompress_stream,
+    write_dataset_streaming,
+)
+from .tuner import tune_encoder
+
 # Import additional modules
 try:
     from .anm import film_grain_optimizer
@@ -225,20 +266,61 @@ __all__ = [
     "hevc_nvenc",
     "av1_nvenc",
     "av1_qsv",
+    "ffv1",
+    "x264_lossless",
     # Native functions
     "ffmpeg_native",
     "compress_native",
     "decompress_native",
+    "compress_many",
+    "decompress_many",
+    "seed_compression_ratio",
+    "expected_compression_ratio",
+    "size_stats",
+    "configure_chunk_cache",
+    "chunk_cache_stats",
+    "clear_chunk_cache",
+    "enable_stats",
+    "stats",
+    "reset_stats",
+    "write_trace",
+    "quantize_intensity",
+    "plan_chunks",
+    "write_dataset_parallel",
+    "read_dataset_parallel",
+    "read_frames",
+    "downsample",
+    "pyramid_levels",
+    "PrefetchedDataset",
+    "prefetch",
+    "iter_slices",
+    "hdf5_chunk_cache_settings",
+    "open_dataset",
+    "set_chunk_cache_access",
+    "StreamEncoder",
+    "StreamDecoder",
+    "compress_stream",
+    "decompress_stream",
+    "write_dataset_streaming",
+    "tune_encoder",
     # Constants and enums
     "EncoderCodec",
     "DecoderCodec",
     "Preset", 
     "Tune",
     "BitMode",
+    "SampleLayout",
+    "Feature",
+    "ThreadType",
     # Hardware detection
     "has_nvidia_gpu",
     "has_intel_gpu",
+    "has_codec",
+    "capabilities",
     "detect_available_gpus",
+    "configure_gpu_scheduler",
+    "disable_gpu_scheduler",
+    "gpu_scheduler_stats",
     # Additional utilities
     "film_grain_optimizer",
 ]
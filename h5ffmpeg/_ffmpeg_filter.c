@@ -4,12 +4,16 @@
 #include <hdf5.h>
 
 #include "ffmpeg_utils.h"
+#include "ffmpeg_pool.h"
+#include "ffmpeg_codec.h"
+#include "ffmpeg_ratio.h"
+#include "ffmpeg_sched.h"
+#include "ffmpeg_caps.h"
 
 #define FFMPEG_FILTER_ID 32030
 
 extern H5Z_class_t ffmpeg_H5Filter[1];
 
-extern size_t ffmpeg_native(unsigned flags, const unsigned int cd_values[], size_t buf_size, void **buf);
 
 // Patched version of the filter registration function
 static PyObject *register_filter(PyObject *self, PyObject *args)
@@ -27,44 +31,36 @@ static PyObject *get_filter_id(PyObject *self, PyObject *args)
     return PyLong_FromLong(FFMPEG_FILTER_ID);
 }
 
-static PyObject *ffmpeg_native_c(PyObject *self, PyObject *args, PyObject *kwargs)
-{
-    PyObject *input_data = NULL;
-    PyObject *cd_values_list = NULL;
-    unsigned int flags;
-    size_t buf_size;
-
-    static char *kwlist[] = {"flags", "cd_values", "buf_size", "data", NULL};
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "IOkO", kwlist,
-                                     &flags, &cd_values_list, &buf_size, &input_data))
-    {
-        return NULL;
-    }
+// Header version written in front of natively compressed data
+static unsigned int header_version = 2;
 
-    // Convert Python list/tuple to C array
+// Convert a Python list/tuple to the C cd_values array, the first 11 values
+// are mandatory and the optional threading parameters may follow
+static Py_ssize_t parse_cd_values(PyObject *cd_values_list, unsigned int cd_values[FFH5_MAX_CD_VALUES])
+{
     if (!PyList_Check(cd_values_list) && !PyTuple_Check(cd_values_list))
     {
         PyErr_SetString(PyExc_TypeError, "cd_values must be a list or tuple");
-        return NULL;
+        return -1;
     }
 
     Py_ssize_t list_size = PySequence_Size(cd_values_list);
-    if (list_size != 11)
+    if (list_size < FFH5_CD_NELMTS || list_size > FFH5_MAX_CD_VALUES)
     {
-        PyErr_SetString(PyExc_ValueError, "cd_values must have 11 elements");
-        return NULL;
+        PyErr_Format(PyExc_ValueError, "cd_values must have between %d and %d elements",
+                     FFH5_CD_NELMTS, FFH5_MAX_CD_VALUES);
+        return -1;
     }
 
-    unsigned int cd_values[11];
-    for (int i = 0; i < 11; i++)
+    memset(cd_values, 0, FFH5_MAX_CD_VALUES * sizeof(unsigned int));
+    for (Py_ssize_t i = 0; i < list_size; i++)
     {
         PyObject *item = PySequence_GetItem(cd_values_list, i);
         if (!PyLong_Check(item))
         {
             Py_DECREF(item);
             PyErr_SetString(PyExc_TypeError, "All cd_values elements must be integers");
-            return NULL;
+            return -1;
         }
         cd_values[i] = PyLong_AsUnsignedLong(item);
         Py_DECREF(item);
@@ -73,159 +69,1378 @@ static PyObject *ffmpeg_native_c(PyObject *self, PyObject *args, PyObject *kwarg
         if (PyErr_Occurred())
         {
             PyErr_SetString(PyExc_ValueError, "Invalid integer value in cd_values");
-            return NULL;
+            return -1;
         }
     }
 
-    void *buf = NULL;
+    return list_size;
+}
 
-    // Get data and copy it
-    if (flags == 0)
-    { 
-        // Compress
-        // First check if input_data is actually a NumPy array
-        if (!PyArray_Check(input_data)) {
-            PyErr_SetString(PyExc_TypeError, "Input data must be a numpy array for compression");
-            return NULL;
-        }
-        
-        // Cast to PyArrayObject* and get contiguous array
-        PyArrayObject *input_array = (PyArrayObject *)input_data;
-        PyArrayObject *array = (PyArrayObject *)PyArray_GETCONTIGUOUS(input_array);
-        if (!array)
-            return NULL;
+// metadata_size(4) + version(4) + 11 uint32 + uint64 compressed_size
+#define NATIVE_METADATA_SIZE (FFH5_CD_NELMTS * sizeof(unsigned int) + sizeof(uint64_t))
+#define NATIVE_HEADER_SIZE (8 + NATIVE_METADATA_SIZE)
+// 12 bit blobs of the native sample layout append cd_values[16] to the
+// metadata, which metadata_size accounts for; other blobs are unchanged
+#define NATIVE_LAYOUT_SIZE sizeof(unsigned int)
 
-        size_t actual_buf_size = PyArray_NBYTES(array);
-        // Use the larger of provided buf_size or actual array size
-        if (buf_size == 0)
-            buf_size = actual_buf_size;
+// One native compress/decompress call. Input is read in place through the
+// buffer protocol, output is produced directly inside the returned object.
+typedef struct NativeItem
+{
+    unsigned int cd_values[FFH5_MAX_CD_VALUES];
+    size_t cd_nelmts;
+    Py_buffer view;
+    int has_view;
+    PyObject *contiguous; // copy of a non-contiguous numpy input
+    const uint8_t *in;
+    size_t in_size;
+    size_t header_size; // room kept for the native header, 0 for raw filter chunks
+    FFH5Sink sink;
+    PyObject *result; // bytes (compress) or numpy array (decompress)
+    size_t result_size;
+} NativeItem;
 
-        buf = malloc(buf_size);
-        if (!buf)
-        {
-            Py_DECREF(array);
-            PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory");
-            return NULL;
-        }
-        memcpy(buf, PyArray_DATA(array), actual_buf_size);
-        Py_DECREF(array);
+// sample layout stored in the native header, 0 when there is none
+static unsigned int native_layout(const NativeItem *item)
+{
+    return (item->cd_nelmts > FFH5_CD_SAMPLE_LAYOUT) ? item->cd_values[FFH5_CD_SAMPLE_LAYOUT] : 0;
+}
+
+// Compressed output lives in a bytes object after the reserved header;
+// resizing it needs the GIL, which the encoder thread does not hold.
+static int bytes_sink_grow(FFH5Sink *sink, size_t min_capacity)
+{
+    NativeItem *item = (NativeItem *)sink->opaque;
+    PyGILState_STATE gil = PyGILState_Ensure();
+    int ret = -1;
+
+    if (item->result && _PyBytes_Resize(&item->result, item->header_size + min_capacity) == 0)
+    {
+        sink->data = (uint8_t *)PyBytes_AS_STRING(item->result) + item->header_size;
+        sink->capacity = min_capacity;
+        ret = 0;
     }
     else
-    { // Decompress
-        char *data_ptr;
-        Py_ssize_t size;
-        if (PyBytes_AsStringAndSize(input_data, &data_ptr, &size) < 0)
+        PyErr_Clear();
+
+    PyGILState_Release(gil);
+    return ret;
+}
+
+static void item_clear(NativeItem *item)
+{
+    if (item->has_view)
+        PyBuffer_Release(&item->view);
+    item->has_view = 0;
+    Py_CLEAR(item->contiguous);
+    Py_CLEAR(item->result);
+}
+
+// Get a C-contiguous view of the input without copying whenever possible
+static int item_acquire_input(NativeItem *item, PyObject *input_data)
+{
+    if (PyObject_GetBuffer(input_data, &item->view, PyBUF_C_CONTIGUOUS) == 0)
+    {
+        item->has_view = 1;
+        item->in = (const uint8_t *)item->view.buf;
+        item->in_size = (size_t)item->view.len;
+        return 0;
+    }
+
+    if (!PyArray_Check(input_data))
+        return -1;
+
+    // Strided numpy arrays have to be copied once
+    PyErr_Clear();
+    item->contiguous = (PyObject *)PyArray_GETCONTIGUOUS((PyArrayObject *)input_data);
+    if (!item->contiguous)
+        return -1;
+    item->in = (const uint8_t *)PyArray_DATA((PyArrayObject *)item->contiguous);
+    item->in_size = PyArray_NBYTES((PyArrayObject *)item->contiguous);
+    return 0;
+}
+
+// Set up the output of a decompression, either a new array or out
+static int item_prepare_array(NativeItem *item, PyObject *out)
+{
+    // Extract dimensions from cd_values
+    unsigned int width = item->cd_values[2];
+    unsigned int height = item->cd_values[3];
+    unsigned int depth = item->cd_values[4];
+    unsigned int bit_mode = item->cd_values[5];
+
+    npy_intp dims[3] = {depth, height, width};
+    int typenum = (bit_mode == 0) ? NPY_UINT8 : NPY_UINT16;
+    size_t needed = ffmpeg_decoded_size(item->cd_values);
+
+    if (out && out != Py_None)
+    {
+        PyArrayObject *array = (PyArrayObject *)out;
+
+        if (!PyArray_Check(out) || !PyArray_IS_C_CONTIGUOUS(array) || !PyArray_ISWRITEABLE(array))
         {
-            return NULL;
+            PyErr_SetString(PyExc_TypeError, "out must be a writeable C-contiguous numpy array");
+            return -1;
         }
+        if (PyArray_TYPE(array) != typenum || (size_t)PyArray_NBYTES(array) != needed)
+        {
+            PyErr_Format(PyExc_ValueError, "out must be a %s array of shape (%u, %u, %u)",
+                         (typenum == NPY_UINT8) ? "uint8" : "uint16", depth, height, width);
+            return -1;
+        }
+        Py_INCREF(out);
+        item->result = out;
+    }
+    else
+    {
+        item->result = PyArray_EMPTY(3, dims, typenum, 0);
+        if (!item->result)
+            return -1;
+    }
+
+    item->sink.data = (uint8_t *)PyArray_DATA((PyArrayObject *)item->result);
+    item->sink.capacity = needed;
+    item->sink.grow = NULL;
+    return 0;
+}
+
+// Everything that needs the GIL before the codec runs
+static int item_prepare(NativeItem *item, unsigned int flags, PyObject *cd_values_list,
+                        PyObject *input_data, PyObject *out, size_t buf_size, int raw)
+{
+    Py_ssize_t cd_nelmts;
+
+    memset(item, 0, sizeof(NativeItem));
+
+    cd_nelmts = parse_cd_values(cd_values_list, item->cd_values);
+    if (cd_nelmts < 0)
+        return -1;
+    item->cd_nelmts = (size_t)cd_nelmts;
 
-        // The Python code has already parsed the metadata and stripped it
-        // So data_ptr now points directly to the compressed data
-        buf_size = size;
-        buf = malloc(buf_size);
-        if (!buf)
+    if (item_acquire_input(item, input_data) < 0)
+    {
+        if (!PyErr_Occurred() || PyErr_ExceptionMatches(PyExc_TypeError) ||
+            PyErr_ExceptionMatches(PyExc_BufferError))
         {
-            PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory");
-            return NULL;
+            PyErr_Clear();
+            PyErr_SetString(PyExc_TypeError, (flags == 0)
+                                                 ? "Input data must be a numpy array for compression"
+                                                 : "Input data must be a bytes-like object for decompression");
         }
-        memcpy(buf, data_ptr, size);
+        return -1;
     }
+    if (buf_size > 0 && buf_size < item->in_size)
+        item->in_size = buf_size;
 
-    // Release GIL during CPU-intensive ffmpeg operation
-    size_t result_size;
-    result_size = ffmpeg_native(flags, cd_values, buf_size, &buf);
+    if (flags == 0)
+    {
+        // Compress: reserve room for the header and the size predicted from earlier
+        // chunks; bytes_sink_grow handles the rare overflow and the tail is trimmed later
+        size_t reserve = ffh5_ratio_reserve(item->cd_values, item->in_size);
+
+        item->header_size = raw ? 0 : NATIVE_HEADER_SIZE + (native_layout(item) ? NATIVE_LAYOUT_SIZE : 0);
+        item->result = PyBytes_FromStringAndSize(NULL, item->header_size + reserve);
+        if (!item->result)
+            return -1;
+        item->sink.data = (uint8_t *)PyBytes_AS_STRING(item->result) + item->header_size;
+        item->sink.capacity = reserve;
+        item->sink.grow = bytes_sink_grow;
+        item->sink.opaque = item;
+        return 0;
+    }
+
+    return item_prepare_array(item, out);
+}
+
+// The codec itself, runs without the GIL
+static void item_run(NativeItem *item, unsigned int flags)
+{
+    if (flags == 0)
+        item->result_size = ffmpeg_encode_chunk(item->cd_nelmts, item->cd_values, item->in, item->in_size,
+                                                &item->sink, raise_ffmpeg_error);
+    else
+        item->result_size = ffmpeg_decode_chunk(item->cd_nelmts, item->cd_values, item->in, item->in_size,
+                                                &item->sink, raise_ffmpeg_error);
+}
+
+// Hand over the result object (new reference), NULL with an exception set on failure
+static PyObject *item_finish(NativeItem *item, unsigned int flags)
+{
+    PyObject *result;
 
-    if (result_size == 0)
+    if (item->result_size == 0 || !item->result)
     {
-        free(buf);
-        PyErr_SetString(PyExc_RuntimeError, "Operation failed");
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, "Operation failed");
         return NULL;
     }
 
-    PyObject *result;
-    if (flags == 0)
-    { 
-        // Compression: Return metadata + compressed data
-        // Create metadata structure with size_t for compressed_size
-
-        PyObject *module = PyImport_ImportModule("h5ffmpeg._ffmpeg_filter");
-        PyObject *version_obj = PyObject_GetAttrString(module, "HEADER_VERSION");
-        unsigned int header_version = version_obj ? (unsigned int)PyLong_AsUnsignedLong(version_obj) : 2;
-        Py_XDECREF(version_obj);
-        Py_XDECREF(module);
-
-        size_t metadata_size = 11 * sizeof(unsigned int) + sizeof(uint64_t); // 11 uint32 + 1 size_t
-        size_t header_size = 8; // metadata_size(4) + version(4)
-        size_t total_size = header_size + metadata_size + result_size;
-        
-        char *output_buf = malloc(total_size);
-        if (!output_buf) {
-            free(buf);
-            PyErr_SetString(PyExc_MemoryError, "Failed to allocate output buffer");
+    if (flags == 0 && item->header_size == 0)
+    {
+        // Raw filter chunk: compressed data only, exactly as the HDF5 filter stores it
+        if (_PyBytes_Resize(&item->result, item->result_size) < 0)
             return NULL;
-        }
-        
+    }
+    else if (flags == 0)
+    {
+        // Compression: metadata + compressed data
+        char *header = PyBytes_AS_STRING(item->result);
         size_t offset = 0;
-        
+        unsigned int metadata_size = (unsigned int)(item->header_size - 8), layout = native_layout(item);
+        uint64_t compressed_size = (uint64_t)item->result_size;
+
         // Write header: metadata size + version
-        *(unsigned int*)(output_buf + offset) = (unsigned int)metadata_size;
+        memcpy(header + offset, &metadata_size, sizeof(unsigned int));
         offset += sizeof(unsigned int);
-        *(unsigned int*)(output_buf + offset) = header_version;
+        memcpy(header + offset, &header_version, sizeof(unsigned int));
         offset += sizeof(unsigned int);
-        
-        // Write metadata fields (11 unsigned ints)
-        unsigned int metadata[11] = {
-            cd_values[0],  // enc_id
-            cd_values[1],  // dec_id
-            cd_values[2],  // width
-            cd_values[3],  // height
-            cd_values[4],  // depth
-            cd_values[5],  // bit_mode
-            cd_values[6],  // preset_id
-            cd_values[7],  // tune_id
-            cd_values[8],  // crf
-            cd_values[9],  // film_grain
-            cd_values[10], // gpu_id
-        };
-        
-        memcpy(output_buf + offset, metadata, 11 * sizeof(unsigned int));
-        offset += 11 * sizeof(unsigned int);
-        
-        // Write compressed_size as uint64_t
-        *(uint64_t*)(output_buf + offset) = (uint64_t)result_size;
+
+        // Write metadata fields (enc_id, dec_id, width, height, depth, bit_mode,
+        // preset_id, tune_id, crf, film_grain, gpu_id)
+        memcpy(header + offset, item->cd_values, FFH5_CD_NELMTS * sizeof(unsigned int));
+        offset += FFH5_CD_NELMTS * sizeof(unsigned int);
+
+        // Write compressed_size as uint64_t, its offset is not 8 byte aligned
+        memcpy(header + offset, &compressed_size, sizeof(uint64_t));
         offset += sizeof(uint64_t);
-        
-        // Write compressed data
-        memcpy(output_buf + offset, buf, result_size);
-        
-        result = PyBytes_FromStringAndSize(output_buf, total_size);
-        free(output_buf);
+
+        // Write the sample layout when there is one
+        if (item->header_size > NATIVE_HEADER_SIZE)
+            memcpy(header + offset, &layout, sizeof(unsigned int));
+
+        if (_PyBytes_Resize(&item->result, item->header_size + item->result_size) < 0)
+            return NULL;
     }
-    else
-    { 
-        // Decompression: Return numpy array
-        // Extract dimensions from cd_values
-        unsigned int width = cd_values[2];
-        unsigned int height = cd_values[3];
-        unsigned int depth = cd_values[4];
-        unsigned int bit_mode = cd_values[5];
-
-        npy_intp dims[3] = {depth, height, width};
-        int typenum = (bit_mode == 0) ? NPY_UINT8 : NPY_UINT16;
-        PyArrayObject *array = (PyArrayObject *)PyArray_SimpleNew(3, dims, typenum);
-        if (!array)
+    else if (item->result_size < item->sink.capacity)
+    {
+        // Decompression: fewer frames than expected, keep the tail defined
+        memset(item->sink.data + item->result_size, 0, item->sink.capacity - item->result_size);
+    }
+
+    result = item->result;
+    item->result = NULL;
+    return result;
+}
+
+static PyObject *ffmpeg_native_c(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *input_data = NULL;
+    PyObject *cd_values_list = NULL;
+    PyObject *out = NULL;
+    unsigned int flags;
+    size_t buf_size;
+    NativeItem item;
+    PyObject *result;
+
+    static char *kwlist[] = {"flags", "cd_values", "buf_size", "data", "out", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "IOkO|O", kwlist,
+                                     &flags, &cd_values_list, &buf_size, &input_data, &out))
+    {
+        return NULL;
+    }
+
+    if (item_prepare(&item, flags, cd_values_list, input_data, out, buf_size, 0) < 0)
+    {
+        item_clear(&item);
+        return NULL;
+    }
+
+    // Release GIL during CPU-intensive ffmpeg operation
+    Py_BEGIN_ALLOW_THREADS
+    item_run(&item, flags);
+    Py_END_ALLOW_THREADS
+
+    result = item_finish(&item, flags);
+    item_clear(&item);
+    return result;
+}
+
+// Decode frames [start, start + count) of one compressed chunk, either a raw
+// filter chunk or the payload of a native blob
+static PyObject *decode_frames(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *cd_values_list = NULL, *input_data = NULL, *result;
+    unsigned int start, count;
+    Py_ssize_t cd_nelmts;
+    NativeItem item;
+
+    static char *kwlist[] = {"cd_values", "data", "start", "count", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOII", kwlist,
+                                     &cd_values_list, &input_data, &start, &count))
+        return NULL;
+
+    memset(&item, 0, sizeof(NativeItem));
+
+    cd_nelmts = parse_cd_values(cd_values_list, item.cd_values);
+    if (cd_nelmts < 0)
+        return NULL;
+    item.cd_nelmts = (size_t)cd_nelmts;
+
+    if (count == 0 || start >= item.cd_values[4] || count > item.cd_values[4] - start)
+    {
+        PyErr_SetString(PyExc_ValueError, "frame range is outside of the chunk");
+        return NULL;
+    }
+
+    if (item_acquire_input(&item, input_data) < 0)
+    {
+        if (!PyErr_Occurred() || PyErr_ExceptionMatches(PyExc_BufferError))
         {
-            free(buf);
-            return NULL;
+            PyErr_Clear();
+            PyErr_SetString(PyExc_TypeError, "Input data must be a bytes-like object for decompression");
+        }
+        goto Finish;
+    }
+
+    npy_intp dims[3] = {count, item.cd_values[3], item.cd_values[2]};
+    item.result = PyArray_EMPTY(3, dims, (item.cd_values[5] == 0) ? NPY_UINT8 : NPY_UINT16, 0);
+    if (!item.result)
+        goto Finish;
+
+    item.sink.data = (uint8_t *)PyArray_DATA((PyArrayObject *)item.result);
+    item.sink.capacity = PyArray_NBYTES((PyArrayObject *)item.result);
+
+    Py_BEGIN_ALLOW_THREADS
+    item.result_size = ffmpeg_decode_chunk_range(item.cd_nelmts, item.cd_values, item.in, item.in_size,
+                                                 start, count, &item.sink, raise_ffmpeg_error);
+    Py_END_ALLOW_THREADS
+
+Finish:
+    result = PyErr_Occurred() ? NULL : item_finish(&item, 1);
+    item_clear(&item);
+    return result;
+}
+
+// One batch of independent native calls
+typedef struct NativeBatch
+{
+    unsigned int flags;
+    NativeItem *items;
+} NativeBatch;
+
+static void native_batch_task(void *arg, int index)
+{
+    NativeBatch *batch = (NativeBatch *)arg;
+
+    item_run(&batch->items[index], batch->flags);
+}
+
+static PyObject *ffmpeg_native_many(unsigned int flags, PyObject *cd_values_seq, PyObject *data_seq,
+                                    int threads, int raw)
+{
+    NativeBatch batch = {flags, NULL};
+    PyObject *result = NULL;
+    Py_ssize_t n, i, prepared = 0;
+
+    if (!PySequence_Check(cd_values_seq) || !PySequence_Check(data_seq))
+    {
+        PyErr_SetString(PyExc_TypeError, "cd_values and data must be sequences");
+        return NULL;
+    }
+
+    n = PySequence_Size(data_seq);
+    if (n < 0)
+        return NULL;
+    if (PySequence_Size(cd_values_seq) != n)
+    {
+        PyErr_SetString(PyExc_ValueError, "cd_values and data must have the same length");
+        return NULL;
+    }
+    if (n > INT_MAX)
+    {
+        PyErr_SetString(PyExc_OverflowError, "too many items in batch");
+        return NULL;
+    }
+
+    batch.items = calloc(n ? n : 1, sizeof(NativeItem));
+    if (!batch.items)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory");
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        PyObject *cd_item = PySequence_GetItem(cd_values_seq, i);
+        PyObject *data_item = PySequence_GetItem(data_seq, i);
+        int ret = -1;
+
+        if (cd_item && data_item)
+            ret = item_prepare(&batch.items[i], flags, cd_item, data_item, NULL, 0, raw);
+        prepared = i + 1;
+
+        Py_XDECREF(cd_item);
+        Py_XDECREF(data_item);
+        if (ret < 0)
+            goto Finish;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ffh5_parallel_for((int)n, threads, native_batch_task, &batch);
+    Py_END_ALLOW_THREADS
+
+    result = PyList_New(n);
+    if (!result)
+        goto Finish;
+
+    for (i = 0; i < n; i++)
+    {
+        PyObject *item = item_finish(&batch.items[i], flags);
+
+        if (!item)
+        {
+            PyObject *type, *value, *traceback;
+
+            PyErr_Fetch(&type, &value, &traceback);
+            PyErr_Format(PyExc_RuntimeError, "Operation failed for item %zd", i);
+            Py_XDECREF(type);
+            Py_XDECREF(value);
+            Py_XDECREF(traceback);
+            Py_CLEAR(result);
+            goto Finish;
         }
-        memcpy(PyArray_DATA(array), buf, result_size);
-        result = (PyObject *)array;
+        PyList_SET_ITEM(result, i, item);
     }
 
-    free(buf);
+Finish:
+    for (i = 0; i < prepared; i++)
+        item_clear(&batch.items[i]);
+    free(batch.items);
     return result;
 }
 
+static PyObject *compress_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *cd_values_seq, *data_seq;
+    int threads = 0;
+
+    int raw = 0;
+
+    static char *kwlist[] = {"cd_values", "data", "threads", "raw", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ip", kwlist, &cd_values_seq, &data_seq, &threads, &raw))
+        return NULL;
+
+    return ffmpeg_native_many(0, cd_values_seq, data_seq, threads, raw);
+}
+
+static PyObject *decompress_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *cd_values_seq, *data_seq;
+    int threads = 0;
+
+    int raw = 0;
+
+    static char *kwlist[] = {"cd_values", "data", "threads", "raw", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|ip", kwlist, &cd_values_seq, &data_seq, &threads, &raw))
+        return NULL;
+
+    return ffmpeg_native_many(1, cd_values_seq, data_seq, threads, raw);
+}
+
+// Number of worker threads used when threads=0
+static PyObject *default_threads(PyObject *self, PyObject *args)
+{
+    return PyLong_FromLong(ffh5_default_threads());
+}
+
+// Streaming encoder handle; close() frees the encoder before the capsule goes away
+#define STREAM_ENCODER_CAPSULE "h5ffmpeg.StreamEncoder"
+
+typedef struct StreamEncoderHandle
+{
+    FFH5Encoder *enc;
+    size_t frame_size;
+} StreamEncoderHandle;
+
+static void stream_encoder_destroy(PyObject *capsule)
+{
+    StreamEncoderHandle *handle = PyCapsule_GetPointer(capsule, STREAM_ENCODER_CAPSULE);
+
+    if (handle)
+    {
+        ffmpeg_h5_encoder_close(handle->enc);
+        free(handle);
+    }
+}
+
+static StreamEncoderHandle *stream_encoder_get(PyObject *capsule)
+{
+    StreamEncoderHandle *handle = PyCapsule_GetPointer(capsule, STREAM_ENCODER_CAPSULE);
+
+    if (handle && !handle->enc)
+    {
+        PyErr_SetString(PyExc_ValueError, "Stream encoder is closed");
+        return NULL;
+    }
+    return handle;
+}
+
+// Bytes produced since the last pull
+static PyObject *stream_encoder_take(StreamEncoderHandle *handle)
+{
+    const unsigned char *data;
+    size_t size;
+
+    data = ffmpeg_h5_encoder_pull(handle->enc, &size);
+    return PyBytes_FromStringAndSize((const char *)data, (Py_ssize_t)size);
+}
+
+static PyObject *encoder_open(PyObject *self, PyObject *args)
+{
+    PyObject *cd_values_list, *capsule;
+    unsigned int cd_values[FFH5_MAX_CD_VALUES];
+    StreamEncoderHandle *handle;
+    Py_ssize_t cd_nelmts;
+
+    if (!PyArg_ParseTuple(args, "O", &cd_values_list))
+        return NULL;
+
+    cd_nelmts = parse_cd_values(cd_values_list, cd_values);
+    if (cd_nelmts < 0)
+        return NULL;
+
+    handle = calloc(1, sizeof(StreamEncoderHandle));
+    if (!handle)
+        return PyErr_NoMemory();
+    handle->frame_size = (size_t)cd_values[2] * cd_values[3] * ((cd_values[5] == 0) ? 1 : 2);
+
+    // opening nvenc may wait for a session of the gpu schedule
+    Py_BEGIN_ALLOW_THREADS
+    handle->enc = ffmpeg_h5_encoder_open((size_t)cd_nelmts, cd_values);
+    Py_END_ALLOW_THREADS
+
+    if (!handle->enc)
+    {
+        free(handle);
+        PyErr_SetString(PyExc_RuntimeError, "Could not open encoder");
+        return NULL;
+    }
+
+    capsule = PyCapsule_New(handle, STREAM_ENCODER_CAPSULE, stream_encoder_destroy);
+    if (!capsule)
+    {
+        ffmpeg_h5_encoder_close(handle->enc);
+        free(handle);
+    }
+    return capsule;
+}
+
+static PyObject *encoder_push(PyObject *self, PyObject *args)
+{
+    PyObject *capsule, *frames;
+    StreamEncoderHandle *handle;
+    Py_buffer view;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "OO", &capsule, &frames))
+        return NULL;
+    handle = stream_encoder_get(capsule);
+    if (!handle)
+        return NULL;
+
+    if (PyObject_GetBuffer(frames, &view, PyBUF_C_CONTIGUOUS) < 0)
+        return NULL;
+    if (handle->frame_size == 0 || view.len % handle->frame_size != 0)
+    {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "frames must hold whole frames of the stream's shape and depth");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = ffmpeg_h5_encoder_push(handle->enc, view.buf, (size_t)view.len / handle->frame_size);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+    if (ret < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Could not encode frames");
+        return NULL;
+    }
+    return stream_encoder_take(handle);
+}
+
+static PyObject *encoder_finish(PyObject *self, PyObject *args)
+{
+    PyObject *capsule;
+    StreamEncoderHandle *handle;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "O", &capsule))
+        return NULL;
+    handle = stream_encoder_get(capsule);
+    if (!handle)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = ffmpeg_h5_encoder_finish(handle->enc);
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Could not flush encoder");
+        return NULL;
+    }
+    return stream_encoder_take(handle);
+}
+
+static PyObject *encoder_close(PyObject *self, PyObject *args)
+{
+    PyObject *capsule;
+    StreamEncoderHandle *handle;
+
+    if (!PyArg_ParseTuple(args, "O", &capsule))
+        return NULL;
+    handle = PyCapsule_GetPointer(capsule, STREAM_ENCODER_CAPSULE);
+    if (!handle)
+        return NULL;
+
+    ffmpeg_h5_encoder_close(handle->enc);
+    handle->enc = NULL;
+    Py_RETURN_NONE;
+}
+
+// Streaming decoder handle; keeps the destination buffer and callback alive
+#define STREAM_DECODER_CAPSULE "h5ffmpeg.StreamDecoder"
+
+typedef struct StreamDecoderHandle
+{
+    FFH5Decoder *dec;
+    Py_buffer out;
+    int has_out;
+    PyObject *callback;
+    npy_intp shape[2];
+    int typenum;
+    // exception raised by the callback, restored once the GIL is back
+    PyObject *err_type, *err_value, *err_tb;
+} StreamDecoderHandle;
+
+static void stream_decoder_free(StreamDecoderHandle *handle)
+{
+    ffmpeg_h5_decoder_close(handle->dec);
+    handle->dec = NULL;
+    if (handle->has_out)
+        PyBuffer_Release(&handle->out);
+    handle->has_out = 0;
+    Py_CLEAR(handle->callback);
+    Py_CLEAR(handle->err_type);
+    Py_CLEAR(handle->err_value);
+    Py_CLEAR(handle->err_tb);
+}
+
+static void stream_decoder_destroy(PyObject *capsule)
+{
+    StreamDecoderHandle *handle = PyCapsule_GetPointer(capsule, STREAM_DECODER_CAPSULE);
+
+    if (handle)
+    {
+        stream_decoder_free(handle);
+        free(handle);
+    }
+}
+
+// Runs on the decoding thread without the GIL; frames are copied since
+// scratch frames are only valid during the call
+static int stream_decoder_frame(void *opaque, unsigned long long index,
+                                const unsigned char *frame, size_t size)
+{
+    StreamDecoderHandle *handle = (StreamDecoderHandle *)opaque;
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject *array, *result = NULL;
+
+    array = PyArray_SimpleNew(2, handle->shape, handle->typenum);
+    if (array)
+    {
+        memcpy(PyArray_DATA((PyArrayObject *)array), frame, size);
+        result = PyObject_CallFunction(handle->callback, "KO", index, array);
+        Py_DECREF(array);
+    }
+
+    if (!result)
+        PyErr_Fetch(&handle->err_type, &handle->err_value, &handle->err_tb);
+    Py_XDECREF(result);
+
+    PyGILState_Release(gil);
+    return result ? 0 : -1;
+}
+
+static StreamDecoderHandle *stream_decoder_get(PyObject *capsule)
+{
+    StreamDecoderHandle *handle = PyCapsule_GetPointer(capsule, STREAM_DECODER_CAPSULE);
+
+    if (handle && !handle->dec)
+    {
+        PyErr_SetString(PyExc_ValueError, "Stream decoder is closed");
+        return NULL;
+    }
+    return handle;
+}
+
+static PyObject *stream_decoder_result(StreamDecoderHandle *handle, int ret, const char *msg)
+{
+    if (handle->err_type)
+    {
+        PyErr_Restore(handle->err_type, handle->err_value, handle->err_tb);
+        handle->err_type = handle->err_value = handle->err_tb = NULL;
+        return NULL;
+    }
+    if (ret < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, msg);
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(ffmpeg_h5_decoder_frames(handle->dec));
+}
+
+static PyObject *decoder_open(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *cd_values_list, *out = Py_None, *callback = Py_None, *capsule;
+    unsigned int cd_values[FFH5_MAX_CD_VALUES];
+    StreamDecoderHandle *handle;
+    Py_ssize_t cd_nelmts;
+    size_t frame_size;
+
+    static char *kwlist[] = {"cd_values", "out", "callback", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO", kwlist, &cd_values_list, &out, &callback))
+        return NULL;
+
+    cd_nelmts = parse_cd_values(cd_values_list, cd_values);
+    if (cd_nelmts < 0)
+        return NULL;
+    if (out == Py_None && callback == Py_None)
+    {
+        PyErr_SetString(PyExc_ValueError, "out or callback is required");
+        return NULL;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback))
+    {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+
+    handle = calloc(1, sizeof(StreamDecoderHandle));
+    if (!handle)
+        return PyErr_NoMemory();
+    handle->shape[0] = cd_values[3];
+    handle->shape[1] = cd_values[2];
+    handle->typenum = (cd_values[5] == 0) ? NPY_UINT8 : NPY_UINT16;
+    frame_size = (size_t)cd_values[2] * cd_values[3] * ((cd_values[5] == 0) ? 1 : 2);
+
+    if (out != Py_None)
+    {
+        if (PyObject_GetBuffer(out, &handle->out, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE) < 0)
+            goto Failure;
+        handle->has_out = 1;
+        if ((size_t)handle->out.len < frame_size * cd_values[4])
+        {
+            PyErr_SetString(PyExc_ValueError, "out is smaller than the decoded volume");
+            goto Failure;
+        }
+    }
+    if (callback != Py_None)
+    {
+        Py_INCREF(callback);
+        handle->callback = callback;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    handle->dec = ffmpeg_h5_decoder_open((size_t)cd_nelmts, cd_values,
+                                         handle->has_out ? handle->out.buf : NULL,
+                                         handle->has_out ? (size_t)handle->out.len : 0,
+                                         handle->callback ? stream_decoder_frame : NULL, handle);
+    Py_END_ALLOW_THREADS
+
+    if (!handle->dec)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Could not open decoder");
+        goto Failure;
+    }
+
+    capsule = PyCapsule_New(handle, STREAM_DECODER_CAPSULE, stream_decoder_destroy);
+    if (!capsule)
+        goto Failure;
+    return capsule;
+
+Failure:
+    stream_decoder_free(handle);
+    free(handle);
+    return NULL;
+}
+
+static PyObject *decoder_push(PyObject *self, PyObject *args)
+{
+    PyObject *capsule, *data;
+    StreamDecoderHandle *handle;
+    Py_buffer view;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "OO", &capsule, &data))
+        return NULL;
+    handle = stream_decoder_get(capsule);
+    if (!handle)
+        return NULL;
+
+    if (PyObject_GetBuffer(data, &view, PyBUF_C_CONTIGUOUS) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = ffmpeg_h5_decoder_push(handle->dec, view.buf, (size_t)view.len);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+    return stream_decoder_result(handle, ret, "Could not decode data");
+}
+
+static PyObject *decoder_finish(PyObject *self, PyObject *args)
+{
+    PyObject *capsule;
+    StreamDecoderHandle *handle;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "O", &capsule))
+        return NULL;
+    handle = stream_decoder_get(capsule);
+    if (!handle)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = ffmpeg_h5_decoder_finish(handle->dec);
+    Py_END_ALLOW_THREADS
+
+    return stream_decoder_result(handle, ret, "Could not flush decoder");
+}
+
+static PyObject *decoder_close(PyObject *self, PyObject *args)
+{
+    PyObject *capsule;
+    StreamDecoderHandle *handle;
+
+    if (!PyArg_ParseTuple(args, "O", &capsule))
+        return NULL;
+    handle = PyCapsule_GetPointer(capsule, STREAM_DECODER_CAPSULE);
+    if (!handle)
+        return NULL;
+
+    stream_decoder_free(handle);
+    Py_RETURN_NONE;
+}
+
+// Seed / read the compression ratio estimate used to size chunk outputs
+static PyObject *seed_ratio(PyObject *self, PyObject *args)
+{
+    unsigned int enc_id, crf, bit_mode;
+    double ratio;
+
+    if (!PyArg_ParseTuple(args, "IIId", &enc_id, &crf, &bit_mode, &ratio))
+        return NULL;
+
+    ffmpeg_h5_seed_ratio(enc_id, crf, bit_mode, ratio);
+    Py_RETURN_NONE;
+}
+
+static PyObject *get_ratio(PyObject *self, PyObject *args)
+{
+    unsigned int enc_id, crf, bit_mode;
+
+    if (!PyArg_ParseTuple(args, "III", &enc_id, &crf, &bit_mode))
+        return NULL;
+
+    return PyFloat_FromDouble(ffmpeg_h5_get_ratio(enc_id, crf, bit_mode));
+}
+
+// Output buffer statistics of the chunks encoded so far
+static PyObject *size_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    FFH5SizeStats stats;
+    int reset = 0;
+
+    static char *kwlist[] = {"reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kwlist, &reset))
+        return NULL;
+
+    ffmpeg_h5_get_size_stats(&stats);
+    if (reset)
+        ffmpeg_h5_reset_size_stats();
+
+    return Py_BuildValue("{s:K,s:K,s:K,s:K}",
+                         "chunks", stats.chunks,
+                         "reallocs", stats.reallocs,
+                         "reserved_bytes", stats.reserved_bytes,
+                         "compressed_bytes", stats.compressed_bytes);
+}
+
+// Spread NVENC/CUVID chunks over several gpus
+static PyObject *gpu_schedule(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *gpu_seq, *item;
+    unsigned int gpu_ids[FFH5_SCHED_MAX_GPUS];
+    Py_ssize_t n_gpus, i;
+    int policy = FFH5_SCHED_ROUND_ROBIN, max_sessions = 0, cpu_fallback = 1;
+
+    static char *kwlist[] = {"gpu_ids", "policy", "max_sessions", "cpu_fallback", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iip", kwlist, &gpu_seq, &policy, &max_sessions,
+                                     &cpu_fallback))
+        return NULL;
+
+    gpu_seq = PySequence_Fast(gpu_seq, "gpu_ids must be a sequence");
+    if (!gpu_seq)
+        return NULL;
+    n_gpus = PySequence_Fast_GET_SIZE(gpu_seq);
+    if (n_gpus > FFH5_SCHED_MAX_GPUS)
+    {
+        Py_DECREF(gpu_seq);
+        PyErr_Format(PyExc_ValueError, "At most %d gpus can be scheduled", FFH5_SCHED_MAX_GPUS);
+        return NULL;
+    }
+    for (i = 0; i < n_gpus; i++)
+    {
+        item = PySequence_Fast_GET_ITEM(gpu_seq, i);
+        gpu_ids[i] = (unsigned int)PyLong_AsUnsignedLong(item);
+        if (PyErr_Occurred())
+        {
+            Py_DECREF(gpu_seq);
+            return NULL;
+        }
+    }
+    Py_DECREF(gpu_seq);
+
+    if (ffmpeg_h5_set_gpu_schedule(gpu_ids, (int)n_gpus, policy, max_sessions, cpu_fallback) < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid gpu schedule");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// Per gpu state of the schedule
+static PyObject *gpu_stats(PyObject *self, PyObject *args)
+{
+    FFH5GpuStats stats[FFH5_SCHED_MAX_GPUS];
+    unsigned long long fallbacks = 0;
+    PyObject *gpus, *entry;
+    int n, i;
+
+    n = ffmpeg_h5_get_gpu_stats(stats, FFH5_SCHED_MAX_GPUS, &fallbacks);
+
+    gpus = PyList_New(n);
+    if (!gpus)
+        return NULL;
+    for (i = 0; i < n; i++)
+    {
+        entry = Py_BuildValue("{s:I,s:i,s:i,s:i,s:K}",
+                              "gpu_id", stats[i].gpu_id,
+                              "active_encoders", stats[i].active_encoders,
+                              "active_decoders", stats[i].active_decoders,
+                              "sessions", stats[i].sessions,
+                              "chunks", stats[i].chunks);
+        if (!entry)
+        {
+            Py_DECREF(gpus);
+            return NULL;
+        }
+        PyList_SET_ITEM(gpus, i, entry);
+    }
+
+    return Py_BuildValue("{s:N,s:K}", "gpus", gpus, "cpu_fallbacks", fallbacks);
+}
+
+// names of the codecs whose bit is set in mask
+static PyObject *codec_names(unsigned int mask, int count, void (*name)(int, char *))
+{
+    char codec_name[50];
+    PyObject *names, *item;
+    int i;
+
+    names = PyList_New(0);
+    if (!names)
+        return NULL;
+    for (i = 0; i < count; i++)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+        name(i, codec_name);
+        item = PyUnicode_FromString(codec_name);
+        /* ids sharing a codec (libx264 and lossless libx264) list it once */
+        if (item && PySequence_Contains(names, item) == 1)
+        {
+            Py_DECREF(item);
+            continue;
+        }
+        if (!item || PyList_Append(names, item) < 0)
+        {
+            Py_XDECREF(item);
+            Py_DECREF(names);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    return names;
+}
+
+// Devices and codecs of this process, probed once
+static PyObject *capabilities(PyObject *self, PyObject *args)
+{
+    FFH5Capabilities caps;
+    PyObject *encoders, *decoders;
+
+    Py_BEGIN_ALLOW_THREADS
+    ffmpeg_h5_get_capabilities(&caps);
+    Py_END_ALLOW_THREADS
+
+    encoders = codec_names(caps.encoders, FFH5_ENC_COUNT, find_encoder_name);
+    if (!encoders)
+        return NULL;
+    decoders = codec_names(caps.decoders, FFH5_DEC_COUNT, find_decoder_name);
+    if (!decoders)
+    {
+        Py_DECREF(encoders);
+        return NULL;
+    }
+    return Py_BuildValue("{s:i,s:O,s:N,s:N}", "cuda_devices", caps.cuda_devices,
+                         "qsv", caps.qsv ? Py_True : Py_False, "encoders", encoders,
+                         "decoders", decoders);
+}
+
+// Size or disable the decoded chunk cache
+static PyObject *chunk_cache(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    unsigned long long budget;
+    int shared = 0;
+
+    static char *kwlist[] = {"budget", "shared", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "K|p", kwlist, &budget, &shared))
+        return NULL;
+
+    if (ffmpeg_h5_set_chunk_cache((size_t)budget, shared) < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Shared memory chunk cache is not supported on this platform");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *clear_chunk_cache(PyObject *self, PyObject *args)
+{
+    ffmpeg_h5_clear_chunk_cache();
+    Py_RETURN_NONE;
+}
+
+static PyObject *chunk_cache_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    FFH5ChunkCacheStats stats;
+    int reset = 0;
+
+    static char *kwlist[] = {"reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kwlist, &reset))
+        return NULL;
+
+    ffmpeg_h5_get_chunk_cache_stats(&stats, reset);
+
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:O}",
+                         "hits", stats.hits,
+                         "misses", stats.misses,
+                         "inserts", stats.inserts,
+                         "evictions", stats.evictions,
+                         "bytes", (unsigned long long)stats.bytes,
+                         "budget", (unsigned long long)stats.budget,
+                         "shared", stats.shared ? Py_True : Py_False);
+}
+
+// HDF5 chunk cache settings (nslots, nbytes, w0) for a dataset shape, None when disabled
+static PyObject *rdcc_settings(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *dims_obj, *chunks_obj, *dims_seq = NULL, *chunks_seq = NULL, *result = NULL;
+    hsize_t dims[H5S_MAX_RANK], chunks[H5S_MAX_RANK];
+    FFH5RdccSettings settings;
+    Py_ssize_t type_size, rank, d;
+    int hint = FFH5_ACCESS_SLICES, ret;
+
+    static char *kwlist[] = {"dims", "chunks", "type_size", "hint", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOn|i", kwlist, &dims_obj, &chunks_obj, &type_size, &hint))
+        return NULL;
+
+    dims_seq = PySequence_Fast(dims_obj, "dims must be a sequence");
+    chunks_seq = PySequence_Fast(chunks_obj, "chunks must be a sequence");
+    if (!dims_seq || !chunks_seq)
+        goto Finish;
+
+    rank = PySequence_Fast_GET_SIZE(dims_seq);
+    if (rank <= 0 || rank > H5S_MAX_RANK || PySequence_Fast_GET_SIZE(chunks_seq) != rank || type_size <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "dims and chunks must have the same rank, type_size must be > 0");
+        goto Finish;
+    }
+    for (d = 0; d < rank; d++)
+    {
+        dims[d] = (hsize_t)PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(dims_seq, d));
+        chunks[d] = (hsize_t)PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(chunks_seq, d));
+    }
+    if (PyErr_Occurred())
+        goto Finish;
+
+    ret = ffmpeg_h5_chunk_cache_settings((int)rank, dims, chunks, (size_t)type_size, hint, &settings);
+    if (ret < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid chunk shape or access hint");
+        goto Finish;
+    }
+    if (ret == 0)
+    {
+        result = Py_None;
+        Py_INCREF(result);
+        goto Finish;
+    }
+    result = Py_BuildValue("{s:K,s:K,s:d}",
+                           "nslots", (unsigned long long)settings.nslots,
+                           "nbytes", (unsigned long long)settings.nbytes,
+                           "w0", settings.w0);
+
+Finish:
+    Py_XDECREF(dims_seq);
+    Py_XDECREF(chunks_seq);
+    return result;
+}
+
+static PyObject *rdcc_stats(PyObject *self, PyObject *args)
+{
+    FFH5RdccStats stats;
+
+    ffmpeg_h5_get_rdcc_stats(&stats);
+
+    return Py_BuildValue("{s:K,s:K,s:K,s:d,s:K,s:i,s:O,s:K}",
+                         "datasets", stats.datasets,
+                         "nslots", (unsigned long long)stats.last.nslots,
+                         "nbytes", (unsigned long long)stats.last.nbytes,
+                         "w0", stats.last.w0,
+                         "chunk_bytes", (unsigned long long)stats.chunk_bytes,
+                         "hint", stats.hint,
+                         "enabled", stats.enabled ? Py_True : Py_False,
+                         "max_nbytes", (unsigned long long)stats.max_nbytes);
+}
+
+// Turn the hot path statistics (and trace events) on or off
+static PyObject *set_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int enabled = 1, trace = 0;
+
+    static char *kwlist[] = {"enabled", "trace", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|pp", kwlist, &enabled, &trace))
+        return NULL;
+
+    return PyBool_FromLong(ffmpeg_h5_set_stats(enabled, trace));
+}
+
+// Per stage times and counters summed over all threads
+static PyObject *filter_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    FFH5Stats stats;
+    PyObject *stages, *stage;
+    int reset = 0, i;
+
+    static char *kwlist[] = {"reset", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kwlist, &reset))
+        return NULL;
+
+    ffmpeg_h5_get_stats(&stats);
+    if (reset)
+        ffmpeg_h5_reset_stats();
+
+    stages = PyDict_New();
+    if (!stages)
+        return NULL;
+    for (i = 0; i < FFH5_STAGE_COUNT; i++)
+    {
+        stage = Py_BuildValue("{s:K,s:d}",
+                              "calls", stats.stages[i].calls,
+                              "seconds", (double)stats.stages[i].ns * 1e-9);
+        if (!stage || PyDict_SetItemString(stages, ffmpeg_h5_stage_name(i), stage) < 0)
+        {
+            Py_XDECREF(stage);
+            Py_DECREF(stages);
+            return NULL;
+        }
+        Py_DECREF(stage);
+    }
+
+    return Py_BuildValue("{s:N,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+                         "stages", stages,
+                         "chunks_encoded", stats.chunks_encoded,
+                         "chunks_decoded", stats.chunks_decoded,
+                         "frames_encoded", stats.frames_encoded,
+                         "frames_decoded", stats.frames_decoded,
+                         "encode_bytes_in", stats.encode_bytes_in,
+                         "encode_bytes_out", stats.encode_bytes_out,
+                         "decode_bytes_in", stats.decode_bytes_in,
+                         "decode_bytes_out", stats.decode_bytes_out,
+                         "reallocs", stats.reallocs,
+                         "context_hits", stats.context_hits,
+                         "context_misses", stats.context_misses,
+                         "chunk_cache_hits", stats.chunk_cache_hits,
+                         "chunk_cache_misses", stats.chunk_cache_misses,
+                         "trace_dropped", stats.trace_dropped);
+}
+
+static PyObject *write_trace(PyObject *self, PyObject *args)
+{
+    PyObject *path_obj;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path_obj))
+        return NULL;
+
+    ret = ffmpeg_h5_write_trace(PyBytes_AS_STRING(path_obj));
+    if (ret < 0)
+    {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        Py_DECREF(path_obj);
+        return NULL;
+    }
+    Py_DECREF(path_obj);
+    Py_RETURN_NONE;
+}
+
+// numpy type of an array as FFH5_QUANT_*, -1 for anything else
+static int quant_type(PyArrayObject *array)
+{
+    switch (PyArray_TYPE(array))
+    {
+    case NPY_UINT8:
+        return FFH5_QUANT_UINT8;
+    case NPY_UINT16:
+        return FFH5_QUANT_UINT16;
+    case NPY_FLOAT32:
+        return FFH5_QUANT_FLOAT32;
+    default:
+        return -1;
+    }
+}
+
+// Apply the norm/beta intensity transform from data to out (same size,
+// may be data itself), see ffmpeg_h5_quantize
+static PyObject *quantize(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *data_obj, *out_obj;
+    PyArrayObject *data, *out;
+    FFH5Quant q = {0.0, 1.0, 1.0, 1.0, 0.0, -INFINITY, INFINITY};
+    int threads = 0, in_type, out_type, ret;
+
+    static char *kwlist[] = {"data", "out", "offset", "scale", "power", "post", "add", "lo", "hi",
+                             "threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|dddddddi", kwlist, &data_obj, &out_obj,
+                                     &q.offset, &q.scale, &q.power, &q.post, &q.add, &q.lo, &q.hi,
+                                     &threads))
+        return NULL;
+
+    if (!PyArray_Check(data_obj) || !PyArray_Check(out_obj))
+    {
+        PyErr_SetString(PyExc_TypeError, "data and out must be numpy arrays");
+        return NULL;
+    }
+    data = (PyArrayObject *)data_obj;
+    out = (PyArrayObject *)out_obj;
+
+    if (!PyArray_IS_C_CONTIGUOUS(data) || !PyArray_IS_C_CONTIGUOUS(out) || !PyArray_ISWRITEABLE(out))
+    {
+        PyErr_SetString(PyExc_TypeError, "data must be C-contiguous and out writeable C-contiguous");
+        return NULL;
+    }
+    in_type = quant_type(data);
+    out_type = quant_type(out);
+    if (in_type < 0 || out_type < 0)
+    {
+        PyErr_SetString(PyExc_TypeError, "data and out must be uint8, uint16 or float32 arrays");
+        return NULL;
+    }
+    if (PyArray_SIZE(data) != PyArray_SIZE(out))
+    {
+        PyErr_SetString(PyExc_ValueError, "data and out must have the same number of elements");
+        return NULL;
+    }
+    if (PyArray_DATA(data) == PyArray_DATA(out) && PyArray_ITEMSIZE(data) != PyArray_ITEMSIZE(out))
+    {
+        PyErr_SetString(PyExc_ValueError, "in place transforms need types of the same size");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = ffmpeg_h5_quantize(&q, in_type, PyArray_DATA(data), out_type, PyArray_DATA(out),
+                             (size_t)PyArray_SIZE(data), threads);
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0)
+        return PyErr_NoMemory();
+    Py_INCREF(out_obj);
+    return out_obj;
+}
+
+// One 2x pyramid level of a 3D volume (mode 0 mean, 1 max; z halves the depth
+// too) into a new array, see ffmpeg_h5_downsample
+static PyObject *downsample(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *data_obj;
+    PyArrayObject *data, *out;
+    npy_intp dims[3];
+    int mode = FFH5_DOWNSAMPLE_MEAN, z = 0, threads = 0, type, ret;
+
+    static char *kwlist[] = {"data", "mode", "z", "threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ipi", kwlist, &data_obj, &mode, &z, &threads))
+        return NULL;
+
+    if (!PyArray_Check(data_obj) || PyArray_NDIM((PyArrayObject *)data_obj) != 3 ||
+        !PyArray_IS_C_CONTIGUOUS((PyArrayObject *)data_obj))
+    {
+        PyErr_SetString(PyExc_TypeError, "data must be a C-contiguous 3D numpy array");
+        return NULL;
+    }
+    data = (PyArrayObject *)data_obj;
+    type = quant_type(data);
+    if (type < 0)
+    {
+        PyErr_SetString(PyExc_TypeError, "data must be a uint8, uint16 or float32 array");
+        return NULL;
+    }
+    if (mode != FFH5_DOWNSAMPLE_MEAN && mode != FFH5_DOWNSAMPLE_MAX)
+    {
+        PyErr_SetString(PyExc_ValueError, "mode must be 0 (mean) or 1 (max)");
+        return NULL;
+    }
+
+    dims[0] = z ? (PyArray_DIM(data, 0) + 1) / 2 : PyArray_DIM(data, 0);
+    dims[1] = (PyArray_DIM(data, 1) + 1) / 2;
+    dims[2] = (PyArray_DIM(data, 2) + 1) / 2;
+    out = (PyArrayObject *)PyArray_SimpleNew(3, dims, PyArray_TYPE(data));
+    if (!out)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = ffmpeg_h5_downsample(type, mode, PyArray_DATA(data), (size_t)PyArray_DIM(data, 0),
+                               (size_t)PyArray_DIM(data, 1), (size_t)PyArray_DIM(data, 2), z ? 2 : 1,
+                               PyArray_DATA(out), threads);
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0)
+    {
+        Py_DECREF(out);
+        PyErr_SetString(PyExc_ValueError, "downsampling failed");
+        return NULL;
+    }
+    return (PyObject *)out;
+}
+
 // Module's function table
 static PyMethodDef FFMPEGFilterMethods[] = {
     {"register_filter", register_filter, METH_NOARGS,
@@ -234,6 +1449,62 @@ static PyMethodDef FFMPEGFilterMethods[] = {
      "Get the filter ID for the FFMPEG filter."},
     {"ffmpeg_native_c", (PyCFunction)ffmpeg_native_c, METH_VARARGS | METH_KEYWORDS,
      "Native FFMPEG function."},
+    {"compress_many", (PyCFunction)compress_many, METH_VARARGS | METH_KEYWORDS,
+     "Compress a list of volumes on the native worker pool (raw=True: bare filter chunks)."},
+    {"decompress_many", (PyCFunction)decompress_many, METH_VARARGS | METH_KEYWORDS,
+     "Decompress a list of blobs on the native worker pool (raw=True: bare filter chunks)."},
+    {"decode_frames", (PyCFunction)decode_frames, METH_VARARGS | METH_KEYWORDS,
+     "Decode a frame range of one chunk, starting at the nearest keyframe."},
+    {"default_threads", default_threads, METH_NOARGS,
+     "Number of native worker threads used by default."},
+    {"encoder_open", encoder_open, METH_VARARGS,
+     "Open a streaming encoder for cd_values (depth is ignored)."},
+    {"encoder_push", encoder_push, METH_VARARGS,
+     "Encode whole frames, returns the bytes that came out."},
+    {"encoder_finish", encoder_finish, METH_VARARGS,
+     "Flush a streaming encoder, returns the remaining bytes."},
+    {"encoder_close", encoder_close, METH_VARARGS,
+     "Free a streaming encoder."},
+    {"decoder_open", (PyCFunction)decoder_open, METH_VARARGS | METH_KEYWORDS,
+     "Open a streaming decoder writing frames to out and/or callback(index, frame)."},
+    {"decoder_push", decoder_push, METH_VARARGS,
+     "Decode the next compressed bytes, returns the frames decoded so far."},
+    {"decoder_finish", decoder_finish, METH_VARARGS,
+     "Flush a streaming decoder, returns the number of frames decoded."},
+    {"decoder_close", decoder_close, METH_VARARGS,
+     "Free a streaming decoder."},
+    {"seed_ratio", seed_ratio, METH_VARARGS,
+     "Seed the expected compression ratio of (enc_id, crf, bit_mode)."},
+    {"get_ratio", get_ratio, METH_VARARGS,
+     "Current expected compression ratio of (enc_id, crf, bit_mode)."},
+    {"size_stats", (PyCFunction)size_stats, METH_VARARGS | METH_KEYWORDS,
+     "Output buffer statistics of encoded chunks (reset=True clears them)."},
+    {"gpu_schedule", (PyCFunction)gpu_schedule, METH_VARARGS | METH_KEYWORDS,
+     "Spread NVENC/CUVID chunks over gpu_ids (empty: off)."},
+    {"gpu_stats", gpu_stats, METH_NOARGS,
+     "Per gpu chunks in flight, NVENC sessions and CPU fallbacks of the schedule."},
+    {"capabilities", capabilities, METH_NOARGS,
+     "CUDA devices, QSV and the encoders/decoders this FFmpeg resolves, probed once."},
+    {"chunk_cache", (PyCFunction)chunk_cache, METH_VARARGS | METH_KEYWORDS,
+     "Keep up to budget bytes of decoded chunks, in shared memory if shared (0: off)."},
+    {"clear_chunk_cache", clear_chunk_cache, METH_NOARGS,
+     "Drop the decoded chunks cached (or published to shared memory) by this process."},
+    {"chunk_cache_stats", (PyCFunction)chunk_cache_stats, METH_VARARGS | METH_KEYWORDS,
+     "Hits, misses, inserts, evictions and bytes of the decoded chunk cache."},
+    {"rdcc_settings", (PyCFunction)rdcc_settings, METH_VARARGS | METH_KEYWORDS,
+     "HDF5 chunk cache settings for a dataset shape, chunk shape and access hint."},
+    {"rdcc_stats", rdcc_stats, METH_NOARGS,
+     "HDF5 chunk cache settings computed so far."},
+    {"set_stats", (PyCFunction)set_stats, METH_VARARGS | METH_KEYWORDS,
+     "Turn hot path statistics (and trace events with trace=True) on or off."},
+    {"stats", (PyCFunction)filter_stats, METH_VARARGS | METH_KEYWORDS,
+     "Per stage times and byte, frame, realloc and cache counters (reset=True clears them)."},
+    {"write_trace", write_trace, METH_VARARGS,
+     "Write the recorded trace events as Chrome trace-event JSON."},
+    {"quantize", (PyCFunction)quantize, METH_VARARGS | METH_KEYWORDS,
+     "Norm/beta intensity transform from data into out on the native worker pool."},
+    {"downsample", (PyCFunction)downsample, METH_VARARGS | METH_KEYWORDS,
+     "Halve a 3D volume in Y and X (and Z) by block mean or max."},
     {NULL, NULL, 0, NULL} // Sentinel
 };
 
@@ -267,7 +1538,7 @@ PyMODINIT_FUNC PyInit__ffmpeg_filter(void)
         if (get_version_func && PyCallable_Check(get_version_func)) {
             PyObject *version_result = PyObject_CallObject(get_version_func, NULL);
             if (version_result && PyLong_Check(version_result)) {
-                long header_version = PyLong_AsLong(version_result);
+                header_version = (unsigned int)PyLong_AsLong(version_result);
                 PyModule_AddIntConstant(m, "HEADER_VERSION", (int)header_version);
             }
             Py_XDECREF(version_result);
@@ -0,0 +1,430 @@
+"""
+Benchmark suite for the FFMPEG HDF5 filter.
+
+Sweeps codecs, presets, crf, bit modes, chunk shapes and codec thread
+counts over a volume, reporting encode/decode throughput, compression
+ratio, PSNR, peak RSS and the time spent in each stage:
+
+    gather    copying a chunk out of the volume (zero padded at edges)
+    encode    compress_native of the chunk
+    decode    decompress_native of the chunk
+    scatter   copying the decoded chunk back into the volume
+    h5_write  writing the volume through the filter pipeline (--h5)
+    h5_read   reading it back (--h5)
+
+Every stage keeps its fastest time over --repeat runs. Results are printed
+as a table and can be saved as JSON; --baseline compares them against an
+earlier JSON report and exits with status 1 on regressions.
+
+    h5ffmpeg-bench --codecs libx264,libx265 --crf 18,23,28 --chunks 100x256x256
+    h5ffmpeg-bench --data demo --json base.json
+    h5ffmpeg-bench --data demo --baseline base.json --tolerance 0.1
+
+The C harness bench/h5ffmpeg_bench.c (cmake -DH5FFMPEG_BUILD_BENCH=ON)
+measures the same stages without the interpreter in the loop.
+"""
+
+import argparse
+import itertools
+import json
+import os
+import platform
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+from . import __version__
+from .constants import BIT_DEPTH, BitMode, CODEC_TO_ENCODER
+from .ffmpeg_filter import compress_native, decompress_native, ffmpeg
+from .utils import calculate_psnr, generate_3d_sample_vol
+
+try:
+    import resource
+except ImportError:  # Windows
+    resource = None
+
+DEMO_DATA = os.path.join(
+    os.path.dirname(os.path.dirname(os.path.abspath(__file__))),
+    "demo_data",
+    "first-instar-brain.h5",
+)
+
+STAGES = ("gather", "encode", "decode", "scatter", "h5_write", "h5_read")
+
+# metrics compared against a baseline, all higher is better
+COMPARED = ("encode_mbps", "decode_mbps", "ratio", "psnr")
+
+# fields that identify a case across reports
+CASE_KEY = ("data", "codec", "preset", "crf", "bit_mode", "chunks", "threads")
+
+
+def peak_rss():
+    """Peak resident set size of this process in bytes, None when unknown"""
+    if resource is None:
+        return None
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # kilobytes everywhere but macOS
+    return int(rss if sys.platform == "darwin" else rss * 1024)
+
+
+def parse_shape(text):
+    """Parse a DxHxW shape"""
+    shape = tuple(int(v) for v in text.lower().split("x"))
+    if len(shape) != 3 or min(shape) <= 0:
+        raise argparse.ArgumentTypeError(f"expected DxHxW, got {text!r}")
+    return shape
+
+
+def _list(convert=str):
+    def parse(text):
+        return [convert(v) for v in text.split(",") if v]
+
+    return parse
+
+
+def _bit_depth(bit_mode):
+    return BIT_DEPTH[int(bit_mode)]
+
+
+def load_volume(data, bit_mode, size=(100, 512, 512), seed=0):
+    """
+    Volume to benchmark on, as uint8 for 8 bit and uint16 otherwise.
+
+    data is "demo" (demo_data/first-instar-brain.h5), a synthetic pattern
+    of generate_3d_sample_vol ("stripes", "gradient", "random") of the
+    given size, or "file.h5:dataset". Stored samples are rescaled to the
+    bit depth of bit_mode, keeping their most significant bits.
+    """
+    depth = _bit_depth(bit_mode)
+    dtype = np.uint8 if bit_mode == BitMode.BIT_8 else np.uint16
+
+    if data in ("stripes", "gradient", "random"):
+        d, h, w = size
+        vol = generate_3d_sample_vol(
+            width=w, height=h, depth=d, dtype=dtype, pattern=data, seed=seed
+        )
+        stored = 8 if dtype == np.uint8 else 16
+    else:
+        import h5py
+
+        path, _, name = (DEMO_DATA, "", "data") if data == "demo" else data.rpartition(":")
+        if not path or not name or name.startswith("\\"):  # no dataset or a drive letter
+            path, name = data, "data"
+        if not os.path.exists(path):
+            raise FileNotFoundError(f"benchmark data not found: {path}")
+        with h5py.File(path, "r") as f:
+            vol = f[name][...]
+        if vol.ndim != 3 or vol.dtype not in (np.uint8, np.uint16):
+            raise ValueError(f"{data}: expected a 3D uint8/uint16 dataset")
+        stored = vol.dtype.itemsize * 8
+
+    vol = vol.astype(np.uint16)
+    vol = vol >> (stored - depth) if stored > depth else vol << (depth - stored)
+    return np.ascontiguousarray(vol, dtype=dtype)
+
+
+def _chunk_boxes(shape, chunks):
+    ranges = [range(0, n, c) for n, c in zip(shape, chunks)]
+    for origin in itertools.product(*ranges):
+        yield tuple(slice(o, min(o + c, n)) for o, c, n in zip(origin, chunks, shape))
+
+
+def run_case(vol, codec, preset, crf, bit_mode, chunks, threads, repeat=3, h5=False):
+    """
+    Benchmark one parameter set on vol.
+
+    Returns a dict with raw_bytes, compressed_bytes, ratio, encode_mbps,
+    decode_mbps, psnr, peak_rss_bytes and stages (fastest seconds per
+    stage).
+    """
+    chunks = tuple(min(c, n) for c, n in zip(chunks, vol.shape))
+    opts = dict(codec=codec, preset=preset, crf=crf, bit_mode=bit_mode, threads=threads)
+    stages = dict.fromkeys(STAGES[:4], float("inf"))
+    decoded = np.empty_like(vol)
+    compressed = 0
+
+    for _ in range(repeat):
+        run = dict.fromkeys(STAGES[:4], 0.0)
+        blobs = []
+        compressed = 0
+        for box in _chunk_boxes(vol.shape, chunks):
+            t = time.perf_counter()
+            chunk = np.zeros(chunks, dtype=vol.dtype)
+            region = tuple(slice(0, s.stop - s.start) for s in box)
+            chunk[region] = vol[box]
+            run["gather"] += time.perf_counter() - t
+
+            t = time.perf_counter()
+            blob = compress_native(chunk, **opts)
+            run["encode"] += time.perf_counter() - t
+            blobs.append((box, region, blob))
+            compressed += len(blob)
+
+        for box, region, blob in blobs:
+            t = time.perf_counter()
+            chunk = decompress_native(blob)
+            run["decode"] += time.perf_counter() - t
+
+            t = time.perf_counter()
+            decoded[box] = chunk[region]
+            run["scatter"] += time.perf_counter() - t
+
+        for stage, seconds in run.items():
+            stages[stage] = min(stages[stage], seconds)
+
+    if h5:
+        stages.update(_run_h5(vol, opts, chunks, repeat))
+
+    mb = vol.nbytes / 1e6
+    return {
+        "raw_bytes": int(vol.nbytes),
+        "compressed_bytes": int(compressed),
+        "ratio": vol.nbytes / compressed,
+        "encode_mbps": mb / stages["encode"],
+        "decode_mbps": mb / stages["decode"],
+        "psnr": float(calculate_psnr(vol, decoded)),
+        "peak_rss_bytes": peak_rss(),
+        "stages": stages,
+    }
+
+
+def _run_h5(vol, opts, chunks, repeat):
+    import h5py
+
+    best = {"h5_write": float("inf"), "h5_read": float("inf")}
+    params = ffmpeg(**opts)
+    params.update(norm=False, beta=1.0)  # time the codec, not the quantization
+    fd, path = tempfile.mkstemp(suffix=".h5")
+    os.close(fd)
+    try:
+        for _ in range(repeat):
+            t = time.perf_counter()
+            with h5py.File(path, "w") as f:
+                f.create_dataset("data", data=vol, chunks=chunks, **params)
+            best["h5_write"] = min(best["h5_write"], time.perf_counter() - t)
+
+            t = time.perf_counter()
+            with h5py.File(path, "r") as f:
+                f["data"][...]
+            best["h5_read"] = min(best["h5_read"], time.perf_counter() - t)
+    finally:
+        os.remove(path)
+    return best
+
+
+def run_suite(
+    data=("stripes",),
+    codecs=("libx264",),
+    presets=(None,),
+    crfs=(23,),
+    bit_modes=(BitMode.BIT_8,),
+    chunks=(None,),
+    threads=(0,),
+    size=(100, 512, 512),
+    repeat=3,
+    h5=False,
+    log=None,
+):
+    """
+    Run the cartesian product of the parameters, see h5ffmpeg-bench --help.
+
+    chunks of None benchmark the volume as a single chunk. Presets unknown
+    to a codec are skipped; cases that fail keep their error message.
+    Returns the report dict written by --json.
+    """
+    cases = []
+    for source, bit_mode in itertools.product(data, bit_modes):
+        vol = load_volume(source, bit_mode, size=size)
+        for codec, preset, crf, chunk, nthreads in itertools.product(
+            codecs, presets, crfs, chunks, threads
+        ):
+            # presets are per codec, sweeping several codecs skips the others'
+            if preset is not None and not _preset_known(codec, preset):
+                continue
+            case = {
+                "data": source,
+                "shape": list(vol.shape),
+                "codec": codec,
+                "preset": preset,
+                "crf": int(crf),
+                "bit_mode": int(bit_mode),
+                "chunks": list(chunk or vol.shape),
+                "threads": int(nthreads),
+            }
+            try:
+                case.update(
+                    run_case(vol, codec, preset, crf, bit_mode, chunk or vol.shape,
+                             nthreads, repeat=repeat, h5=h5)
+                )
+            except Exception as e:
+                case["error"] = str(e)
+            cases.append(case)
+            if log:
+                log(case)
+
+    return {
+        "version": __version__,
+        "host": {
+            "machine": platform.machine(),
+            "system": platform.system(),
+            "processor": platform.processor(),
+            "cpus": os.cpu_count(),
+            "python": platform.python_version(),
+        },
+        "repeat": repeat,
+        "cases": cases,
+    }
+
+
+def _preset_known(codec, preset):
+    from .constants import PRESET_MAPPING
+
+    return preset in PRESET_MAPPING.get(codec, {})
+
+
+def _key(case):
+    return tuple(
+        tuple(case[k]) if isinstance(case[k], list) else case[k] for k in CASE_KEY
+    )
+
+
+def compare(report, baseline, tolerance=0.1, psnr_tolerance=0.5):
+    """
+    Cases of report that got worse than the same case of baseline.
+
+    Throughput and ratio regress when they drop by more than tolerance
+    (relative), PSNR when it drops by more than psnr_tolerance dB. Returns
+    a list of (case, metric, baseline value, new value).
+    """
+    previous = {_key(c): c for c in baseline.get("cases", []) if "error" not in c}
+    regressions = []
+    for case in report["cases"]:
+        old = previous.get(_key(case))
+        if old is None:
+            continue
+        if "error" in case:
+            regressions.append((case, "error", None, case["error"]))
+            continue
+        for metric in COMPARED:
+            before, after = old.get(metric), case.get(metric)
+            if before is None or after is None:
+                continue
+            if metric == "psnr":
+                worse = after < before - psnr_tolerance
+            else:
+                worse = after < before * (1.0 - tolerance)
+            if worse:
+                regressions.append((case, metric, before, after))
+    return regressions
+
+
+def _describe(case):
+    preset = case["preset"] or "default"
+    chunks = "x".join(str(c) for c in case["chunks"])
+    return (
+        f"{case['data']} {case['codec']} preset={preset} crf={case['crf']} "
+        f"bit_mode={case['bit_mode']} chunks={chunks} threads={case['threads']}"
+    )
+
+
+def _print_table(cases):
+    from tabulate import tabulate
+
+    rows = []
+    for c in cases:
+        if "error" in c:
+            rows.append([_describe(c), "error: " + c["error"]] + [""] * 5)
+            continue
+        st = c["stages"]
+        rss = c["peak_rss_bytes"]
+        rows.append([
+            _describe(c),
+            f"{c['encode_mbps']:.1f}",
+            f"{c['decode_mbps']:.1f}",
+            f"{c['ratio']:.1f}",
+            f"{c['psnr']:.2f}",
+            "-" if rss is None else f"{rss / 2**20:.0f}",
+            " ".join(f"{k}={v * 1e3:.0f}ms" for k, v in st.items()),
+        ])
+    headers = ["case", "enc MB/s", "dec MB/s", "ratio", "PSNR", "RSS MiB", "stages"]
+    print(tabulate(rows, headers=headers, tablefmt="simple"))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        prog="h5ffmpeg-bench",
+        description="Benchmark the FFMPEG HDF5 filter over a sweep of codec parameters.",
+    )
+    parser.add_argument("--data", type=_list(), default=["stripes"],
+                        help="comma separated: demo, stripes, gradient, random or file.h5:dataset")
+    parser.add_argument("--size", type=parse_shape, default=(100, 512, 512),
+                        help="DxHxW of synthetic volumes (default 100x512x512)")
+    parser.add_argument("--codecs", type=_list(), default=["libx264"],
+                        help=f"comma separated, from {', '.join(CODEC_TO_ENCODER)}")
+    parser.add_argument("--presets", type=_list(), default=[None],
+                        help="comma separated preset names (default: codec default)")
+    parser.add_argument("--crf", type=_list(int), default=[23])
+    parser.add_argument("--bit-mode", type=_list(int), default=[BitMode.BIT_8],
+                        help="comma separated: 0 (8 bit), 1 (10 bit), 2 (12 bit), 3 (16 bit)")
+    parser.add_argument("--chunks", type=_list(parse_shape), default=[None],
+                        help="comma separated DxHxW chunk shapes (default: whole volume)")
+    parser.add_argument("--threads", type=_list(int), default=[0],
+                        help="comma separated codec thread counts (0: codec default)")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--h5", action="store_true",
+                        help="also time writing and reading through h5py")
+    parser.add_argument("--json", metavar="FILE", help="write the report as JSON")
+    parser.add_argument("--baseline", metavar="FILE",
+                        help="JSON report to compare against, exit 1 on regressions")
+    parser.add_argument("--tolerance", type=float, default=0.1,
+                        help="relative drop of MB/s or ratio counted as a regression")
+    parser.add_argument("--psnr-tolerance", type=float, default=0.5,
+                        help="PSNR drop in dB counted as a regression")
+    parser.add_argument("--quiet", action="store_true", help="do not print the table")
+    args = parser.parse_args(argv)
+
+    unknown = [c for c in args.codecs if c not in CODEC_TO_ENCODER]
+    if unknown:
+        parser.error(f"unknown codecs: {', '.join(unknown)}")
+    if args.repeat < 1:
+        parser.error("--repeat must be >= 1")
+
+    log = None if args.quiet else (lambda case: print(_describe(case), file=sys.stderr))
+    report = run_suite(
+        data=args.data,
+        codecs=args.codecs,
+        presets=args.presets,
+        crfs=args.crf,
+        bit_modes=args.bit_mode,
+        chunks=args.chunks,
+        threads=args.threads,
+        size=args.size,
+        repeat=args.repeat,
+        h5=args.h5,
+        log=log,
+    )
+
+    if not args.quiet:
+        _print_table(report["cases"])
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = compare(report, baseline, args.tolerance, args.psnr_tolerance)
+        for case, metric, before, after in regressions:
+            print(f"REGRESSION {_describe(case)}: {metric} {before} -> {after}")
+        if regressions:
+            return 1
+        print(f"no regressions against {args.baseline}")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
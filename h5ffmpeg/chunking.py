@@ -0,0 +1,198 @@
+"""
+Chunk shape planning for FFMPEG compressed HDF5 datasets.
+
+Every chunk is encoded as one video, so its shape decides how well the
+codec works and how much has to be decoded for a read: frames must meet
+the codec's alignment and minimum size, the depth has to be long enough
+for inter prediction to pay off, a single chunk should decode within a
+latency budget, and a volume that is read whole needs enough chunks to
+keep every core busy.
+
+plan_chunks turns those rules into a (depth, height, width) chunk shape.
+create_dataset uses it for chunks="auto-ffmpeg".
+"""
+
+import math
+import os
+
+import numpy as np
+
+# (alignment, minimum width, minimum height) of a frame. The software
+# codecs encode yuv420 / gray and only need even sizes; the hardware
+# encoders and SVT-AV1 reject frames below their minimum and work on
+# 16 / 8 pixel blocks internally. The filter pads frames that miss the
+# hard limits (see ffh5_coded_params), keeping to these avoids encoding
+# the padding.
+CODEC_ALIGNMENT = {
+    "mpeg4": (2, 16, 16),
+    "libxvid": (2, 16, 16),
+    "libx264": (2, 16, 16),
+    "libx265": (8, 64, 64),
+    "libsvtav1": (8, 64, 64),
+    "librav1e": (8, 16, 16),
+    "h264_nvenc": (16, 160, 64),
+    "hevc_nvenc": (16, 160, 64),
+    "av1_nvenc": (16, 160, 64),
+    "av1_qsv": (16, 64, 64),
+    "ffv1": (1, 16, 16),
+    "libx264_lossless": (2, 16, 16),
+}
+DEFAULT_ALIGNMENT = (2, 16, 16)
+
+# Rough single thread decode throughput in MB/s of decoded output. Used to
+# turn the latency target into a chunk size; pass decode_mbps= with a value
+# measured by h5ffmpeg-bench for the actual data.
+DECODE_MBPS = {
+    "mpeg4": 400.0,
+    "libxvid": 400.0,
+    "libx264": 250.0,
+    "h264_nvenc": 250.0,
+    "libx265": 150.0,
+    "hevc_nvenc": 150.0,
+    "libsvtav1": 120.0,
+    "librav1e": 120.0,
+    "av1_nvenc": 120.0,
+    "av1_qsv": 120.0,
+    "ffv1": 200.0,
+    "libx264_lossless": 150.0,
+}
+DEFAULT_DECODE_MBPS = 150.0
+
+# fewest frames per chunk for inter prediction to be worth it
+MIN_DEPTH = 8
+# chunks per thread for whole volume reads
+CHUNKS_PER_THREAD = 2
+# same cap as create_dataset's default chunking
+MAX_CHUNK_SIZE = 4 * 1024**3
+
+ACCESS_PATTERNS = ("slice", "tile", "volume")
+
+
+def _codec_name(codec):
+    if isinstance(codec, str):
+        return codec
+    from .ffmpeg_filter import get_codec_name_from_encoder_id
+
+    return get_codec_name_from_encoder_id(int(codec))
+
+
+def _fit(size, dim, align, minimum):
+    """
+    Aligned chunk extent of about size along an axis of length dim, split
+    evenly so the last chunk is not mostly padding.
+    """
+    if size >= dim or dim <= minimum:
+        return dim
+    count = math.ceil(dim / max(int(size), minimum))
+    size = math.ceil(dim / count)
+    size += -size % align
+    return min(max(size, minimum), dim)
+
+
+def _fit_depth(depth, dim, gop_size):
+    depth = max(1, min(int(depth), dim))
+    if depth == dim:
+        return depth
+    if gop_size:
+        if depth > gop_size:
+            depth -= depth % gop_size
+        return depth
+    even = math.ceil(dim / math.ceil(dim / depth))
+    return even if even >= MIN_DEPTH else depth
+
+
+def plan_chunks(
+    shape,
+    dtype=np.uint8,
+    codec="libx264",
+    access="volume",
+    target_latency=0.1,
+    threads=None,
+    gop_size=0,
+    decode_mbps=None,
+):
+    """
+    Pick a chunk shape for a 3D dataset compressed with the FFMPEG filter.
+
+    Parameters:
+        shape: Dataset shape (depth, height, width)
+        dtype: Element type (uint8 or uint16)
+        codec: Encoder name or encoder id
+        access: Expected read pattern
+            "slice": single frames, chunks span whole frames and stay shallow
+            "tile": sub-volumes, chunks are roughly cubic
+            "volume": whole volume, chunks are as large as the latency
+                target allows but at least threads * CHUNKS_PER_THREAD of
+                them when the volume does not decode within the target
+        target_latency: Seconds one chunk may take to decode
+        threads: Readers decoding in parallel (default: CPU count)
+        gop_size: Keyframe interval used when encoding; depths are rounded
+            to a multiple of it
+        decode_mbps: Measured decode throughput, overrides the codec default
+
+    Returns:
+        tuple: Chunk shape (depth, height, width)
+    """
+    if len(shape) != 3:
+        raise ValueError(f"FFMPEG chunks are 3D (depth, height, width), got shape {shape}")
+    if access not in ACCESS_PATTERNS:
+        raise ValueError(
+            f"Invalid access '{access}'. Valid access patterns: {', '.join(ACCESS_PATTERNS)}"
+        )
+    if target_latency <= 0:
+        raise ValueError("target_latency must be > 0")
+
+    depth, height, width = (max(1, int(d)) for d in shape)
+    itemsize = np.dtype(dtype).itemsize
+    name = _codec_name(codec)
+    align, min_width, min_height = CODEC_ALIGNMENT.get(name, DEFAULT_ALIGNMENT)
+    rate = decode_mbps or DECODE_MBPS.get(name, DEFAULT_DECODE_MBPS)
+    threads = max(1, int(threads or os.cpu_count() or 1))
+
+    # elements one chunk may hold; never below MIN_DEPTH minimum frames
+    budget = rate * 1e6 * target_latency / itemsize
+    budget = max(budget, MIN_DEPTH * min_width * min_height)
+    budget = min(budget, MAX_CHUNK_SIZE / itemsize)
+
+    if access == "tile":
+        side = budget ** (1 / 3)
+        h = _fit(side, height, align, min_height)
+        w = _fit(side, width, align, min_width)
+    else:
+        # whole frames unless the shallowest useful chunk exceeds the budget;
+        # a slice read decodes at most one keyframe interval
+        frames = max(MIN_DEPTH, gop_size) if access == "slice" else MIN_DEPTH
+        scale = min(1.0, math.sqrt(budget / (frames * height * width)))
+        h = _fit(height * scale, height, align, min_height)
+        w = _fit(width * scale, width, align, min_width)
+
+    if access == "slice":
+        d = max(MIN_DEPTH, gop_size)
+    else:
+        d = max(budget // (h * w), MIN_DEPTH)
+    d = _fit_depth(d, depth, gop_size)
+
+    if access == "volume" and depth * height * width > budget:
+        # split until every reader has chunks to decode, depth first while
+        # it stays useful for the codec, then the longer frame axis; a
+        # volume that decodes within the target anyway stays in one piece
+        wanted = threads * CHUNKS_PER_THREAD
+        while True:
+            count = math.ceil(depth / d) * math.ceil(height / h) * math.ceil(width / w)
+            if count >= wanted:
+                break
+            if d > MIN_DEPTH:
+                split = _fit_depth(max(MIN_DEPTH, d // 2), depth, gop_size)
+                if split < d:
+                    d = split
+                    continue
+            split_h = _fit(h // 2, height, align, min_height) if h // 2 >= min_height else h
+            split_w = _fit(w // 2, width, align, min_width) if w // 2 >= min_width else w
+            if split_h < h and (h >= w or split_w == w):
+                h = split_h
+            elif split_w < w:
+                w = split_w
+            else:
+                break
+
+    return (d, h, w)
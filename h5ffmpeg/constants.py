@@ -17,6 +17,7 @@ FFMPEG_ID = 32030
 HEADER_VERSION = get_current_header_version()
 METADATA_FIELDS = 11  # Keep all fields
 METADATA_SIZE = METADATA_FIELDS * 4 + 8  # 11 * uint32 + 1 * uint64
+LAYOUT_SIZE = 4  # optional trailing uint32 sample layout of 12 bit blobs
 HEADER_SIZE = 8  # metadata_size(uint32) + version(uint32)
 
 # Encoder codec IDs
@@ -33,6 +34,9 @@ class EncoderCodec:
     RAV1E = 7
     AV1_NVENC = 8
     AV1_QSV = 9
+    # lossless, intra only
+    FFV1 = 10
+    X264_LOSSLESS = 11
 
 
 # Decoder codec IDs
@@ -48,6 +52,7 @@ class DecoderCodec:
     DAV1D = 6
     AV1_CUVID = 7
     AV1_QSV = 8
+    FFV1 = 9
 
 
 # Preset IDs
@@ -214,6 +219,50 @@ class BitMode:
     BIT_8 = 0
     BIT_10 = 1
     BIT_12 = 2
+    BIT_16 = 3
+
+
+# Significant bits of the samples of each bit mode
+BIT_DEPTH = {BitMode.BIT_8: 8, BitMode.BIT_10: 10, BitMode.BIT_12: 12, BitMode.BIT_16: 16}
+
+
+# Sample layout of 12 bit chunks (optional cd_values[16])
+class SampleLayout:
+    """How 12 bit samples are handed to the codec"""
+
+    # files without the flag: gray10 frames scaled to 12 bit by swscale,
+    # decoded back to the 10 bit scale
+    LEGACY = 0
+    # 12 bit samples as they are
+    NATIVE = 1
+
+
+# Stream features newer than 2.4 readers (optional cd_values[17], bit flags)
+class Feature:
+    """Opt-in stream features; chunks using them need an h5ffmpeg 2.5+ reader"""
+
+    NONE = 0
+    # packet table behind the bitstream, decoders skip the parser
+    PACKET_INDEX = 0x1
+    # gray data coded as 4:0:0 by x265, rav1e and x264 built with I400
+    MONOCHROME = 0x2
+    ALL = PACKET_INDEX | MONOCHROME
+
+
+# Codec threading modes (optional cd_values[12])
+class ThreadType:
+    """Threading modes for FFMPEG HDF5 filter codecs"""
+
+    AUTO = 0
+    FRAME = 1
+    SLICE = 2
+
+
+THREAD_TYPE_MAPPING = {
+    "auto": ThreadType.AUTO,
+    "frame": ThreadType.FRAME,
+    "slice": ThreadType.SLICE,
+}
 
 
 # Mapping of codec names to encoder IDs
@@ -228,8 +277,16 @@ CODEC_TO_ENCODER = {
     "librav1e": EncoderCodec.RAV1E,
     "av1_nvenc": EncoderCodec.AV1_NVENC,
     "av1_qsv": EncoderCodec.AV1_QSV,
+    "ffv1": EncoderCodec.FFV1,
+    "libx264_lossless": EncoderCodec.X264_LOSSLESS,
 }
 
+# Encoders whose chunks are bit-exact and decode frame by frame
+LOSSLESS_ENCODERS = (EncoderCodec.FFV1, EncoderCodec.X264_LOSSLESS)
+
+# Highest bit mode whose samples each encoder codes whole, BIT_10 otherwise
+MAX_BIT_MODE = {EncoderCodec.X265: BitMode.BIT_12, EncoderCodec.FFV1: BitMode.BIT_16}
+
 # Mapping of codec names to decoder IDs
 CODEC_TO_DECODER = {
     "mpeg4": DecoderCodec.MPEG4,
@@ -241,6 +298,7 @@ CODEC_TO_DECODER = {
     "libdav1d": DecoderCodec.DAV1D,
     "av1_cuvid": DecoderCodec.AV1_CUVID,
     "av1_qsv": DecoderCodec.AV1_QSV,
+    "ffv1": DecoderCodec.FFV1,
 }
 
 # Mapping of preset names to preset IDs for each codec
@@ -391,6 +449,10 @@ TUNE_MAPPING = {
     },
 }
 
+# lossless x264 takes the presets and tunes of libx264
+PRESET_MAPPING["libx264_lossless"] = PRESET_MAPPING["libx264"]
+TUNE_MAPPING["libx264_lossless"] = TUNE_MAPPING["libx264"]
+
 # Default decoder mapping for encoders
 DEFAULT_DECODER = {
     EncoderCodec.MPEG4: DecoderCodec.MPEG4,
@@ -404,6 +466,8 @@ DEFAULT_DECODER = {
     EncoderCodec.RAV1E: DecoderCodec.DAV1D,
     EncoderCodec.AV1_NVENC: DecoderCodec.DAV1D,
     EncoderCodec.AV1_QSV: DecoderCodec.DAV1D,
+    EncoderCodec.FFV1: DecoderCodec.FFV1,
+    EncoderCodec.X264_LOSSLESS: DecoderCodec.H264,
 }
 
 # Default decoder mapping for GPU-based encoders
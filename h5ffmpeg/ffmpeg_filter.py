@@ -8,14 +8,16 @@ allowing compression of HDF5 datasets using various video codecs.
 import numpy as np
 import h5py
 import logging
+import os
 import struct
 
 from .constants import (
-    FFMPEG_ID, METADATA_FIELDS, HEADER_SIZE, Preset, Tune, BitMode,
+    FFMPEG_ID, METADATA_FIELDS, METADATA_SIZE, LAYOUT_SIZE, HEADER_SIZE, Preset, Tune, BitMode,
+    SampleLayout, Feature, ThreadType, MAX_BIT_MODE,
     CODEC_TO_ENCODER, CODEC_TO_DECODER, PRESET_MAPPING, TUNE_MAPPING,
-    DEFAULT_DECODER, DEFAULT_GPU_DECODER, get_current_header_version
+    THREAD_TYPE_MAPPING, DEFAULT_DECODER, DEFAULT_GPU_DECODER, get_current_header_version
 )
-from .gpu_utils import has_nvidia_gpu, has_intel_gpu, validate_and_adjust_gpu_id
+from .gpu_utils import has_nvidia_gpu, has_intel_gpu, has_codec, validate_and_adjust_gpu_id
 
 logger = logging.getLogger(__name__)
 
@@ -26,12 +28,136 @@ def get_codec_name_from_encoder_id(enc_id):
             return codec_name
     return "unknown"
 
+def _tile_opts(tiles):
+    """(tile_columns, tile_rows) of tiles, an int (columns) or (rows, columns)"""
+    if not tiles:
+        return 0, 0
+    if isinstance(tiles, int):
+        rows, columns = 1, tiles
+    else:
+        rows, columns = tiles
+    rows, columns = int(rows), int(columns)
+    if rows < 1 or columns < 1 or rows > 64 or columns > 64:
+        raise ValueError("tiles must be between 1 and 64 per direction")
+    if (rows, columns) == (1, 1):
+        return 0, 0
+    return columns, rows
+
+def check_bit_mode(codec, bit_mode):
+    """Raise when codec would scale the samples of bit_mode down to fewer bits"""
+    enc_id = CODEC_TO_ENCODER[codec]
+    max_mode = MAX_BIT_MODE.get(enc_id, BitMode.BIT_10)
+    if not BitMode.BIT_8 <= int(bit_mode) <= max_mode:
+        supported = ", ".join(
+            get_codec_name_from_encoder_id(e) for e, m in MAX_BIT_MODE.items() if m >= int(bit_mode)
+        )
+        raise ValueError(
+            f"bit_mode {bit_mode} is not supported by {codec}"
+            + (f", use {supported}" if supported else "")
+        )
+
+def sample_layout(bit_mode):
+    """Sample layout written for new data of bit_mode (see SampleLayout)"""
+    return SampleLayout.NATIVE if int(bit_mode) == BitMode.BIT_12 else SampleLayout.LEGACY
+
+def optional_opts(threads=0, thread_type=None, gop_size=0, tiles=None, layout=SampleLayout.LEGACY,
+                  features=Feature.NONE):
+    """
+    Optional trailing cd_values (codec threading, keyframe interval,
+    intra-frame tiles/slices, sample layout of 12 bit data, opt-in stream
+    features).
+
+    Only the parameters up to the last non-default one are returned so
+    that the stored filter parameters stay identical to older files when
+    none of them is used.
+    """
+    if thread_type is None:
+        thread_type_id = ThreadType.AUTO
+    elif thread_type in THREAD_TYPE_MAPPING:
+        thread_type_id = THREAD_TYPE_MAPPING[thread_type]
+    else:
+        raise ValueError(
+            f"Invalid thread_type '{thread_type}'. Valid thread types: {', '.join(THREAD_TYPE_MAPPING.keys())}"
+        )
+
+    threads = int(threads or 0)
+    if threads < 0:
+        raise ValueError("threads must be >= 0 (0 uses the codec default)")
+
+    gop_size = int(gop_size or 0)
+    if gop_size < 0:
+        raise ValueError("gop_size must be >= 0 (0 disables the keyframe index)")
+
+    features = int(features or 0)
+    if features & ~Feature.ALL:
+        raise ValueError(f"Unknown features {features:#x}, see Feature")
+
+    opts = (threads, thread_type_id, gop_size) + _tile_opts(tiles) + (int(layout), features)
+    while opts and opts[-1] == 0:
+        opts = opts[:-1]
+    return opts
+
+def encoder_cd_values(
+    width,
+    height,
+    depth,
+    codec="libx264",
+    preset=None,
+    tune=None,
+    crf=23,
+    bit_mode=BitMode.BIT_8,
+    film_grain=0,
+    gpu_id=0,
+    threads=0,
+    thread_type=None,
+    gop_size=0,
+    tiles=None,
+    features=Feature.NONE,
+):
+    """cd_values of a native compress call for a (depth, height, width) volume"""
+    enc_id = CODEC_TO_ENCODER[codec]
+    check_bit_mode(codec, bit_mode)
+    dec_id = DEFAULT_DECODER[enc_id]
+
+    # Validate and adjust GPU ID for compression
+    validated_gpu_id = validate_and_adjust_gpu_id(codec, gpu_id)
+
+    if validated_gpu_id < 0:
+        raise RuntimeError("No GPU Detected!")
+
+    preset_id = (
+        PRESET_MAPPING.get(codec, {}).get(preset, Preset.NONE)
+        if preset
+        else Preset.NONE
+    )
+    tune_id = (
+        TUNE_MAPPING.get(codec, {}).get(tune, Tune.NONE) if tune else Tune.NONE
+    )
+
+    return (
+        enc_id,
+        dec_id,
+        int(width),
+        int(height),
+        int(depth),
+        int(bit_mode),
+        preset_id,
+        tune_id,
+        int(crf),
+        int(film_grain),
+        validated_gpu_id,
+    ) + optional_opts(threads, thread_type, gop_size, tiles, sample_layout(bit_mode), features)
+
 def modify_compression_opts(compression_opts):
     """
     Design to handle hardware decompression
         use different GPU [different systems]
     or
         Fall Back to Software Decompression
+
+    Decided from the cached capability registry (see capabilities); the
+    filter applies the same fallback itself when decoding, so this is only
+    needed for callers that pick a decoder from cd_values.
     """
     compression_opts = list(compression_opts)
     enc_id = compression_opts[0]
@@ -40,8 +166,9 @@ def modify_compression_opts(compression_opts):
 
     if dec_id in DEFAULT_GPU_DECODER.values():
         codec_name = get_codec_name_from_encoder_id(enc_id)
+        dec_name = next((n for n, i in CODEC_TO_DECODER.items() if i == dec_id), None)
         actual_gpu_id = validate_and_adjust_gpu_id(codec_name, gpu_id)
-        if actual_gpu_id < 0:
+        if actual_gpu_id < 0 or not has_codec(dec_name, encoder=False):
             dec_id = DEFAULT_DECODER[enc_id]
             compression_opts[10] = 0
         else:
@@ -74,6 +201,13 @@ class FFMPEG(h5py.filters.FilterRefBase):
         crf,
         film_grain,
         gpu_id,
+        threads=0,
+        thread_type=ThreadType.AUTO,
+        gop_size=0,
+        tile_columns=0,
+        tile_rows=0,
+        layout=None,
+        features=Feature.NONE,
     ):
         """
         Create an FFMPEG filter instance with the given parameters.
@@ -91,7 +225,7 @@ class FFMPEG(h5py.filters.FilterRefBase):
         width : int
             Width of the video frames
         bit_mode : int
-            Bit depth mode (8, 10, or 12)
+            Bit depth mode (8, 10, 12 or 16)
         preset : int
             Preset ID for encoding speed/quality tradeoff
         tune : int
@@ -102,6 +236,19 @@ class FFMPEG(h5py.filters.FilterRefBase):
             Film grain synthesis parameter (0-50, 0 means disabled)
         gpu_id : int
             GPU ID for hardware acceleration
+        threads : int, optional
+            Codec thread count (0 means codec default)
+        thread_type : int, optional
+            ThreadType.AUTO, ThreadType.FRAME or ThreadType.SLICE
+        gop_size : int, optional
+            Keyframe interval; > 0 stores a keyframe index in every chunk
+        tile_columns, tile_rows : int, optional
+            Tiles (AV1) or slices (H.264/HEVC) each frame is split into
+        layout : int, optional
+            SampleLayout of 12 bit data, SampleLayout.NATIVE for new 12 bit
+            datasets by default
+        features : int, optional
+            Feature flags; chunks using any need an h5ffmpeg 2.5+ reader
         """
         self.filter_options = (
             int(enc_id),
@@ -116,6 +263,13 @@ class FFMPEG(h5py.filters.FilterRefBase):
             int(film_grain),
             int(gpu_id),
         )
+        if layout is None:
+            layout = sample_layout(bit_mode)
+        extra = (int(threads), int(thread_type), int(gop_size), int(tile_columns), int(tile_rows),
+                 int(layout), int(features))
+        while extra and extra[-1] == 0:
+            extra = extra[:-1]
+        self.filter_options += extra
 
 
 def ffmpeg(
@@ -130,6 +284,11 @@ def ffmpeg(
     width=None,
     height=None,
     depth=None,
+    threads=0,
+    thread_type=None,
+    gop_size=0,
+    tiles=None,
+    features=Feature.NONE,
     **kwargs,
 ):
     """
@@ -138,7 +297,8 @@ def ffmpeg(
     Parameters:
     -----------
     codec : str
-        Video codec to use (e.g., "libx264", "libx265", "libsvtav1")
+        Video codec to use (e.g., "libx264", "libx265", "libsvtav1"); "ffv1"
+        and "libx264_lossless" are lossless and intra only
     decoder : str, optional
         Decoder to use for decompression. If None, a default decoder is selected.
     preset : str, optional
@@ -148,7 +308,8 @@ def ffmpeg(
     crf : int, optional
         Constant Rate Factor for quality control (lower = better quality)
     bit_mode : int, optional
-        Bit depth mode (8, 10, or 12 bits)
+        Bit depth mode (8, 10, 12 or 16 bits); 12 bit needs libx265 or ffv1,
+        16 bit needs ffv1
     film_grain : int, optional
         Film grain synthesis parameter (0-100, 0 means disabled)
     gpu_id : int, optional
@@ -159,6 +320,26 @@ def ffmpeg(
         Custom height override (default: auto-detected from data)
     depth : int, optional
         Custom depth override (default: auto-detected from data)
+    threads : int, optional
+        Number of codec threads per chunk (0 means codec default). Useful to
+        pin a fixed number of threads per process on shared nodes.
+    thread_type : str, optional
+        Codec threading mode: "auto", "frame" or "slice"
+    gop_size : int, optional
+        Keyframe interval in frames. When > 0 every chunk gets a small
+        keyframe index so single slices can be decoded from the nearest
+        keyframe (see read_frames); B-frames are disabled. 0 keeps the
+        codec default (typically a single keyframe per chunk).
+    tiles : int or (int, int), optional
+        Split every frame into tile columns, or (rows, columns), that are
+        encoded and decoded in parallel: AV1 tiles with SVT-AV1, rav1e and
+        av1_nvenc, slices with x264, x265 (plus wavefront) and NVENC. Meant
+        for very wide frames in shallow chunks, where frame threading has
+        nothing to work on. Costs a little compression per tile.
+    features : int, optional
+        Feature flags (Feature.PACKET_INDEX, Feature.MONOCHROME, or
+        Feature.ALL) of stream features that speed up coding. Off by
+        default: chunks using them can only be read by h5ffmpeg 2.5 or later.
     **kwargs : dict
         Additional parameters (reserved for future use)
 
@@ -175,6 +356,7 @@ def ffmpeg(
         )
 
     enc_id = CODEC_TO_ENCODER[codec]
+    check_bit_mode(codec, bit_mode)
 
     # Select decoder
     if decoder is None:
@@ -236,7 +418,7 @@ def ffmpeg(
         crf or 0,
         film_grain,
         gpu_id,
-    )
+    ) + optional_opts(threads, thread_type, gop_size, tiles, sample_layout(bit_mode), features)
 
     return {
         "compression": FFMPEG_ID,
@@ -295,9 +477,44 @@ def av1_qsv(preset="medium", crf=30, tune=None, **kwargs):
     return ffmpeg(codec="av1_qsv", preset=preset, crf=crf, tune=tune, **kwargs)
 
 
+def ffv1(**kwargs):
+    """
+    Convenience function for lossless FFV1 compression.
+
+    Frames are coded as gray (16 bit samples whole, uint16 data is stored
+    without quantization) in slices decoded in parallel, every frame on its
+    own: bit-exact "hot" copies with fast random access to single slices.
+    """
+    kwargs.setdefault("bit_mode", BitMode.BIT_16)
+    return ffmpeg(codec="ffv1", crf=0, **kwargs)
+
+
+def x264_lossless(preset="veryfast", tune=None, **kwargs):
+    """
+    Convenience function for lossless intra-only H.264 (x264 qp 0)
+
+    Every frame is an IDR frame, bit-exact up to 8 (or 10, bit_mode=1) bits.
+    Wider samples would be scaled down to 10 bit, use ffv1() for them.
+    """
+    if kwargs.get("bit_mode", BitMode.BIT_8) > BitMode.BIT_10:
+        raise ValueError("x264_lossless codes at most 10 bit samples, use ffv1() for 12/16 bit data")
+    return ffmpeg(codec="libx264_lossless", preset=preset, crf=0, tune=tune, **kwargs)
+
+
 # native functions
 try:
-    from ._ffmpeg_filter import ffmpeg_native_c
+    from ._ffmpeg_filter import ffmpeg_native_c, decode_frames
+    from ._ffmpeg_filter import compress_many as _compress_many_c
+    from ._ffmpeg_filter import decompress_many as _decompress_many_c
+    from ._ffmpeg_filter import seed_ratio as _seed_ratio_c, get_ratio as _get_ratio_c
+    from ._ffmpeg_filter import size_stats as _size_stats_c
+    from ._ffmpeg_filter import chunk_cache as _chunk_cache_c
+    from ._ffmpeg_filter import chunk_cache_stats as _chunk_cache_stats_c
+    from ._ffmpeg_filter import clear_chunk_cache as _clear_chunk_cache_c
+    from ._ffmpeg_filter import set_stats as _set_stats_c, stats as _stats_c
+    from ._ffmpeg_filter import rdcc_stats as _rdcc_stats_c
+    from ._ffmpeg_filter import write_trace as _write_trace_c
+    from ._ffmpeg_filter import quantize as _quantize_c
 
     def read_metadata_from_compressed(compressed_data):
         """Extract metadata from compressed data"""
@@ -327,7 +544,13 @@ try:
         # Read compressed_size as uint64_t (always 8 bytes, platform-agnostic)
         compressed_size = struct.unpack("Q", compressed_data[offset:offset + 8])[0]
         offset += 8
-        
+
+        # 12 bit blobs of the native sample layout append it to the metadata
+        layout = SampleLayout.LEGACY
+        if metadata_size >= METADATA_SIZE + LAYOUT_SIZE:
+            layout = struct.unpack("I", compressed_data[offset:offset + LAYOUT_SIZE])[0]
+        offset = HEADER_SIZE + metadata_size
+
         (enc_id, dec_id, width, height, depth, bit_mode, 
         preset_id, tune_id, crf, film_grain, stored_gpu_id) = metadata_values
 
@@ -344,11 +567,12 @@ try:
             "film_grain": film_grain,
             "stored_gpu_id": stored_gpu_id,
             "compressed_size": compressed_size,
+            "layout": layout,
             "data_offset": offset,
             "version": version,
         }
 
-    def ffmpeg_native(
+    def _native_call_args(
         flags,
         data,
         codec="libx264",
@@ -358,28 +582,15 @@ try:
         bit_mode=BitMode.BIT_8,
         film_grain=0,
         gpu_id=0,
+        threads=0,
+        thread_type=None,
+        gop_size=0,
+        tiles=None,
+        features=Feature.NONE,
     ):
-        """Single native function for compress (flags=0) and decompress (flags=1)"""
+        """Build (cd_values, buf_size, data) for a native compress/decompress call"""
 
         if flags == 0:  # Compress
-            enc_id = CODEC_TO_ENCODER[codec]
-            dec_id = DEFAULT_DECODER[enc_id]
-
-            # Validate and adjust GPU ID for compression
-            validated_gpu_id = validate_and_adjust_gpu_id(codec, gpu_id)
-
-            if validated_gpu_id < 0:
-                raise RuntimeError("No GPU Detected!")
-
-            preset_id = (
-                PRESET_MAPPING.get(codec, {}).get(preset, Preset.NONE)
-                if preset
-                else Preset.NONE
-            )
-            tune_id = (
-                TUNE_MAPPING.get(codec, {}).get(tune, Tune.NONE) if tune else Tune.NONE
-            )
-
             data = np.ascontiguousarray(
                 data, dtype=(np.uint8 if bit_mode == BitMode.BIT_8 else np.uint16)
             )
@@ -388,10 +599,13 @@ try:
                 raise ValueError("Data must be a 3D array (depth, height, width)")
 
             depth, height, width = data.shape
-            buf_size = data.nbytes
-
-            stored_gpu_id = gpu_id
-            actual_gpu_id = validated_gpu_id
+            cd_values = encoder_cd_values(
+                width, height, depth, codec=codec, preset=preset, tune=tune,
+                crf=crf, bit_mode=bit_mode, film_grain=film_grain, gpu_id=gpu_id,
+                threads=threads, thread_type=thread_type, gop_size=gop_size, tiles=tiles,
+                features=features,
+            )
+            return cd_values, data.nbytes, data
 
         else:  # Decompress (flags=1)
             # Read metadata from the compressed bytes
@@ -409,6 +623,7 @@ try:
             crf = metadata["crf"]
             film_grain = metadata["film_grain"]
             stored_gpu_id = metadata["stored_gpu_id"]
+            layout = metadata["layout"]
 
             if dec_id in DEFAULT_GPU_DECODER.values():
                 codec_name = get_codec_name_from_encoder_id(enc_id)
@@ -430,12 +645,14 @@ try:
             else:
                 actual_gpu_id = 0
 
-            # Extract only the compressed data (skip metadata)
+            # Extract only the compressed data (skip metadata) without copying it
             data_offset = metadata["data_offset"]
-            data = data[data_offset:]
+            data = memoryview(data)[data_offset:]
             buf_size = len(data)
 
-        # Build cd_values tuple (exactly 11 elements as expected by C function)
+        # Build cd_values tuple (11 stored elements, optionally followed by
+        # the threading parameters, which only affect this call; tiles only
+        # turns on in-frame parallel decoding here)
         cd_values = (
             enc_id,
             dec_id,
@@ -448,9 +665,21 @@ try:
             crf,
             film_grain,
             actual_gpu_id,  # Use validated GPU ID for actual operation
-        )
+        ) + optional_opts(threads, thread_type, gop_size, tiles, layout)
+
+        return cd_values, buf_size, data
+
+    def ffmpeg_native(flags, data, out=None, **kwargs):
+        """Single native function for compress (flags=0) and decompress (flags=1)
+
+        When decompressing, out may be a preallocated C-contiguous array of
+        the stored shape and dtype; frames are decoded straight into it.
+        """
+        cd_values, buf_size, data = _native_call_args(flags, data, **kwargs)
 
         # Call C function
+        if out is not None:
+            return ffmpeg_native_c(flags, cd_values, buf_size, data, out)
         return ffmpeg_native_c(flags, cd_values, buf_size, data)
 
     # Convenience functions
@@ -458,9 +687,206 @@ try:
         """Compress data using native FFMPEG"""
         return ffmpeg_native(0, data, **kwargs)
 
-    def decompress_native(compressed_data, **kwargs):
-        """Decompress data using native FFMPEG"""
-        return ffmpeg_native(1, compressed_data, **kwargs)
+    def decompress_native(compressed_data, out=None, frames=None, **kwargs):
+        """Decompress data using native FFMPEG, optionally into out
+
+        frames=(start, stop) decodes only that z-range; with data compressed
+        using gop_size decoding starts at the nearest preceding keyframe.
+        """
+        if frames is None:
+            return ffmpeg_native(1, compressed_data, out=out, **kwargs)
+
+        if out is not None:
+            raise ValueError("out cannot be combined with frames")
+        cd_values, _, data = _native_call_args(1, compressed_data, **kwargs)
+        start, stop = frames
+        return decode_frames(cd_values, data, int(start), int(stop) - int(start))
+
+    def _native_many(flags, items, threads=None, **kwargs):
+        cd_values_list, data_list = [], []
+        for item in items:
+            cd_values, _, data = _native_call_args(flags, item, **kwargs)
+            cd_values_list.append(cd_values)
+            data_list.append(data)
+
+        run = _compress_many_c if flags == 0 else _decompress_many_c
+        return run(cd_values_list, data_list, threads=int(threads or 0))
+
+    def compress_many(volumes, threads=None, **kwargs):
+        """
+        Compress several 3D volumes in parallel on the native worker pool.
+
+        Parameters:
+        -----------
+        volumes : iterable of array-like
+            3D (depth, height, width) volumes, they may differ in shape
+        threads : int, optional
+            Number of worker threads (default: one per CPU core)
+        **kwargs
+            Same codec options as compress_native
+
+        Returns:
+        --------
+        list of bytes, one compress_native result per volume
+        """
+        return _native_many(0, volumes, threads=threads, **kwargs)
+
+    def decompress_many(blobs, threads=None, **kwargs):
+        """
+        Decompress several compress_native results in parallel.
+
+        Parameters:
+        -----------
+        blobs : iterable of bytes
+            Data returned by compress_native or compress_many
+        threads : int, optional
+            Number of worker threads (default: one per CPU core)
+        **kwargs
+            Same options as decompress_native (e.g. gpu_id)
+
+        Returns:
+        --------
+        list of numpy arrays
+        """
+        return _native_many(1, blobs, threads=threads, **kwargs)
+
+    def seed_compression_ratio(ratio, codec="libx264", crf=23, bit_mode=BitMode.BIT_8):
+        """
+        Seed the compression ratio (raw size / compressed size) expected for
+        a codec, crf and bit mode.
+
+        Output buffers of chunks are sized from a running average of the
+        ratios seen so far; seeding avoids regrowing them for the first
+        chunks of a dataset whose ratio is known from earlier runs.
+        """
+        _seed_ratio_c(CODEC_TO_ENCODER[codec], int(crf), int(bit_mode), float(ratio))
+
+    def expected_compression_ratio(codec="libx264", crf=23, bit_mode=BitMode.BIT_8):
+        """Current compression ratio estimate for a codec, crf and bit mode"""
+        return _get_ratio_c(CODEC_TO_ENCODER[codec], int(crf), int(bit_mode))
+
+    def size_stats(reset=False):
+        """
+        Output buffer statistics of the chunks encoded by this process.
+
+        Returns a dict with chunks, reallocs (times an output buffer grew
+        beyond its initial reservation), reserved_bytes and compressed_bytes.
+        """
+        return _size_stats_c(reset=reset)
+
+    _SIZE_SUFFIXES = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+
+    def configure_chunk_cache(budget, shared=False):
+        """
+        Cache decoded chunks so that rereading a hot chunk skips the decode.
+
+        Every whole-chunk decode (dset[...], read_dataset_parallel,
+        decompress_native) looks in the cache first. Chunks are keyed by a
+        digest of their compressed bytes and codec parameters, so they are
+        found whatever file or dataset they are read from.
+
+        Parameters:
+        -----------
+        budget : int or str
+            Bytes of decoded chunks to keep, e.g. 2**30 or "1G"; 0 disables
+            the cache
+        shared : bool
+            Publish decoded chunks as POSIX shared memory objects, so every
+            reader process on the node shares them (not on Windows). Each
+            process evicts the objects it created beyond its budget.
+        """
+        if isinstance(budget, str):
+            text = budget.strip().upper()
+            scale = _SIZE_SUFFIXES.get(text[-1:], 1)
+            budget = float(text[:-1] if scale > 1 else text) * scale
+        budget = int(budget)
+        if budget < 0:
+            raise ValueError("budget must be >= 0 (0 disables the cache)")
+        _chunk_cache_c(budget, shared=bool(shared))
+
+    def chunk_cache_stats(reset=False):
+        """
+        Decoded chunk cache statistics of this process.
+
+        Returns a dict with hits, misses, inserts, evictions, bytes (held by
+        this process), budget and shared.
+        """
+        return _chunk_cache_stats_c(reset=reset)
+
+    def clear_chunk_cache():
+        """Drop cached chunks, including the shared objects this process created"""
+        _clear_chunk_cache_c()
+
+    def enable_stats(enabled=True, trace=False):
+        """
+        Collect hot path statistics (see stats) from now on.
+
+        Off by default, when off every probe costs a single branch. With
+        trace=True every timed stage is also recorded as a Chrome trace
+        event for write_trace. H5FFMPEG_STATS=1 or H5FFMPEG_TRACE=file turn
+        them on for processes that do not call the Python API.
+
+        Returns whether statistics were enabled before.
+        """
+        return _set_stats_c(enabled=bool(enabled), trace=bool(trace))
+
+    def stats(reset=False):
+        """
+        Hot path statistics of this process, summed over all threads.
+
+        Returns a dict with stages, mapping encode_chunk, decode_chunk,
+        codec_open, parse, send, receive, convert, copy and h5_filter to
+        their calls and seconds (chunk stages include the others), byte and
+        frame counters, reallocs, context and chunk cache hits/misses, the
+        derived context_hit_rate and chunk_cache_hit_rate (None without
+        lookups), and trace_dropped.
+
+        hdf5_chunk_cache holds the HDF5 chunk cache sizing of ffmpeg
+        datasets (h5ffmpeg.rdcc): datasets sized so far, the nslots,
+        nbytes and w0 given to the last one with its chunk_bytes and access,
+        enabled and max_nbytes (H5FFMPEG_RDCC_MAX, 0 when unset).
+        """
+        result = _stats_c(reset=reset)
+        for name in ("context", "chunk_cache"):
+            hits, misses = result[f"{name}_hits"], result[f"{name}_misses"]
+            result[f"{name}_hit_rate"] = hits / (hits + misses) if hits + misses else None
+        rdcc = _rdcc_stats_c()
+        hint = rdcc.pop("hint")
+        rdcc["access"] = ("slice", "tile", "volume")[hint] if rdcc["datasets"] else None
+        result["hdf5_chunk_cache"] = rdcc
+        return result
+
+    def reset_stats():
+        """Zero the hot path statistics and drop the recorded trace events"""
+        _stats_c(reset=True)
+
+    def write_trace(path):
+        """Write the trace events recorded so far (enable_stats(trace=True))
+        as Chrome trace-event JSON, for chrome://tracing or Perfetto"""
+        _write_trace_c(os.fspath(path))
+
+    def quantize_intensity(
+        data, dtype, offset=0.0, scale=1.0, power=1.0, post=1.0, add=0.0,
+        lo=-np.inf, hi=np.inf, out=None, threads=0,
+    ):
+        """
+        Intensity transform of the norm/beta datasets in one native pass.
+
+        Computes clip(max((data - offset) * scale, 0) ** power * post + add,
+        lo, hi) in float32 and truncates it to dtype (uint8, uint16 or
+        float32), without float copies of the whole array. uint8/uint16
+        inputs go through a lookup table. out may be data itself when the
+        types have the same size.
+        """
+        data = np.ascontiguousarray(data)
+        if data.dtype not in (np.uint8, np.uint16, np.float32):
+            data = data.astype(np.float32)
+        if out is None:
+            out = np.empty(data.shape, dtype=dtype)
+        return _quantize_c(
+            data, out, offset=float(offset), scale=float(scale), power=float(power),
+            post=float(post), add=float(add), lo=float(lo), hi=float(hi), threads=int(threads),
+        )
 
     NATIVE_AVAILABLE = True
 
@@ -481,4 +907,69 @@ except ImportError:
             "Native functions not available - C extension not compiled with native support"
         )
 
+    def compress_many(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def decompress_many(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def seed_compression_ratio(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def expected_compression_ratio(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def size_stats(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def configure_chunk_cache(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def chunk_cache_stats(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def clear_chunk_cache(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def enable_stats(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def stats(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def reset_stats(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def write_trace(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+    def quantize_intensity(*args, **kwargs):
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
     NATIVE_AVAILABLE = False
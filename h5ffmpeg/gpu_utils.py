@@ -2,44 +2,36 @@
 GPU detection and validation utilities for FFMPEG HDF5 filter.
 """
 
+import functools
 import os
 import subprocess
 import logging
 
 logger = logging.getLogger(__name__)
 
-def has_nvidia_gpu():
-    """
-    Detect if NVIDIA GPU is available for hardware acceleration.
+def _probe_subprocess():
+    """Capabilities from nvidia-smi / vainfo, for builds without the extension"""
+    caps = {"cuda_devices": 0, "qsv": False, "encoders": None, "decoders": None}
 
-    Returns:
-    --------
-    bool
-        True if NVIDIA GPU is available, False otherwise.
-    """
     try:
         result = subprocess.run(
-            ["nvidia-smi"], stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=2
+            ["nvidia-smi", "--list-gpus"],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            timeout=2
         )
-        return result.returncode == 0
+        if result.returncode == 0:
+            gpu_lines = [line for line in result.stdout.decode().strip().split("\n") if line.strip()]
+            caps["cuda_devices"] = len(gpu_lines)
     except (subprocess.SubprocessError, FileNotFoundError):
-        return False
-
-def has_intel_gpu():
-    """
-    Detect if Intel GPU with QuickSync support is available.
+        pass
 
-    Returns:
-    --------
-    bool
-        True if Intel GPU with QuickSync is available, False otherwise.
-    """
     try:
         if os.name == "posix":
             result = subprocess.run(
                 ["vainfo"], stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=2
             )
-            return result.returncode == 0 and b"VA-API version" in result.stdout
+            caps["qsv"] = result.returncode == 0 and b"VA-API version" in result.stdout
         elif os.name == "nt":
             result = subprocess.run(
                 ["wmic", "path", "win32_VideoController", "get", "name"],
@@ -47,11 +39,71 @@ def has_intel_gpu():
                 stderr=subprocess.PIPE,
                 timeout=2,
             )
-            return result.returncode == 0 and b"Intel" in result.stdout
-        else:
-            return False
+            caps["qsv"] = result.returncode == 0 and b"Intel" in result.stdout
     except (subprocess.SubprocessError, FileNotFoundError):
-        return False
+        pass
+
+    return caps
+
+
+@functools.lru_cache(maxsize=None)
+def _capabilities():
+    try:
+        from ._ffmpeg_filter import capabilities as probe
+    except ImportError:
+        return _probe_subprocess()
+    return probe()
+
+
+def capabilities():
+    """
+    Devices and codecs available to this process.
+
+    Probed once per process, in process through the C extension (CUDA
+    driver, av_hwdevice_ctx_create, avcodec_find_*_by_name), and cached;
+    without the extension nvidia-smi / vainfo are run once instead.
+
+    Returns:
+    --------
+    dict
+        "cuda_devices": number of CUDA devices, "qsv": whether a QSV device
+        can be opened, "encoders" / "decoders": FFmpeg names of the codecs
+        that resolve (None when unknown)
+    """
+    caps = _capabilities()
+    return dict(caps, encoders=caps["encoders"] and list(caps["encoders"]),
+                decoders=caps["decoders"] and list(caps["decoders"]))
+
+
+def has_nvidia_gpu():
+    """
+    Detect if NVIDIA GPU is available for hardware acceleration.
+
+    Returns:
+    --------
+    bool
+        True if NVIDIA GPU is available, False otherwise.
+    """
+    return _capabilities()["cuda_devices"] > 0
+
+def has_intel_gpu():
+    """
+    Detect if Intel GPU with QuickSync support is available.
+
+    Returns:
+    --------
+    bool
+        True if Intel GPU with QuickSync is available, False otherwise.
+    """
+    return bool(_capabilities()["qsv"])
+
+def has_codec(name, encoder=True):
+    """
+    Whether the linked FFmpeg resolves the encoder (or decoder) name.
+    Always True when that is unknown (no C extension).
+    """
+    names = _capabilities()["encoders" if encoder else "decoders"]
+    return names is None or name in names
 
 def detect_available_gpus():
     """
@@ -62,27 +114,8 @@ def detect_available_gpus():
     dict
         Dictionary with "nvidia" and "intel" keys containing GPU counts
     """
-    gpu_info = {"nvidia": 0, "intel": 0}
-    
-    # Check NVIDIA GPUs
-    try:
-        result = subprocess.run(
-            ["nvidia-smi", "--list-gpus"], 
-            stdout=subprocess.PIPE, 
-            stderr=subprocess.PIPE, 
-            timeout=2
-        )
-        if result.returncode == 0:
-            gpu_lines = [line for line in result.stdout.decode().strip().split("\n") if line.strip()]
-            gpu_info["nvidia"] = len(gpu_lines)
-    except (subprocess.SubprocessError, FileNotFoundError):
-        pass
-    
-    # Check Intel GPUs
-    if has_intel_gpu():
-        gpu_info["intel"] = 1
-    
-    return gpu_info
+    caps = _capabilities()
+    return {"nvidia": caps["cuda_devices"], "intel": 1 if caps["qsv"] else 0}
 
 def validate_and_adjust_gpu_id(codec, requested_gpu_id):
     """
@@ -123,4 +156,78 @@ def validate_and_adjust_gpu_id(codec, requested_gpu_id):
         # Intel QSV typically uses GPU 0
         return 0
     
-    return requested_gpu_id
\ No newline at end of file
+    return requested_gpu_id
+
+
+_SCHEDULE_POLICIES = {"round_robin": 0, "least_loaded": 1}
+
+
+def _native_scheduler():
+    try:
+        from ._ffmpeg_filter import gpu_schedule, gpu_stats
+    except ImportError:
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+    return gpu_schedule, gpu_stats
+
+
+def configure_gpu_scheduler(gpus=None, policy="round_robin", max_sessions=0, cpu_fallback=True):
+    """
+    Spread NVENC encoding and CUVID decoding over several GPUs.
+
+    Every chunk, written through the filter or the parallel pipeline, is
+    placed on one of the GPUs instead of the gpu_id stored with the
+    dataset. This applies process wide until changed.
+
+    Parameters:
+    -----------
+    gpus : list of int, optional
+        GPUs to use (default: every NVIDIA GPU from detect_available_gpus)
+    policy : str
+        "round_robin" or "least_loaded" (fewest chunks in flight)
+    max_sessions : int
+        Concurrent NVENC sessions per GPU, 0 for no cap. Consumer cards
+        limit the number of sessions per system.
+    cpu_fallback : bool
+        Encode with libx264/libx265/SVT-AV1 when every GPU is at
+        max_sessions, instead of waiting for a session to free up
+
+    Returns:
+    --------
+    list of int
+        The GPUs scheduled on, empty when no NVIDIA GPU was found
+    """
+    gpu_schedule, _ = _native_scheduler()
+
+    if policy not in _SCHEDULE_POLICIES:
+        raise ValueError(f"policy must be one of {sorted(_SCHEDULE_POLICIES)}")
+    if gpus is None:
+        gpus = list(range(detect_available_gpus()["nvidia"]))
+    gpus = [int(g) for g in gpus]
+
+    gpu_schedule(gpus, _SCHEDULE_POLICIES[policy], int(max_sessions), bool(cpu_fallback))
+    if not gpus:
+        logger.warning("No GPUs to schedule on, chunks keep their stored gpu_id.")
+    return gpus
+
+
+def disable_gpu_scheduler():
+    """Let chunks use the gpu_id stored with the dataset again"""
+    gpu_schedule, _ = _native_scheduler()
+    gpu_schedule([])
+
+
+def gpu_scheduler_stats():
+    """
+    State of the GPU schedule.
+
+    Returns:
+    --------
+    dict
+        "gpus": one dict per scheduled GPU with gpu_id, active_encoders,
+        active_decoders, sessions (open NVENC sessions, including idle
+        cached ones) and chunks; "cpu_fallbacks": chunks encoded on the CPU
+    """
+    _, gpu_stats = _native_scheduler()
+    return gpu_stats()
@@ -0,0 +1,272 @@
+"""
+Parallel whole-dataset access for FFMPEG compressed HDF5 datasets.
+
+HDF5 runs the filter chunk by chunk on the calling thread. These helpers
+encode/decode chunks concurrently on the native worker pool and move the
+compressed bytes with h5py's direct chunk I/O, so the files stay ordinary
+filter 32030 datasets that any reader can open.
+
+The C library offers the same through ffmpeg_h5_write_dataset_parallel /
+ffmpeg_h5_read_dataset_parallel for callers that own the HDF5 handles.
+"""
+
+import itertools
+
+import numpy as np
+
+from .constants import FFMPEG_ID
+from .ffmpeg_filter import modify_compression_opts
+from .pyramid import iter_levels, pyramid_levels
+
+try:
+    from ._ffmpeg_filter import (
+        compress_many as _compress_many_c,
+        decompress_many as _decompress_many_c,
+        default_threads as _default_threads_c,
+        decode_frames as _decode_frames_c,
+    )
+
+    _PARALLEL_AVAILABLE = True
+except ImportError:
+    _PARALLEL_AVAILABLE = False
+
+# chunks in flight per worker thread
+CHUNKS_PER_THREAD = 2
+
+
+def _require_native():
+    if not _PARALLEL_AVAILABLE:
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+
+def _filter_cd_values(dset):
+    """Stored ffmpeg filter parameters of dset, which must use only that filter"""
+    plist = dset.id.get_create_plist()
+    if dset.chunks is None or plist.get_nfilters() != 1:
+        raise ValueError("Dataset must be chunked with the ffmpeg filter as only filter")
+
+    code, _flags, cd_values, _name = plist.get_filter(0)
+    if code != FFMPEG_ID:
+        raise ValueError("Dataset is not compressed with the ffmpeg filter")
+
+    # norm/beta quantization is applied by the patched __setitem__/__getitem__
+    if "bit" in dset.attrs and (
+        dset.attrs.get("norm", False) or dset.attrs.get("beta", 1.0) != 1.0
+    ):
+        raise ValueError(
+            "Quantized datasets (norm/beta) are not supported, use dset[...] instead"
+        )
+
+    return tuple(int(v) for v in cd_values)
+
+
+def _chunk_offsets(shape, chunks):
+    return itertools.product(*(range(0, n, c) for n, c in zip(shape, chunks)))
+
+
+def _chunk_slices(offset, shape, chunks):
+    return tuple(
+        slice(o, min(o + c, n)) for o, c, n in zip(offset, chunks, shape)
+    )
+
+
+def _batches(offsets, threads):
+    size = max(1, (threads or _default_threads_c()) * CHUNKS_PER_THREAD)
+    offsets = iter(offsets)
+    while True:
+        batch = list(itertools.islice(offsets, size))
+        if not batch:
+            return
+        yield batch
+
+
+def write_dataset_parallel(dset, data, threads=None):
+    """
+    Write a whole ffmpeg compressed dataset, encoding its chunks in parallel.
+
+    Parameters:
+    -----------
+    dset : h5py.Dataset
+        Chunked dataset created with the ffmpeg filter
+    data : numpy.ndarray
+        Array with the shape of the dataset
+    threads : int, optional
+        Worker threads (default: one per core)
+
+    Datasets created with pyramid=N also get their pyramid levels written,
+    downsampled from data.
+    """
+    _require_native()
+    data = np.ascontiguousarray(data, dtype=dset.dtype)
+    if data.shape != dset.shape:
+        raise ValueError(f"data has shape {data.shape}, dataset has {dset.shape}")
+
+    _write_chunks(dset, data, threads)
+
+    levels = int(dset.attrs.get("pyramid_levels", 0))
+    if levels:
+        mode = str(dset.attrs.get("pyramid_mode", "mean"))
+        z = bool(dset.attrs.get("pyramid_z", False))
+        for (_level, level_data), level_dset in zip(
+            iter_levels(data, levels, mode, z, threads or 0), pyramid_levels(dset)[1:]
+        ):
+            _write_chunks(level_dset, level_data, threads)
+
+
+def _write_chunks(dset, data, threads):
+    """Encode data (the shape of dset) chunk by chunk on the worker pool"""
+    cd_values = _filter_cd_values(dset)
+    shape, chunks = dset.shape, dset.chunks
+    for batch in _batches(_chunk_offsets(shape, chunks), threads):
+        raw_chunks = []
+        for offset in batch:
+            region = data[_chunk_slices(offset, shape, chunks)]
+            if region.shape != chunks:
+                # edge chunks are padded with zeros, like HDF5 does for the filter
+                padded = np.zeros(chunks, dtype=data.dtype)
+                padded[tuple(slice(0, n) for n in region.shape)] = region
+                region = padded
+            raw_chunks.append(region)
+
+        blobs = _compress_many_c(
+            [cd_values] * len(raw_chunks), raw_chunks, threads or 0, raw=True
+        )
+
+        # HDF5 is only called from this thread
+        for offset, blob in zip(batch, blobs):
+            dset.id.write_direct_chunk(offset, blob, filter_mask=0)
+
+
+def read_dataset_parallel(dset, threads=None, out=None):
+    """
+    Read a whole ffmpeg compressed dataset, decoding its chunks in parallel.
+
+    Parameters:
+    -----------
+    dset : h5py.Dataset
+        Chunked dataset created with the ffmpeg filter
+    threads : int, optional
+        Worker threads (default: one per core)
+    out : numpy.ndarray, optional
+        C-contiguous array with the shape and dtype of the dataset
+
+    Returns:
+    --------
+    numpy.ndarray
+        The dataset contents
+    """
+    _require_native()
+    cd_values = modify_compression_opts(_filter_cd_values(dset))
+
+    shape, chunks = dset.shape, dset.chunks
+    if out is None:
+        out = np.empty(shape, dtype=dset.dtype)
+    elif out.shape != shape or out.dtype != dset.dtype:
+        raise ValueError(f"out must be a {dset.dtype} array of shape {shape}")
+
+    _read_chunks(dset, cd_values, _chunk_offsets(shape, chunks), out, threads)
+    return out
+
+
+def _read_chunks(dset, cd_values, offsets, out, threads, origin=None):
+    """Decode the chunks at offsets on the worker pool into out, which holds
+    the region of dset starting at origin (default: the whole dataset)"""
+    shape, chunks = dset.shape, dset.chunks
+    origin = origin or (0,) * len(shape)
+    fill = dset.fillvalue
+    for batch in _batches(offsets, threads):
+        encoded, targets = [], []
+        for offset in batch:
+            region = _chunk_slices(offset, shape, chunks)
+            target = tuple(slice(s.start - o, s.stop - o) for s, o in zip(region, origin))
+            try:
+                filter_mask, blob = dset.id.read_direct_chunk(offset)
+            except (KeyError, OSError, RuntimeError):
+                # chunk was never written
+                out[target] = fill
+                continue
+
+            if filter_mask & 1:
+                # stored without the (optional) filter
+                chunk = np.frombuffer(blob, dtype=dset.dtype).reshape(chunks)
+                out[target] = chunk[tuple(slice(0, s.stop - s.start) for s in target)]
+                continue
+
+            encoded.append(blob)
+            targets.append(target)
+
+        decoded = _decompress_many_c(
+            [cd_values] * len(encoded), encoded, threads or 0, raw=True
+        )
+
+        for target, chunk in zip(targets, decoded):
+            chunk = chunk.view(dset.dtype).reshape(chunks)
+            out[target] = chunk[tuple(slice(0, s.stop - s.start) for s in target)]
+
+
+def read_frames(dset, start, stop=None):
+    """
+    Read z-slices [start, stop) of a 3D ffmpeg compressed dataset.
+
+    Only the chunks covering the range are fetched, and each of them is
+    decoded from the nearest keyframe preceding the range when it was
+    written with gop_size > 0 or an intra only codec (ffv1,
+    libx264_lossless; otherwise from its first frame).
+
+    Parameters:
+    -----------
+    dset : h5py.Dataset
+        3D (z, y, x) chunked dataset created with the ffmpeg filter
+    start : int
+        First slice
+    stop : int, optional
+        End of the range (default: start + 1)
+
+    Returns:
+    --------
+    numpy.ndarray
+        Array of shape (stop - start, y, x)
+    """
+    _require_native()
+    cd_values = modify_compression_opts(_filter_cd_values(dset))
+
+    if len(dset.shape) != 3:
+        raise ValueError("read_frames needs a 3D (z, y, x) dataset")
+
+    stop = start + 1 if stop is None else stop
+    depth, height, width = dset.shape
+    if not 0 <= start < stop <= depth:
+        raise ValueError(f"invalid frame range [{start}, {stop}) for depth {depth}")
+
+    chunks = dset.chunks
+    out = np.empty((stop - start, height, width), dtype=dset.dtype)
+    z0 = start - start % chunks[0]
+
+    for offset in itertools.product(
+        range(z0, stop, chunks[0]), range(0, height, chunks[1]), range(0, width, chunks[2])
+    ):
+        first = max(start, offset[0]) - offset[0]
+        last = min(stop, offset[0] + chunks[0]) - offset[0]
+        target = (
+            slice(offset[0] + first - start, offset[0] + last - start),
+            slice(offset[1], min(offset[1] + chunks[1], height)),
+            slice(offset[2], min(offset[2] + chunks[2], width)),
+        )
+        rows = target[1].stop - target[1].start
+        cols = target[2].stop - target[2].start
+
+        try:
+            filter_mask, blob = dset.id.read_direct_chunk(offset)
+        except (KeyError, OSError, RuntimeError):
+            out[target] = dset.fillvalue
+            continue
+
+        if filter_mask & 1:
+            chunk = np.frombuffer(blob, dtype=dset.dtype).reshape(chunks)[first:last]
+        else:
+            chunk = _decode_frames_c(cd_values, blob, first, last - first).view(dset.dtype)
+        out[target] = chunk[:, :rows, :cols]
+
+    return out
@@ -2,7 +2,11 @@ import h5py
 import numpy as np
 import math
 from collections.abc import Iterable
-from .ffmpeg_filter import modify_compression_opts
+from .ffmpeg_filter import quantize_intensity, NATIVE_AVAILABLE
+from .chunking import plan_chunks
+from .pyramid import PYRAMID_MODES, iter_levels, level_name, level_shapes
+from . import rdcc
+from .constants import BIT_DEPTH, BitMode, EncoderCodec
 
 FFMPEG_ID = 32030
 MAX_CHUNK_SIZE = 4 * 1024**3  # 4 GB
@@ -12,14 +16,34 @@ _original_dataset_getitem = h5py.Dataset.__getitem__
 _original_dataset_setitem = h5py.Dataset.__setitem__
 
 
-# Define new getitem method
-def _patched_getitem(self, key):
-    compression = self.attrs.get("compression", 0)
+def _quantize(data, dtype, out=None, offset=0.0, scale=1.0, power=1.0, post=1.0, add=0.0,
+              lo=-np.inf, hi=np.inf):
+    """clip(max((data - offset) * scale, 0) ** power * post + add, lo, hi) as dtype,
+    natively when the extension is built, with numpy otherwise"""
+    if NATIVE_AVAILABLE:
+        return quantize_intensity(data, dtype, offset, scale, power, post, add, lo, hi, out=out)
+
+    data = np.asarray(data, dtype=np.float32)
+    data = (data - np.float32(offset)) * np.float32(scale)
+    np.maximum(data, 0, out=data)
+    if power != 1.0:
+        np.power(data, np.float32(power), out=data)
+    data *= np.float32(post)
+    data += np.float32(add)
+    np.clip(data, lo, hi, out=data)
+    if np.dtype(dtype).kind == "u":
+        info = np.iinfo(dtype)
+        np.clip(data, info.min, info.max, out=data)
+    if out is not None:
+        out[...] = data
+        return out
+    return data.astype(dtype, copy=False)
 
-    if compression == FFMPEG_ID:
-        compression_opts = self.attrs.get("compression_opts", 0)
-        self.attrs.set("compression_opts", modify_compression_opts(compression_opts))
 
+# Define new getitem method
+def _patched_getitem(self, key):
+    # GPU decoders missing on this machine are replaced by the filter
+    # itself, reads never write attributes
     data = _original_dataset_getitem(self, key)
 
     # Check if this dataset should be quantized
@@ -36,24 +60,22 @@ def _patched_getitem(self, key):
 
     bit = self.attrs.get("bit", 8)
     max_bitType_val = (1 << bit) - 1
-    max_val = self.attrs.get("init_max_intensity", max_bitType_val)
-    min_val = self.attrs.get("init_min_intensity", 0)
+    max_val = float(self.attrs.get("init_max_intensity", max_bitType_val))
+    min_val = float(self.attrs.get("init_min_intensity", 0))
 
-    data = data.astype(np.float32, copy=False)
+    params = {"lo": min_val, "hi": max_val}
+    if beta != 1.0 and beta > 0:
+        params["power"] = 1 / beta
     if norm:
-        if beta != 1.0 and beta > 0:
-            np.power(data / max_bitType_val, 1 / beta, out=data)
-            data *= max_val - min_val
-            data += min_val
-        else:
-            data = data / max_bitType_val * (max_val - min_val) + min_val
-    elif beta != 1.0 and beta > 0:
-        np.power(data, 1 / beta, out=data)
-        np.clip(data + min_val, min_val, max_val, out=data)
-    else:
-        np.clip(data, min_val, max_val, out=data)
+        params.update(scale=1 / max_bitType_val, post=max_val - min_val, add=min_val)
+    elif "power" in params:
+        params["add"] = min_val
 
-    return data.astype(dtype, copy=False)
+    shape = np.shape(data)
+    data = np.ascontiguousarray(data).reshape(-1)
+    # the read buffer is ours, transform it in place when the type allows
+    out = data if data.dtype == np.dtype(dtype) else None
+    return _quantize(data, dtype, out=out, **params).reshape(shape)[()]
 
 
 # Define new setitem method
@@ -70,37 +92,28 @@ def _patched_setitem(self, key, value):
         _original_dataset_setitem(self, key, value)
         return
 
+    value = np.asarray(value)
     if value.dtype == np.float32:
         dtype = np.uint8
-    else:
+    elif value.dtype in (np.uint8, np.uint16):
         dtype = value.dtype
+    else:
+        dtype = np.float32
 
-    data = np.asarray(value, dtype=np.float32)
     bit = self.attrs.get("bit", 8)
     max_bitType_val = (1 << bit) - 1
 
-    # Fix: Safe handling of dtype for np.iinfo
-    try:
-        default_max = np.iinfo(dtype).max if dtype in [np.uint8, np.uint16] else 255
-    except:
-        default_max = 255
-    max_val = self.attrs.get("init_max_intensity", default_max)
-    min_val = self.attrs.get("init_min_intensity", 0)
+    default_max = np.iinfo(dtype).max if dtype != np.float32 else 255
+    max_val = float(self.attrs.get("init_max_intensity", default_max))
+    min_val = float(self.attrs.get("init_min_intensity", 0))
 
+    params = {"lo": 0.0, "hi": float(max_bitType_val)}
+    if beta != 1.0 and beta > 0:
+        params.update(offset=min_val, power=beta)
     if norm:
-        data -= min_val
-        data /= max_val - min_val
-        if beta != 1.0 and beta > 0:
-            np.power(data, beta, out=data)
-        data *= max_bitType_val
-    elif beta != 1.0 and beta > 0:
-        data -= min_val  # Fix: Subtract min_val before power scaling
-        np.power(data, beta, out=data)
-        np.clip(data, 0, max_bitType_val, out=data)
-    else:
-        np.clip(data, 0, max_bitType_val, out=data)
+        params.update(offset=min_val, scale=1 / (max_val - min_val), post=max_bitType_val)
 
-    _original_dataset_setitem(self, key, data.astype(dtype, copy=False))
+    _original_dataset_setitem(self, key, _quantize(value, dtype, **params))
 
 
 # Apply the patches
@@ -111,34 +124,83 @@ h5py.Dataset.__setitem__ = _patched_setitem
 _original_group_create_dataset = h5py.Group.create_dataset
 
 
+def _create_pyramid(group, name, dset, data, dtype, kwargs, levels, mode, z):
+    """Create the pyramid levels of dset as siblings with the same filter
+    options, written from data when it is given; chunks are those of dset
+    clipped to each level"""
+    shapes = level_shapes(dset.shape, levels, z)
+    data_levels = iter_levels(data, len(shapes), mode, z) if data is not None else None
+
+    for level, level_shape in enumerate(shapes, start=1):
+        level_data = next(data_levels)[1] if data_levels is not None else None
+        level_kwargs = dict(
+            kwargs, chunks=tuple(min(c, n) for c, n in zip(dset.chunks, level_shape))
+        )
+        _patched_create_dataset(
+            group,
+            level_name(name, level),
+            level_shape if level_data is None else None,
+            dtype,
+            level_data,
+            **level_kwargs,
+        )
+
+    dset.attrs["pyramid_levels"] = len(shapes)
+    dset.attrs["pyramid_mode"] = mode
+    dset.attrs["pyramid_z"] = bool(z)
+
+
 def _patched_create_dataset(self, name, shape=None, dtype=None, data=None, **kwargs):
     compression = kwargs.get("compression", 0)
 
     if compression == FFMPEG_ID:
+        pyramid = kwargs.pop("pyramid", 0)
+        pyramid_mode = kwargs.pop("pyramid_mode", "mean")
+        pyramid_z = kwargs.pop("pyramid_z", False)
+        if pyramid_mode not in PYRAMID_MODES:
+            raise ValueError(f"Invalid pyramid_mode '{pyramid_mode}', use 'mean' or 'max'")
+        # levels are created with the caller's options and the unquantized frames
+        level_kwargs = dict(kwargs)
+        source, source_dtype = data, dtype
+
         norm = kwargs.pop("norm", False)
         beta = kwargs.pop("beta", 1.0)
+        chunk_access = kwargs.pop("chunk_access", "volume")
+        chunk_latency = kwargs.pop("chunk_latency", 0.1)
         compression_opts = list(kwargs.get("compression_opts", ()))
-        bit = {0: 8, 1: 10, 2: 12}.get(
-            compression_opts[5] if len(compression_opts) > 5 else 0, 8
-        )
+        bit = BIT_DEPTH.get(compression_opts[5] if len(compression_opts) > 5 else 0, 8)
         use_quant = False
+        # uint16 is stored as it is in 16 bit mode, which FFV1 codes whole
+        raw16 = bool(compression_opts) and (
+            compression_opts[0] == EncoderCodec.FFV1 or bit == 16
+        )
 
         if data is not None:
             assert data.dtype in [np.uint8, np.uint16, np.float32]
-            use_quant = data.dtype != np.uint8
-            if not use_quant and len(compression_opts) > 5:
+            use_quant = data.dtype != np.uint8 and not (raw16 and data.dtype == np.uint16)
+            if data.dtype == np.uint8 and len(compression_opts) > 5:
                 compression_opts[5] = 0
                 bit = 8
+            elif not use_quant and len(compression_opts) > 5:
+                compression_opts[5] = BitMode.BIT_16
 
             kwargs["compression_opts"] = tuple(compression_opts)
 
         if dtype is not None:
             assert dtype in [np.uint8, np.uint16]
-            use_quant = dtype != np.uint8
+            use_quant = dtype != np.uint8 and not raw16
+            # one byte per sample, whatever bit mode the options default to
+            if dtype == np.uint8 and len(compression_opts) > 5:
+                compression_opts[5] = 0
+                bit = 8
+                kwargs["compression_opts"] = tuple(compression_opts)
+            elif raw16 and dtype == np.uint16 and len(compression_opts) > 5:
+                compression_opts[5] = BitMode.BIT_16
+                kwargs["compression_opts"] = tuple(compression_opts)
 
         user_chunks = kwargs.get("chunks", None)
 
-        if user_chunks is None or user_chunks is True:
+        if user_chunks is None or user_chunks is True or user_chunks == "auto-ffmpeg":
             final_shape = shape or (np.shape(data) if data is not None else None)
             if final_shape is None:
                 raise RuntimeError(
@@ -153,7 +215,18 @@ def _patched_create_dataset(self, name, shape=None, dtype=None, data=None, **kwa
             element_size = final_dtype.itemsize
             full_size = math.prod(final_shape) * element_size
 
-            if full_size <= MAX_CHUNK_SIZE:
+            if user_chunks == "auto-ffmpeg":
+                # the codec sees the quantized samples
+                stored_dtype = (np.uint8 if bit == 8 else np.uint16) if use_quant else final_dtype
+                chunks = plan_chunks(
+                    final_shape,
+                    dtype=stored_dtype,
+                    codec=compression_opts[0] if compression_opts else "libx264",
+                    access=chunk_access,
+                    target_latency=chunk_latency,
+                    gop_size=compression_opts[13] if len(compression_opts) > 13 else 0,
+                )
+            elif full_size <= MAX_CHUNK_SIZE:
                 chunks = final_shape
             else:
                 scale = (MAX_CHUNK_SIZE / full_size) ** (1 / len(final_shape))
@@ -168,7 +241,7 @@ def _patched_create_dataset(self, name, shape=None, dtype=None, data=None, **kwa
 
         else:
             raise ValueError(
-                f"For FFMPEG compression, 'chunks' must be True, None, or a tuple, got {user_chunks}"
+                f"For FFMPEG compression, 'chunks' must be True, None, 'auto-ffmpeg', or a tuple, got {user_chunks}"
             )
 
         comp_opts = list(
@@ -186,37 +259,44 @@ def _patched_create_dataset(self, name, shape=None, dtype=None, data=None, **kwa
 
         if use_quant and data is not None:
             data_dtype = data.dtype
+            max_bit_val = (1 << bit) - 1
+            params = {"lo": 0.0, "hi": float(max_bit_val)}
             if data_dtype == np.uint16:
-                data = np.asarray(data, dtype=np.float32)
-                init_max = np.amax(data)
-                max_bit_val = (1 << bit) - 1
+                init_max = np.float32(np.amax(data))
 
                 if norm:
-                    data = data / init_max * max_bit_val
-                    data = np.power(data, beta)
+                    params.update(scale=max_bit_val / float(init_max), power=beta)
                 else:
                     beta = math.log(max_bit_val, init_max) - np.finfo(float).eps
-                    data = np.power(data, beta)
+                    params["power"] = beta
 
             elif data_dtype == np.float32:  # MRI/CT has negative values
                 init_min, init_max = np.amin(data), np.amax(data)
-                max_bit_val = (1 << bit) - 1
 
                 if norm:
-                    data = (data - init_min) / (init_max - init_min) * max_bit_val
-                    data = np.power(data, beta)
+                    params.update(
+                        offset=float(init_min),
+                        scale=max_bit_val / float(init_max - init_min),
+                        power=beta,
+                    )
                 else:
                     beta = (
                         math.log(max_bit_val, init_max - init_min) - np.finfo(float).eps
                     )
-                    data = np.power(data - init_min, beta)
+                    params.update(offset=float(init_min), power=beta)
 
-            if bit == 8:
-                data = data.astype(np.uint8, copy=False)
-                dtype = np.uint8
-            else:
-                data = data.astype(np.uint16, copy=False)
-                dtype = np.uint16
+            dtype = np.uint8 if bit == 8 else np.uint16
+            data = _quantize(data, dtype, **params)
+
+        # size HDF5's chunk cache, partial writes re-encode uncached chunks
+        stored_shape = shape or np.shape(data)
+        if dtype is not None:
+            stored_dtype = np.dtype(dtype)
+        else:
+            stored_dtype = np.asarray(data).dtype if data is not None else np.dtype("f4")
+        access = "tile" if chunk_access == "tile" else "slice"
+        for key, value in rdcc.create_kwargs(stored_shape, chunks, stored_dtype, access).items():
+            kwargs.setdefault(key, value)
 
         # Create dataset and add attributes
         dset = _original_group_create_dataset(self, name, shape, dtype, data, **kwargs)
@@ -237,6 +317,11 @@ def _patched_create_dataset(self, name, shape=None, dtype=None, data=None, **kwa
             dtype_map = {"uint8": 0, "uint16": 1, "float32": 2}
             dset.attrs["data_type"] = dtype_map.get(str(data_dtype), 0)
 
+        if pyramid:
+            _create_pyramid(
+                self, name, dset, source, source_dtype, level_kwargs, pyramid, pyramid_mode, pyramid_z
+            )
+
         return dset
     else:
         return _original_group_create_dataset(self, name, shape, dtype, data, **kwargs)
@@ -245,5 +330,19 @@ def _patched_create_dataset(self, name, shape=None, dtype=None, data=None, **kwa
 h5py.Group.create_dataset = _patched_create_dataset
 
 
+_original_group_getitem = h5py.Group.__getitem__
+
+
+def _patched_group_getitem(self, name):
+    obj = _original_group_getitem(self, name)
+    if isinstance(obj, h5py.Dataset):
+        # ffmpeg datasets come back with a chunk cache their chunks fit in
+        return rdcc.tune(self, name, obj)
+    return obj
+
+
+h5py.Group.__getitem__ = _patched_group_getitem
+
+
 def dummy():
     pass
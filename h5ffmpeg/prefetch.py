@@ -0,0 +1,228 @@
+"""
+Read-ahead for loops over the z-slices of ffmpeg compressed datasets.
+
+`for z in range(n): dset[z]` decodes the chunk holding z on the caller's
+thread, and HDF5's chunk cache rarely holds a chunk of video frames until
+the next slice asks for it, so every chunk is decoded once per slice it
+holds. prefetch(dset) wraps the dataset: reads along the first axis are
+served from whole decoded chunk rows ("slabs", chunks[0] slices deep), and
+once two reads show a sequential or strided pattern the slabs ahead of it
+are decoded on background threads, in native code with the GIL released,
+while the caller works on the current one. At most depth + 1 slabs are
+buffered.
+
+    with hf.prefetch(f["data"]) as data:
+        for z in range(data.shape[0]):
+            process(data[z])
+
+iter_slices(dset, start, stop, step) does the same for a known range.
+"""
+
+import collections
+import threading
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from .parallel import _PARALLEL_AVAILABLE, _chunk_offsets, _filter_cd_values, _read_chunks
+from .ffmpeg_filter import modify_compression_opts
+
+# slabs decoded ahead of the current one
+PREFETCH_DEPTH = 2
+
+
+class PrefetchedDataset:
+    """
+    Read-only view of an h5py dataset with read-ahead along its first axis.
+
+    Parameters:
+    -----------
+    dset : h5py.Dataset
+        Chunked dataset (ffmpeg compressed or not)
+    depth : int
+        Slabs decoded ahead of the current one, and decoded concurrently
+    threads : int, optional
+        Worker threads of each slab decode (default: one per core)
+
+    Other attributes (attrs, name, file, ...) are those of dset. Keys that
+    are not an index or slice of the first axis (optionally followed by
+    indices of the others) are read from dset directly.
+    """
+
+    def __init__(self, dset, depth=PREFETCH_DEPTH, threads=None):
+        if dset.chunks is None or not dset.shape:
+            raise ValueError("prefetch needs a chunked dataset")
+        self.dset = dset
+        self.depth = max(1, int(depth))
+        self.threads = threads
+        self.slab_depth = dset.chunks[0]
+        self.n_slabs = -(-dset.shape[0] // self.slab_depth)
+
+        # quantized (norm/beta) and non-ffmpeg datasets decode through dset[...]
+        try:
+            self._cd_values = _PARALLEL_AVAILABLE and modify_compression_opts(_filter_cd_values(dset))
+        except ValueError:
+            self._cd_values = None
+
+        self._lock = threading.Lock()
+        self._slabs = collections.OrderedDict()  # slab -> Future, least recent first
+        self._executor = ThreadPoolExecutor(self.depth, thread_name_prefix="h5ffmpeg-prefetch")
+        self._last = None
+        self._stride = None
+        self.decoded = 0
+        self.hits = 0
+
+    def __getattr__(self, name):
+        return getattr(self.dset, name)
+
+    def __len__(self):
+        return self.dset.shape[0]
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        self.close()
+
+    def close(self):
+        """Stop the background decodes and drop the buffered slabs"""
+        self._executor.shutdown(wait=True, cancel_futures=True)
+        with self._lock:
+            self._slabs.clear()
+
+    def _decode(self, slab):
+        z0 = slab * self.slab_depth
+        z1 = min(z0 + self.slab_depth, self.dset.shape[0])
+        if not self._cd_values:
+            return self.dset[z0:z1]
+
+        shape = (z1 - z0,) + self.dset.shape[1:]
+        out = np.empty(shape, dtype=self.dset.dtype)
+        offsets = ((z0,) + rest for rest in _chunk_offsets(shape[1:], self.dset.chunks[1:]))
+        _read_chunks(self.dset, self._cd_values, offsets, out, self.threads, (z0,) + (0,) * (len(shape) - 1))
+        return out
+
+    def _submit(self, slab):
+        """Future of slab, queued for decoding unless buffered (lock held)"""
+        future = self._slabs.get(slab)
+        if future is None:
+            future = self._executor.submit(self._decode, slab)
+            self._slabs[slab] = future
+            self.decoded += 1
+        else:
+            self._slabs.move_to_end(slab)
+        return future
+
+    def _evict(self, keep):
+        """Drop least recently used slabs beyond depth + 1 (lock held)"""
+        for slab in list(self._slabs):
+            if len(self._slabs) <= self.depth + 1:
+                break
+            if slab not in keep:
+                self._slabs.pop(slab).cancel()
+
+    def _slab(self, slab, ahead=()):
+        with self._lock:
+            if slab in self._slabs:
+                self.hits += 1
+            future = self._submit(slab)
+            for s in ahead:
+                self._submit(s)
+            self._evict({slab, *ahead})
+        # waited for outside the lock, the decodes run meanwhile
+        return future.result()
+
+    def _ahead(self, z):
+        """Slabs the access pattern reaches next after slice z"""
+        stride = None if self._last is None else z - self._last
+        pattern = stride is not None and stride != 0 and stride == self._stride
+        self._last, self._stride = z, stride
+        if not pattern:
+            return []
+
+        current, ahead = z // self.slab_depth, []
+        while len(ahead) < self.depth:
+            z += stride
+            if not 0 <= z < self.dset.shape[0]:
+                break
+            slab = z // self.slab_depth
+            if slab != current and slab not in ahead:
+                ahead.append(slab)
+        return ahead
+
+    def read(self, start, stop, step=1, ahead=None):
+        """Slices start:stop:step (step > 0) of the first axis"""
+        slabs = range(start // self.slab_depth, (stop - 1) // self.slab_depth + 1)
+        if ahead is None:
+            ahead = self._ahead(start)
+        parts = []
+        for slab in slabs:
+            z0 = slab * self.slab_depth
+            first = max(start, z0)
+            # keep the step aligned across slab boundaries
+            first += (start - first) % step
+            data = self._slab(slab, ahead if slab == slabs[-1] else ())
+            if first < min(stop, z0 + self.slab_depth):
+                parts.append(data[first - z0:stop - z0:step])
+        if len(parts) == 1:
+            return parts[0]
+        return np.concatenate(parts) if parts else np.empty((0,) + self.dset.shape[1:], self.dset.dtype)
+
+    def __getitem__(self, key):
+        head, rest = (key[0], key[1:]) if isinstance(key, tuple) and key else (key, ())
+        n = self.dset.shape[0]
+
+        if isinstance(head, (int, np.integer)) and not isinstance(head, bool):
+            z = int(head) + n if head < 0 else int(head)
+            if not 0 <= z < n:
+                raise IndexError(f"index {head} is out of range for axis 0 with size {n}")
+            data = self.read(z, z + 1)[0]
+        elif isinstance(head, slice) and (head.step or 1) > 0:
+            start, stop, step = head.indices(n)
+            if start >= stop:
+                return self.dset[key]
+            data = self.read(start, stop, step)
+        else:
+            return self.dset[key]
+
+        # copy so the caller never holds a view of a buffered slab
+        return np.array(data[rest] if rest else data)
+
+    def __iter__(self):
+        return iter_slices(self)
+
+    def stats(self):
+        """{'decoded': slabs decoded, 'hits': reads served from the buffer}"""
+        return {"decoded": self.decoded, "hits": self.hits}
+
+
+def prefetch(dset, depth=PREFETCH_DEPTH, threads=None):
+    """PrefetchedDataset of dset, see PrefetchedDataset"""
+    return PrefetchedDataset(dset, depth, threads)
+
+
+def iter_slices(dset, start=0, stop=None, step=1, depth=PREFETCH_DEPTH, threads=None):
+    """
+    Yield the slices start, start + step, ... < stop of the first axis of dset,
+    decoding the slabs ahead on background threads. dset may be a dataset or
+    a PrefetchedDataset (which is then left open).
+    """
+    if step <= 0:
+        raise ValueError("step must be positive")
+    owned = not isinstance(dset, PrefetchedDataset)
+    reader = PrefetchedDataset(dset, depth, threads) if owned else dset
+    stop = reader.dset.shape[0] if stop is None else min(stop, reader.dset.shape[0])
+
+    try:
+        slab_depth = reader.slab_depth
+        for z in range(start, stop, step):
+            # the whole range is known, no need to detect the pattern
+            ahead = sorted({
+                (z + k * step) // slab_depth
+                for k in range(1, reader.depth * max(1, slab_depth // step) + 1)
+                if z + k * step < stop
+            } - {z // slab_depth})[:reader.depth]
+            yield np.array(reader.read(z, z + 1, ahead=ahead)[0])
+    finally:
+        if owned:
+            reader.close()
@@ -0,0 +1,119 @@
+"""
+Multi-resolution pyramids written next to ffmpeg compressed datasets.
+
+Viewers want overviews of TB-scale volumes without decoding the full
+resolution. With pyramid=N, create_dataset (and write_dataset_parallel for
+datasets created from a shape) also writes levels 1..N of the frames it
+already has in memory: level l halves Y and X of level l - 1 (and Z with
+pyramid_z=True) by block mean or max and is stored as the sibling dataset
+"<name>_<2**l>x" with the same filter 32030 options. The base dataset
+records the levels in its pyramid_levels / pyramid_mode / pyramid_z
+attributes, so any reader can find them.
+"""
+
+import numpy as np
+
+try:
+    from ._ffmpeg_filter import downsample as _downsample_c
+
+    _DOWNSAMPLE_AVAILABLE = True
+except ImportError:
+    _DOWNSAMPLE_AVAILABLE = False
+
+# levels stop before Y or X drops below this, smaller frames are not worth
+# a dataset and some encoders refuse them
+PYRAMID_MIN_SIZE = 32
+
+PYRAMID_MODES = {"mean": 0, "max": 1}
+
+
+def level_name(name, level):
+    """Name of the sibling dataset holding pyramid level (1 = 2x)"""
+    return f"{name}_{2 ** level}x"
+
+
+def level_shapes(shape, levels, z=False):
+    """Shapes of pyramid levels 1..levels of shape (..., Y, X), fewer when
+    frames would get smaller than PYRAMID_MIN_SIZE; levels=True builds as
+    many as fit"""
+    if levels is True:
+        levels = 64
+    shapes = []
+    shape = tuple(shape)
+    for _ in range(int(levels or 0)):
+        if min(shape[-2:]) < 2 * PYRAMID_MIN_SIZE:
+            break
+        lead = shape[:-2]
+        if z and lead:
+            lead = lead[:-1] + ((lead[-1] + 1) // 2,)
+        shape = lead + ((shape[-2] + 1) // 2, (shape[-1] + 1) // 2)
+        shapes.append(shape)
+    return shapes
+
+
+def _downsample_numpy(data, mode, z):
+    """Same as the native kernel: edge replicated 2x(2) blocks"""
+    axes = [data.ndim - 2, data.ndim - 1] + ([data.ndim - 3] if z else [])
+    pad = [(0, 0)] * data.ndim
+    for axis in axes:
+        pad[axis] = (0, data.shape[axis] % 2)
+    data = np.pad(data, pad, mode="edge")
+
+    shape = []
+    for axis, n in enumerate(data.shape):
+        shape += [n // 2, 2] if axis in axes else [n]
+    blocks = data.reshape(shape)
+    reduce_axes = tuple(a + i + 1 for i, a in enumerate(sorted(axes)))
+
+    if mode == "max":
+        return blocks.max(axis=reduce_axes)
+    if data.dtype.kind == "f":
+        return blocks.mean(axis=reduce_axes, dtype=np.float32).astype(data.dtype)
+    count = 2 ** len(axes)
+    total = blocks.sum(axis=reduce_axes, dtype=np.uint32)
+    return ((total + count // 2) // count).astype(data.dtype)
+
+
+def downsample(data, mode="mean", z=False, threads=0):
+    """
+    One pyramid level of data (..., Y, X): the rounded mean or the maximum
+    of each 2x2 block of a frame, or 2x2x2 block of two frames with z=True.
+    Odd edges replicate the last row, column or frame.
+
+    uint8, uint16 and float32 run in the native kernel, split over threads
+    worker threads (0: one per core).
+    """
+    if mode not in PYRAMID_MODES:
+        raise ValueError(f"Invalid pyramid mode '{mode}', use 'mean' or 'max'")
+    data = np.asarray(data)
+    if data.ndim < 2 or (z and data.ndim < 3):
+        raise ValueError("data must have (Z,) Y and X axes")
+
+    if not _DOWNSAMPLE_AVAILABLE or data.dtype not in (np.uint8, np.uint16, np.float32):
+        return _downsample_numpy(data, mode, z)
+
+    # the kernel takes (frames, Y, X); z only pairs frames of the last axis
+    lead = data.shape[:-2]
+    if z:
+        frames = data.reshape((-1,) + data.shape[-3:])
+        out = [_downsample_c(np.ascontiguousarray(v), PYRAMID_MODES[mode], True, threads)
+               for v in frames]
+        return np.stack(out).reshape(lead[:-1] + out[0].shape)
+    frames = np.ascontiguousarray(data).reshape((-1,) + data.shape[-2:])
+    out = _downsample_c(frames, PYRAMID_MODES[mode], False, threads)
+    return out.reshape(lead + out.shape[1:])
+
+
+def iter_levels(data, levels, mode="mean", z=False, threads=0):
+    """Yield (level, array) for pyramid levels 1.. of data, each from the last"""
+    for level, _shape in enumerate(level_shapes(np.shape(data), levels, z), start=1):
+        data = downsample(data, mode, z, threads)
+        yield level, data
+
+
+def pyramid_levels(dset):
+    """[dset, 2x level, 4x level, ...] of a dataset written with pyramid=N"""
+    parent = dset.parent
+    name = dset.name.rsplit("/", 1)[-1]
+    levels = int(dset.attrs.get("pyramid_levels", 0))
+    return [dset] + [parent[level_name(name, level)] for level in range(1, levels + 1)]
@@ -0,0 +1,106 @@
+"""
+HDF5 chunk cache sizing for ffmpeg compressed datasets.
+
+HDF5 caches decoded chunks per dataset, 1 MB by default, and bypasses the
+cache for larger chunks: every partial read (dset[z], dset[:, y0:y1]) of a
+video coded chunk then decodes the whole chunk again. Datasets with filter
+32030 opened through h5py (f["name"]) or created by create_dataset get a
+cache sized by ffmpeg_h5_chunk_cache_settings for their chunk shape, the
+memory available and an access hint, using the vocabulary of plan_chunks:
+
+    "slice"   planes of the first axis in order: one row of chunks
+    "tile"    partial reads anywhere: four rows of chunks
+    "volume"  whole chunks read once: a single chunk
+
+Caches that are already larger (h5py.File(..., rdcc_nbytes=...)) are kept.
+H5FFMPEG_RDCC=0 disables the sizing, H5FFMPEG_RDCC_MAX caps it; the
+settings applied are reported by stats()["hdf5_chunk_cache"].
+"""
+
+import h5py
+
+from .constants import FFMPEG_ID
+
+try:
+    from ._ffmpeg_filter import rdcc_settings as _rdcc_settings_c
+
+    _RDCC_AVAILABLE = True
+except ImportError:
+    _RDCC_AVAILABLE = False
+
+ACCESS_HINTS = {"slice": 0, "tile": 1, "volume": 2}
+
+_default_access = "slice"
+
+
+def set_default_access(access="slice"):
+    """Access hint used for datasets opened without one, returns the previous"""
+    global _default_access
+    if access not in ACCESS_HINTS:
+        raise ValueError(
+            f"Invalid access '{access}'. Valid access patterns: {', '.join(ACCESS_HINTS)}"
+        )
+    previous, _default_access = _default_access, access
+    return previous
+
+
+def chunk_cache_settings(shape, chunks, itemsize, access=None):
+    """
+    HDF5 chunk cache settings for a dataset.
+
+    Returns a dict with nslots, nbytes and w0 (the H5Pset_chunk_cache
+    arguments, also h5py's rdcc_nslots, rdcc_nbytes and rdcc_w0), or None
+    when the native extension is missing or sizing is disabled.
+    """
+    access = access or _default_access
+    if access not in ACCESS_HINTS:
+        raise ValueError(
+            f"Invalid access '{access}'. Valid access patterns: {', '.join(ACCESS_HINTS)}"
+        )
+    if not _RDCC_AVAILABLE or not shape or chunks is None:
+        return None
+    return _rdcc_settings_c(tuple(shape), tuple(chunks), int(itemsize), ACCESS_HINTS[access])
+
+
+def _uses_ffmpeg(dset):
+    if dset.chunks is None:
+        return False
+    plist = dset.id.get_create_plist()
+    return any(plist.get_filter(i)[0] == FFMPEG_ID for i in range(plist.get_nfilters()))
+
+
+def create_kwargs(shape, chunks, dtype, access=None):
+    """rdcc_* keywords of create_dataset for a new ffmpeg dataset, may be empty"""
+    settings = chunk_cache_settings(shape, chunks, dtype.itemsize, access)
+    if settings is None:
+        return {}
+    return {f"rdcc_{k}": v for k, v in settings.items()}
+
+
+def tune(group, name, dset, access=None):
+    """dset reopened from group[name] with a sized chunk cache when it is an
+    ffmpeg dataset whose cache is smaller, dset itself otherwise"""
+    if not isinstance(name, (str, bytes)) or not _uses_ffmpeg(dset):
+        return dset
+    settings = chunk_cache_settings(dset.shape, dset.chunks, dset.dtype.itemsize, access)
+    if settings is None:
+        return dset
+
+    dapl = dset.id.get_access_plist()
+    _nslots, nbytes, _w0 = dapl.get_chunk_cache()
+    if nbytes >= settings["nbytes"]:
+        return dset
+
+    # HDF5 only applies the cache when the dataset is opened with it
+    dapl.set_chunk_cache(settings["nslots"], settings["nbytes"], settings["w0"])
+    name = name.encode() if isinstance(name, str) else name
+    return h5py.Dataset(h5py.h5d.open(group.id, name, dapl=dapl))
+
+
+def open_dataset(group, name, access=None):
+    """group[name] with a chunk cache sized for access ("slice", "tile" or
+    "volume", default set_chunk_cache_access)"""
+    return tune(group, name, _original_group_getitem(group, name), access)
+
+
+_original_group_getitem = h5py.Group.__getitem__
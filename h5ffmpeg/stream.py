@@ -0,0 +1,444 @@
+"""
+Streaming compression and decompression for volumes larger than memory.
+
+compress_native and the filter encode a whole chunk at once, so the raw
+volume and its bitstream have to fit in memory together. A StreamEncoder
+keeps one native encoder open and is fed a few frames at a time, e.g.
+from a numpy.memmap or a camera; the compressed bytes are handed back as
+they come out of the codec. A StreamDecoder does the reverse, writing
+frames in place to a caller's buffer or handing them out one by one.
+"""
+
+import io
+import itertools
+import struct
+
+import numpy as np
+
+from .constants import (
+    BitMode, LAYOUT_SIZE, METADATA_FIELDS, METADATA_SIZE, get_current_header_version
+)
+from .ffmpeg_filter import encoder_cd_values
+from .parallel import _filter_cd_values
+
+try:
+    from ._ffmpeg_filter import (
+        encoder_open as _encoder_open_c,
+        encoder_push as _encoder_push_c,
+        encoder_finish as _encoder_finish_c,
+        encoder_close as _encoder_close_c,
+        decoder_open as _decoder_open_c,
+        decoder_push as _decoder_push_c,
+        decoder_finish as _decoder_finish_c,
+        decoder_close as _decoder_close_c,
+    )
+    from .ffmpeg_filter import _native_call_args, read_metadata_from_compressed
+
+    _STREAM_AVAILABLE = True
+except ImportError:
+    _STREAM_AVAILABLE = False
+
+# frames pushed to the native encoder per call
+FRAMES_PER_PUSH = 16
+# compressed bytes read per decoder push
+READ_BLOCK_SIZE = 1 << 20
+
+
+def _require_native():
+    if not _STREAM_AVAILABLE:
+        raise RuntimeError(
+            "Native functions not available - C extension not compiled with native support"
+        )
+
+
+def _frame_blocks(frames, block=FRAMES_PER_PUSH):
+    """Yield 3D blocks of frames from an array (memmap) or an iterable of 2D/3D arrays"""
+    if hasattr(frames, "ndim") and frames.ndim in (2, 3):
+        if frames.ndim == 2:
+            yield frames[np.newaxis]
+            return
+        for z in range(0, frames.shape[0], block):
+            yield frames[z:z + block]
+        return
+
+    for item in frames:
+        item = np.asarray(item)
+        yield item[np.newaxis] if item.ndim == 2 else item
+
+
+class StreamEncoder:
+    """
+    Encode a stream of (height, width) frames with a single codec context.
+
+    The options are those of compress_native. pull() returns the compressed
+    bytes produced so far; close() flushes the codec and returns the rest,
+    including the keyframe index when gop_size > 0. Concatenated, they are
+    the payload compress_native would produce for the same frames.
+    """
+
+    def __init__(self, width, height, bit_mode=BitMode.BIT_8, **kwargs):
+        # depth is unknown up front, the native encoder ignores it
+        self._open(encoder_cd_values(width, height, 0, bit_mode=bit_mode, **kwargs))
+
+    @classmethod
+    def from_cd_values(cls, cd_values):
+        """Encoder for stored filter parameters, e.g. those of a dataset"""
+        enc = cls.__new__(cls)
+        enc._open(tuple(int(v) for v in cd_values))
+        return enc
+
+    def _open(self, cd_values):
+        _require_native()
+        self.cd_values = cd_values
+        self.width, self.height = cd_values[2], cd_values[3]
+        self.bit_mode = cd_values[5]
+        self.dtype = np.uint8 if self.bit_mode == BitMode.BIT_8 else np.uint16
+        self.frames = 0
+        self._pending = []
+        self._handle = _encoder_open_c(cd_values)
+
+    def push(self, frames):
+        """Encode a (height, width) frame or a (n, height, width) block of frames"""
+        if self._handle is None:
+            raise ValueError("StreamEncoder is closed")
+
+        frames = np.ascontiguousarray(frames, dtype=self.dtype)
+        if frames.ndim == 2:
+            frames = frames[np.newaxis]
+        if frames.ndim != 3 or frames.shape[1:] != (self.height, self.width):
+            raise ValueError(
+                f"frames must have shape (n, {self.height}, {self.width}), got {frames.shape}"
+            )
+
+        out = _encoder_push_c(self._handle, frames)
+        self.frames += frames.shape[0]
+        if out:
+            self._pending.append(out)
+
+    def pull(self):
+        """Compressed bytes produced since the last pull()"""
+        data, self._pending = b"".join(self._pending), []
+        return data
+
+    def close(self):
+        """Flush the encoder and return the remaining compressed bytes"""
+        if self._handle is None:
+            return b""
+        try:
+            tail = _encoder_finish_c(self._handle)
+        finally:
+            _encoder_close_c(self._handle)
+            self._handle = None
+        self._pending.append(tail)
+        return self.pull()
+
+    def abort(self):
+        """Free the encoder without flushing it"""
+        if self._handle is not None:
+            _encoder_close_c(self._handle)
+            self._handle = None
+        self._pending = []
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        if exc_type is None:
+            self.close()
+        else:
+            self.abort()
+
+
+class StreamDecoder:
+    """
+    Decode a bitstream pushed in pieces, writing frames as they come out.
+
+    Frames go in place to out, any writable C-contiguous buffer of at
+    least depth frames (e.g. a numpy.memmap), and/or to callback(index,
+    frame) with frame a (height, width) array. cd_values are those of the
+    chunk, or of a compress_native result for its payload.
+    """
+
+    def __init__(self, cd_values, out=None, callback=None):
+        _require_native()
+        self.cd_values = tuple(int(v) for v in cd_values)
+        self.out = out
+        self.frames = 0
+        self._handle = _decoder_open_c(self.cd_values, out=out, callback=callback)
+
+    def push(self, data):
+        """Decode the next compressed bytes (any split of the bitstream)"""
+        if self._handle is None:
+            raise ValueError("StreamDecoder is closed")
+        self.frames = _decoder_push_c(self._handle, data)
+
+    def close(self):
+        """Flush the decoder, returns the number of frames decoded"""
+        if self._handle is None:
+            return self.frames
+        try:
+            self.frames = _decoder_finish_c(self._handle)
+        finally:
+            self.abort()
+        return self.frames
+
+    def abort(self):
+        """Free the decoder without flushing it"""
+        if self._handle is not None:
+            _decoder_close_c(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        if exc_type is None:
+            self.close()
+        else:
+            self.abort()
+
+
+def decompress_stream(source, out=None, callback=None, **kwargs):
+    """
+    Decode a compress_native result without holding a second copy of it.
+
+    Frames are written in place as the decoder produces them, so a volume
+    can be decoded straight into a memory mapped scratch file or a pinned
+    buffer, or consumed frame by frame.
+
+    Parameters:
+    -----------
+    source : str, binary file object or bytes-like
+        File written by compress_stream (or holding compress_native bytes),
+        read a block at a time, or the compressed bytes themselves
+    out : buffer, optional
+        Writable C-contiguous destination of depth x height x width
+        samples, e.g. numpy.memmap(..., mode="w+"); allocated when neither
+        out nor callback is given
+    callback : callable, optional
+        callback(index, frame) for every decoded (height, width) frame
+    **kwargs
+        Same options as decompress_native (e.g. gpu_id)
+
+    Returns:
+    --------
+    out (the allocated array when none was given), or the number of
+    decoded frames with only a callback
+    """
+    _require_native()
+    owned = isinstance(source, str) or hasattr(source, "__fspath__")
+    fh = open(source, "rb") if owned else source
+    blob = None if hasattr(fh, "read") else memoryview(fh).cast("B")
+
+    try:
+        if blob is None:
+            header = fh.read(8 + METADATA_SIZE)
+            # 12 bit streams carry their sample layout behind the metadata
+            extra = struct.unpack("I", header[:4])[0] - METADATA_SIZE if len(header) >= 4 else 0
+            if extra > 0:
+                header += fh.read(extra)
+        else:
+            size = struct.unpack("I", blob[:4])[0] if len(blob) >= 4 else METADATA_SIZE
+            header = blob[:8 + max(size, METADATA_SIZE)]
+        metadata = read_metadata_from_compressed(header)
+        cd_values, _, _ = _native_call_args(1, header, **kwargs)
+
+        if out is None and callback is None:
+            dtype = np.uint8 if metadata["bit_mode"] == BitMode.BIT_8 else np.uint16
+            out = np.empty((metadata["depth"], metadata["height"], metadata["width"]), dtype=dtype)
+
+        remaining = metadata["compressed_size"]
+        with StreamDecoder(cd_values, out=out, callback=callback) as dec:
+            if blob is not None:
+                dec.push(blob[metadata["data_offset"]:metadata["data_offset"] + remaining])
+                remaining = 0
+            while remaining:
+                data = fh.read(min(READ_BLOCK_SIZE, remaining))
+                if not data:
+                    raise ValueError("Compressed data is truncated")
+                dec.push(data)
+                remaining -= len(data)
+    finally:
+        if owned:
+            fh.close()
+
+    if out is None:
+        return dec.frames
+    if dec.frames < metadata["depth"]:
+        # fewer frames than stored, keep the tail defined like decompress_native
+        frame_bytes = metadata["width"] * metadata["height"] * (
+            1 if metadata["bit_mode"] == BitMode.BIT_8 else 2
+        )
+        view = memoryview(out).cast("B")
+        view[dec.frames * frame_bytes:metadata["depth"] * frame_bytes] = bytes(
+            (metadata["depth"] - dec.frames) * frame_bytes
+        )
+    return out
+
+
+def _native_header(cd_values, depth, compressed_size):
+    """Header of a compress_native result (see read_metadata_from_compressed)"""
+    stored = list(cd_values[:METADATA_FIELDS])
+    stored[4] = depth
+    layout = cd_values[16] if len(cd_values) > 16 else 0
+    return (
+        struct.pack("II", METADATA_SIZE + (LAYOUT_SIZE if layout else 0), get_current_header_version())
+        + struct.pack("I" * METADATA_FIELDS, *stored)
+        + struct.pack("Q", compressed_size)
+        + (struct.pack("I", layout) if layout else b"")
+    )
+
+
+def compress_stream(frames, file, bit_mode=BitMode.BIT_8, **kwargs):
+    """
+    Compress frames into a seekable file without holding the volume in memory.
+
+    The file receives the compressed bytes as they are produced and gets the
+    native header patched in at the end, so its contents can be passed to
+    decompress_native like the result of compress_native.
+
+    Parameters:
+    -----------
+    frames : numpy.ndarray or iterable
+        (depth, height, width) array, typically a numpy.memmap, or an
+        iterable of (height, width) frames or (n, height, width) blocks
+    file : str or binary file object
+        Destination, must be seekable
+    bit_mode : BitMode
+        Bit depth of the frames
+    **kwargs
+        Same codec options as compress_native
+
+    Returns:
+    --------
+    tuple of int
+        (depth, height, width) of the compressed volume
+    """
+    if isinstance(frames, np.ndarray) and frames.ndim == 3:
+        # a memmap needs nothing read to know its layout
+        blocks = _frame_blocks(frames)
+        first = None
+    else:
+        blocks = _frame_blocks(frames)
+        first = next(blocks, None)
+        if first is None:
+            raise ValueError("No frames to compress")
+        frames = first
+
+    height, width = frames.shape[-2:]
+    owned = isinstance(file, (str, bytes)) or hasattr(file, "__fspath__")
+    fh = open(file, "wb") if owned else file
+
+    try:
+        start = fh.tell()
+        with StreamEncoder(width, height, bit_mode=bit_mode, **kwargs) as enc:
+            fh.write(_native_header(enc.cd_values, 0, 0))
+            size = 0
+            for block in itertools.chain([first] if first is not None else [], blocks):
+                enc.push(block)
+                data = enc.pull()
+                fh.write(data)
+                size += len(data)
+            tail = enc.close()
+            fh.write(tail)
+            size += len(tail)
+
+        end = fh.tell()
+        fh.seek(start, io.SEEK_SET)
+        fh.write(_native_header(enc.cd_values, enc.frames, size))
+        fh.seek(end, io.SEEK_SET)
+    finally:
+        if owned:
+            fh.close()
+
+    return (enc.frames, height, width)
+
+
+def write_dataset_streaming(dset, frames, start=0):
+    """
+    Write z-slices of a 3D ffmpeg compressed dataset from a stream of frames.
+
+    One encoder is kept per chunk of the current z-row of chunks, and each
+    chunk is stored with direct chunk I/O as soon as its last frame was
+    pushed. Only one chunk row of compressed data is held in memory; the
+    files stay ordinary filter 32030 datasets.
+
+    Parameters:
+    -----------
+    dset : h5py.Dataset
+        3D (z, y, x) chunked dataset created with the ffmpeg filter
+    frames : numpy.ndarray or iterable
+        (z, y, x) array, typically a numpy.memmap, or an iterable of (y, x)
+        frames or (n, y, x) blocks
+    start : int
+        First slice to write, must be a multiple of the chunk depth
+
+    Returns:
+    --------
+    int
+        Number of frames written
+    """
+    _require_native()
+    cd_values = _filter_cd_values(dset)
+    if dset.ndim != 3:
+        raise ValueError("Streaming writes need a 3D (z, y, x) dataset")
+
+    depth, height, width = dset.shape
+    cz, cy, cx = dset.chunks
+    if start % cz:
+        raise ValueError(f"start must be a multiple of the chunk depth {cz}")
+
+    tiles = [(y, x) for y in range(0, height, cy) for x in range(0, width, cx)]
+    encoders = {}
+    z = start
+
+    def flush(z0):
+        # chunks are raw filter output: packets plus keyframe index, no header
+        for (y, x), enc in encoders.items():
+            dset.id.write_direct_chunk((z0, y, x), enc.close(), filter_mask=0)
+        encoders.clear()
+
+    def frames_for(tile, block):
+        y, x = tile
+        region = block[:, y:y + cy, x:x + cx]
+        if region.shape[1:] != (cy, cx):
+            # edge chunks are padded with zeros, like HDF5 does for the filter
+            padded = np.zeros((region.shape[0], cy, cx), dtype=dset.dtype)
+            padded[:, :region.shape[1], :region.shape[2]] = region
+            region = padded
+        return region
+
+    try:
+        for block in _frame_blocks(frames, cz):
+            block = np.asarray(block, dtype=dset.dtype)
+            if block.shape[1:] != (height, width):
+                raise ValueError(f"frames must have shape (n, {height}, {width})")
+
+            while block.shape[0]:
+                if z >= depth:
+                    raise ValueError(f"More frames than the {depth} slices of the dataset")
+                z0 = z - z % cz
+                take = min(block.shape[0], z0 + cz - z, depth - z)
+                if not encoders:
+                    for tile in tiles:
+                        encoders[tile] = StreamEncoder.from_cd_values(cd_values)
+                for tile, enc in encoders.items():
+                    enc.push(frames_for(tile, block[:take]))
+                block = block[take:]
+                z += take
+                if z % cz == 0:
+                    flush(z0)
+
+        if encoders:
+            # the last chunk row is padded with zero frames to the chunk depth
+            z0 = z - z % cz
+            pad = np.zeros((z0 + cz - z, cy, cx), dtype=dset.dtype)
+            for enc in encoders.values():
+                enc.push(pad)
+            flush(z0)
+    except BaseException:
+        for enc in encoders.values():
+            enc.abort()
+        raise
+
+    return z - start
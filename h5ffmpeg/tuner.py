@@ -0,0 +1,508 @@
+"""
+Encoder parameter tuning from a throughput or quality budget.
+
+tune_encoder(data, ...) samples chunk sized patches of a volume, probes
+(codec, preset, crf, threads) candidates on them through the native batch
+API (compress_many / decompress_many on the worker pool, no HDF5 round
+trip) within a time budget, and returns the Pareto-optimal candidates of
+those meeting the targets:
+
+    min_encode_mbps   raw MB/s encoded by the worker pool
+    max_decode_ms     decode latency of one chunk on one worker
+    min_psnr          PSNR in dB at the peak of the bit mode
+    min_ssim          mean SSIM over slices of the patches
+    target_ratio      raw size / compressed size
+
+    result = hf.tune_encoder(vol, min_encode_mbps=200, min_psnr=45)
+    f.create_dataset("data", data=vol, chunks=(32, 256, 256), **result.compression_opts)
+
+Every (codec, preset, threads) group is first probed at its middle crf,
+then at the others; with min_psnr or target_ratio, PSNR and log ratio are
+fitted linearly against crf and the crf the fit puts at the threshold is
+probed as well. Results are cached per dataset signature (shape, dtype,
+patch content, targets and candidates) in memory and in a JSON file,
+H5FFMPEG_TUNE_CACHE or ~/.cache/h5ffmpeg/tune.json, so repeated ingestion
+runs of the same kind of data do not probe again.
+"""
+
+import hashlib
+import json
+import logging
+import math
+import os
+import time
+
+import numpy as np
+
+from .constants import BIT_DEPTH, CODEC_TO_ENCODER, MAX_BIT_MODE, BitMode
+from .ffmpeg_filter import NATIVE_AVAILABLE, encoder_cd_values, ffmpeg
+from .gpu_utils import has_codec
+
+try:
+    from ._version import __version__
+except ImportError:
+    __version__ = "unknown"
+
+if NATIVE_AVAILABLE:
+    from .ffmpeg_filter import _compress_many_c, _decompress_many_c, _native_call_args
+
+logger = logging.getLogger(__name__)
+
+# presets from fast to slow and crfs probed per codec when none are given
+DEFAULT_CANDIDATES = {
+    "libx264": (("ultrafast", "veryfast", "medium"), (18, 23, 28, 33)),
+    "libx265": (("ultrafast", "fast", "medium"), (20, 26, 32)),
+    "libsvtav1": (("10", "8", "6"), (25, 32, 40)),
+}
+# other codecs get their default preset at this crf
+FALLBACK_CANDIDATES = ((None,), (23,))
+CRF_RANGE = {"libsvtav1": (1, 63), "librav1e": (0, 255)}
+DEFAULT_CRF_RANGE = (0, 51)
+
+DEFAULT_PATCH_SIZE = (32, 128, 128)
+SSIM_WINDOW = 7
+
+_memory_cache = {}
+
+
+class Probe:
+    """Measurements of one candidate on the sampled patches"""
+
+    FIELDS = ("codec", "preset", "crf", "threads", "encode_mbps", "decode_ms", "psnr", "ssim", "ratio")
+
+    def __init__(self, codec, preset, crf, threads, encode_mbps, decode_ms, psnr, ssim, ratio, bit_mode):
+        self.codec, self.preset, self.crf, self.threads = codec, preset, int(crf), int(threads)
+        self.encode_mbps, self.decode_ms = float(encode_mbps), float(decode_ms)
+        self.psnr, self.ssim, self.ratio = float(psnr), float(ssim), float(ratio)
+        self.bit_mode = int(bit_mode)
+
+    @property
+    def options(self):
+        """Keyword arguments of hf.ffmpeg for this candidate"""
+        return dict(codec=self.codec, preset=self.preset, crf=self.crf, bit_mode=self.bit_mode,
+                    threads=self.threads)
+
+    @property
+    def compression_opts(self):
+        """create_dataset keyword arguments (compression, compression_opts, ...)"""
+        return ffmpeg(**self.options)
+
+    def to_dict(self):
+        d = {k: getattr(self, k) for k in self.FIELDS}
+        d["bit_mode"] = self.bit_mode
+        return d
+
+    @classmethod
+    def from_dict(cls, d):
+        return cls(**{k: d[k] for k in cls.FIELDS + ("bit_mode",)})
+
+    def __repr__(self):
+        return (
+            f"Probe({self.codec} preset={self.preset} crf={self.crf} threads={self.threads}: "
+            f"{self.encode_mbps:.1f} MB/s, {self.decode_ms:.1f} ms/chunk, PSNR {self.psnr:.2f} dB, "
+            f"SSIM {self.ssim:.4f}, ratio {self.ratio:.1f})"
+        )
+
+
+class TuneResult:
+    """
+    Outcome of tune_encoder.
+
+    best           the chosen Probe: highest ratio meeting the targets, or
+                   highest PSNR with target_ratio
+    met            False when no candidate met the targets, best is then
+                   the one missing them by the least
+    pareto         Probes not dominated in (ratio, encode_mbps, decode_ms,
+                   psnr) among those meeting the targets
+    probes         every Probe measured
+    signature      key of the result cache
+    cached         True when the result came from the cache
+    """
+
+    def __init__(self, best, met, pareto, probes, signature, cached=False):
+        self.best, self.met, self.pareto, self.probes = best, met, pareto, probes
+        self.signature, self.cached = signature, cached
+
+    @property
+    def compression_opts(self):
+        """create_dataset keyword arguments of best"""
+        return self.best.compression_opts
+
+    def to_dict(self):
+        return {
+            "best": self.probes.index(self.best),
+            "met": self.met,
+            "pareto": [self.probes.index(p) for p in self.pareto],
+            "probes": [p.to_dict() for p in self.probes],
+        }
+
+    @classmethod
+    def from_dict(cls, d, signature):
+        probes = [Probe.from_dict(p) for p in d["probes"]]
+        return cls(probes[d["best"]], d["met"], [probes[i] for i in d["pareto"]], probes, signature, True)
+
+
+def sample_patches(data, num_patches=4, patch_size=DEFAULT_PATCH_SIZE, seed=0):
+    """
+    Chunk sized patches of a (depth, height, width) array or dataset.
+
+    Like anm.extract_patches, most patches are taken where the content is
+    most detailed (highest variance among random draws), the rest at
+    random; only the patches are read from a dataset.
+    """
+    shape = tuple(data.shape)
+    if len(shape) != 3:
+        raise ValueError("data must be 3D (depth, height, width)")
+    size = tuple(min(p, s) for p, s in zip(patch_size, shape))
+    rng = np.random.default_rng(seed)
+
+    def draw():
+        return tuple(int(rng.integers(0, s - p + 1)) for s, p in zip(shape, size))
+
+    def read(start):
+        return np.asarray(data[tuple(slice(o, o + p) for o, p in zip(start, size))])
+
+    detailed = max(1, int(round(num_patches * 0.7)))
+    drawn = [read(draw()) for _ in range(2 * detailed)]
+    drawn.sort(key=lambda p: float(np.std(p, dtype=np.float64)), reverse=True)
+    patches = drawn[:detailed] + [read(draw()) for _ in range(num_patches - detailed)]
+    return patches[:num_patches]
+
+
+def _to_bit_mode(patches, bit_mode):
+    """Patches as the codec sees them: uint8, uint16 at 16 bit, else scaled
+    to the range of the bit mode like the norm quantization of datasets"""
+    if all(p.dtype == np.uint8 for p in patches):
+        return [np.ascontiguousarray(p) for p in patches], BitMode.BIT_8
+    if bit_mode == BitMode.BIT_8:
+        peak, dtype = 255.0, np.uint8
+    else:
+        peak, dtype = float((1 << BIT_DEPTH[bit_mode]) - 1), np.uint16
+    if bit_mode == BitMode.BIT_16 and all(p.dtype == np.uint16 for p in patches):
+        return [np.ascontiguousarray(p) for p in patches], bit_mode
+
+    lo = min(float(np.min(p)) for p in patches)
+    hi = max(float(np.max(p)) for p in patches)
+    scale = peak / (hi - lo) if hi > lo else 0.0
+    return [np.round((p.astype(np.float32) - lo) * scale).astype(dtype) for p in patches], bit_mode
+
+
+def _box_mean(x, win):
+    c = np.pad(x, ((1, 0), (1, 0))).cumsum(0).cumsum(1)
+    return (c[win:, win:] - c[:-win, win:] - c[win:, :-win] + c[:-win, :-win]) / (win * win)
+
+
+def _ssim(a, b, peak, win=SSIM_WINDOW):
+    """SSIM of two slices with a uniform win x win window"""
+    if min(a.shape) < win:
+        win = max(1, min(a.shape))
+    a, b = a.astype(np.float64), b.astype(np.float64)
+    mu_a, mu_b = _box_mean(a, win), _box_mean(b, win)
+    var_a = _box_mean(a * a, win) - mu_a * mu_a
+    var_b = _box_mean(b * b, win) - mu_b * mu_b
+    cov = _box_mean(a * b, win) - mu_a * mu_b
+    c1, c2 = (0.01 * peak) ** 2, (0.03 * peak) ** 2
+    s = ((2 * mu_a * mu_b + c1) * (2 * cov + c2)) / ((mu_a * mu_a + mu_b * mu_b + c1) * (var_a + var_b + c2))
+    return float(np.mean(s))
+
+
+def _quality(patches, decoded, peak):
+    se = sum(float(np.sum((p.astype(np.float64) - d) ** 2)) for p, d in zip(patches, decoded))
+    mse = se / sum(p.size for p in patches)
+    psnr = float("inf") if mse == 0 else 20 * math.log10(peak / math.sqrt(mse))
+
+    scores = []
+    for p, d in zip(patches, decoded):
+        # a few slices per patch, as film_grain_optimizer looks at the middle one
+        for z in range(0, p.shape[0], max(1, p.shape[0] // 4)):
+            scores.append(_ssim(p[z], d[z], peak))
+    return psnr, float(np.mean(scores))
+
+
+def _probe(patches, bit_mode, codec, preset, crf, threads, workers):
+    """Encode and decode the patches with one candidate"""
+    cd_list = [
+        encoder_cd_values(p.shape[2], p.shape[1], p.shape[0], codec=codec, preset=preset, crf=crf,
+                          bit_mode=bit_mode, threads=threads)
+        for p in patches
+    ]
+
+    t0 = time.perf_counter()
+    blobs = _compress_many_c(cd_list, patches, threads=int(workers or 0))
+    encode_s = time.perf_counter() - t0
+
+    calls = [_native_call_args(1, blob, threads=threads) for blob in blobs]
+    t0 = time.perf_counter()
+    decoded = _decompress_many_c([c for c, _, _ in calls], [d for _, _, d in calls], threads=1)
+    decode_s = time.perf_counter() - t0
+
+    raw = sum(p.nbytes for p in patches)
+    psnr, ssim = _quality(patches, decoded, float((1 << BIT_DEPTH[bit_mode]) - 1))
+    return Probe(
+        codec, preset, crf, threads,
+        encode_mbps=raw / max(encode_s, 1e-9) / 1e6,
+        decode_ms=decode_s * 1e3 / len(patches),
+        psnr=min(psnr, 1e3),
+        ssim=ssim,
+        ratio=raw / max(1, sum(len(b) for b in blobs)),
+        bit_mode=bit_mode,
+    )
+
+
+def _violation(probe, targets):
+    """How far a probe misses the targets, relative to each target; 0 when met"""
+    miss = 0.0
+    if targets["min_encode_mbps"]:
+        miss += max(0.0, 1 - probe.encode_mbps / targets["min_encode_mbps"])
+    if targets["max_decode_ms"]:
+        miss += max(0.0, probe.decode_ms / targets["max_decode_ms"] - 1)
+    if targets["min_psnr"]:
+        miss += max(0.0, 1 - probe.psnr / targets["min_psnr"])
+    if targets["min_ssim"]:
+        miss += max(0.0, 1 - probe.ssim / targets["min_ssim"])
+    if targets["target_ratio"]:
+        miss += max(0.0, 1 - probe.ratio / targets["target_ratio"])
+    return miss
+
+
+def _dominates(a, b):
+    ge = (a.ratio >= b.ratio, a.encode_mbps >= b.encode_mbps, a.decode_ms <= b.decode_ms, a.psnr >= b.psnr)
+    gt = (a.ratio > b.ratio, a.encode_mbps > b.encode_mbps, a.decode_ms < b.decode_ms, a.psnr > b.psnr)
+    return all(ge) and any(gt)
+
+
+def pareto_front(probes):
+    """Probes not dominated in (ratio, encode_mbps, decode_ms, psnr)"""
+    return [p for p in probes if not any(_dominates(q, p) for q in probes if q is not p)]
+
+
+def _fitted_crf(group, targets, crf_range):
+    """crf at which the linear fits of PSNR and log ratio reach the
+    targets, None when there is nothing to fit or no crf meets both"""
+    if len(group) < 2 or not (targets["min_psnr"] or targets["target_ratio"]):
+        return None
+    crfs = np.array([p.crf for p in group], dtype=np.float64)
+    if np.ptp(crfs) == 0:
+        return None
+
+    hi, lo = float(crf_range[1]), float(crf_range[0])
+    if targets["min_psnr"]:
+        slope, icpt = np.polyfit(crfs, [p.psnr for p in group], 1)
+        if slope < 0:
+            hi = min(hi, (targets["min_psnr"] - icpt) / slope)
+    if targets["target_ratio"]:
+        slope, icpt = np.polyfit(crfs, [math.log(p.ratio) for p in group], 1)
+        if slope > 0:
+            lo = max(lo, (math.log(targets["target_ratio"]) - icpt) / slope)
+    if lo > hi:
+        return None
+    # the highest crf the quality allows, ratio grows with it
+    return int(math.floor(hi)) if targets["min_psnr"] else int(math.ceil(lo))
+
+
+def _cache_path(cache):
+    if isinstance(cache, (str, os.PathLike)):
+        return os.fspath(cache)
+    return os.environ.get("H5FFMPEG_TUNE_CACHE") or os.path.join(
+        os.path.expanduser("~"), ".cache", "h5ffmpeg", "tune.json"
+    )
+
+
+def _load_cache(path):
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+
+def _store_cache(path, signature, result):
+    entries = _load_cache(path)
+    entries[signature] = result.to_dict()
+    try:
+        os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+        tmp = f"{path}.{os.getpid()}.tmp"
+        with open(tmp, "w") as f:
+            json.dump(entries, f)
+        os.replace(tmp, path)
+    except OSError as e:
+        logger.warning(f"Could not write the tuning cache {path}: {e}")
+
+
+def _signature(shape, dtype, patches, bit_mode, targets, candidates, workers):
+    digest = hashlib.sha1()
+    for p in patches:
+        digest.update(np.ascontiguousarray(p).tobytes())
+    key = {
+        "version": __version__,
+        "shape": list(shape),
+        "dtype": str(np.dtype(dtype)),
+        "patches": [list(p.shape) for p in patches],
+        "content": digest.hexdigest(),
+        "bit_mode": int(bit_mode),
+        "targets": targets,
+        "candidates": candidates,
+        "workers": workers or 0,
+        "cores": os.cpu_count(),
+    }
+    return hashlib.sha1(json.dumps(key, sort_keys=True).encode()).hexdigest()
+
+
+def tune_encoder(
+    data,
+    min_encode_mbps=None,
+    max_decode_ms=None,
+    min_psnr=None,
+    min_ssim=None,
+    target_ratio=None,
+    codecs=None,
+    presets=None,
+    crfs=None,
+    threads=(0,),
+    bit_mode=None,
+    chunks=None,
+    num_patches=4,
+    workers=None,
+    time_budget=30.0,
+    cache=True,
+    seed=0,
+):
+    """
+    Pick codec, preset, crf and codec threads for a volume from targets.
+
+    Parameters:
+    -----------
+    data : array-like
+        (depth, height, width) volume or h5py dataset, uint8, uint16 or float32
+    min_encode_mbps, max_decode_ms, min_psnr, min_ssim, target_ratio : float, optional
+        Targets, see the module documentation; without any the highest
+        ratio wins
+    codecs : sequence of str, optional
+        Codecs to probe (default: those of DEFAULT_CANDIDATES available)
+    presets, crfs : dict or sequence, optional
+        Per codec {codec: (...)} or one sequence for every codec
+    threads : sequence of int
+        Codec threads per chunk to probe (0: codec default)
+    bit_mode : int, optional
+        BitMode of the dataset (default: BIT_8 for uint8, BIT_10 otherwise)
+    chunks : tuple, optional
+        Chunk shape of the dataset, the size of the patches
+    num_patches : int
+        Patches sampled from data
+    workers : int, optional
+        Native worker threads encoding the patches (default: one per core)
+    time_budget : float
+        Seconds of probing after which no new candidate is started
+    cache : bool or str
+        Use the result cache (True), a cache file at this path, or not (False)
+    seed : int
+        Seed of the patch sampling
+
+    Returns:
+    --------
+    TuneResult, see TuneResult
+    """
+    if not NATIVE_AVAILABLE:
+        raise RuntimeError("tune_encoder needs the native extension")
+
+    targets = {
+        "min_encode_mbps": min_encode_mbps,
+        "max_decode_ms": max_decode_ms,
+        "min_psnr": min_psnr,
+        "min_ssim": min_ssim,
+        "target_ratio": target_ratio,
+    }
+    if bit_mode is None:
+        bit_mode = BitMode.BIT_8 if np.dtype(data.dtype) == np.uint8 else BitMode.BIT_10
+
+    # codecs that would scale the samples down to fewer bits are left out
+    codecs = [
+        c for c in (codecs or DEFAULT_CANDIDATES)
+        if has_codec(c) and MAX_BIT_MODE.get(CODEC_TO_ENCODER.get(c), BitMode.BIT_10) >= bit_mode
+    ]
+    if not codecs:
+        raise RuntimeError("None of the codecs to probe is available")
+
+    def per_codec(values, codec, default):
+        if values is None:
+            return tuple(default)
+        if isinstance(values, dict):
+            return tuple(values.get(codec, default))
+        return tuple(values)
+
+    candidates = {}
+    for c in codecs:
+        default_presets, default_crfs = DEFAULT_CANDIDATES.get(c, FALLBACK_CANDIDATES)
+        candidates[c] = {
+            "presets": list(per_codec(presets, c, default_presets)),
+            "crfs": [int(v) for v in per_codec(crfs, c, default_crfs)],
+        }
+    threads = [int(t) for t in threads]
+
+    patches = sample_patches(data, num_patches, chunks or DEFAULT_PATCH_SIZE, seed)
+    patches, bit_mode = _to_bit_mode(patches, bit_mode)
+
+    signature = _signature(data.shape, data.dtype, patches, bit_mode, targets,
+                           {"candidates": candidates, "threads": threads}, workers)
+    path = _cache_path(cache) if cache else None
+    if cache:
+        entry = _memory_cache.get(signature) or _load_cache(path).get(signature)
+        if entry:
+            _memory_cache[signature] = entry
+            return TuneResult.from_dict(entry, signature)
+
+    # (codec, preset, threads) groups, fastest presets first; each pass
+    # over the groups probes one more crf, middle crfs first
+    groups = [(c, p, t) for c in codecs for p in candidates[c]["presets"] for t in threads]
+    orders = {}
+    for c in codecs:
+        values = candidates[c]["crfs"]
+        orders[c] = sorted(values, key=lambda v: abs(values.index(v) - (len(values) - 1) / 2))
+
+    start = time.perf_counter()
+    probes, done = [], set()
+
+    def run(codec, preset, crf, t):
+        if (codec, preset, crf, t) in done:
+            return
+        if probes and time.perf_counter() - start >= time_budget:
+            return
+        done.add((codec, preset, crf, t))
+        try:
+            probe = _probe(patches, bit_mode, codec, preset, crf, t, workers)
+        except Exception as e:
+            logger.warning(f"Probe of {codec} preset={preset} crf={crf} failed: {e}")
+            return
+        logger.info(repr(probe))
+        probes.append(probe)
+
+    for i in range(max(len(o) for o in orders.values())):
+        for codec, preset, t in groups:
+            if i < len(orders[codec]):
+                run(codec, preset, orders[codec][i], t)
+
+    for codec, preset, t in groups:
+        group = [p for p in probes if (p.codec, p.preset, p.threads) == (codec, preset, t)]
+        crf = _fitted_crf(group, targets, CRF_RANGE.get(codec, DEFAULT_CRF_RANGE))
+        if crf is not None:
+            run(codec, preset, crf, t)
+
+    if not probes:
+        raise RuntimeError("Every probe failed")
+
+    feasible = [p for p in probes if _violation(p, targets) == 0]
+    met = bool(feasible)
+    if met:
+        if target_ratio:
+            best = max(feasible, key=lambda p: (p.psnr, p.encode_mbps))
+        else:
+            best = max(feasible, key=lambda p: (p.ratio, p.encode_mbps))
+    else:
+        best = min(probes, key=lambda p: (_violation(p, targets), -p.ratio))
+        logger.warning(f"No candidate meets the targets, closest: {best!r}")
+
+    result = TuneResult(best, met, pareto_front(feasible or probes), probes, signature)
+    if cache:
+        _memory_cache[signature] = result.to_dict()
+        _store_cache(path, signature, result)
+    return result
@@ -273,7 +273,8 @@ public class HDF5Reader implements PlugIn {
 				} else if (numberOfDimensions == 3) {
 					logger.info("3D Image");
 
-					if (selectedDatasets.isVirtualStack()) {
+					boolean wholeStack = selectedDatasets.getSlice() == null && selectedDatasets.getModulo() == null;
+					if (selectedDatasets.isVirtualStack() || (wholeStack && exceedsHeap(var))) {
 						logger.info("Use virtual stack");
 						stack = new VirtualStackHDF5(file, var);
 					} else {
@@ -428,6 +429,27 @@ public class HDF5Reader implements PlugIn {
 		return stack; // TODO should return stacks instead of stack
 	}
 
+	/**
+	 * Whether decoding the whole dataset would take more than half of the heap
+	 * left, in which case it is opened as a virtual stack instead
+	 * 
+	 * @param dataset
+	 * @return true if the dataset should not be read at once
+	 */
+	private boolean exceedsHeap(Dataset dataset) {
+		long bytes = dataset.getDatatype().getDatatypeSize();
+		for (long d : dataset.getDims()) {
+			bytes *= d;
+		}
+		Runtime runtime = Runtime.getRuntime();
+		long available = runtime.maxMemory() - (runtime.totalMemory() - runtime.freeMemory());
+		if (bytes > available / 2) {
+			logger.info("Dataset of " + (bytes >> 20) + " MB does not fit the heap, opening it as a virtual stack");
+			return true;
+		}
+		return false;
+	}
+
 	/**
 	 * Selection of the datasets to visualize
 	 * 
@@ -2,10 +2,22 @@ package ch.psi.imagej.hdf5;
 
 import java.lang.reflect.Array;
 import java.util.ArrayList;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
+import java.util.concurrent.FutureTask;
 import java.util.logging.Level;
 import java.util.logging.Logger;
 
+import com.cailab.hdf5compression.FFH5Native;
+
 import hdf.object.Dataset;
+import hdf.object.Datatype;
 import hdf.object.h5.H5File;
 import ij.IJ;
 import ij.process.ByteProcessor;
@@ -14,15 +26,38 @@ import ij.process.FloatProcessor;
 import ij.process.ImageProcessor;
 import ij.process.ShortProcessor;
 
+/**
+ * Lazy stack over a 3D dataset: slices are decoded one z-chunk at a time when
+ * they are first shown, kept in an LRU of decoded chunks (bounded by the buffer
+ * size of the GUI, in slices) and the neighbouring z-chunks are decoded on a
+ * background thread while the user scrolls.  ffmpeg compressed 8/16-bit datasets
+ * are decoded with the parallel chunk reader (FFH5Native) when it is available.
+ */
 public class VirtualStackHDF5 extends BufferedVirtualStack {
 
 	private static final Logger logger = Logger.getLogger(VirtualStackHDF5.class.getName());
 
+	/* z-chunk depth of unchunked datasets */
+	private static final int DEFAULT_Z_CHUNK = 16;
+
 	private int bitDepth = 0;
 	private Dataset dataset;
 	private H5File file;
 
-	private int zChunkPreLoad = 0;
+	private int zChunk;
+	private int prefetchChunks;
+	private boolean nativeReader;
+	private int lastChunk = -1;
+
+	/* decoded chunks in least recently used order, chunk index -> first slice */
+	private final LinkedHashMap<Integer, Integer> chunkOrder = new LinkedHashMap<>(16, 0.75f, true);
+	/* chunks being decoded, by the caller or the prefetcher */
+	private final Map<Integer, Future<ArrayList<ImageProcessor>>> pending = new ConcurrentHashMap<>();
+	private final ExecutorService prefetcher = Executors.newSingleThreadExecutor(r -> {
+		Thread t = new Thread(r, "hdf5-prefetch");
+		t.setDaemon(true);
+		return t;
+	});
 
 	public VirtualStackHDF5(H5File file, Dataset dataset) {
 		// super((int) dataset.getDims()[2], (int) dataset.getDims()[1]);
@@ -45,7 +80,17 @@ public class VirtualStackHDF5 extends BufferedVirtualStack {
 			}
 			System.out.println("chunkSize: " + sizeStr);
 		}
-		this.zChunkPreLoad = 2 * (int) chunks[0];
+		// one z-chunk decodes every chunk it touches once, read them whole
+		this.zChunk = (chunks != null) ? (int) chunks[0] : DEFAULT_Z_CHUNK;
+		this.prefetchChunks = Integer.getInteger("h5ffmpeg.prefetchChunks", 1);
+
+		Datatype type = dataset.getDatatype();
+		if (type.getDatatypeClass() == Datatype.CLASS_INTEGER && type.getDatatypeSize() <= 2) {
+			this.bitDepth = 8 * (int) type.getDatatypeSize();
+			this.nativeReader = chunks != null && FFH5Native.isAvailable();
+		} else if (type.getDatatypeClass() == Datatype.CLASS_FLOAT) {
+			this.bitDepth = 32;
+		}
 	}
 
 	/** Does noting. */
@@ -68,43 +113,64 @@ public class VirtualStackHDF5 extends BufferedVirtualStack {
 	public void deleteLastSlice() {
 	}
 
-	/**  */
-	public Object getChunks(int slice) {
-		try {
-			long[] dimensions = dataset.getDims();
-
-			// Select what to readout
-			long[] selected = dataset.getSelectedDims();
-			selected[0] = zChunkPreLoad;
-			selected[1] = dimensions[1];
-			selected[2] = dimensions[2];
-
-			long[] start = dataset.getStartDims();
-			start[0] = (slice - 1) / zChunkPreLoad * zChunkPreLoad; // Indexing at image J starts at 1
-
-			if ((start[0] + zChunkPreLoad) > dimensions[0]){
-				selected[0] = dimensions[0] - start[0];
-			}
-
-			Object wholeDataset = dataset.read();
-
-			if (wholeDataset instanceof byte[]) {
-				return (byte[]) wholeDataset;
-			} else if (wholeDataset instanceof short[]) {
-				return (short[]) wholeDataset;
-			} else if (wholeDataset instanceof int[]) {
-				return HDF5Utilities.convertToFloat((int[]) wholeDataset);
-			} else if (wholeDataset instanceof long[]) {
-				return HDF5Utilities.convertToFloat((long[]) wholeDataset);
-			} else if (wholeDataset instanceof float[]) {
-				return (float[]) wholeDataset;
-			} else if (wholeDataset instanceof double[]) {
-				return HDF5Utilities.convertToFloat((double[]) wholeDataset);
-			} else {
-				logger.warning("Datatype not supported");
+	/**
+	 * Decode z-chunk index (slices index * zChunk + 1 ...) into one pixel array,
+	 * natively when possible, through the HDF5 filter pipeline otherwise.
+	 */
+	public Object getChunks(int index) {
+		long[] dimensions = dataset.getDims();
+		long z0 = (long) index * zChunk;
+		long nz = Math.min(zChunk, dimensions[0] - z0);
+		int size = (int) (nz * dimensions[1] * dimensions[2]);
+
+		// the dataset keeps the selection, one reader at a time
+		synchronized (dataset) {
+			try {
+				if (nativeReader) {
+					Object buf = (bitDepth == 8) ? new byte[size] : new short[size];
+					long did = dataset.open();
+					try {
+						if (FFH5Native.readRegion(did, new long[] { z0, 0, 0 },
+								new long[] { nz, dimensions[1], dimensions[2] }, buf, 0) == 0) {
+							return buf;
+						}
+					} finally {
+						dataset.close(did);
+					}
+					// not an ffmpeg dataset, or another libhdf5
+					logger.info("Parallel chunk reader not usable, reading through HDF5");
+					nativeReader = false;
+				}
+
+				// Select what to readout
+				long[] selected = dataset.getSelectedDims();
+				selected[0] = nz;
+				selected[1] = dimensions[1];
+				selected[2] = dimensions[2];
+
+				long[] start = dataset.getStartDims();
+				start[0] = z0;
+
+				Object wholeDataset = dataset.read();
+
+				if (wholeDataset instanceof byte[]) {
+					return (byte[]) wholeDataset;
+				} else if (wholeDataset instanceof short[]) {
+					return (short[]) wholeDataset;
+				} else if (wholeDataset instanceof int[]) {
+					return HDF5Utilities.convertToFloat((int[]) wholeDataset);
+				} else if (wholeDataset instanceof long[]) {
+					return HDF5Utilities.convertToFloat((long[]) wholeDataset);
+				} else if (wholeDataset instanceof float[]) {
+					return (float[]) wholeDataset;
+				} else if (wholeDataset instanceof double[]) {
+					return HDF5Utilities.convertToFloat((double[]) wholeDataset);
+				} else {
+					logger.warning("Datatype not supported");
+				}
+			} catch (OutOfMemoryError | Exception e) {
+				logger.log(Level.WARNING, "Unable to open slice", e);
 			}
-		} catch (OutOfMemoryError | Exception e) {
-			logger.log(Level.WARNING, "Unable to open slice", e);
 		}
 
 		return null;
@@ -116,48 +182,118 @@ public class VirtualStackHDF5 extends BufferedVirtualStack {
 	public void setPixels(Object pixels, int n) {
 	}
 
+	/** Decoded slices of chunk index, decoding them here unless the prefetcher already is. */
+	private ArrayList<ImageProcessor> loadChunk(int index) {
+		FutureTask<ArrayList<ImageProcessor>> task = new FutureTask<>(() -> getProcessor_internal(index * zChunk + 1));
+		Future<ArrayList<ImageProcessor>> future = pending.putIfAbsent(index, task);
+		if (future == null) {
+			future = task;
+			task.run();
+		}
+		try {
+			return future.get();
+		} catch (InterruptedException e) {
+			Thread.currentThread().interrupt();
+			throw new IllegalStateException(e);
+		} catch (ExecutionException e) {
+			throw new IllegalStateException("Unable to decode chunk " + index, e.getCause());
+		}
+	}
+
+	/** Put the slices of chunk index in the buffer, evicting least recently used chunks. */
+	private void storeChunk(int index, ArrayList<ImageProcessor> ips) {
+		int first = index * zChunk + 1;
+
+		test_lock.lock();
+		try {
+			if (!processor_buffer.containsKey(first)) {
+				for (int i = 0; i < ips.size(); ++i) {
+					processor_buffer.put(first + i, ips.get(i));
+				}
+			}
+			chunkOrder.put(index, first);
+
+			Iterator<Map.Entry<Integer, Integer>> it = chunkOrder.entrySet().iterator();
+			while (processor_buffer.size() > Math.max(proc_buffer_MAX, zChunk) && it.hasNext()) {
+				Map.Entry<Integer, Integer> eldest = it.next();
+				if (eldest.getKey() == index) {
+					continue;
+				}
+				for (int i = 0; i < zChunk; ++i) {
+					processor_buffer.remove(eldest.getValue() + i);
+				}
+				it.remove();
+
+				buffer_clean_count++;
+				if (buffer_clean_count % 10 == 0) {
+					System.gc();
+					buffer_clean_count = 0;
+				}
+			}
+		} finally {
+			test_lock.unlock();
+		}
+		pending.remove(index);
+	}
+
+	/** Decode the chunks around index in the background, next in scroll direction first. */
+	private void prefetch(int index) {
+		int direction = (index < lastChunk) ? -1 : 1;
+		int nChunks = (getSize() + zChunk - 1) / zChunk;
+		lastChunk = index;
+
+		for (int d = 1; d <= prefetchChunks; ++d) {
+			for (int next : new int[] { index + direction * d, index - direction * d }) {
+				if (next < 0 || next >= nChunks || pending.containsKey(next)) {
+					continue;
+				}
+				test_lock.lock();
+				boolean cached = processor_buffer.containsKey(next * zChunk + 1);
+				test_lock.unlock();
+				if (cached) {
+					continue;
+				}
+				FutureTask<ArrayList<ImageProcessor>> task = new FutureTask<>(
+						() -> getProcessor_internal(next * zChunk + 1));
+				if (pending.putIfAbsent(next, task) == null) {
+					prefetcher.execute(() -> {
+						task.run();
+						try {
+							storeChunk(next, task.get());
+						} catch (Exception e) {
+							pending.remove(next);
+							logger.log(Level.FINE, "Prefetch of chunk " + next + " failed", e);
+						}
+					});
+				}
+			}
+		}
+	}
+
 	/**
 	 * Returns an ImageProcessor for the specified slice, were 1<=n<=nslices.
 	 * Returns null if the stack is empty.
 	 */
 	public ImageProcessor getProcessor(int slice) {
 		int t0 = (int) System.currentTimeMillis();
-		IJ.log("Getting processor, slice: " + slice);
-		System.out.println("Getting processor, slice: " + slice);
+		int index = (slice - 1) / zChunk;
+
 		test_lock.lock();
-		if (processor_fifo.size() > proc_buffer_MAX) {
-			int to_remove = processor_fifo.remove();
-			IJ.log("\tClearing Cache Item " + to_remove);
-			processor_buffer.remove(to_remove);
-
-			buffer_clean_count++;
-			if (buffer_clean_count % 10 == 0) {
-				System.gc();
-				buffer_clean_count = 0;
-			}
+		ImageProcessor to_return = processor_buffer.get(slice);
+		if (to_return != null) {
+			chunkOrder.get(index); // mark as recently used
 		}
+		test_lock.unlock();
 
-		ImageProcessor to_return = null;
-		if (processor_buffer.containsKey(slice)) {
-			IJ.log("Cache HIT (" + slice + ") " + processor_buffer.size());
-			to_return = processor_buffer.get(slice);
-		} else {
-			IJ.log("Cache MISS (" + slice + ")");
-			ArrayList<ImageProcessor> ips;
-			ips = getProcessor_internal(slice);
-			for (int i = 1; i < ips.size() + 1; ++i) {
-				processor_buffer.put((slice - 1) / zChunkPreLoad * zChunkPreLoad + i, ips.get(i - 1));
-				processor_fifo.add((slice - 1) / zChunkPreLoad * zChunkPreLoad + i);
-			}
-			to_return = processor_buffer.get(slice);
+		if (to_return == null) {
+			// decoding runs without the lock, the prefetcher may be storing meanwhile
+			ArrayList<ImageProcessor> ips = loadChunk(index);
+			storeChunk(index, ips);
+			to_return = ips.get(slice - 1 - index * zChunk);
+			IJ.log("Cache MISS (" + slice + ") took " + ((int) System.currentTimeMillis() - t0) + "ms");
 		}
-
+		prefetch(index);
 		this.gui.updateStatus();
-		test_lock.unlock();
-
-		IJ.log("Getting processor, slice: " + slice + " took " + ((int) System.currentTimeMillis() - t0) + "ms");
-
-		// return to_return;
 
 		if (to_return instanceof ByteProcessor) {
 			ByteProcessor out = new ByteProcessor(to_return.getWidth(), to_return.getHeight(),
@@ -180,6 +316,7 @@ public class VirtualStackHDF5 extends BufferedVirtualStack {
 		return to_return;
 	}
 
+	/** Slices of the z-chunk holding slice n, decoded. */
 	public ArrayList<ImageProcessor> getProcessor_internal(int n) {
 		// IJ.log("Loading Processor " + n + "...");
 		if (isOutOfRange(n)) {
@@ -187,14 +324,17 @@ public class VirtualStackHDF5 extends BufferedVirtualStack {
 		}
 
 		long[] dimensions = dataset.getDims();
-		long[] selected = dataset.getSelectedDims();
 
-		final Object chunks = getChunks(n);
+		final Object chunks = getChunks((n - 1) / zChunk);
+		if (chunks == null) {
+			throw new IllegalStateException("Unable to read slice " + n);
+		}
 		final int size = (int) dimensions[2] * (int) dimensions[1];
+		final int nSlices = Array.getLength(chunks) / size;
 		ArrayList<ImageProcessor> ips = new ArrayList<ImageProcessor>();
 
 		// Todo support more ImageProcessor types
-		for (int lec = 0; lec < selected[0]; ++lec) {
+		for (int lec = 0; lec < nSlices; ++lec) {
 			ImageProcessor ip;
 			int startIdx = lec * size;
 			Object pixels = Array.newInstance(chunks.getClass().getComponentType(), size);
@@ -260,6 +400,7 @@ public class VirtualStackHDF5 extends BufferedVirtualStack {
 	 */
 	public void close() {
 		logger.info("Closing HDF5 file");
+		prefetcher.shutdownNow();
 		try {
 			file.close();
 		} catch (Exception e) {
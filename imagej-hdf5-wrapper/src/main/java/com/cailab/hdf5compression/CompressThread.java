@@ -1,6 +1,7 @@
 package com.cailab.hdf5compression;
 
 import java.io.IOException;
+import java.util.Arrays;
 
 import org.apache.commons.io.output.ByteArrayOutputStream;
 
@@ -20,10 +21,36 @@ public class CompressThread implements Runnable {
 	private int tuneType;
 	private int crf;
 	private int filmGrain;
+	private int threads;
+	private int threadType;
+	private int pyramidLevels;
+	private int pyramidMode;
+	private long[] levelDs = new long[0];
+	private int chunkFrames = 0;
+	private boolean nativeWriter = false;
 	private ImagePlus imp;
 
 	public CompressThread(MainWindow mw, String filename, int encoderId, int decoderId, int presetId, int tuneType,
 			int crf, int filmGrain) {
+		this(mw, filename, encoderId, decoderId, presetId, tuneType, crf, filmGrain, 0, Constants.FFH5_THREAD_AUTO);
+	}
+
+	/**
+	 * threads: codec threads per chunk (0 keeps the codec default)
+	 * threadType: Constants.FFH5_THREAD_AUTO, FFH5_THREAD_FRAME or FFH5_THREAD_SLICE
+	 */
+	public CompressThread(MainWindow mw, String filename, int encoderId, int decoderId, int presetId, int tuneType,
+			int crf, int filmGrain, int threads, int threadType) {
+		this(mw, filename, encoderId, decoderId, presetId, tuneType, crf, filmGrain, threads, threadType, 0,
+				Constants.PYRAMID_MEAN);
+	}
+
+	/**
+	 * pyramidLevels: downsampled levels written next to "data" as "data_2x", "data_4x", ...
+	 * pyramidMode: Constants.PYRAMID_MEAN or PYRAMID_MAX
+	 */
+	public CompressThread(MainWindow mw, String filename, int encoderId, int decoderId, int presetId, int tuneType,
+			int crf, int filmGrain, int threads, int threadType, int pyramidLevels, int pyramidMode) {
 		this.mw = mw;
 		this.filename = filename;
 		this.encoderId = encoderId;
@@ -32,6 +59,157 @@ public class CompressThread implements Runnable {
 		this.tuneType = tuneType;
 		this.crf = crf;
 		this.filmGrain = filmGrain;
+		this.threads = threads;
+		this.threadType = threadType;
+		this.pyramidLevels = pyramidLevels;
+		this.pyramidMode = pyramidMode;
+	}
+
+	/**
+	 * Frames per chunk; 0 keeps the whole stack in one chunk, or splits it so every core
+	 * has chunks to encode when the parallel writer is available.
+	 */
+	public void setChunkFrames(int chunkFrames) {
+		this.chunkFrames = chunkFrames;
+	}
+
+	/** Frames per chunk for a stack of nSlices frames of frameBytes each. */
+	int chooseChunkFrames(int nSlices, long frameBytes) {
+		int frames = nSlices;
+		if (chunkFrames > 0) {
+			frames = Math.min(chunkFrames, nSlices);
+		} else if (nativeWriter) {
+			int cores = Runtime.getRuntime().availableProcessors();
+			frames = Math.min(nSlices, Math.max(Constants.MIN_CHUNK_FRAMES, (nSlices + cores - 1) / cores));
+		}
+		// chunks travel in one Java array and HDF5 caps chunks at 4 GB
+		return (int) Math.max(1, Math.min(frames, Constants.MAX_BLOCK_BYTES / frameBytes));
+	}
+
+	/**
+	 * Halve frames (nFrames x nRows x nCols) in Y and X by 2x2 block mean or max,
+	 * odd edges replicate the last row or column, like the Python writer.
+	 */
+	static byte[] downsample(byte[] frames, int nFrames, int nRows, int nCols, boolean max) {
+		int outRows = (nRows + 1) / 2;
+		int outCols = (nCols + 1) / 2;
+		byte[] out = new byte[nFrames * outRows * outCols];
+		int o = 0;
+
+		for (int z = 0; z < nFrames; ++z) {
+			int frame = z * nRows * nCols;
+			for (int y = 0; y < outRows; ++y) {
+				int r0 = frame + 2 * y * nCols;
+				int r1 = (2 * y + 1 < nRows) ? r0 + nCols : r0;
+				for (int x = 0; x < outCols; ++x) {
+					int c0 = 2 * x;
+					int c1 = (2 * x + 1 < nCols) ? c0 + 1 : c0;
+					int a = frames[r0 + c0] & 0xff, b = frames[r0 + c1] & 0xff;
+					int c = frames[r1 + c0] & 0xff, d = frames[r1 + c1] & 0xff;
+					out[o++] = (byte) (max ? Math.max(Math.max(a, b), Math.max(c, d)) : (a + b + c + d + 2) / 4);
+				}
+			}
+		}
+		return out;
+	}
+
+	/**
+	 * Create the pyramid levels of the dataset space as "data_2x", "data_4x", ... with
+	 * the filter options of the base dataset, for frames of at least PYRAMID_MIN_SIZE.
+	 * Returns the number of levels.
+	 */
+	public int createLevels(long fid, long space, int[] cd_values, int zChunk) {
+		int rank = H5.H5Sget_simple_extent_ndims(space);
+		long[] dims = new long[rank];
+		H5.H5Sget_simple_extent_dims(space, dims, null);
+
+		int n = 0;
+		for (long rows = dims[rank - 2], cols = dims[rank - 1]; n < pyramidLevels
+				&& Math.min(rows, cols) >= 2 * Constants.PYRAMID_MIN_SIZE; ++n) {
+			rows = (rows + 1) / 2;
+			cols = (cols + 1) / 2;
+		}
+
+		levelDs = new long[n];
+		for (int l = 0; l < n; ++l) {
+			dims[rank - 2] = (dims[rank - 2] + 1) / 2;
+			dims[rank - 1] = (dims[rank - 1] + 1) / 2;
+
+			int[] levelValues = cd_values.clone();
+			levelValues[2] = (int) dims[rank - 1];
+			levelValues[3] = (int) dims[rank - 2];
+
+			long levelSpace = H5.H5Screate_simple(rank, dims, null);
+			long plist = H5.H5Pcreate(HDF5Constants.H5P_DATASET_CREATE);
+			H5.H5Pset_filter(plist, Constants.FILTER_ID, HDF5Constants.H5Z_FLAG_OPTIONAL, levelValues.length,
+					levelValues);
+			setChunkShape(plist, new int[] { levelValues[2], levelValues[3], zChunk });
+			levelDs[l] = H5.H5Dcreate(fid, "data_" + (2 << l) + "x", HDF5Constants.H5T_NATIVE_UINT8, levelSpace,
+					HDF5Constants.H5P_DEFAULT, plist, HDF5Constants.H5P_DEFAULT);
+			H5.H5Pclose(plist);
+			H5.H5Sclose(levelSpace);
+		}
+		return n;
+	}
+
+	/**
+	 * Write the pyramid levels of a block of frames written to "data" at start
+	 * (count ends with nFrames, nRows, nCols), each level from the previous one.
+	 */
+	public void writeLevels(byte[] frames, long[] start, long[] count) {
+		int rank = count.length;
+		int nFrames = (int) count[rank - 3];
+		long[] levelCount = count.clone();
+
+		for (int l = 0; l < levelDs.length; ++l) {
+			frames = downsample(frames, nFrames, (int) levelCount[rank - 2], (int) levelCount[rank - 1],
+					pyramidMode == Constants.PYRAMID_MAX);
+			levelCount[rank - 2] = (levelCount[rank - 2] + 1) / 2;
+			levelCount[rank - 1] = (levelCount[rank - 1] + 1) / 2;
+
+			long fileSpace = H5.H5Dget_space(levelDs[l]);
+			writeRegion(levelDs[l], fileSpace, frames, start, levelCount);
+			H5.H5Sclose(fileSpace);
+		}
+	}
+
+	/**
+	 * Write frames to the region start / count of ds: on the native worker pool when
+	 * the plugin library is loaded, otherwise through H5Dwrite and the filter pipeline.
+	 * The first failing native write (e.g. a plugin linked against another libhdf5 than
+	 * the Java binding) switches to H5Dwrite for the rest of the file.
+	 */
+	private void writeRegion(long ds, long fileSpace, byte[] frames, long[] start, long[] count) {
+		if (nativeWriter) {
+			if (FFH5Native.writeRegion(ds, start, count, frames, 0) == 0) {
+				return;
+			}
+			System.out.println("Parallel chunk writer not usable at " + Arrays.toString(start)
+					+ ", writing through HDF5");
+			nativeWriter = false;
+		}
+
+		long[] ones = new long[count.length];
+		Arrays.fill(ones, 1);
+		long memSpace = H5.H5Screate_simple(count.length, count, null);
+		H5.H5Sselect_hyperslab(fileSpace, HDF5Constants.H5S_SELECT_SET, start, ones, ones, count);
+		H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, fileSpace, HDF5Constants.H5P_DEFAULT, frames);
+		H5.H5Sclose(memSpace);
+	}
+
+	/** Write a block of frames of "data" and its pyramid levels. */
+	private void writeBlock(long ds, long targetSpace, byte[] frames, long[] start, long[] count) {
+		writeRegion(ds, targetSpace, frames, start, count);
+		writeLevels(frames, start, count);
+	}
+
+	private void writePyramidAttribute(long ds, int levels) {
+		long attrSpace = H5.H5Screate(HDF5Constants.H5S_SCALAR);
+		long attr = H5.H5Acreate(ds, "pyramid_levels", HDF5Constants.H5T_NATIVE_INT, attrSpace,
+				HDF5Constants.H5P_DEFAULT, HDF5Constants.H5P_DEFAULT);
+		H5.H5Awrite(attr, HDF5Constants.H5T_NATIVE_INT, new int[] { levels });
+		H5.H5Aclose(attr);
+		H5.H5Sclose(attrSpace);
 	}
 
 	public int getImageStackType(ImagePlus imp) {
@@ -133,12 +311,11 @@ public class CompressThread implements Runnable {
 		return r;
 	}
 
-	public void writeThreeDDataset(long ds, long targetSpace, ImagePlus imp, int zChunk) {
+	public void writeThreeDDataset(long ds, long targetSpace, ImagePlus imp, int framesPerWrite) {
 		byte[] pixels = null;
 		ImageProcessor imageProcessor;
 		int slice = 1;
 
-		long memSpace = -1;
 		ByteArrayOutputStream outputStream = new ByteArrayOutputStream();
 		int stackType = getImageStackType(imp);
 		int nFirstDim = 1;
@@ -180,15 +357,11 @@ public class CompressThread implements Runnable {
 				pixels = (byte[]) imageProcessor.getPixels();
 				outputStream.write(pixels);
 
-				if (i % zChunk == 0) {
-					H5.H5Sselect_hyperslab(targetSpace, HDF5Constants.H5S_SELECT_SET,
-							new long[] { i - zChunk, 0, 0 },
-							new long[] { 1, 1, 1 }, new long[] { 1, 1, 1 },
-							new long[] { zChunk, nRows, nCols });
-					memSpace = H5.H5Screate_simple(3, new long[] { zChunk, nRows, nCols }, null);
+				if (i % framesPerWrite == 0) {
 					// Write to dataset and update GUI
-					H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, targetSpace, HDF5Constants.H5P_DEFAULT,
-							outputStream.toByteArray());
+					writeBlock(ds, targetSpace, outputStream.toByteArray(),
+							new long[] { i - framesPerWrite, 0, 0 },
+							new long[] { framesPerWrite, nRows, nCols });
 					mw.updateProgress((int) Math.floor((float) i / (float) (nFirstDim) * 100));
 					// clear out outputStream
 					outputStream.close();
@@ -196,16 +369,13 @@ public class CompressThread implements Runnable {
 				}
 			}
 			// write the rest data to h5 file
-			if (nFirstDim % zChunk > 0) {
-				int rest = nFirstDim % zChunk;
-				int start = nFirstDim - (nFirstDim % zChunk);
-				memSpace = H5.H5Screate_simple(3, new long[] { rest, nRows, nCols }, null);
-				H5.H5Sselect_hyperslab(targetSpace, HDF5Constants.H5S_SELECT_SET, new long[] { start, 0, 0 },
-						new long[] { 1, 1, 1 }, new long[] { 1, 1, 1 }, new long[] { rest, nRows, nCols });
-
+			if (nFirstDim % framesPerWrite > 0) {
+				int rest = nFirstDim % framesPerWrite;
+				int start = nFirstDim - (nFirstDim % framesPerWrite);
 				// Write to dataset and update GUI
-				H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, targetSpace, HDF5Constants.H5P_DEFAULT,
-						outputStream.toByteArray());
+				writeBlock(ds, targetSpace, outputStream.toByteArray(),
+						new long[] { start, 0, 0 },
+						new long[] { rest, nRows, nCols });
 				mw.updateProgress(100);
 				// close outputStream
 				outputStream.close();
@@ -215,12 +385,11 @@ public class CompressThread implements Runnable {
 		}
 	}
 
-	public void writeFourDDataset(long ds, long targetSpace, ImagePlus imp, int zChunk) {
+	public void writeFourDDataset(long ds, long targetSpace, ImagePlus imp, int framesPerWrite) {
 		byte[] pixels = null;
 		ImageProcessor imageProcessor;
 		int slice = 1;
 
-		long memSpace = -1;
 		ByteArrayOutputStream outputStream = new ByteArrayOutputStream();
 		int stackType = getImageStackType(imp);
 
@@ -270,15 +439,11 @@ public class CompressThread implements Runnable {
 
 					++counter;
 
-					if (i % zChunk == 0) {
-						H5.H5Sselect_hyperslab(targetSpace, HDF5Constants.H5S_SELECT_SET,
-								new long[] { c - 1, i - zChunk, 0, 0 },
-								new long[] { 1, 1, 1, 1 }, new long[] { 1, 1, 1, 1 },
-								new long[] { 1, zChunk, nRows, nCols });
-						memSpace = H5.H5Screate_simple(4, new long[] { 1, zChunk, nRows, nCols }, null);
+					if (i % framesPerWrite == 0) {
 						// Write to dataset and update GUI
-						H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, targetSpace,
-								HDF5Constants.H5P_DEFAULT, outputStream.toByteArray());
+						writeBlock(ds, targetSpace, outputStream.toByteArray(),
+								new long[] { c - 1, i - framesPerWrite, 0, 0 },
+								new long[] { 1, framesPerWrite, nRows, nCols });
 						mw.updateProgress((int) Math.floor((float) counter / (float) (nFirstDim * nSecondDim) * 100));
 						// clear out outputStream
 						outputStream.close();
@@ -286,23 +451,18 @@ public class CompressThread implements Runnable {
 					}
 				}
 				// write the rest data to h5 file
-				if (nSecondDim % zChunk > 0) {
-					int rest = nSecondDim % zChunk;
-					int start = nSecondDim - (nSecondDim % zChunk);
+				if (nSecondDim % framesPerWrite > 0) {
+					int rest = nSecondDim % framesPerWrite;
+					int start = nSecondDim - (nSecondDim % framesPerWrite);
 
-					memSpace = H5.H5Screate_simple(4, new long[] { 1, rest, nRows, nCols }, null);
-					H5.H5Sselect_hyperslab(targetSpace, HDF5Constants.H5S_SELECT_SET,
+					// Write to dataset and update GUI
+					writeBlock(ds, targetSpace, outputStream.toByteArray(),
 							new long[] { c - 1, start, 0, 0 },
-							new long[] { 1, 1, 1, 1 },
-							new long[] { 1, 1, 1, 1 },
 							new long[] { 1, rest, nRows, nCols });
-
-					// Write to dataset and update GUI
-					H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, targetSpace, HDF5Constants.H5P_DEFAULT,
-							outputStream.toByteArray());
 					mw.updateProgress((int) Math.floor((float) counter / (float) (nFirstDim * nSecondDim) * 100));
-					// close outputStream
+					// the next channel starts a new buffer
 					outputStream.close();
+					outputStream = new ByteArrayOutputStream();
 				}
 			}
 		} catch (OutOfMemoryError | IOException e) {
@@ -310,12 +470,11 @@ public class CompressThread implements Runnable {
 		}
 	}
 
-	public void writeFiveDDataset(long ds, long targetSpace, ImagePlus imp, int zChunk) {
+	public void writeFiveDDataset(long ds, long targetSpace, ImagePlus imp, int framesPerWrite) {
 		byte[] pixels = null;
 		ImageProcessor imageProcessor;
 		int slice = 1;
 
-		long memSpace = -1;
 		ByteArrayOutputStream outputStream = new ByteArrayOutputStream();
 
 		int nRows = imp.getHeight();
@@ -339,15 +498,11 @@ public class CompressThread implements Runnable {
 
 						++counter;
 
-						if (i % zChunk == 0) {
-							H5.H5Sselect_hyperslab(targetSpace, HDF5Constants.H5S_SELECT_SET,
-									new long[] { c - 1, t - 1, i - zChunk, 0, 0 },
-									new long[] { 1, 1, 1, 1, 1 }, new long[] { 1, 1, 1, 1, 1 },
-									new long[] { 1, 1, zChunk, nRows, nCols });
-							memSpace = H5.H5Screate_simple(5, new long[] { 1, 1, zChunk, nRows, nCols }, null);
+						if (i % framesPerWrite == 0) {
 							// Write to dataset and update GUI
-							H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, targetSpace,
-									HDF5Constants.H5P_DEFAULT, outputStream.toByteArray());
+							writeBlock(ds, targetSpace, outputStream.toByteArray(),
+									new long[] { c - 1, t - 1, i - framesPerWrite, 0, 0 },
+									new long[] { 1, 1, framesPerWrite, nRows, nCols });
 							mw.updateProgress(
 									(int) Math.floor(
 											(float) counter / (float) (nFirstDim * nSecondDim * nThirdDim) * 100));
@@ -357,22 +512,18 @@ public class CompressThread implements Runnable {
 						}
 					}
 					// write the rest data to h5 file
-					if (nThirdDim % zChunk > 0) {
-						int rest = nThirdDim % zChunk;
-						int start = nThirdDim - (nThirdDim % zChunk);
-						memSpace = H5.H5Screate_simple(5, new long[] { 1, 1, rest, nRows, nCols }, null);
-						H5.H5Sselect_hyperslab(targetSpace, HDF5Constants.H5S_SELECT_SET,
+					if (nThirdDim % framesPerWrite > 0) {
+						int rest = nThirdDim % framesPerWrite;
+						int start = nThirdDim - (nThirdDim % framesPerWrite);
+						// Write to dataset and update GUI
+						writeBlock(ds, targetSpace, outputStream.toByteArray(),
 								new long[] { c - 1, t - 1, start, 0, 0 },
-								new long[] { 1, 1, 1, 1, 1 }, new long[] { 1, 1, 1, 1, 1 },
 								new long[] { 1, 1, rest, nRows, nCols });
-
-						// Write to dataset and update GUI
-						H5.H5Dwrite(ds, HDF5Constants.H5T_NATIVE_UINT8, memSpace, targetSpace,
-								HDF5Constants.H5P_DEFAULT, outputStream.toByteArray());
 						mw.updateProgress(
 								(int) Math.floor((float) counter / (float) (nFirstDim * nSecondDim * nThirdDim) * 100));
-						// close outputStream
+						// the next time point starts a new buffer
 						outputStream.close();
+						outputStream = new ByteArrayOutputStream();
 					}
 				}
 			}
@@ -404,9 +555,18 @@ public class CompressThread implements Runnable {
 			int nCols = imp.getWidth();
 			int nSlices = imp.getNSlices();
 			long space;
-			final int[] CHUNK_SIZES = { nCols, nRows, nSlices };
+			long frameBytes = (long) nRows * nCols;
+			nativeWriter = FFH5Native.isAvailable();
+			final int[] CHUNK_SIZES = { nCols, nRows, chooseChunkFrames(nSlices, frameBytes) };
 			int stackType = getImageStackType(imp);
 			int zChunk = CHUNK_SIZES[2];
+			// the parallel writer gets several chunks per call, one per core at most
+			int chunksPerWrite = 1;
+			if (nativeWriter) {
+				chunksPerWrite = (int) Math.max(1, Math.min(Runtime.getRuntime().availableProcessors(),
+						Constants.MAX_BLOCK_BYTES / (frameBytes * zChunk)));
+			}
+			int framesPerWrite = zChunk * chunksPerWrite;
 
 			space = prepareMemorySpace(imp);
 
@@ -414,7 +574,10 @@ public class CompressThread implements Runnable {
 			fid = H5.H5Fcreate(filename, HDF5Constants.H5F_ACC_TRUNC, HDF5Constants.H5P_DEFAULT,
 					HDF5Constants.H5P_DEFAULT);
 
-			int[] cd_values = new int[11];
+			// the threading parameters are only appended when set, so files stay
+			// identical to the ones written by older versions otherwise
+			boolean withThreads = threads > 0 || threadType != Constants.FFH5_THREAD_AUTO;
+			int[] cd_values = new int[withThreads ? 13 : 11];
 
 			// Set filter parameters
 			cd_values[0] = encoderId;
@@ -428,13 +591,17 @@ public class CompressThread implements Runnable {
 			cd_values[8] = crf;
 			cd_values[9] = filmGrain;
 			cd_values[10] = 0;
+			if (withThreads) {
+				cd_values[11] = threads;
+				cd_values[12] = threadType;
+			}
 
 			for (int d : cd_values) { 
 				System.out.print(d + ", ");
 			}
 			System.out.println();
 
-			int r = H5.H5Pset_filter(plist, Constants.FILTER_ID, HDF5Constants.H5Z_FLAG_OPTIONAL, 11, cd_values);
+			int r = H5.H5Pset_filter(plist, Constants.FILTER_ID, HDF5Constants.H5Z_FLAG_OPTIONAL, cd_values.length, cd_values);
 			if (r < 0) {
 				System.out.println("Error: " + r);
 				return;
@@ -458,19 +625,24 @@ public class CompressThread implements Runnable {
 					HDF5Constants.H5P_DEFAULT);
 			long targetSpace = H5.H5Scopy(space);
 
+			// pyramid levels get the frames of each chunk as they are written
+			if (pyramidLevels > 0) {
+				writePyramidAttribute(ds, createLevels(fid, space, cd_values, zChunk));
+			}
+
 			switch (stackType) {
 				case Constants.IMAGE_ZYX:
 				case Constants.IMAGE_TYX:
 				case Constants.IMAGE_CYX:
-					writeThreeDDataset(ds, targetSpace, imp, zChunk);
+					writeThreeDDataset(ds, targetSpace, imp, framesPerWrite);
 					break;
 				case Constants.IMAGE_CZYX:
 				case Constants.IMAGE_CTYX:
 				case Constants.IMAGE_TZYX:
-					writeFourDDataset(ds, targetSpace, imp, zChunk);
+					writeFourDDataset(ds, targetSpace, imp, framesPerWrite);
 					break;
 				case Constants.IMAGE_CTZYX:
-					writeFiveDDataset(ds, targetSpace, imp, zChunk);
+					writeFiveDDataset(ds, targetSpace, imp, framesPerWrite);
 					break;
 
 				default:
@@ -478,6 +650,9 @@ public class CompressThread implements Runnable {
 			}
 
 			// Cleanup
+			for (long level : levelDs) {
+				H5.H5Dclose(level);
+			}
 			H5.H5Dclose(ds);
 			H5.H5Fflush(fid, HDF5Constants.H5F_SCOPE_LOCAL);
 			H5.H5Fclose(fid);
@@ -488,6 +663,9 @@ public class CompressThread implements Runnable {
 			e.printStackTrace();
 			imp.unlock();
 			try {
+				for (long level : levelDs) {
+					H5.H5Dclose(level);
+				}
 				if (ds != -1) {
 					H5.H5Dclose(ds);
 				}
@@ -12,6 +12,21 @@ public class Constants {
     static final int IMAGE_TZYX = 5;    
     static final int IMAGE_CTZYX = 6;
 
+    // Codec threading (optional cd_values[11], cd_values[12])
+    static final int FFH5_THREAD_AUTO = 0;
+    static final int FFH5_THREAD_FRAME = 1;
+    static final int FFH5_THREAD_SLICE = 2;
+
+    // Pyramid levels data_2x, data_4x, ... (2x2 block mean or max per level)
+    static final int PYRAMID_MEAN = 0;
+    static final int PYRAMID_MAX = 1;
+    // levels stop before frames get smaller than this
+    static final int PYRAMID_MIN_SIZE = 32;
+
+    // Parallel writer (FFH5Native): shortest chunks it splits stacks into, and the
+    // largest block of frames passed in one Java array
+    static final int MIN_CHUNK_FRAMES = 16;
+    static final long MAX_BLOCK_BYTES = 1L << 30;
 
     // ENCODERS
     static final int FFH5_ENC_MPEG4 = 0;
@@ -24,6 +39,9 @@ public class Constants {
     static final int FFH5_ENC_RAV1E = 7;
     static final int FFH5_ENC_AV1_NV = 8;
     static final int FFH5_ENC_AV1_QSV = 9;
+    // lossless, intra only
+    static final int FFH5_ENC_FFV1 = 10;
+    static final int FFH5_ENC_X264_LOSSLESS = 11;
     
     // DECODERS
     static final int FFH5_DEC_MPEG4 = 0;
@@ -35,6 +53,7 @@ public class Constants {
     static final int FFH5_DEC_DAV1D = 6;
     static final int FFH5_DEC_AV1_CUVID = 7;
     static final int FFH5_DEC_AV1_QSV = 8;
+    static final int FFH5_DEC_FFV1 = 9;
 
     // PRESETS
     /*
@@ -0,0 +1,93 @@
+package com.cailab.hdf5compression;
+
+import java.io.File;
+import java.lang.reflect.Array;
+
+import hdf.hdf5lib.H5;
+
+/**
+ * JNI entry points of the filter library (src/ffmpeg_jni.c): chunks of a region of
+ * whole chunks, such as a z-slab, are encoded or decoded concurrently on the filter's
+ * worker pool and moved with H5Dwrite_chunk / H5Dread_chunk, instead of one chunk at a
+ * time through the HDF5 filter pipeline.
+ *
+ * The library is looked up at -Dh5ffmpeg.library=/path/to/libh5ffmpeg_shared.so, then
+ * in HDF5_PLUGIN_PATH, then on java.library.path. It must use the same libhdf5 as the
+ * HDF5 Java binding; without it, or with -Dh5ffmpeg.native=false, isAvailable() is
+ * false and callers keep using H5Dwrite / H5Dread.
+ */
+public final class FFH5Native {
+	private static final String LIBRARY = "h5ffmpeg_shared";
+	private static final boolean AVAILABLE = load();
+
+	private FFH5Native() {
+	}
+
+	private static boolean load() {
+		if ("false".equals(System.getProperty("h5ffmpeg.native"))) {
+			return false;
+		}
+		try {
+			String path = System.getProperty("h5ffmpeg.library");
+			if (path != null) {
+				System.load(path);
+				return true;
+			}
+			String pluginPath = System.getenv("HDF5_PLUGIN_PATH");
+			if (pluginPath != null) {
+				for (String dir : pluginPath.split(File.pathSeparator)) {
+					File lib = new File(dir, System.mapLibraryName(LIBRARY));
+					if (lib.isFile()) {
+						System.load(lib.getAbsolutePath());
+						return true;
+					}
+				}
+			}
+			System.loadLibrary(LIBRARY);
+			return true;
+		} catch (UnsatisfiedLinkError | SecurityException e) {
+			System.out.println("Parallel chunk coding not available: " + e.getMessage());
+			return false;
+		}
+	}
+
+	public static boolean isAvailable() {
+		return AVAILABLE;
+	}
+
+	private static native int writeRegion0(long dset, long[] start, long[] count, Object buf, long bufBytes,
+			int threads);
+
+	private static native int readRegion0(long dset, long[] start, long[] count, Object buf, long bufBytes,
+			int threads);
+
+	/** size of a primitive array in bytes, checked against the region natively */
+	private static long byteSize(Object buf) {
+		Class<?> type = buf.getClass().getComponentType();
+		if (type == null || !type.isPrimitive()) {
+			throw new IllegalArgumentException("buf must be a primitive array");
+		}
+		int size = (type == byte.class || type == boolean.class) ? 1
+				: (type == short.class || type == char.class) ? 2 : (type == int.class || type == float.class) ? 4 : 8;
+		return (long) Array.getLength(buf) * size;
+	}
+
+	/**
+	 * Encode and store the region start / count of dataset dset from buf (a primitive
+	 * array of the dataset type, C order) on threads threads (0: one per core).
+	 * Returns 0 on success, negative on failure.
+	 */
+	public static int writeRegion(long dset, long[] start, long[] count, Object buf, int threads) {
+		// the Java binding serializes HDF5 calls on H5.class, so do we
+		synchronized (H5.class) {
+			return writeRegion0(dset, start, count, buf, byteSize(buf), threads);
+		}
+	}
+
+	/** Read and decode the region start / count of dset into buf, see writeRegion. */
+	public static int readRegion(long dset, long[] start, long[] count, Object buf, int threads) {
+		synchronized (H5.class) {
+			return readRegion0(dset, start, count, buf, byteSize(buf), threads);
+		}
+	}
+}
@@ -71,7 +71,7 @@ public class MainWindow extends javax.swing.JFrame implements PlugInFilter {
             }
         });
 
-        encoderComboBox.setModel(new javax.swing.DefaultComboBoxModel<>(new String[] { "mpeg4", "libxvid", "libx264", "h264_nvenc", "libx265", "hevc_nvenc", "libsvtav1", "librav1e", "av1_nvenc", "av1_qsv", " " }));
+        encoderComboBox.setModel(new javax.swing.DefaultComboBoxModel<>(new String[] { "mpeg4", "libxvid", "libx264", "h264_nvenc", "libx265", "hevc_nvenc", "libsvtav1", "librav1e", "av1_nvenc", "av1_qsv", "ffv1", "libx264 lossless", " " }));
         encoderComboBox.setSelectedIndex(2);
         encoderComboBox.addActionListener(new java.awt.event.ActionListener() {
             public void actionPerformed(java.awt.event.ActionEvent evt) {
@@ -303,6 +303,10 @@ public class MainWindow extends javax.swing.JFrame implements PlugInFilter {
 				return Constants.FFH5_DEC_AV1_CUVID;
 			case Constants.FFH5_ENC_AV1_QSV:
 				return Constants.FFH5_DEC_AV1_QSV;
+			case Constants.FFH5_ENC_FFV1:
+				return Constants.FFH5_DEC_FFV1;
+			case Constants.FFH5_ENC_X264_LOSSLESS:
+				return Constants.FFH5_DEC_H264;
 			default:
 				return c_id;
 		}
@@ -311,6 +315,7 @@ public class MainWindow extends javax.swing.JFrame implements PlugInFilter {
     private int getPresetAndTuneOffset() {
         switch (encoderComboBox.getSelectedIndex()) {
             case Constants.FFH5_ENC_X264:
+            case Constants.FFH5_ENC_X264_LOSSLESS:
                 return 10;
             case Constants.FFH5_ENC_H264_NV:
                 return 100;
@@ -354,6 +359,7 @@ public class MainWindow extends javax.swing.JFrame implements PlugInFilter {
         switch(encoderComboBox.getSelectedIndex()) {
             /* x264 and x265 */
             case Constants.FFH5_ENC_X264:
+            case Constants.FFH5_ENC_X264_LOSSLESS:
             case Constants.FFH5_ENC_X265:
                 presetComboBox.setModel(new javax.swing.DefaultComboBoxModel<>(new String[] { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow" }));
                 tuneComboBox.setModel(new javax.swing.DefaultComboBoxModel<>(new String[] { "psnr", "ssim", "grain", "fastdecode", "zerolatency", "animation", "film", "stillimage" }));
@@ -406,7 +412,18 @@ public class MainWindow extends javax.swing.JFrame implements PlugInFilter {
         cancelButton.setVisible(true);
         compressButton.setEnabled(false);
 
-        CompressThread ct = new CompressThread(this, selectedFilename, encoderId, decoderId, presetId, tuneType, crf, filmGrain);
+        // codec threads can be pinned with -Dh5ffmpeg.threads=N (and -Dh5ffmpeg.threadType=1|2)
+        int threads = Integer.getInteger("h5ffmpeg.threads", 0);
+        int threadType = Integer.getInteger("h5ffmpeg.threadType", Constants.FFH5_THREAD_AUTO);
+        // downsampled levels with -Dh5ffmpeg.pyramid=N (and -Dh5ffmpeg.pyramidMode=max)
+        int pyramidLevels = Integer.getInteger("h5ffmpeg.pyramid", 0);
+        int pyramidMode = "max".equals(System.getProperty("h5ffmpeg.pyramidMode")) ? Constants.PYRAMID_MAX
+                : Constants.PYRAMID_MEAN;
+
+        CompressThread ct = new CompressThread(this, selectedFilename, encoderId, decoderId, presetId, tuneType, crf,
+                filmGrain, threads, threadType, pyramidLevels, pyramidMode);
+        // frames per chunk with -Dh5ffmpeg.chunkFrames=N (0: whole stack, split per core when parallel)
+        ct.setChunkFrames(Integer.getInteger("h5ffmpeg.chunkFrames", 0));
         currThread = new Thread(ct);
         currThread.start();
     }//GEN-LAST:event_compressButtonActionPerformed
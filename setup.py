@@ -6,7 +6,7 @@ import subprocess
 from setuptools import setup, Extension, find_packages
 from setuptools.command.build_ext import build_ext
 
-__VERSION__ = "2.4.0"
+__VERSION__ = "2.5.0"
 
 def is_building_sdist():
     return "sdist" in sys.argv or "egg_info" in sys.argv
@@ -99,6 +99,21 @@ if is_building_sdist():
             os.path.join("src", "ffmpeg_native.c"),
             os.path.join("src", "ffmpeg_utils.c"),
             os.path.join("src", "ffmpeg_h5plugin.c"),
+            os.path.join("src", "ffmpeg_cache.c"),
+            os.path.join("src", "ffmpeg_codec.c"),
+            os.path.join("src", "ffmpeg_pool.c"),
+            os.path.join("src", "ffmpeg_h5parallel.c"),
+            os.path.join("src", "ffmpeg_pixconv.c"),
+            os.path.join("src", "ffmpeg_ratio.c"),
+            os.path.join("src", "ffmpeg_hw.c"),
+            os.path.join("src", "ffmpeg_sched.c"),
+            os.path.join("src", "ffmpeg_stream.c"),
+            os.path.join("src", "ffmpeg_chunkcache.c"),
+            os.path.join("src", "ffmpeg_stats.c"),
+            os.path.join("src", "ffmpeg_quant.c"),
+            os.path.join("src", "ffmpeg_caps.c"),
+            os.path.join("src", "ffmpeg_downsample.c"),
+            os.path.join("src", "ffmpeg_rdcc.c"),
         ],
     )
 
@@ -122,6 +137,32 @@ else:
         os.path.join(src_dir, "ffmpeg_h5plugin.c"),
         os.path.join(src_dir, "ffmpeg_utils.c"),
         os.path.join(src_dir, "ffmpeg_native.c"),
+        os.path.join(src_dir, "ffmpeg_cache.c"),
+        os.path.join(src_dir, "ffmpeg_codec.c"),
+        os.path.join(src_dir, "ffmpeg_cache.h"),
+        os.path.join(src_dir, "ffmpeg_codec.h"),
+        os.path.join(src_dir, "ffmpeg_thread.h"),
+        os.path.join(src_dir, "ffmpeg_pool.c"),
+        os.path.join(src_dir, "ffmpeg_pool.h"),
+        os.path.join(src_dir, "ffmpeg_h5parallel.c"),
+        os.path.join(src_dir, "ffmpeg_pixconv.c"),
+        os.path.join(src_dir, "ffmpeg_pixconv.h"),
+        os.path.join(src_dir, "ffmpeg_ratio.c"),
+        os.path.join(src_dir, "ffmpeg_ratio.h"),
+        os.path.join(src_dir, "ffmpeg_hw.c"),
+        os.path.join(src_dir, "ffmpeg_hw.h"),
+        os.path.join(src_dir, "ffmpeg_sched.c"),
+        os.path.join(src_dir, "ffmpeg_sched.h"),
+        os.path.join(src_dir, "ffmpeg_stream.c"),
+        os.path.join(src_dir, "ffmpeg_chunkcache.c"),
+        os.path.join(src_dir, "ffmpeg_chunkcache.h"),
+        os.path.join(src_dir, "ffmpeg_stats.c"),
+        os.path.join(src_dir, "ffmpeg_stats.h"),
+        os.path.join(src_dir, "ffmpeg_quant.c"),
+        os.path.join(src_dir, "ffmpeg_caps.c"),
+        os.path.join(src_dir, "ffmpeg_caps.h"),
+        os.path.join(src_dir, "ffmpeg_downsample.c"),
+        os.path.join(src_dir, "ffmpeg_rdcc.c"),
     ]
 
     for file_path in required_files:
@@ -367,6 +408,8 @@ else:
     extra_link_args = []
 
     if system == "linux":
+        # shm_open lives in librt before glibc 2.34
+        libraries.append("rt")
         extra_compile_args.extend(["-std=c99", "-fPIC", "-D_POSIX_C_SOURCE=200809L"])
         extra_link_args.extend(["-Wl,--no-as-needed"])
         for dir_path in library_dirs:
@@ -399,6 +442,21 @@ else:
             os.path.join("src", "ffmpeg_h5plugin.c"),
             os.path.join("src", "ffmpeg_native.c"),
             os.path.join("src", "ffmpeg_utils.c"),
+            os.path.join("src", "ffmpeg_cache.c"),
+            os.path.join("src", "ffmpeg_codec.c"),
+            os.path.join("src", "ffmpeg_pool.c"),
+            os.path.join("src", "ffmpeg_h5parallel.c"),
+            os.path.join("src", "ffmpeg_pixconv.c"),
+            os.path.join("src", "ffmpeg_ratio.c"),
+            os.path.join("src", "ffmpeg_hw.c"),
+            os.path.join("src", "ffmpeg_sched.c"),
+            os.path.join("src", "ffmpeg_stream.c"),
+            os.path.join("src", "ffmpeg_chunkcache.c"),
+            os.path.join("src", "ffmpeg_stats.c"),
+            os.path.join("src", "ffmpeg_quant.c"),
+            os.path.join("src", "ffmpeg_caps.c"),
+            os.path.join("src", "ffmpeg_downsample.c"),
+            os.path.join("src", "ffmpeg_rdcc.c"),
         ],
         include_dirs=include_dirs,
         library_dirs=library_dirs,
@@ -489,6 +547,9 @@ setup(
     },
     python_requires=">=3.10,<4.0",
     cmdclass={"build_ext": CustomBuildExt},
+    entry_points={
+        "console_scripts": ["h5ffmpeg-bench=h5ffmpeg.bench:main"],
+    },
     license="MIT",
     classifiers=[
         "Development Status :: 4 - Beta",
@@ -0,0 +1,1169 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Per-thread encoder/decoder context cache.
+ *
+ * Every chunk used to pay for avcodec_find_*, avcodec_open2, parser,
+ * frame and sws setup, which dominates the run time for datasets with
+ * many small chunks.  Opened contexts are kept in a small thread-local
+ * LRU list keyed on cd_values (depth excluded, it does not affect any
+ * of the cached objects) and reset between chunks instead.
+ *
+ * Environment variables (read once per process):
+ *  H5FFMPEG_CONTEXT_CACHE=0       disable caching entirely
+ *  H5FFMPEG_CONTEXT_CACHE_SIZE=N  contexts kept per thread (default 4)
+ *
+ */
+
+#include "ffmpeg_cache.h"
+#include "ffmpeg_thread.h"
+#include "ffmpeg_sched.h"
+#include "ffmpeg_stats.h"
+
+static ffh5_once_t cache_once = FFH5_ONCE_INIT;
+static ffh5_tls_key_t cache_key;
+static int cache_key_valid = 0;
+static int cache_enabled = 1;
+static int cache_size = FFH5_CACHE_DEFAULT_SIZE;
+
+static void destroy_entry(FFH5CodecEntry *entry);
+
+static void FFH5_TLS_CALLBACK cache_thread_exit(void *head)
+{
+    FFH5CodecEntry *entry = (FFH5CodecEntry *)head;
+
+    while (entry)
+    {
+        FFH5CodecEntry *next = entry->next;
+        destroy_entry(entry);
+        entry = next;
+    }
+}
+
+/* Runs at exit or when the plugin is unloaded: the thread-exit callback
+ * must not outlive our code.  Cached contexts are deliberately leaked
+ * here, hardware runtimes may already be torn down at this point.
+ */
+static void cache_shutdown(void)
+{
+    if (!cache_key_valid)
+        return;
+
+    cache_key_valid = 0;
+    ffh5_tls_delete(cache_key);
+}
+
+static void cache_init(void)
+{
+    const char *env;
+
+    env = getenv("H5FFMPEG_CONTEXT_CACHE");
+    if (env && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0 || strcmp(env, "false") == 0))
+        cache_enabled = 0;
+
+    env = getenv("H5FFMPEG_CONTEXT_CACHE_SIZE");
+    if (env && *env)
+    {
+        cache_size = atoi(env);
+        if (cache_size <= 0)
+            cache_enabled = 0;
+    }
+
+    if (cache_enabled)
+    {
+        if (ffh5_tls_create(&cache_key, cache_thread_exit) == 0)
+        {
+            cache_key_valid = 1;
+            atexit(cache_shutdown);
+        }
+        else
+            cache_enabled = 0;
+    }
+}
+
+/*
+ * Function:  make_key
+ * --------------------
+ * build the lookup key from cd_values, masking parameters that do not
+ * influence the cached contexts
+ *
+ */
+static size_t make_key(int is_encoder, size_t cd_nelmts, const unsigned int cd_values[],
+                       unsigned int key[FFH5_MAX_CD_VALUES])
+{
+    size_t i, n = (cd_nelmts > FFH5_MAX_CD_VALUES) ? FFH5_MAX_CD_VALUES : cd_nelmts;
+
+    memset(key, 0, FFH5_MAX_CD_VALUES * sizeof(unsigned int));
+    for (i = 0; i < n; i++)
+        key[i] = cd_values[i];
+
+    /* depth only changes the number of frames sent */
+    key[4] = 0;
+    if (!is_encoder)
+    {
+        /* decoders only care about decoder, geometry, bit mode and gpu */
+        key[0] = 0;
+        key[6] = 0;
+        key[7] = 0;
+        key[8] = 0;
+        key[9] = 0;
+        key[FFH5_CD_GOP_SIZE] = 0;
+        key[FFH5_CD_FEATURES] = 0;
+    }
+
+    return n;
+}
+
+/* tiles or slices per frame asked for in cd_values[14] / [15] */
+static unsigned int tile_count(const unsigned int cd_values[])
+{
+    unsigned int cols = cd_values[FFH5_CD_TILE_COLS], rows = cd_values[FFH5_CD_TILE_ROWS];
+
+    return (cols ? cols : 1) * (rows ? rows : 1);
+}
+
+/*
+ * Function:  configure_threads
+ * --------------------
+ * apply the optional thread count (cd_values[11]) and thread type
+ * (cd_values[12]) to a codec context before it is opened; zero keeps
+ * the library defaults, unless frames are tiled (cd_values[14] / [15])
+ *
+ */
+static void configure_threads(AVCodecContext *c, const unsigned int cd_values[])
+{
+    unsigned int threads = cd_values[FFH5_CD_THREADS];
+
+    if (threads > 0)
+        c->thread_count = (int)threads;
+
+    switch (cd_values[FFH5_CD_THREAD_TYPE])
+    {
+    case FFH5_THREAD_FRAME:
+        c->thread_type = FF_THREAD_FRAME;
+        break;
+    case FFH5_THREAD_SLICE:
+        c->thread_type = FF_THREAD_SLICE;
+        break;
+    default:
+        /* tiled frames are coded in parallel within the frame, which is
+         * what shallow chunks of huge frames need; FFV1 frames are
+         * always cut into slices */
+        if (tile_count(cd_values) > 1 || cd_values[0] == FFH5_ENC_FFV1)
+        {
+            if (threads == 0)
+                c->thread_count = 0;
+            c->thread_type = FF_THREAD_SLICE;
+        }
+        break;
+    }
+}
+
+/* FFV1 slices per frame unless more tiles are asked for */
+#define FFV1_DEFAULT_SLICES 4
+/* frames below this on a side are coded as one slice */
+#define FFV1_MIN_SLICED 32
+
+/* largest slice count FFV1 accepts up to count: v x h slices with
+ * v <= h < 2v, at least the default */
+static unsigned int ffv1_slices(unsigned int count, int width, int height)
+{
+    unsigned int v, h, best = FFV1_DEFAULT_SLICES;
+
+    if (width < FFV1_MIN_SLICED || height < FFV1_MIN_SLICED)
+        return 1;
+    for (v = 2; v * v <= count; v++)
+        for (h = v; h < 2 * v && v * h <= count; h++)
+            if (v * h > best)
+                best = v * h;
+    return best;
+}
+
+/* smallest n with (1 << n) >= count, SVT-AV1 takes tiles as log2 */
+static unsigned int log2_ceil(unsigned int count)
+{
+    unsigned int n = 0;
+
+    while ((1u << n) < count && n < 6)
+        n++;
+    return n;
+}
+
+/* whether the encoder lists fmt among the pixel formats it takes */
+static int codec_takes_format(const AVCodec *codec, enum AVPixelFormat fmt)
+{
+    const enum AVPixelFormat *p = NULL;
+
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+    if (avcodec_get_supported_config(NULL, codec, AV_CODEC_CONFIG_PIX_FORMAT, 0, (const void **)&p, NULL) < 0)
+        return 0;
+#else
+    p = codec->pix_fmts;
+#endif
+    /* no list: unknown, not "anything" */
+    for (; p && *p != AV_PIX_FMT_NONE; p++)
+    {
+        if (*p == fmt)
+            return 1;
+    }
+    return 0;
+}
+
+/* CUVID and QSV decoders output NV12/P010 only */
+static int is_hw_decoder(unsigned int dec_id)
+{
+    return dec_id == FFH5_DEC_H264_CUVID || dec_id == FFH5_DEC_HEVC_CUVID || dec_id == FFH5_DEC_AV1_CUVID ||
+           dec_id == FFH5_DEC_AV1_QSV;
+}
+
+/*
+ * Function:  configure_encoder
+ * --------------------
+ * set up pixel format, time base, presets, tunes and crf on a freshly
+ * allocated encoder context
+ *
+ */
+static void configure_encoder(AVCodecContext *c, const unsigned int cd_values[])
+{
+    enum EncoderCodecEnum c_id;
+    enum PresetIDEnum p_id;
+    enum TuneTypeEnum t_id;
+    int color_mode, crf, film_grain, gpu_id;
+    unsigned int threads, thread_type, gop_size, tile_cols, tile_rows, tiles;
+    char preset[50] = {0}, tune[160] = {0};
+    char film_grain_buffer[10];
+    char x265_params[128];
+
+    c_id = cd_values[0];
+    color_mode = cd_values[5];
+    p_id = cd_values[6];
+    t_id = cd_values[7];
+    crf = cd_values[8];
+    film_grain = cd_values[9]; // for svt-av1 particularly
+    gpu_id = cd_values[10];    // for nvenc only
+    threads = cd_values[FFH5_CD_THREADS];
+    thread_type = cd_values[FFH5_CD_THREAD_TYPE];
+    gop_size = cd_values[FFH5_CD_GOP_SIZE];
+    tile_cols = cd_values[FFH5_CD_TILE_COLS] ? cd_values[FFH5_CD_TILE_COLS] : 1;
+    tile_rows = cd_values[FFH5_CD_TILE_ROWS] ? cd_values[FFH5_CD_TILE_ROWS] : 1;
+    tiles = tile_cols * tile_rows;
+
+    if (c_id == FFH5_ENC_MPEG4 || c_id == FFH5_ENC_XVID || c_id == FFH5_ENC_FFV1)
+    {
+        p_id = FFH5_PRESET_NONE;
+        t_id = FFH5_TUNE_NONE;
+    }
+
+    find_preset(p_id, preset);
+    find_tune(t_id, tune);
+
+    /* set width and height */
+    c->width = cd_values[2];
+    c->height = cd_values[3];
+
+    switch (c_id)
+    {
+    // list those who support 10bit encoding (actually using 16bit)
+    case FFH5_ENC_X264:
+    case FFH5_ENC_X264_LOSSLESS:
+    case FFH5_ENC_SVTAV1:
+    case FFH5_ENC_RAV1E:
+        c->pix_fmt = (color_mode == 0) ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_YUV420P10;
+        break;
+    // gray natively, at the depth of the bit mode
+    case FFH5_ENC_FFV1:
+        c->pix_fmt = ffh5_gray_format(color_mode);
+        break;
+    case FFH5_ENC_X265:
+        switch (color_mode)
+        {
+        case 0: // 8bit
+            c->pix_fmt = AV_PIX_FMT_YUV420P;
+            break;
+        case 1: // 10bit
+            c->pix_fmt = AV_PIX_FMT_YUV420P10;
+            break;
+        case 2: // 12bit
+            c->pix_fmt = AV_PIX_FMT_YUV420P12;
+            break;
+        default:
+            c->pix_fmt = AV_PIX_FMT_YUV420P;
+        }
+        break;
+    // We have to use NV12
+    case FFH5_ENC_H264_NV:
+    case FFH5_ENC_HEVC_NV:
+    case FFH5_ENC_AV1_NV:
+    case FFH5_ENC_AV1_QSV:
+        c->pix_fmt = (color_mode == 0) ? AV_PIX_FMT_NV12 : AV_PIX_FMT_P010;
+        break;
+    default:
+        // common supported pixel format 8bit (actually using 16bit)
+        c->pix_fmt = AV_PIX_FMT_YUV420P;
+    }
+
+    /* 4:0:0 where the encoder codes it (x265, rav1e, x264 built with
+     * I400) and the dataset asks for it, readers before 2.5 expect 4:2:0:
+     * no chroma planes to fill, convert or code, and the gray frames are
+     * taken as they are.  Datasets read by a hardware decoder keep 4:2:0,
+     * also for the software fallback of NVENC, so a dataset never mixes
+     * chroma layouts */
+    if ((cd_values[FFH5_CD_FEATURES] & FFH5_FEATURE_MONOCHROME) && !is_hw_decoder(cd_values[1]) && c->codec &&
+        codec_takes_format(c->codec, ffh5_gray_format(color_mode)))
+        c->pix_fmt = ffh5_gray_format(color_mode);
+
+    /* frames per second */
+    c->time_base = (AVRational){1, 25};
+    c->framerate = (AVRational){25, 1};
+
+    configure_threads(c, cd_values);
+
+    /* random access: closed gops without b-frames keep packets in frame
+     * order, so each keyframe packet starts an independently decodable run */
+    if (gop_size > 0)
+    {
+        c->gop_size = (int)gop_size;
+        c->max_b_frames = 0;
+        c->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+    }
+
+    /* Presets and Tunes and CRFS */
+    switch (c_id)
+    {
+    case FFH5_ENC_X264:
+    case FFH5_ENC_X265:
+        if (strlen(preset) > 0)
+            av_opt_set(c->priv_data, "preset", preset, 0);
+        if (strlen(tune) > 0)
+            av_opt_set(c->priv_data, "tune", tune, 0);
+        if (crf < 52)
+            av_opt_set_int(c->priv_data, "crf", crf, 0);
+
+        /* libx264 takes thread_count/thread_type from the context,
+         * x265 sizes its own thread pool and frame threads */
+        stpcpy(x265_params, "log-level=0");
+        if (c_id == FFH5_ENC_X265 && threads > 0)
+        {
+            snprintf(x265_params + strlen(x265_params), sizeof(x265_params) - strlen(x265_params),
+                     ":pools=%u", threads);
+            if (thread_type == FFH5_THREAD_FRAME)
+                snprintf(x265_params + strlen(x265_params), sizeof(x265_params) - strlen(x265_params),
+                         ":frame-threads=%u", (threads > 16) ? 16 : threads);
+        }
+        if (c_id == FFH5_ENC_X265 && thread_type == FFH5_THREAD_SLICE)
+            strcat(x265_params, ":frame-threads=1");
+        /* every keyframe needs its own VPS/SPS/PPS to be a decoding entry point */
+        if (c_id == FFH5_ENC_X265 && gop_size > 0)
+            strcat(x265_params, ":repeat-headers=1:open-gop=0");
+        /* x265 has no tiles: slices, and wavefront rows within each */
+        if (c_id == FFH5_ENC_X265 && tiles > 1)
+            snprintf(x265_params + strlen(x265_params), sizeof(x265_params) - strlen(x265_params),
+                     ":slices=%u:wpp=1", tiles);
+        av_opt_set(c->priv_data, "x265-params", x265_params, 0);
+        /* with the slice thread type libx264 codes the slices of a frame in parallel */
+        if (c_id == FFH5_ENC_X264 && tiles > 1)
+            c->slices = (int)tiles;
+        break;
+    case FFH5_ENC_H264_NV:
+    case FFH5_ENC_HEVC_NV:
+    case FFH5_ENC_AV1_NV:
+        if (strlen(preset) > 0)
+            av_opt_set(c->priv_data, "preset", preset, 0);
+        if (strlen(tune) > 0)
+            av_opt_set(c->priv_data, "tune", tune, 0);
+        if (crf < 52)
+        {
+            /* we have to use constqp for Variable bitrate mode and set bit_rate to 0 (auto),
+             * otherwise the bitrate will be capped to ~2Mbs by NVENC
+             * instead of using cq mode, constqp is better to reflect different qps
+             */
+            av_opt_set(c->priv_data, "rc", "constqp", 0);
+            c->bit_rate = 0;
+            av_opt_set_int(c->priv_data, "qp", crf, 0);
+        }
+
+        av_opt_set_int(c->priv_data, "gpu", gpu_id, 0);
+        if (tiles > 1 && c_id == FFH5_ENC_AV1_NV)
+        {
+            av_opt_set_int(c->priv_data, "tile-columns", tile_cols, 0);
+            av_opt_set_int(c->priv_data, "tile-rows", tile_rows, 0);
+        }
+        else if (tiles > 1)
+            c->slices = (int)tiles;
+        break;
+    case FFH5_ENC_SVTAV1:
+        if (strlen(preset) > 0)
+            av_opt_set_int(c->priv_data, "preset", atoi(preset), 0);
+
+        /* By default, for SVT-AV1, the maximum value for film_grain parameter,
+         * If we want to enable film_grain parameter value > 50,
+         * we have to change the SVT-AV1 source code and recompile it.
+         */
+        snprintf(film_grain_buffer, 10, "%d", film_grain);
+
+        if (strlen(tune) > 0)
+        {
+            strcat(tune, ":film-grain=");
+            strcat(tune, film_grain_buffer);
+        }
+        else
+        {
+            stpcpy(tune, "film-grain=");
+            strcat(tune, film_grain_buffer);
+        }
+        if (film_grain > 0)
+            strcat(tune, ":film-grain-denoise=1");
+        strcat(tune, ":enable-tf=0");
+        if (threads > 0)
+            snprintf(tune + strlen(tune), sizeof(tune) - strlen(tune), ":lp=%u", threads);
+        /* closed (key frame) intra refresh for random access */
+        if (gop_size > 0)
+            strcat(tune, ":irefresh-type=2");
+        if (tiles > 1)
+            snprintf(tune + strlen(tune), sizeof(tune) - strlen(tune), ":tile-columns=%u:tile-rows=%u",
+                     log2_ceil(tile_cols), log2_ceil(tile_rows));
+
+        av_opt_set(c->priv_data, "svtav1-params", tune, 0);
+        if (crf < 64)
+            av_opt_set_int(c->priv_data, "crf", crf, 0);
+        break;
+    case FFH5_ENC_RAV1E:
+        if (strlen(preset) > 0)
+            av_opt_set_int(c->priv_data, "speed", atoi(preset), 0);
+        if (strlen(tune) > 0)
+            av_opt_set(c->priv_data, "rav1e-params", tune, 0);
+        if (crf < 255)
+            av_opt_set_int(c->priv_data, "qp", crf, 0);
+        if (tiles > 1)
+        {
+            av_opt_set_int(c->priv_data, "tile-columns", tile_cols, 0);
+            av_opt_set_int(c->priv_data, "tile-rows", tile_rows, 0);
+        }
+        break;
+    case FFH5_ENC_AV1_QSV:
+        if (strlen(preset) > 0)
+            av_opt_set(c->priv_data, "preset", preset, 0);
+        if (strlen(tune) > 0)
+            av_opt_set(c->priv_data, "scenario", tune, 0);
+        if (crf < 52)
+            av_opt_set_int(c->priv_data, "global_quality", crf, 0);
+        if (tiles > 1)
+        {
+            av_opt_set_int(c->priv_data, "tile_cols", tile_cols, 0);
+            av_opt_set_int(c->priv_data, "tile_rows", tile_rows, 0);
+        }
+        break;
+    case FFH5_ENC_FFV1:
+        /* version 3 carries slices and per slice crcs; every frame a
+         * keyframe so no frame depends on the contexts of the one before */
+        av_opt_set_int(c->priv_data, "level", 3, 0);
+        c->slices = (int)ffv1_slices(tiles, c->width, c->height);
+        c->gop_size = 1;
+        break;
+    case FFH5_ENC_X264_LOSSLESS:
+        /* qp 0 is lossless (High 4:4:4 Predictive), crf is meaningless */
+        if (strlen(preset) > 0)
+            av_opt_set(c->priv_data, "preset", preset, 0);
+        if (strlen(tune) > 0)
+            av_opt_set(c->priv_data, "tune", tune, 0);
+        av_opt_set_int(c->priv_data, "qp", 0, 0);
+        av_opt_set(c->priv_data, "x264-params", "log-level=0", 0);
+        /* intra only: all IDR frames */
+        c->gop_size = 1;
+        c->max_b_frames = 0;
+        if (tiles > 1)
+            c->slices = (int)tiles;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Function:  open_encoder_context
+ * --------------------
+ * allocate, configure and open the codec context of an encoder entry
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+static int open_encoder_context(FFH5CodecEntry *entry, const unsigned int cd_values[],
+                                void (*error)(const char *msg))
+{
+    entry->c = avcodec_alloc_context3(entry->codec);
+    if (!entry->c)
+    {
+        error("Could not allocate video codec context\n");
+        return -1;
+    }
+
+    configure_encoder(entry->c, cd_values);
+
+    /* nvenc takes device frames directly, sparing it the upload of a
+     * whole system memory frame (half of which is constant chroma) */
+    switch (cd_values[0])
+    {
+    case FFH5_ENC_H264_NV:
+    case FFH5_ENC_HEVC_NV:
+    case FFH5_ENC_AV1_NV:
+        /* the device upload packs 10 bit samples only */
+        if (!entry->hw && ffh5_hw_enabled() && cd_values[5] <= 1)
+            entry->hw = ffh5_hw_frames_open(cd_values[10], entry->c->pix_fmt, entry->c->width, entry->c->height);
+        if (entry->hw)
+        {
+            entry->c->pix_fmt = AV_PIX_FMT_CUDA;
+            entry->c->hw_frames_ctx = ffh5_hw_frames_ctx(entry->hw);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (avcodec_open2(entry->c, entry->codec, NULL) < 0)
+    {
+        error("Could not open codec\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Function:  open_frame_pool
+ * --------------------
+ * set up the encoder frame sources used with a dedicated conversion: a
+ * pool of luma planes and, for yuv formats, one chroma buffer that is
+ * filled once and then shared read-only by every frame
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+static int open_frame_pool(FFH5CodecEntry *entry, void (*error)(const char *msg))
+{
+    AVFrame *frame = entry->dst_frame;
+    int bytes = ffh5_pixconv_bytes(entry->pixconv);
+    int chroma_width = (frame->width + 1) >> 1, chroma_height = (frame->height + 1) >> 1;
+    int planar = (entry->pixconv == FFH5_PIXCONV_YUV420P || entry->pixconv == FFH5_PIXCONV_YUV420P10 ||
+                  entry->pixconv == FFH5_PIXCONV_YUV420P12);
+    size_t chroma_plane;
+    int ret;
+
+    entry->luma_linesize = FFALIGN(frame->width * bytes, FFH5_FRAME_ALIGN);
+    if (!ffh5_pixconv_has_chroma(entry->pixconv))
+    {
+        /* gray codecs, luma is all there is */
+        entry->luma_pool = av_buffer_pool_init((size_t)entry->luma_linesize * frame->height, NULL);
+        if (!entry->luma_pool)
+        {
+            error("Could not allocate the video frame pool\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    /* planar u and v planes, or one interleaved uv plane */
+    entry->chroma_linesize = FFALIGN(chroma_width * bytes * (planar ? 1 : 2), FFH5_FRAME_ALIGN);
+    chroma_plane = (size_t)entry->chroma_linesize * chroma_height;
+
+    entry->luma_pool = av_buffer_pool_init((size_t)entry->luma_linesize * frame->height, NULL);
+    entry->chroma = av_buffer_alloc(chroma_plane * (planar ? 2 : 1));
+    if (!entry->luma_pool || !entry->chroma)
+    {
+        error("Could not allocate the video frame pool\n");
+        return -1;
+    }
+
+    frame->data[1] = entry->chroma->data;
+    frame->linesize[1] = entry->chroma_linesize;
+    if (planar)
+    {
+        frame->data[2] = entry->chroma->data + chroma_plane;
+        frame->linesize[2] = entry->chroma_linesize;
+    }
+    ret = ffh5_fill_chroma(entry->pixconv, frame);
+    frame->data[1] = frame->data[2] = NULL;
+    frame->linesize[1] = frame->linesize[2] = 0;
+
+    return ret;
+}
+
+/*
+ * Function:  ffh5_encoder_frame
+ * --------------------
+ * assemble entry->dst_frame from one gray frame for a context using a
+ * dedicated conversion
+ *
+ *  *entry: encoder context with pixconv set
+ *  *gray: first gray row
+ *  linesize: bytes between gray rows
+ *  *gray_ref: buffer holding gray, or NULL; when given and the luma
+ *             format matches, gray is referenced as luma instead of copied
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_encoder_frame(FFH5CodecEntry *entry, const uint8_t *gray, int linesize, AVBufferRef *gray_ref)
+{
+    AVFrame *frame = entry->dst_frame;
+    int format = frame->format, width = frame->width, height = frame->height;
+    int planar = (entry->pixconv == FFH5_PIXCONV_YUV420P || entry->pixconv == FFH5_PIXCONV_YUV420P10 ||
+                  entry->pixconv == FFH5_PIXCONV_YUV420P12);
+
+    /* the encoder keeps its own references to frames it still needs */
+    av_frame_unref(frame);
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+
+    if (entry->chroma)
+    {
+        frame->buf[1] = av_buffer_ref(entry->chroma);
+        if (!frame->buf[1])
+            return AVERROR(ENOMEM);
+        frame->data[1] = entry->chroma->data;
+        frame->linesize[1] = entry->chroma_linesize;
+        if (planar)
+        {
+            frame->data[2] = entry->chroma->data + (size_t)entry->chroma_linesize * ((height + 1) >> 1);
+            frame->linesize[2] = entry->chroma_linesize;
+        }
+    }
+
+    if (gray_ref && ffh5_pixconv_is_copy(entry->pixconv) &&
+        !((uintptr_t)gray & (FFH5_SWS_ALIGN - 1)) && !(linesize & (FFH5_SWS_ALIGN - 1)))
+    {
+        frame->buf[0] = av_buffer_ref(gray_ref);
+        if (!frame->buf[0])
+            return AVERROR(ENOMEM);
+        frame->data[0] = (uint8_t *)gray;
+        frame->linesize[0] = linesize;
+        return 0;
+    }
+
+    frame->buf[0] = av_buffer_pool_get(entry->luma_pool);
+    if (!frame->buf[0])
+        return AVERROR(ENOMEM);
+    frame->data[0] = frame->buf[0]->data;
+    frame->linesize[0] = entry->luma_linesize;
+
+    return ffh5_gray_to_luma(entry->pixconv, gray, linesize, frame);
+}
+
+static FFH5CodecEntry *create_encoder(const unsigned int cd_values[], void (*error)(const char *msg))
+{
+    FFH5CodecEntry *entry;
+    char codec_name[50] = {0};
+    int width, height, color_mode;
+
+    width = cd_values[2];
+    height = cd_values[3];
+    color_mode = cd_values[5];
+
+    entry = calloc(1, sizeof(FFH5CodecEntry));
+    if (!entry)
+    {
+        error("Out of memory occurred during encoding\n");
+        return NULL;
+    }
+    entry->is_encoder = 1;
+
+    av_log_set_level(AV_LOG_ERROR);
+    find_encoder_name(cd_values[0], codec_name);
+
+    entry->codec = avcodec_find_encoder_by_name(codec_name);
+    if (!entry->codec)
+    {
+        error("Codec not found\n");
+        goto Failure;
+    }
+
+    if (open_encoder_context(entry, cd_values, error) < 0)
+        goto Failure;
+
+    /* counted against the session cap of the gpu schedule */
+    if (cd_values[0] == FFH5_ENC_H264_NV || cd_values[0] == FFH5_ENC_HEVC_NV || cd_values[0] == FFH5_ENC_AV1_NV)
+    {
+        entry->nv_session = cd_values[10] + 1;
+        ffh5_sched_session(cd_values[10], 1);
+    }
+
+    entry->pkt = av_packet_alloc();
+    if (!entry->pkt)
+    {
+        error("Could not allocate packet\n");
+        goto Failure;
+    }
+
+    entry->dst_frame = av_frame_alloc();
+    if (!entry->dst_frame)
+    {
+        error("Could not allocate video dst_frame due to out of memory problem\n");
+        goto Failure;
+    }
+
+    entry->dst_frame->format = entry->c->pix_fmt;
+    entry->dst_frame->width = width;
+    entry->dst_frame->height = height;
+
+    /* frames come from the device pool, see ffh5_hw_frame_from_gray */
+    if (entry->hw)
+        return entry;
+
+    entry->pixconv = ffh5_pixconv_select(ffh5_sample_format(color_mode, cd_values[FFH5_CD_SAMPLE_LAYOUT]),
+                                         entry->c->pix_fmt);
+    if (entry->pixconv != FFH5_PIXCONV_NONE)
+    {
+        /* frames are assembled by ffh5_encoder_frame, no swscale needed */
+        if (open_frame_pool(entry, error) < 0)
+            goto Failure;
+        return entry;
+    }
+
+    if (av_frame_get_buffer(entry->dst_frame, 0) < 0)
+    {
+        error("Could not allocate the video dst_frame data\n");
+        goto Failure;
+    }
+
+    entry->src_frame = av_frame_alloc();
+    if (!entry->src_frame)
+    {
+        error("Could not allocate video src_frame due to out of memory problem\n");
+        goto Failure;
+    }
+
+    entry->src_frame->format = ffh5_sample_format(color_mode, cd_values[FFH5_CD_SAMPLE_LAYOUT]);
+    entry->src_frame->width = width;
+    entry->src_frame->height = height;
+
+    if (av_frame_get_buffer(entry->src_frame, 0) < 0)
+    {
+        error("Could not allocate the video src_frame data\n");
+        goto Failure;
+    }
+
+    entry->sws_context = sws_getContext(width,
+                                        height,
+                                        entry->src_frame->format,
+                                        width,
+                                        height,
+                                        entry->dst_frame->format,
+                                        SWS_BILINEAR,
+                                        NULL,
+                                        NULL,
+                                        NULL);
+    if (!entry->sws_context)
+    {
+        error("Could not initialize conversion context\n");
+        goto Failure;
+    }
+
+    return entry;
+
+Failure:
+    destroy_entry(entry);
+    return NULL;
+}
+
+/* prefer device frames when the decoder offers them */
+static enum AVPixelFormat get_device_format(AVCodecContext *c, const enum AVPixelFormat *fmts)
+{
+    const enum AVPixelFormat *p;
+
+    (void)c;
+    for (p = fmts; *p != AV_PIX_FMT_NONE; p++)
+    {
+        if (*p == AV_PIX_FMT_CUDA)
+            return *p;
+    }
+    return fmts[0];
+}
+
+static FFH5CodecEntry *create_decoder(const unsigned int cd_values[], void (*error)(const char *msg))
+{
+    FFH5CodecEntry *entry;
+    char codec_name[50] = {0};
+    enum DecoderCodecEnum c_id;
+    int width, height, color_mode;
+
+    c_id = cd_values[1];
+    width = cd_values[2];
+    height = cd_values[3];
+    color_mode = cd_values[5];
+
+    entry = calloc(1, sizeof(FFH5CodecEntry));
+    if (!entry)
+    {
+        error("Out of memory occurred during decoding\n");
+        return NULL;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    entry->pkt = av_packet_alloc();
+    if (!entry->pkt)
+    {
+        error("Could not allocate packet\n");
+        goto Failure;
+    }
+
+    find_decoder_name(c_id, codec_name);
+
+    entry->codec = avcodec_find_decoder_by_name(codec_name);
+    if (!entry->codec)
+    {
+        error("Codec not found\n");
+        goto Failure;
+    }
+    /* FFV1 has no parser, its chunks are split by their packet table */
+    entry->parser = av_parser_init(entry->codec->id);
+    if (!entry->parser && c_id != FFH5_DEC_FFV1)
+    {
+        error("parser not found\n");
+        goto Failure;
+    }
+    entry->c = avcodec_alloc_context3(entry->codec);
+    if (!entry->c)
+    {
+        error("Could not allocate video codec context\n");
+        goto Failure;
+    }
+
+    /* For some codecs, such as msmpeg4 and mpeg4, width and height
+       MUST be initialized there because this information is not
+       available in the bitstream. */
+    entry->c->width = width;
+    entry->c->height = height;
+
+    /* h264/hevc/aom read thread_count/thread_type, dav1d maps thread_count
+     * to its worker count and only pipelines frames when asked to */
+    configure_threads(entry->c, cd_values);
+    if (c_id == FFH5_DEC_DAV1D && (cd_values[FFH5_CD_THREAD_TYPE] == FFH5_THREAD_SLICE ||
+                                   (cd_values[FFH5_CD_THREAD_TYPE] == 0 && tile_count(cd_values) > 1)))
+        av_opt_set_int(entry->c->priv_data, "max_frame_delay", 1, 0);
+
+    /* cuvid keeps decoded frames on the device when given a device
+     * context, which also pins it to gpu_id; only luma is downloaded */
+    switch (c_id)
+    {
+    case FFH5_DEC_H264_CUVID:
+    case FFH5_DEC_HEVC_CUVID:
+    case FFH5_DEC_AV1_CUVID:
+        /* the luma download unpacks 10 bit samples only */
+        if (color_mode > 1)
+            break;
+        entry->c->hw_device_ctx = ffh5_hw_device(cd_values[10]);
+        if (entry->c->hw_device_ctx)
+            entry->c->get_format = get_device_format;
+        break;
+    default:
+        break;
+    }
+
+    /* open it */
+    if (avcodec_open2(entry->c, entry->codec, NULL) < 0)
+    {
+        error("Could not open codec\n");
+        goto Failure;
+    }
+    entry->src_frame = av_frame_alloc();
+    if (!entry->src_frame)
+    {
+        error("Could not allocate video frame due to out of memory problem\n");
+        goto Failure;
+    }
+    switch (c_id)
+    {
+    // list those who support 10bit encoding
+    case FFH5_DEC_H264:
+    case FFH5_DEC_AOMAV1:
+    case FFH5_DEC_DAV1D:
+        entry->src_frame->format = (color_mode == 0) ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_YUV420P10;
+        break;
+    case FFH5_DEC_HEVC:
+        switch (color_mode)
+        {
+        case 0: // 8bit
+            entry->src_frame->format = AV_PIX_FMT_YUV420P;
+            break;
+        case 1: // 10bit
+            entry->src_frame->format = AV_PIX_FMT_YUV420P10;
+            break;
+        case 2: // 12bit
+        case 3:
+            entry->src_frame->format = AV_PIX_FMT_YUV420P12;
+            break;
+        default:
+            entry->src_frame->format = AV_PIX_FMT_YUV420P;
+        }
+        break;
+    case FFH5_DEC_H264_CUVID:
+    case FFH5_DEC_HEVC_CUVID:
+    case FFH5_DEC_AV1_CUVID:
+    case FFH5_DEC_AV1_QSV:
+        entry->src_frame->format = (color_mode == 0) ? AV_PIX_FMT_NV12 : AV_PIX_FMT_P010;
+        break;
+    case FFH5_DEC_FFV1:
+        entry->src_frame->format = (color_mode == 0) ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_GRAY16;
+        break;
+    default:
+        // common supported pixel format 8bit
+        entry->src_frame->format = AV_PIX_FMT_YUV420P;
+    }
+    entry->src_frame->width = width;
+    entry->src_frame->height = height;
+
+    entry->dst_frame = av_frame_alloc();
+    if (!entry->dst_frame)
+    {
+        error("Could not allocate video dst_frame due to out of memory problem\n");
+        goto Failure;
+    }
+
+    /* legacy 12 bit streams decode to the gray10 scale they were written from */
+    entry->dst_frame->format = ffh5_sample_format(color_mode, cd_values[FFH5_CD_SAMPLE_LAYOUT]);
+    entry->dst_frame->width = width;
+    entry->dst_frame->height = height;
+
+    /* the format is a guess until the first frame: streams of 4:0:0
+     * encoders decode to gray, decode() then picks the conversion of the
+     * actual format; swscale stays around for frames none of them takes */
+    entry->pixconv = ffh5_pixconv_select(entry->dst_frame->format, entry->src_frame->format);
+    entry->sws_context = sws_getContext(width,
+                                        height,
+                                        entry->src_frame->format,
+                                        width,
+                                        height,
+                                        entry->dst_frame->format,
+                                        SWS_BILINEAR,
+                                        NULL,
+                                        NULL,
+                                        NULL);
+    if (!entry->sws_context)
+    {
+        error("Could not initialize conversion context\n");
+        goto Failure;
+    }
+
+    return entry;
+
+Failure:
+    destroy_entry(entry);
+    return NULL;
+}
+
+static void destroy_entry(FFH5CodecEntry *entry)
+{
+    if (!entry)
+        return;
+    if (entry->parser)
+        av_parser_close(entry->parser);
+    if (entry->c)
+        avcodec_free_context(&entry->c);
+    if (entry->src_frame)
+        av_frame_free(&entry->src_frame);
+    if (entry->dst_frame)
+        av_frame_free(&entry->dst_frame);
+    if (entry->pkt)
+        av_packet_free(&entry->pkt);
+    if (entry->sws_context)
+        sws_freeContext(entry->sws_context);
+    if (entry->chroma)
+        av_buffer_unref(&entry->chroma);
+    if (entry->luma_pool)
+        av_buffer_pool_uninit(&entry->luma_pool);
+    /* after the codec context, which references its frames */
+    ffh5_hw_frames_close(entry->hw);
+    if (entry->nv_session)
+        ffh5_sched_session(entry->nv_session - 1, -1);
+    free(entry);
+}
+
+/*
+ * Function:  reset_entry
+ * --------------------
+ * bring a drained context back to a state where a new, independent
+ * stream can be pushed through it
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+static int reset_entry(FFH5CodecEntry *entry, void (*error)(const char *msg))
+{
+    if (!entry->used)
+        return 0;
+
+    if (entry->is_encoder)
+    {
+        /* Only encoders advertising AV_CODEC_CAP_ENCODER_FLUSH can be
+         * restarted after draining; the others are reopened while the
+         * frames, packet and sws context are kept.
+         */
+        if (entry->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH)
+            avcodec_flush_buffers(entry->c);
+        else
+        {
+            avcodec_free_context(&entry->c);
+            if (open_encoder_context(entry, entry->key, error) < 0)
+                return -1;
+        }
+    }
+    else
+    {
+        avcodec_flush_buffers(entry->c);
+
+        /* the parser keeps partial packets around after the final flush */
+        if (entry->parser)
+        {
+            av_parser_close(entry->parser);
+            entry->parser = av_parser_init(entry->codec->id);
+            if (!entry->parser)
+            {
+                error("parser not found\n");
+                return -1;
+            }
+        }
+    }
+
+    av_packet_unref(entry->pkt);
+    entry->used = 0;
+    return 0;
+}
+
+static FFH5CodecEntry *acquire(int is_encoder, size_t cd_nelmts, const unsigned int cd_values[],
+                               void (*error)(const char *msg))
+{
+    FFH5CodecEntry *entry, **link;
+    unsigned int key[FFH5_MAX_CD_VALUES];
+    unsigned int params[FFH5_MAX_CD_VALUES];
+    uint64_t t0 = FFH5_STATS_BEGIN();
+    size_t key_len;
+
+    if (cd_nelmts < FFH5_CD_NELMTS)
+    {
+        error("Not enough auxiliary parameters\n");
+        return NULL;
+    }
+
+    ffh5_once(&cache_once, cache_init);
+
+    key_len = make_key(is_encoder, cd_nelmts, cd_values, key);
+
+    if (cache_enabled && cache_key_valid)
+    {
+        entry = (FFH5CodecEntry *)ffh5_tls_get(cache_key);
+        for (link = NULL; entry; link = &entry->next, entry = entry->next)
+        {
+            if (entry->is_encoder == is_encoder && entry->key_len == key_len &&
+                memcmp(entry->key, key, sizeof(key)) == 0)
+                break;
+        }
+
+        if (entry)
+        {
+            /* unlink, the entry belongs to the caller until released */
+            if (link)
+                *link = entry->next;
+            else
+                ffh5_tls_set(cache_key, entry->next);
+            entry->next = NULL;
+
+            if (reset_entry(entry, error) == 0)
+            {
+                FFH5_STATS_ADD(context_hits, 1);
+                FFH5_STATS_END(FFH5_STAGE_CODEC_OPEN, t0);
+                return entry;
+            }
+
+            destroy_entry(entry);
+        }
+    }
+
+    /* optional trailing parameters read as zero when the caller omits them */
+    memset(params, 0, sizeof(params));
+    memcpy(params, cd_values, key_len * sizeof(unsigned int));
+
+    entry = is_encoder ? create_encoder(params, error) : create_decoder(params, error);
+    if (entry)
+    {
+        /* encoder keys keep every parameter but depth, which
+         * configure_encoder does not use, so reopening can rely on it */
+        entry->key_len = key_len;
+        memcpy(entry->key, key, sizeof(key));
+    }
+
+    FFH5_STATS_ADD(context_misses, 1);
+    FFH5_STATS_END(FFH5_STAGE_CODEC_OPEN, t0);
+    return entry;
+}
+
+FFH5CodecEntry *ffh5_acquire_encoder(size_t cd_nelmts, const unsigned int cd_values[],
+                                     void (*error)(const char *msg))
+{
+    return acquire(1, cd_nelmts, cd_values, error);
+}
+
+FFH5CodecEntry *ffh5_acquire_decoder(size_t cd_nelmts, const unsigned int cd_values[],
+                                     void (*error)(const char *msg))
+{
+    return acquire(0, cd_nelmts, cd_values, error);
+}
+
+void ffh5_release_context(FFH5CodecEntry *entry, int reusable)
+{
+    FFH5CodecEntry *head, *it;
+    int count;
+
+    if (!entry)
+        return;
+
+    /* idle nvenc sessions must not keep the gpu above its session cap */
+    if (entry->nv_session && ffh5_sched_sessions_over(entry->nv_session - 1))
+        reusable = 0;
+
+    if (!reusable || !cache_enabled || !cache_key_valid)
+    {
+        destroy_entry(entry);
+        return;
+    }
+
+    entry->used = 1;
+
+    /* most recently used first, drop whatever falls off the end */
+    head = (FFH5CodecEntry *)ffh5_tls_get(cache_key);
+    entry->next = head;
+    if (ffh5_tls_set(cache_key, entry) != 0)
+    {
+        entry->next = NULL;
+        destroy_entry(entry);
+        return;
+    }
+
+    for (it = entry, count = 1; it->next;)
+    {
+        if (count >= cache_size)
+        {
+            FFH5CodecEntry *victim = it->next;
+            it->next = victim->next;
+            destroy_entry(victim);
+        }
+        else
+        {
+            it = it->next;
+            count++;
+        }
+    }
+}
+
+void ffh5_cache_clear(void)
+{
+    FFH5CodecEntry *head;
+
+    if (!cache_key_valid)
+        return;
+
+    head = (FFH5CodecEntry *)ffh5_tls_get(cache_key);
+    ffh5_tls_set(cache_key, NULL);
+    cache_thread_exit(head);
+}
@@ -0,0 +1,78 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Per-thread cache of opened encoder/decoder contexts so that
+ * consecutive chunks with identical parameters skip codec setup.
+ *
+ */
+
+#ifndef FFMPEG_CACHE_H
+#define FFMPEG_CACHE_H
+
+#include "ffmpeg_utils.h"
+#include "ffmpeg_pixconv.h"
+#include "ffmpeg_hw.h"
+
+/* default number of cached contexts kept per thread */
+#define FFH5_CACHE_DEFAULT_SIZE 4
+
+/* row alignment of pooled encoder frame planes */
+#define FFH5_FRAME_ALIGN 64
+
+typedef struct FFH5CodecEntry
+{
+    int is_encoder;
+    int used; /* drained at least once, needs a reset before reuse */
+    size_t key_len;
+    unsigned int key[FFH5_MAX_CD_VALUES];
+
+    const AVCodec *codec;
+    AVCodecContext *c;
+    AVCodecParserContext *parser; /* decoder only */
+    AVFrame *src_frame;
+    AVFrame *dst_frame;
+    AVPacket *pkt;
+    struct SwsContext *sws_context;
+    int pixconv; /* FFH5_PIXCONV_* replacing sws_context, or FFH5_PIXCONV_NONE */
+
+    /* encoder with pixconv: luma plane pool and shared prefilled chroma */
+    AVBufferPool *luma_pool;
+    AVBufferRef *chroma;
+    int luma_linesize;
+    int chroma_linesize;
+
+    /* nvenc encoder fed with device frames, replaces both of the above */
+    FFH5HwFrames *hw;
+    unsigned int nv_session; /* gpu_id + 1 of the nvenc session held, 0 for none */
+
+    struct FFH5CodecEntry *next;
+} FFH5CodecEntry;
+
+/*
+ * Acquire an opened context for the given parameters.  A cached one is
+ * reset and handed out when available, otherwise a new one is created.
+ * Returns NULL on failure (the reason is reported through error).
+ */
+FFH5CodecEntry *ffh5_acquire_encoder(size_t cd_nelmts, const unsigned int cd_values[],
+                                     void (*error)(const char *msg));
+
+FFH5CodecEntry *ffh5_acquire_decoder(size_t cd_nelmts, const unsigned int cd_values[],
+                                     void (*error)(const char *msg));
+
+/*
+ * Give a context back.  reusable should be 0 when the context might be
+ * in an inconsistent state (e.g. after an error); it is destroyed then.
+ */
+void ffh5_release_context(FFH5CodecEntry *entry, int reusable);
+
+/*
+ * Assemble entry->dst_frame of an encoder with pixconv set from one gray
+ * frame: luma is a pooled copy, or gray itself when gray_ref holds it and
+ * no conversion is needed; chroma is shared.  Returns 0 on success.
+ */
+int ffh5_encoder_frame(FFH5CodecEntry *entry, const uint8_t *gray, int linesize, AVBufferRef *gray_ref);
+
+/* Free every context cached by the calling thread */
+void ffh5_cache_clear(void);
+
+#endif // FFMPEG_CACHE_H
@@ -0,0 +1,119 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Capability registry.
+ *
+ * Which encoders and decoders the linked FFmpeg resolves, how many CUDA
+ * devices the driver reports and whether a QSV device can be created are
+ * probed once per process, in process, and then read without locking.
+ * The decoder fallback of chunks written with NVENC or QSV on another
+ * machine is decided here instead of rewriting dataset attributes.
+ *
+ */
+
+#include <libavutil/hwcontext.h>
+
+#include "ffmpeg_caps.h"
+#include "ffmpeg_hw.h"
+#include "ffmpeg_thread.h"
+
+static ffh5_once_t caps_once = FFH5_ONCE_INIT;
+static FFH5Capabilities caps;
+
+static void caps_init(void)
+{
+    AVBufferRef *ref = NULL;
+    char codec_name[50];
+    int i;
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    for (i = 0; i < FFH5_ENC_COUNT; i++)
+    {
+        find_encoder_name(i, codec_name);
+        if (avcodec_find_encoder_by_name(codec_name))
+            caps.encoders |= 1u << i;
+    }
+    for (i = 0; i < FFH5_DEC_COUNT; i++)
+    {
+        find_decoder_name(i, codec_name);
+        if (avcodec_find_decoder_by_name(codec_name))
+            caps.decoders |= 1u << i;
+    }
+
+    caps.cuda_devices = ffh5_hw_device_count();
+
+    /* only worth opening a device for when a QSV codec is built in */
+    if ((caps.encoders & (1u << FFH5_ENC_AV1_QSV)) || (caps.decoders & (1u << FFH5_DEC_AV1_QSV)))
+    {
+        if (av_hwdevice_ctx_create(&ref, AV_HWDEVICE_TYPE_QSV, NULL, NULL, 0) >= 0)
+        {
+            caps.qsv = 1;
+            av_buffer_unref(&ref);
+        }
+    }
+}
+
+const FFH5Capabilities *ffh5_caps(void)
+{
+    ffh5_once(&caps_once, caps_init);
+    return &caps;
+}
+
+void ffmpeg_h5_get_capabilities(FFH5Capabilities *out) { *out = *ffh5_caps(); }
+
+/*
+ * Function:  ffh5_caps_decoder
+ * --------------------
+ * decode with software when the GPU decoder stored with a chunk cannot
+ * run here, the streams are ordinary h264/hevc/av1
+ *
+ *  params: auxiliary parameters, rewritten in place
+ *
+ *  return: 1 if params was changed, 0 otherwise
+ *
+ */
+int ffh5_caps_decoder(unsigned int params[])
+{
+    const FFH5Capabilities *c = ffh5_caps();
+    unsigned int dec_id = params[1], sw_id;
+    int usable;
+
+    switch (dec_id)
+    {
+    case FFH5_DEC_H264_CUVID:
+        sw_id = FFH5_DEC_H264;
+        usable = c->cuda_devices > 0;
+        break;
+    case FFH5_DEC_HEVC_CUVID:
+        sw_id = FFH5_DEC_HEVC;
+        usable = c->cuda_devices > 0;
+        break;
+    case FFH5_DEC_AV1_CUVID:
+        sw_id = FFH5_DEC_DAV1D;
+        usable = c->cuda_devices > 0;
+        break;
+    case FFH5_DEC_AV1_QSV:
+        sw_id = FFH5_DEC_DAV1D;
+        usable = c->qsv;
+        break;
+    default:
+        return 0;
+    }
+    usable = usable && (c->decoders & (1u << dec_id));
+
+    if (usable)
+    {
+        if (dec_id == FFH5_DEC_AV1_QSV || params[10] < (unsigned int)c->cuda_devices)
+            return 0;
+        params[10] = c->cuda_devices - 1;
+        return 1;
+    }
+
+    /* builds without dav1d still read av1 with libaom */
+    if (sw_id == FFH5_DEC_DAV1D && !(c->decoders & (1u << FFH5_DEC_DAV1D)))
+        sw_id = FFH5_DEC_AOMAV1;
+    params[1] = sw_id;
+    params[10] = 0;
+    return 1;
+}
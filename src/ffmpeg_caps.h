@@ -0,0 +1,29 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Process wide registry of what this build and machine can code with,
+ * see ffmpeg_h5_get_capabilities.
+ *
+ */
+
+#ifndef FFMPEG_CAPS_H
+#define FFMPEG_CAPS_H
+
+#include "ffmpeg_utils.h"
+
+/* number of EncoderCodecEnum / DecoderCodecEnum ids */
+#define FFH5_ENC_COUNT 12
+#define FFH5_DEC_COUNT 10
+
+/* Capabilities, probed on the first call and kept for the process */
+const FFH5Capabilities *ffh5_caps(void);
+
+/*
+ * Rewrite the CUVID/QSV decoder of params (FFH5_MAX_CD_VALUES entries)
+ * to the software decoder of the same format when its device or codec
+ * is missing, and clamp gpu_id to the devices present.  Returns 1 when
+ * params was changed.
+ */
+int ffh5_caps_decoder(unsigned int params[]);
+
+#endif // FFMPEG_CAPS_H
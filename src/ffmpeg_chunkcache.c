@@ -0,0 +1,540 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Decoded chunk cache.
+ *
+ * The HDF5 filter only sees cd_values and the compressed bytes, not the
+ * file, dataset or chunk offset, so chunks are keyed by a 128-bit digest
+ * of both; equal keys mean equal decoded frames, wherever they are read.
+ * The digest is not cryptographic, entries also have to match in size.
+ *
+ * In memory, entries sit on one LRU list under cache_lock and are pinned
+ * while a reader copies them out, so eviction never waits for a copy.
+ * With the shared backend every decoded chunk becomes a POSIX shared
+ * memory object named after its key; the list then only tracks the
+ * objects this process created, for its budget.  An object is complete
+ * once its header's ready flag is set, readers ignore it before that.
+ * The exit hook unlinks the objects a process still holds; one that is
+ * killed leaves them in /dev/shm (names start with h5ff-) until reboot.
+ *
+ * Environment variables (read once per process, before the first call
+ * to ffmpeg_h5_set_chunk_cache):
+ *  H5FFMPEG_CHUNK_CACHE=512M                 budget in bytes (unset: off)
+ *  H5FFMPEG_CHUNK_CACHE_SHM=1                use POSIX shared memory
+ *
+ */
+
+#include "ffmpeg_chunkcache.h"
+#include "ffmpeg_codec.h"
+#include "ffmpeg_thread.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FFH5_HAVE_SHM 1
+#endif
+
+#define CACHE_MIN_BUCKETS 256
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+
+/* "FFH5CHK1" */
+#define SHM_MAGIC 0x314B484335484646ULL
+/* header of a shared object, the frames start at this offset */
+#define SHM_HEADER_SIZE 64
+/* macOS limits names to 31 characters */
+#define SHM_NAME_SIZE 32
+
+typedef struct CacheEntry
+{
+    uint64_t a, b;
+    size_t size;
+    uint8_t *data; /* NULL for shared memory objects */
+    int refs;      /* readers copying data */
+    int dead;      /* evicted while pinned, freed by the last reader */
+    struct CacheEntry *prev, *next; /* LRU list, most recent first */
+    struct CacheEntry *hnext;
+} CacheEntry;
+
+typedef struct ShmHeader
+{
+    uint64_t magic;
+    uint64_t a, b;
+    uint64_t size;
+    uint32_t ready;
+} ShmHeader;
+
+static ffh5_once_t cache_once = FFH5_ONCE_INIT;
+static ffh5_mutex_t cache_lock = FFH5_MUTEX_INIT;
+
+static size_t cache_budget = 0;
+static int cache_shared = 0;
+static size_t cache_bytes = 0;
+static CacheEntry **buckets = NULL;
+static size_t n_buckets = 0;
+static size_t n_entries = 0;
+static CacheEntry *lru_head = NULL, *lru_tail = NULL;
+static FFH5ChunkCacheStats counters;
+
+static void clear_entries(void);
+
+/* Runs at exit: unlinks the shared objects this process created, so that
+ * other readers only keep what they published themselves.
+ */
+static void cache_shutdown(void)
+{
+    ffh5_mutex_lock(&cache_lock);
+    clear_entries();
+    ffh5_mutex_unlock(&cache_lock);
+}
+
+static void cache_init(void)
+{
+    const char *env;
+
+    env = getenv("H5FFMPEG_CHUNK_CACHE");
+    if (env && *env)
+        cache_budget = ffh5_parse_size(env);
+
+#ifdef FFH5_HAVE_SHM
+    env = getenv("H5FFMPEG_CHUNK_CACHE_SHM");
+    if (env && (strcmp(env, "1") == 0 || strcmp(env, "on") == 0 || strcmp(env, "true") == 0))
+        cache_shared = 1;
+    atexit(cache_shutdown);
+#endif
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* two independent 64-bit lanes over the parameters that shape the frames and the bitstream */
+static void chunk_digest(size_t cd_nelmts, const unsigned int cd_values[], const uint8_t *in, size_t in_size,
+                         uint64_t *a, uint64_t *b)
+{
+    uint64_t h1 = HASH_P1 ^ in_size, h2 = HASH_P2 + in_size, w;
+    unsigned int layout = (cd_nelmts > FFH5_CD_SAMPLE_LAYOUT) ? cd_values[FFH5_CD_SAMPLE_LAYOUT] : 0;
+    size_t i;
+
+    /* encoder, decoder, width, height, depth, bit mode; not the gpu */
+    for (i = 0; i < 6; i++)
+    {
+        h1 = rotl64(h1 ^ cd_values[i], 27) * HASH_P2;
+        h2 = rotl64(h2 + cd_values[i], 31) * HASH_P1;
+    }
+    /* the sample layout changes the scale 12 bit chunks decode to */
+    h1 = rotl64(h1 ^ layout, 27) * HASH_P2;
+    h2 = rotl64(h2 + layout, 31) * HASH_P1;
+
+    for (i = 0; i + 8 <= in_size; i += 8)
+    {
+        memcpy(&w, in + i, 8);
+        h1 = rotl64(h1 ^ (w * HASH_P2), 31) * HASH_P1;
+        h2 = rotl64(h2 + (w * HASH_P1), 29) * HASH_P2;
+    }
+    if (i < in_size)
+    {
+        w = 0;
+        memcpy(&w, in + i, in_size - i);
+        h1 = rotl64(h1 ^ (w * HASH_P2), 31) * HASH_P1;
+        h2 = rotl64(h2 + (w * HASH_P1), 29) * HASH_P2;
+    }
+
+    *a = mix64(h1 ^ rotl64(h2, 17));
+    *b = mix64(h2 + h1);
+}
+
+#ifdef FFH5_HAVE_SHM
+static void shm_name(char name[SHM_NAME_SIZE], uint64_t a, uint64_t b)
+{
+    snprintf(name, SHM_NAME_SIZE, "/h5ff-%016llx%08x", (unsigned long long)a, (unsigned int)(b & 0xFFFFFFFF));
+}
+
+/* copy a complete object of key to out, 0 when there is none */
+static int shm_read(const FFH5ChunkKey *key, uint8_t *out)
+{
+    char name[SHM_NAME_SIZE];
+    const ShmHeader *header;
+    struct stat st;
+    void *map;
+    int fd, hit = 0;
+
+    shm_name(name, key->a, key->b);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size == SHM_HEADER_SIZE + key->size)
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            header = (const ShmHeader *)map;
+            if (__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) && header->magic == SHM_MAGIC &&
+                header->a == key->a && header->b == key->b && header->size == key->size)
+            {
+                memcpy(out, (const uint8_t *)map + SHM_HEADER_SIZE, key->size);
+                hit = 1;
+            }
+            munmap(map, (size_t)st.st_size);
+        }
+    }
+
+    close(fd);
+    return hit;
+}
+
+/* publish data under key, negative when it exists already or cannot be stored */
+static int shm_write(const FFH5ChunkKey *key, const uint8_t *data)
+{
+    char name[SHM_NAME_SIZE];
+    size_t total = SHM_HEADER_SIZE + key->size;
+    ShmHeader *header;
+    void *map;
+    int fd;
+
+    shm_name(name, key->a, key->b);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, (off_t)total) < 0)
+        goto Failure;
+#if defined(__linux__)
+    /* a full /dev/shm is an error here rather than SIGBUS in memcpy */
+    if (posix_fallocate(fd, 0, (off_t)total) != 0)
+        goto Failure;
+#endif
+
+    map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto Failure;
+
+    header = (ShmHeader *)map;
+    header->magic = SHM_MAGIC;
+    header->a = key->a;
+    header->b = key->b;
+    header->size = key->size;
+    memcpy((uint8_t *)map + SHM_HEADER_SIZE, data, key->size);
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+
+    munmap(map, total);
+    close(fd);
+    return 0;
+
+Failure:
+    close(fd);
+    shm_unlink(name);
+    return -1;
+}
+
+static void shm_remove(uint64_t a, uint64_t b)
+{
+    char name[SHM_NAME_SIZE];
+
+    shm_name(name, a, b);
+    shm_unlink(name);
+}
+#else
+static int shm_read(const FFH5ChunkKey *key, uint8_t *out) { return 0; }
+static int shm_write(const FFH5ChunkKey *key, const uint8_t *data) { return -1; }
+static void shm_remove(uint64_t a, uint64_t b) {}
+#endif
+
+/* cache_lock must be held for all of the list and table helpers */
+static void lru_unlink(CacheEntry *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        lru_head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(CacheEntry *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head)
+        lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail)
+        lru_tail = e;
+}
+
+static CacheEntry *find_entry(uint64_t a, uint64_t b, size_t size)
+{
+    CacheEntry *e;
+
+    if (!n_buckets)
+        return NULL;
+    for (e = buckets[a & (n_buckets - 1)]; e; e = e->hnext)
+        if (e->a == a && e->b == b && e->size == size)
+            return e;
+    return NULL;
+}
+
+static int grow_buckets(void)
+{
+    size_t count = n_buckets ? n_buckets * 2 : CACHE_MIN_BUCKETS, i;
+    CacheEntry **grown, *e, *next;
+
+    grown = calloc(count, sizeof(CacheEntry *));
+    if (!grown)
+        return -1;
+
+    for (i = 0; i < n_buckets; i++)
+        for (e = buckets[i]; e; e = next)
+        {
+            next = e->hnext;
+            e->hnext = grown[e->a & (count - 1)];
+            grown[e->a & (count - 1)] = e;
+        }
+
+    free(buckets);
+    buckets = grown;
+    n_buckets = count;
+    return 0;
+}
+
+static void free_entry(CacheEntry *e)
+{
+    free(e->data);
+    free(e);
+}
+
+static void remove_entry(CacheEntry *e)
+{
+    CacheEntry **p = &buckets[e->a & (n_buckets - 1)];
+
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+    lru_unlink(e);
+    cache_bytes -= e->size;
+    n_entries--;
+
+    if (!e->data)
+        shm_remove(e->a, e->b);
+    if (e->refs > 0)
+        e->dead = 1;
+    else
+        free_entry(e);
+}
+
+static void evict(size_t budget, const CacheEntry *keep)
+{
+    while (cache_bytes > budget && lru_tail && lru_tail != keep)
+    {
+        remove_entry(lru_tail);
+        counters.evictions++;
+    }
+}
+
+int ffh5_chunkcache_get(size_t cd_nelmts, const unsigned int cd_values[], const uint8_t *in, size_t in_size,
+                        FFH5Sink *sink, FFH5ChunkKey *key)
+{
+    CacheEntry *e = NULL;
+    size_t budget;
+    int shared, hit;
+
+    key->valid = 0;
+    ffh5_once(&cache_once, cache_init);
+
+    ffh5_mutex_lock(&cache_lock);
+    budget = cache_budget;
+    shared = cache_shared;
+    ffh5_mutex_unlock(&cache_lock);
+
+    key->size = ffmpeg_decoded_size(cd_values);
+    if (budget == 0 || key->size == 0 || key->size > budget)
+        return 0;
+
+    chunk_digest(cd_nelmts, cd_values, in, in_size, &key->a, &key->b);
+    key->valid = 1;
+
+    /* a miss decodes into the same room */
+    if (ffh5_sink_reserve(sink, key->size) < 0)
+        return 0;
+
+    if (shared)
+    {
+        hit = shm_read(key, sink->data + sink->size);
+
+        ffh5_mutex_lock(&cache_lock);
+        e = find_entry(key->a, key->b, key->size);
+        if (e)
+        {
+            lru_unlink(e);
+            lru_push_front(e);
+        }
+    }
+    else
+    {
+        ffh5_mutex_lock(&cache_lock);
+        e = find_entry(key->a, key->b, key->size);
+        if (e)
+        {
+            lru_unlink(e);
+            lru_push_front(e);
+            e->refs++;
+        }
+        hit = (e != NULL);
+    }
+    if (hit)
+        counters.hits++;
+    else
+        counters.misses++;
+    ffh5_mutex_unlock(&cache_lock);
+
+    if (e && !shared)
+    {
+        memcpy(sink->data + sink->size, e->data, key->size);
+
+        ffh5_mutex_lock(&cache_lock);
+        if (--e->refs == 0 && e->dead)
+            free_entry(e);
+        ffh5_mutex_unlock(&cache_lock);
+    }
+
+    if (hit)
+        sink->size += key->size;
+    return hit;
+}
+
+void ffh5_chunkcache_put(const FFH5ChunkKey *key, const uint8_t *data)
+{
+    CacheEntry *e;
+    int shared;
+
+    if (!key->valid)
+        return;
+
+    ffh5_mutex_lock(&cache_lock);
+    shared = cache_shared;
+    ffh5_mutex_unlock(&cache_lock);
+
+    e = calloc(1, sizeof(CacheEntry));
+    if (!e)
+        return;
+    e->a = key->a;
+    e->b = key->b;
+    e->size = key->size;
+
+    if (shared)
+    {
+        /* another process may have published it first, it is theirs to evict */
+        if (shm_write(key, data) < 0)
+        {
+            free(e);
+            return;
+        }
+    }
+    else
+    {
+        e->data = malloc(key->size);
+        if (!e->data)
+        {
+            free(e);
+            return;
+        }
+        memcpy(e->data, data, key->size);
+    }
+
+    ffh5_mutex_lock(&cache_lock);
+    if (cache_budget < key->size || cache_shared != shared || find_entry(key->a, key->b, key->size) ||
+        (n_entries >= n_buckets && grow_buckets() < 0))
+    {
+        /* reconfigured or stored by another thread meanwhile */
+        ffh5_mutex_unlock(&cache_lock);
+        if (shared)
+            shm_remove(key->a, key->b);
+        free_entry(e);
+        return;
+    }
+
+    e->hnext = buckets[e->a & (n_buckets - 1)];
+    buckets[e->a & (n_buckets - 1)] = e;
+    lru_push_front(e);
+    n_entries++;
+    cache_bytes += e->size;
+    counters.inserts++;
+    evict(cache_budget, e);
+    ffh5_mutex_unlock(&cache_lock);
+}
+
+/* cache_lock must be held */
+static void clear_entries(void)
+{
+    while (lru_head)
+        remove_entry(lru_head);
+}
+
+/*
+ * Function:  ffmpeg_h5_set_chunk_cache
+ * --------------------
+ * size or disable the decoded chunk cache, see ffmpeg_h5filter.h
+ *
+ *  budget: bytes of decoded chunks to keep, 0 disables the cache
+ *  shared: keep them in POSIX shared memory
+ *
+ *  return: negative value (shared memory not supported), otherwise success
+ *
+ */
+int ffmpeg_h5_set_chunk_cache(size_t budget, int shared)
+{
+#ifndef FFH5_HAVE_SHM
+    if (shared)
+        return -1;
+#endif
+
+    /* the environment only provides the initial setting */
+    ffh5_once(&cache_once, cache_init);
+
+    ffh5_mutex_lock(&cache_lock);
+    if (budget == 0 || (shared != 0) != cache_shared)
+        clear_entries();
+    cache_budget = budget;
+    cache_shared = (shared != 0);
+    evict(budget, NULL);
+    ffh5_mutex_unlock(&cache_lock);
+
+    return 0;
+}
+
+void ffmpeg_h5_clear_chunk_cache(void)
+{
+    ffh5_once(&cache_once, cache_init);
+
+    ffh5_mutex_lock(&cache_lock);
+    clear_entries();
+    ffh5_mutex_unlock(&cache_lock);
+}
+
+void ffmpeg_h5_get_chunk_cache_stats(FFH5ChunkCacheStats *stats, int reset)
+{
+    ffh5_once(&cache_once, cache_init);
+
+    ffh5_mutex_lock(&cache_lock);
+    *stats = counters;
+    stats->bytes = cache_bytes;
+    stats->budget = cache_budget;
+    stats->shared = cache_shared;
+    if (reset)
+        memset(&counters, 0, sizeof(counters));
+    ffh5_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,37 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Process wide cache of decoded chunks, optionally in POSIX shared
+ * memory, see ffmpeg_h5_set_chunk_cache.
+ *
+ */
+
+#ifndef FFMPEG_CHUNKCACHE_H
+#define FFMPEG_CHUNKCACHE_H
+
+#include "ffmpeg_utils.h"
+
+struct FFH5Sink;
+
+/* identity of a decoded chunk: digest of its parameters and compressed bytes */
+typedef struct FFH5ChunkKey
+{
+    uint64_t a;
+    uint64_t b;
+    size_t size; /* decoded size */
+    int valid;   /* 0 when the cache is off */
+} FFH5ChunkKey;
+
+/*
+ * Look up the chunk in of in_size bytes decoded with the cd_nelmts
+ * cd_values.  On a hit the decoded chunk is appended to sink and 1 is
+ * returned; otherwise key is filled in for ffh5_chunkcache_put and 0 is
+ * returned.
+ */
+int ffh5_chunkcache_get(size_t cd_nelmts, const unsigned int cd_values[], const uint8_t *in, size_t in_size,
+                        struct FFH5Sink *sink, FFH5ChunkKey *key);
+
+/* Store the decoded chunk of a miss, a copy of data is kept */
+void ffh5_chunkcache_put(const FFH5ChunkKey *key, const uint8_t *data);
+
+#endif // FFMPEG_CHUNKCACHE_H
@@ -0,0 +1,1075 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Chunk level encode/decode shared by ffmpeg_h5_filter and ffmpeg_native.
+ * Codec contexts come from the per-thread cache in ffmpeg_cache.c.
+ *
+ */
+
+#include "ffmpeg_codec.h"
+#include "ffmpeg_cache.h"
+#include "ffmpeg_ratio.h"
+#include "ffmpeg_caps.h"
+#include "ffmpeg_sched.h"
+#include "ffmpeg_chunkcache.h"
+#include "ffmpeg_stats.h"
+
+#include <limits.h>
+
+/*
+ * Function:  ffh5_sink_reserve
+ * --------------------
+ * make sure extra more bytes fit into the sink, growing it to at least
+ * twice its capacity when it has to grow
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_sink_reserve(FFH5Sink *sink, size_t extra)
+{
+    size_t needed = sink->size + extra;
+
+    if (needed <= sink->capacity)
+        return 0;
+    if (!sink->grow)
+        return -1;
+
+    if (needed < sink->capacity * 2)
+        needed = sink->capacity * 2;
+    if (sink->capacity > 0)
+    {
+        sink->grows++;
+        FFH5_STATS_ADD(reallocs, 1);
+    }
+
+    return sink->grow(sink, needed);
+}
+
+int ffh5_sink_realloc(FFH5Sink *sink, size_t min_capacity)
+{
+    void *grown = realloc(sink->data, min_capacity);
+
+    if (!grown)
+        return -1;
+    sink->data = grown;
+    sink->capacity = min_capacity;
+    return 0;
+}
+
+size_t ffmpeg_decoded_size(const unsigned int cd_values[])
+{
+    size_t frame_size = (size_t)cd_values[2] * cd_values[3];
+
+    if (cd_values[5] != 0)
+        frame_size *= 2;
+
+    return frame_size * cd_values[4];
+}
+
+/*
+ * Function:  ffh5_write_key_index
+ * --------------------
+ * append the keyframe table and footer behind the bitstream of a chunk
+ * that started at sink offset start
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_write_key_index(FFH5Sink *sink, const FFH5KeyIndex *keys, size_t start)
+{
+    uint32_t frame, reserved = 0, count = (uint32_t)keys->count, version = FFH5_KEY_INDEX_VERSION;
+    uint64_t offset;
+    uint8_t *p;
+    size_t i;
+
+    if (ffh5_sink_reserve(sink, keys->count * FFH5_KEY_INDEX_ENTRY_SIZE + FFH5_KEY_INDEX_FOOTER_SIZE) < 0)
+        return -1;
+
+    p = sink->data + sink->size;
+    for (i = 0; i < keys->count; i++)
+    {
+        frame = keys->frames[i];
+        offset = keys->offsets[i] - start;
+        memcpy(p, &frame, 4);
+        memcpy(p + 4, &reserved, 4);
+        memcpy(p + 8, &offset, 8);
+        p += FFH5_KEY_INDEX_ENTRY_SIZE;
+    }
+    memcpy(p, &count, 4);
+    memcpy(p + 4, &version, 4);
+    memcpy(p + 8, FFH5_KEY_INDEX_MAGIC, 8);
+
+    sink->size += keys->count * FFH5_KEY_INDEX_ENTRY_SIZE + FFH5_KEY_INDEX_FOOTER_SIZE;
+    return 0;
+}
+
+/*
+ * Function:  find_key_frame
+ * --------------------
+ * look up the keyframe table of a chunk, if it has one, for the last
+ * keyframe at or before frame first
+ *
+ *  *key_frame, *key_offset: start of decoding, 0 without a table
+ *
+ *  return: size of the bitstream without the table
+ *
+ */
+static size_t find_key_frame(const uint8_t *in, size_t in_size, unsigned int depth, unsigned int first,
+                             unsigned int *key_frame, size_t *key_offset)
+{
+    const uint8_t *footer, *entry;
+    uint32_t count, version, frame, prev_frame = 0;
+    uint64_t offset, prev_offset = 0;
+    size_t table_size, bitstream_size, i;
+
+    *key_frame = 0;
+    *key_offset = 0;
+
+    if (in_size < FFH5_KEY_INDEX_FOOTER_SIZE)
+        return in_size;
+
+    footer = in + in_size - FFH5_KEY_INDEX_FOOTER_SIZE;
+    if (memcmp(footer + 8, FFH5_KEY_INDEX_MAGIC, 8) != 0)
+        return in_size;
+
+    memcpy(&count, footer, 4);
+    memcpy(&version, footer + 4, 4);
+    if (version != FFH5_KEY_INDEX_VERSION || count == 0 || count > depth)
+        return in_size;
+
+    table_size = (size_t)count * FFH5_KEY_INDEX_ENTRY_SIZE + FFH5_KEY_INDEX_FOOTER_SIZE;
+    if (table_size > in_size)
+        return in_size;
+    bitstream_size = in_size - table_size;
+
+    /* validate the whole table before trusting any entry of it */
+    entry = in + bitstream_size;
+    for (i = 0; i < count; i++, entry += FFH5_KEY_INDEX_ENTRY_SIZE)
+    {
+        memcpy(&frame, entry, 4);
+        memcpy(&offset, entry + 8, 8);
+        if (frame >= depth || offset >= bitstream_size ||
+            (i == 0 && (frame != 0 || offset != 0)) ||
+            (i > 0 && (frame <= prev_frame || offset <= prev_offset)))
+            return in_size;
+        prev_frame = frame;
+        prev_offset = offset;
+    }
+
+    entry = in + bitstream_size;
+    for (i = 0; i < count; i++, entry += FFH5_KEY_INDEX_ENTRY_SIZE)
+    {
+        memcpy(&frame, entry, 4);
+        memcpy(&offset, entry + 8, 8);
+        if (frame > first)
+            break;
+        *key_frame = frame;
+        *key_offset = (size_t)offset;
+    }
+
+    return bitstream_size;
+}
+
+int ffh5_packet_index_add(FFH5PacketIndex *packets, uint32_t size, uint32_t flags)
+{
+    size_t capacity = packets->capacity ? packets->capacity * 2 : 64;
+    uint32_t *grown;
+
+    if (packets->count == packets->capacity)
+    {
+        grown = realloc(packets->sizes, capacity * sizeof(uint32_t));
+        if (!grown)
+            return -1;
+        packets->sizes = grown;
+        grown = realloc(packets->flags, capacity * sizeof(uint32_t));
+        if (!grown)
+            return -1;
+        packets->flags = grown;
+        packets->capacity = capacity;
+    }
+
+    packets->sizes[packets->count] = size;
+    packets->flags[packets->count] = flags & AV_PKT_FLAG_KEY;
+    packets->count++;
+    return 0;
+}
+
+int ffh5_write_packet_index(FFH5Sink *sink, const FFH5PacketIndex *packets, size_t max_count)
+{
+    uint32_t count = (uint32_t)packets->count, version = FFH5_PACKET_INDEX_VERSION;
+    size_t table_size = packets->count * FFH5_PACKET_INDEX_ENTRY_SIZE + FFH5_PACKET_INDEX_FOOTER_SIZE;
+    uint8_t *p;
+    size_t i;
+
+    if (packets->count == 0 || packets->count > max_count)
+        return 0;
+    if (ffh5_sink_reserve(sink, table_size) < 0)
+        return -1;
+
+    p = sink->data + sink->size;
+    for (i = 0; i < packets->count; i++, p += FFH5_PACKET_INDEX_ENTRY_SIZE)
+    {
+        memcpy(p, &packets->sizes[i], 4);
+        memcpy(p + 4, &packets->flags[i], 4);
+    }
+    memcpy(p, &count, 4);
+    memcpy(p + 4, &version, 4);
+    memcpy(p + 8, FFH5_PACKET_INDEX_MAGIC, 8);
+
+    sink->size += table_size;
+    return 0;
+}
+
+/*
+ * Function:  ffh5_packet_index_size
+ * --------------------
+ * find the packet table at the end of a bitstream; it is only trusted
+ * when its sizes cover the bytes in front of it exactly
+ *
+ *  *in: bitstream followed by the table
+ *  size: bytes of both
+ *  before: bitstream bytes in front of in (streams that were fed already)
+ *  depth: frames of the chunk, the most packets a table may list
+ *  **entries: receives the first entry, NULL without a table
+ *  *count: receives the number of packets
+ *
+ *  return: size of the table, 0 without one
+ *
+ */
+size_t ffh5_packet_index_size(const uint8_t *in, size_t size, size_t before, unsigned int depth,
+                              const uint8_t **entries, size_t *count)
+{
+    const uint8_t *footer, *entry;
+    uint32_t n, version, packet_size;
+    size_t table_size, total = 0, i;
+
+    *entries = NULL;
+    *count = 0;
+
+    if (size < FFH5_PACKET_INDEX_FOOTER_SIZE)
+        return 0;
+
+    footer = in + size - FFH5_PACKET_INDEX_FOOTER_SIZE;
+    if (memcmp(footer + 8, FFH5_PACKET_INDEX_MAGIC, 8) != 0)
+        return 0;
+
+    memcpy(&n, footer, 4);
+    memcpy(&version, footer + 4, 4);
+    if (version != FFH5_PACKET_INDEX_VERSION || n == 0 || n > depth)
+        return 0;
+
+    table_size = (size_t)n * FFH5_PACKET_INDEX_ENTRY_SIZE + FFH5_PACKET_INDEX_FOOTER_SIZE;
+    if (table_size > size)
+        return 0;
+
+    entry = in + size - table_size;
+    for (i = 0; i < n; i++)
+    {
+        memcpy(&packet_size, entry + i * FFH5_PACKET_INDEX_ENTRY_SIZE, 4);
+        if (packet_size == 0 || packet_size > INT_MAX)
+            return 0;
+        total += packet_size;
+    }
+    if (total != before + size - table_size)
+        return 0;
+
+    *entries = entry;
+    *count = n;
+    return table_size;
+}
+
+/*
+ * Function:  ffh5_packet_index_wanted
+ * --------------------
+ * whether chunks get a packet table; it is opt-in because readers that
+ * predate it would hand it to the parser with the bitstream, but FFV1
+ * cannot be decoded without one
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters
+ *
+ *  return: non-zero when the table is written
+ *
+ */
+int ffh5_packet_index_wanted(size_t cd_nelmts, const unsigned int cd_values[])
+{
+    if (cd_values[0] == FFH5_ENC_FFV1)
+        return 1;
+    return cd_nelmts > FFH5_CD_FEATURES && (cd_values[FFH5_CD_FEATURES] & FFH5_FEATURE_PACKET_INDEX);
+}
+
+/*
+ * Function:  ffh5_intra_only
+ * --------------------
+ * whether an encoder codes every frame on its own, so any frame of its
+ * chunks can be decoded without the ones before it
+ *
+ *  enc_id: encoder id (cd_values[0])
+ *
+ *  return: non-zero for intra only encoders
+ *
+ */
+int ffh5_intra_only(unsigned int enc_id)
+{
+    return enc_id == FFH5_ENC_FFV1 || enc_id == FFH5_ENC_X264_LOSSLESS;
+}
+
+/*
+ * Function:  ffh5_bit_mode_supported
+ * --------------------
+ * whether the pixel format an encoder is opened with holds the samples
+ * of a bit mode; 12 bit needs x265 or FFV1, 16 bit needs FFV1, the other
+ * encoders would silently scale the samples down to 10 bit
+ *
+ *  enc_id: encoder id (cd_values[0])
+ *  bit_mode: cd_values[5]
+ *
+ *  return: non-zero when the encoder codes every bit
+ *
+ */
+int ffh5_bit_mode_supported(unsigned int enc_id, unsigned int bit_mode)
+{
+    switch (bit_mode)
+    {
+    case 0:
+    case 1:
+        return 1;
+    case 2:
+        return enc_id == FFH5_ENC_X265 || enc_id == FFH5_ENC_FFV1;
+    case 3:
+        return enc_id == FFH5_ENC_FFV1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Function:  ffh5_coded_params
+ * --------------------
+ * frame size the encoder accepts: 4:2:0 needs even sides, NVENC rejects
+ * frames below 145 x 49 (H.264) or 129 x 33 (HEVC, AV1) and SVT-AV1
+ * below 64 x 64; FFV1 takes gray frames of any size
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters
+ *  coded: cd_values with the coded width and height
+ *
+ *  return: 1 when frames have to be padded, 0 otherwise
+ *
+ */
+int ffh5_coded_params(size_t cd_nelmts, const unsigned int cd_values[], unsigned int coded[])
+{
+    unsigned int min_width = 0, min_height = 0;
+
+    if (cd_nelmts > FFH5_MAX_CD_VALUES)
+        cd_nelmts = FFH5_MAX_CD_VALUES;
+    memcpy(coded, cd_values, cd_nelmts * sizeof(unsigned int));
+
+    switch (cd_values[0])
+    {
+    case FFH5_ENC_H264_NV:
+        min_width = 145;
+        min_height = 49;
+        break;
+    case FFH5_ENC_HEVC_NV:
+    case FFH5_ENC_AV1_NV:
+        min_width = 129;
+        min_height = 33;
+        break;
+    case FFH5_ENC_SVTAV1:
+        min_width = 64;
+        min_height = 64;
+        break;
+    case FFH5_ENC_FFV1:
+        /* gray, no subsampling: any size */
+        return 0;
+    default:
+        break;
+    }
+
+    if (coded[2] < min_width)
+        coded[2] = min_width;
+    if (coded[3] < min_height)
+        coded[3] = min_height;
+    coded[2] += coded[2] & 1;
+    coded[3] += coded[3] & 1;
+
+    return coded[2] != cd_values[2] || coded[3] != cd_values[3];
+}
+
+/*
+ * Function:  ffh5_pad_frame
+ * --------------------
+ * copy a frame into a larger packed one, replicating the last column
+ * and row, which costs the encoder next to nothing
+ *
+ *  *src: first row of the frame
+ *  linesize: bytes between rows of src
+ *  width, height: frame size
+ *  bytes: bytes per sample
+ *  *dst: coded_width x coded_height samples
+ *
+ */
+void ffh5_pad_frame(const uint8_t *src, size_t linesize, unsigned int width, unsigned int height,
+                    int bytes, uint8_t *dst, unsigned int coded_width, unsigned int coded_height)
+{
+    size_t row_size = (size_t)width * bytes, coded_row = (size_t)coded_width * bytes;
+    const uint8_t *last;
+    uint8_t *row = dst;
+    unsigned int x, y;
+
+    for (y = 0; y < height; y++, src += linesize, row += coded_row)
+    {
+        memcpy(row, src, row_size);
+        last = src + row_size - bytes;
+        for (x = width; x < coded_width; x++)
+            memcpy(row + (size_t)x * bytes, last, bytes);
+    }
+    for (; y < coded_height; y++, row += coded_row)
+        memcpy(row, row - coded_row, coded_row);
+}
+
+int ffh5_write_pad_record(FFH5Sink *sink, unsigned int coded_width, unsigned int coded_height)
+{
+    uint32_t w = coded_width, h = coded_height;
+    uint8_t *p;
+
+    if (ffh5_sink_reserve(sink, FFH5_PAD_RECORD_SIZE) < 0)
+        return -1;
+
+    p = sink->data + sink->size;
+    memcpy(p, &w, 4);
+    memcpy(p + 4, &h, 4);
+    memcpy(p + 8, FFH5_PAD_MAGIC, 8);
+    sink->size += FFH5_PAD_RECORD_SIZE;
+    return 0;
+}
+
+size_t ffh5_pad_record_size(const uint8_t *in, size_t size, unsigned int width, unsigned int height)
+{
+    const uint8_t *record;
+    uint32_t w, h;
+
+    if (size < FFH5_PAD_RECORD_SIZE)
+        return 0;
+
+    record = in + size - FFH5_PAD_RECORD_SIZE;
+    if (memcmp(record + 8, FFH5_PAD_MAGIC, 8) != 0)
+        return 0;
+
+    memcpy(&w, record, 4);
+    memcpy(&h, record + 4, 4);
+    if (w < width || h < height || w - width > FFH5_PAD_MAX || h - height > FFH5_PAD_MAX)
+        return 0;
+    return FFH5_PAD_RECORD_SIZE;
+}
+
+/* free callback of buffers wrapping memory owned by someone else */
+static void keep_buffer(void *opaque, uint8_t *data)
+{
+    (void)opaque;
+    (void)data;
+}
+
+/*
+ * Function:  ffh5_encode_frame
+ * --------------------
+ * convert one gray frame into the encoder's input format and encode it
+ *
+ *  *entry: encoder context
+ *  *gray: first row of the frame
+ *  linesize: bytes between rows
+ *  *gray_ref: buffer holding gray when frames may reference it, or NULL
+ *  pts: frame number within the stream
+ *  *sink: where packets the encoder outputs are appended
+ *  *keys: keyframe table to extend, or NULL
+ *  *packets: packet table to extend, or NULL
+ *  error: error reporting callback
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_encode_frame(FFH5CodecEntry *entry, const uint8_t *gray, int linesize, AVBufferRef *gray_ref,
+                      int64_t pts, FFH5Sink *sink, FFH5KeyIndex *keys, FFH5PacketIndex *packets,
+                      void (*error)(const char *msg))
+{
+    AVFrame *src_frame = entry->src_frame, *dst_frame = entry->dst_frame;
+    uint64_t t0 = FFH5_STATS_BEGIN();
+    int ret;
+
+    if (entry->hw)
+    {
+        /* straight into a device frame, nvenc reads it in place */
+        ret = ffh5_hw_frame_from_gray(entry->hw, gray, linesize, dst_frame);
+    }
+    else if (entry->pixconv != FFH5_PIXCONV_NONE)
+    {
+        /* gray rows become luma, chroma is shared and never rewritten */
+        ret = ffh5_encoder_frame(entry, gray, linesize, gray_ref);
+    }
+    else
+    {
+        ret = av_frame_make_writable(dst_frame);
+        if (ret < 0)
+        {
+            error("Frame not writable\n");
+            return ret;
+        }
+        ret = av_frame_make_writable(src_frame);
+        if (ret < 0)
+        {
+            error("Frame not writable\n");
+            return ret;
+        }
+        /* put buffer data to frame and do colorspace conversion */
+        av_image_fill_arrays(src_frame->data, src_frame->linesize, gray, src_frame->format,
+                             src_frame->width, src_frame->height, 1);
+        ret = sws_scale_frame(entry->sws_context, dst_frame, src_frame);
+    }
+    FFH5_STATS_END(FFH5_STAGE_CONVERT, t0);
+
+    if (ret < 0)
+    {
+        error("Could not do colorspace conversion\n");
+        return ret;
+    }
+
+    FFH5_STATS_ADD(frames_encoded, 1);
+    dst_frame->pts = pts;
+    dst_frame->quality = entry->c->global_quality;
+
+    /* encode the frame */
+    return encode(entry->c, dst_frame, entry->pkt, sink, keys, packets);
+}
+
+/* encode with the given parameters, gpu placement is done by the caller */
+static size_t encode_chunk(size_t cd_nelmts, const unsigned int cd_values[],
+                           const uint8_t *in, size_t in_size, FFH5Sink *sink,
+                           void (*error)(const char *msg))
+{
+    /*
+     * cd_values[0] = encoder_id
+     * cd_values[1] = decoder_id
+     * cd_values[2] = width
+     * cd_values[3] = height
+     * cd_values[4] = depth
+     * cd_values[5] = bit_mode
+     * cd_values[6] = preset
+     * cd_values[7] = tune
+     * cd_values[8] = crf
+     * cd_values[9] = film_grain [for svt-av1 only]
+     * cd_values[10] = gpu_id [for nvidia gpu only]
+     * cd_values[11] = threads [optional, 0 = codec default]
+     * cd_values[12] = thread_type [optional, 1 = frame, 2 = slice]
+     * cd_values[13] = gop_size [optional, > 0 adds a keyframe table]
+     */
+    FFH5CodecEntry *entry = NULL;
+    AVCodecContext *c;
+    AVFrame *dst_frame;
+
+    int width, height, depth;
+    int color_mode;
+
+    size_t expected_size = 0, frame_size = 0;
+    const uint8_t *p_data = NULL;
+    size_t start = sink->size, grows = sink->grows;
+    FFH5KeyIndex keys = {0, 0, NULL, NULL}, *p_keys = NULL;
+    FFH5PacketIndex packets = {0, 0, NULL, NULL}, *p_packets = NULL;
+    AVBufferRef *in_ref = NULL;
+    unsigned int coded[FFH5_MAX_CD_VALUES];
+    uint8_t *pad = NULL;
+    int padded, bytes;
+    int reusable = 1;
+
+    int i;
+
+    if (cd_nelmts < FFH5_CD_NELMTS)
+    {
+        error("Not enough auxiliary parameters\n");
+        goto CompressFailure;
+    }
+
+    width = cd_values[2];
+    height = cd_values[3];
+    depth = cd_values[4];
+    color_mode = cd_values[5];
+
+    if (!ffh5_bit_mode_supported(cd_values[0], color_mode))
+    {
+        error("Bit mode not supported by the encoder\n");
+        goto CompressFailure;
+    }
+
+    frame_size = (color_mode == 0) ? (size_t)width * height : (size_t)width * height * 2;
+    if (in_size < frame_size * depth)
+    {
+        error("Input buffer is smaller than the chunk\n");
+        goto CompressFailure;
+    }
+
+    /* frames the encoder rejects at their size go through pad at the coded size */
+    bytes = (color_mode == 0) ? 1 : 2;
+    padded = ffh5_coded_params(cd_nelmts, cd_values, coded);
+    if (padded)
+    {
+        pad = malloc((size_t)coded[2] * coded[3] * bytes);
+        if (!pad)
+        {
+            error("Out of memory occurred during encoding\n");
+            goto CompressFailure;
+        }
+        entry = ffh5_acquire_encoder((cd_nelmts < FFH5_MAX_CD_VALUES) ? cd_nelmts : FFH5_MAX_CD_VALUES,
+                                     coded, error);
+    }
+    else
+        entry = ffh5_acquire_encoder(cd_nelmts, cd_values, error);
+    if (!entry)
+        goto CompressFailure;
+
+    c = entry->c;
+    dst_frame = entry->dst_frame;
+
+    p_data = in;
+
+    /* lets frames reference the input as luma; nothing to free, the
+     * caller owns in and every reference is gone once we return */
+    if (!padded && entry->pixconv != FFH5_PIXCONV_NONE && ffh5_pixconv_is_copy(entry->pixconv))
+    {
+        in_ref = av_buffer_create((uint8_t *)in, frame_size * depth, keep_buffer, NULL,
+                                  AV_BUFFER_FLAG_READONLY);
+        if (!in_ref)
+        {
+            error("Out of memory occurred during encoding\n");
+            goto CompressFailure;
+        }
+    }
+
+    /* keyframe table for random access, see ffmpeg_decode_chunk_range;
+     * intra only chunks have one entry per frame */
+    if ((cd_nelmts > FFH5_CD_GOP_SIZE && cd_values[FFH5_CD_GOP_SIZE] > 0) || ffh5_intra_only(cd_values[0]))
+    {
+        keys.capacity = depth;
+        keys.frames = malloc(depth * sizeof(uint32_t));
+        keys.offsets = malloc(depth * sizeof(size_t));
+        if (!keys.frames || !keys.offsets)
+        {
+            error("Out of memory occurred during encoding\n");
+            goto CompressFailure;
+        }
+        p_keys = &keys;
+    }
+
+    if (ffh5_packet_index_wanted(cd_nelmts, cd_values))
+        p_packets = &packets;
+
+    /* sized from the ratios of earlier chunks, growing is the exception */
+    expected_size = ffh5_ratio_reserve(cd_values, frame_size * depth);
+    if (ffh5_sink_reserve(sink, expected_size) < 0)
+    {
+        error("Out of memory occurred during encoding\n");
+        goto CompressFailure;
+    }
+
+    /* real code for encoding buffer data */
+    for (i = 0; i < depth; i++)
+    {
+        if (padded)
+        {
+            ffh5_pad_frame(p_data, frame_size / height, width, height, bytes, pad, coded[2], coded[3]);
+            if (ffh5_encode_frame(entry, pad, (int)coded[2] * bytes, NULL, i, sink, p_keys, p_packets,
+                                  error) < 0)
+                goto CompressFailure;
+        }
+        else if (ffh5_encode_frame(entry, p_data, (int)(frame_size / height), in_ref, i, sink, p_keys,
+                                   p_packets, error) < 0)
+            goto CompressFailure;
+        p_data += frame_size;
+    }
+
+    /* flush the encoder */
+    if (encode(c, NULL, entry->pkt, sink, p_keys, p_packets) < 0)
+        goto CompressFailure;
+
+    if (entry->hw || entry->pixconv != FFH5_PIXCONV_NONE)
+        av_frame_unref(dst_frame);
+    /* an encoder still holding frames would read in after we return */
+    if (in_ref && av_buffer_get_ref_count(in_ref) > 1)
+        reusable = 0;
+
+    if (sink->size == start)
+    {
+        error("Encoder produced no data\n");
+        goto CompressFailure;
+    }
+
+    /* decoders submit the packets as they came out, see ffh5_packet_index_size */
+    if (p_packets && ffh5_write_packet_index(sink, p_packets, depth) < 0)
+    {
+        error("Out of memory occurred during encoding\n");
+        goto CompressFailure;
+    }
+
+    /* decoders crop back to width x height, see ffh5_pad_record_size */
+    if (padded && ffh5_write_pad_record(sink, coded[2], coded[3]) < 0)
+    {
+        error("Out of memory occurred during encoding\n");
+        goto CompressFailure;
+    }
+
+    if (p_keys && keys.count > 0 && ffh5_write_key_index(sink, &keys, start) < 0)
+    {
+        error("Out of memory occurred during encoding\n");
+        goto CompressFailure;
+    }
+
+    goto CompressFinish;
+
+CompressFinish:
+    ffh5_ratio_observe(cd_values, frame_size * depth, sink->size - start, expected_size,
+                       sink->grows - grows);
+    free(keys.frames);
+    free(keys.offsets);
+    free(packets.sizes);
+    free(packets.flags);
+    free(pad);
+    ffh5_release_context(entry, reusable);
+    av_buffer_unref(&in_ref);
+    return sink->size - start;
+
+CompressFailure:
+    error("Error compressing array\n");
+    free(keys.frames);
+    free(keys.offsets);
+    free(packets.sizes);
+    free(packets.flags);
+    free(pad);
+    ffh5_release_context(entry, 0);
+    av_buffer_unref(&in_ref);
+    sink->size = start;
+    return 0;
+}
+
+/*
+ * Function:  ffmpeg_encode_chunk
+ * --------------------
+ * compress a chunk of depth x height x width gray frames
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters
+ *  *in: raw frames
+ *  in_size: size of the raw frames buffer
+ *  *sink: where the compressed bitstream is appended
+ *  error: error reporting callback
+ *
+ *  return: 0 (failed), otherwise size of the compressed bitstream
+ *
+ */
+size_t ffmpeg_encode_chunk(size_t cd_nelmts, const unsigned int cd_values[],
+                           const uint8_t *in, size_t in_size, FFH5Sink *sink,
+                           void (*error)(const char *msg))
+{
+    unsigned int params[FFH5_MAX_CD_VALUES];
+    uint64_t t0 = FFH5_STATS_BEGIN();
+    size_t out_size;
+    int slot;
+
+    /* nvenc chunks go to the gpu the schedule picks, or to the cpu */
+    slot = ffh5_sched_acquire(1, cd_nelmts, cd_values, params);
+    if (slot == FFH5_SCHED_NONE && params[0] == cd_values[0])
+    {
+        out_size = encode_chunk(cd_nelmts, cd_values, in, in_size, sink, error);
+        goto Finish;
+    }
+
+    if (cd_nelmts > FFH5_MAX_CD_VALUES)
+        cd_nelmts = FFH5_MAX_CD_VALUES;
+    out_size = encode_chunk(cd_nelmts, params, in, in_size, sink, error);
+    ffh5_sched_release(1, slot);
+
+    /* sessions opened by other processes count against the cap too */
+    if (out_size == 0 && slot != FFH5_SCHED_NONE && ffh5_sched_fallback(params))
+        out_size = encode_chunk(cd_nelmts, params, in, in_size, sink, error);
+
+Finish:
+    if (t0)
+        ffh5_stats_chunk(FFH5_STAGE_ENCODE_CHUNK, t0, in_size, out_size);
+    return out_size;
+}
+
+/*
+ * Function:  decode_frames
+ * --------------------
+ * decode a bitstream (without trailers) that starts at a keyframe,
+ * dropping the first skip frames and keeping at most count frames
+ *
+ *  *packets: n_packets packet table entries covering in, NULL to parse
+ *
+ *  return: 0 (failed), otherwise size of the decoded frames
+ *
+ */
+static size_t decode_frames(size_t cd_nelmts, const unsigned int cd_values[],
+                            const uint8_t *in, size_t in_size, const uint8_t *packets, size_t n_packets,
+                            int skip, int count, FFH5Sink *sink, void (*error)(const char *msg))
+{
+    FFH5CodecEntry *entry = NULL;
+    AVCodecContext *c;
+    AVPacket *pkt;
+
+    int width, height;
+    int color_mode;
+
+    size_t p_data_size = 0, frame_size = 0;
+    const uint8_t *p_data = NULL;
+    size_t start = sink->size;
+    FFH5Sink frames;
+
+    uint32_t packet_size, packet_flags;
+    size_t i;
+    int ret, eof = 0;
+
+    width = cd_values[2];
+    height = cd_values[3];
+    color_mode = cd_values[5];
+
+    entry = ffh5_acquire_decoder(cd_nelmts, cd_values, error);
+    if (!entry)
+        goto DecompressFailure;
+
+    c = entry->c;
+    pkt = entry->pkt;
+
+    p_data = in;
+    p_data_size = in_size;
+
+    frame_size = (color_mode == 0) ? (size_t)width * height : (size_t)width * height * 2;
+    if (ffh5_sink_reserve(sink, frame_size * count) < 0)
+    {
+        error("Out of memory occurred during decoding\n");
+        goto DecompressFailure;
+    }
+
+    /* frames go straight to the sink, bounded to the requested count */
+    frames.data = sink->data + start;
+    frames.size = 0;
+    frames.capacity = frame_size * count;
+    frames.grow = NULL;
+    frames.opaque = NULL;
+    frames.grows = 0;
+
+    /* the encoder's own packets, no parsing needed */
+    for (i = 0; packets && i < n_packets && frames.size < frames.capacity; i++)
+    {
+        memcpy(&packet_size, packets + i * FFH5_PACKET_INDEX_ENTRY_SIZE, 4);
+        memcpy(&packet_flags, packets + i * FFH5_PACKET_INDEX_ENTRY_SIZE + 4, 4);
+        pkt->data = (uint8_t *)p_data;
+        pkt->size = (int)packet_size;
+        pkt->flags = (int)(packet_flags & AV_PKT_FLAG_KEY);
+
+        if (decode(c, entry->src_frame, pkt, entry->pixconv, &entry->sws_context, entry->dst_frame,
+                   &frames, frame_size, &skip) < 0)
+            goto DecompressFailure;
+        p_data += packet_size;
+    }
+
+    /* codecs without a parser (FFV1) only decode chunks with a packet table */
+    if (!packets && !entry->parser)
+    {
+        error("Chunk has no packet table and the codec no parser\n");
+        goto DecompressFailure;
+    }
+
+    /* real code for decoding buffer data */
+    while (!packets && frames.size < frames.capacity)
+    {
+        uint64_t t0 = FFH5_STATS_BEGIN();
+
+        eof = !p_data_size;
+
+        ret = av_parser_parse2(entry->parser, c, &pkt->data, &pkt->size,
+                               p_data, (int)p_data_size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        FFH5_STATS_END(FFH5_STAGE_PARSE, t0);
+
+        if (ret < 0)
+        {
+            error("Packet not readable\n");
+            goto DecompressFailure;
+        }
+
+        p_data += ret;
+        p_data_size -= ret;
+
+        if (pkt->size)
+        {
+            if (decode(c, entry->src_frame, pkt, entry->pixconv, &entry->sws_context, entry->dst_frame,
+                       &frames, frame_size, &skip) < 0)
+                goto DecompressFailure;
+        }
+        else if (eof)
+            break;
+    }
+
+    /* flush the decoder */
+    pkt->data = NULL;
+    pkt->size = 0;
+    pkt->flags = 0;
+    if (decode(c, entry->src_frame, pkt, entry->pixconv, &entry->sws_context, entry->dst_frame,
+               &frames, frame_size, &skip) < 0)
+        goto DecompressFailure;
+
+    if (frames.size == 0)
+    {
+        error("Decoder produced no frames\n");
+        goto DecompressFailure;
+    }
+
+    sink->size = start + frames.size;
+
+    goto DecompressFinish; // success
+
+DecompressFinish:
+    ffh5_release_context(entry, 1);
+    return frames.size;
+
+DecompressFailure:
+    error("Error decompressing packets\n");
+    ffh5_release_context(entry, 0);
+    sink->size = start;
+    return 0;
+}
+
+/*
+ * Function:  ffmpeg_decode_chunk_range
+ * --------------------
+ * decompress frames [first, first + count) of a chunk; with a keyframe
+ * table decoding starts at the closest keyframe before first
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters
+ *  *in: compressed chunk
+ *  in_size: size of the compressed chunk
+ *  first: first frame wanted
+ *  count: number of frames wanted
+ *  *sink: where the raw frames are appended
+ *  error: error reporting callback
+ *
+ *  return: 0 (failed), otherwise size of the decoded frames
+ *
+ */
+size_t ffmpeg_decode_chunk_range(size_t cd_nelmts, const unsigned int cd_values[],
+                                 const uint8_t *in, size_t in_size,
+                                 unsigned int first, unsigned int count,
+                                 FFH5Sink *sink, void (*error)(const char *msg))
+{
+    /*
+     * cd_values[0] = encoder_id
+     * cd_values[1] = decoder_id
+     * cd_values[2] = width
+     * cd_values[3] = height
+     * cd_values[4] = depth
+     * cd_values[5] = bit_mode
+     * cd_values[11] = threads [optional]
+     * cd_values[12] = thread_type [optional]
+     */
+    unsigned int params[FFH5_MAX_CD_VALUES];
+    unsigned int depth, key_frame;
+    size_t bitstream_size, key_offset, out_size, n_packets, key_packet = 0, offset = 0;
+    const uint8_t *packets;
+    uint32_t packet_size;
+    uint64_t t0 = FFH5_STATS_BEGIN();
+    int slot;
+
+    if (cd_nelmts < FFH5_CD_NELMTS)
+    {
+        error("Not enough auxiliary parameters\n");
+        return 0;
+    }
+
+    depth = cd_values[4];
+    if (count == 0 || first >= depth || count > depth - first)
+    {
+        error("Frame range is outside of the chunk\n");
+        return 0;
+    }
+
+    bitstream_size = find_key_frame(in, in_size, depth, first, &key_frame, &key_offset);
+    bitstream_size -= ffh5_pad_record_size(in, bitstream_size, cd_values[2], cd_values[3]);
+    bitstream_size -= ffh5_packet_index_size(in, bitstream_size, 0, depth, &packets, &n_packets);
+
+    /* packet the keyframe starts; a keyframe inside a packet means parsing */
+    while (packets && offset < key_offset && key_packet < n_packets)
+    {
+        memcpy(&packet_size, packets + key_packet * FFH5_PACKET_INDEX_ENTRY_SIZE, 4);
+        offset += packet_size;
+        key_packet++;
+    }
+    if (offset != key_offset)
+        packets = NULL;
+
+    /* cuvid chunks go to the gpu the schedule picks, or to software
+     * decoders on machines without the device */
+    slot = ffh5_sched_acquire(0, cd_nelmts, cd_values, params);
+    if (slot != FFH5_SCHED_NONE || (cd_nelmts >= FFH5_CD_NELMTS && ffh5_caps_decoder(params)))
+    {
+        if (cd_nelmts > FFH5_MAX_CD_VALUES)
+            cd_nelmts = FFH5_MAX_CD_VALUES;
+        cd_values = params;
+    }
+
+    out_size = decode_frames(cd_nelmts, cd_values, in + key_offset, bitstream_size - key_offset,
+                             packets ? packets + key_packet * FFH5_PACKET_INDEX_ENTRY_SIZE : NULL,
+                             n_packets - key_packet, (int)(first - key_frame), (int)count, sink, error);
+
+    /* streams that cannot start mid-chunk (e.g. missing headers) */
+    if (out_size == 0 && key_offset > 0)
+        out_size = decode_frames(cd_nelmts, cd_values, in, bitstream_size, packets, n_packets,
+                                 (int)first, (int)count, sink, error);
+
+    ffh5_sched_release(0, slot);
+    if (t0)
+        ffh5_stats_chunk(FFH5_STAGE_DECODE_CHUNK, t0, in_size, out_size);
+    return out_size;
+}
+
+/*
+ * Function:  ffmpeg_decode_chunk
+ * --------------------
+ * decompress a chunk back to depth x height x width gray frames
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters
+ *  *in: compressed bitstream
+ *  in_size: size of the compressed bitstream
+ *  *sink: where the raw frames are appended
+ *  error: error reporting callback
+ *
+ *  return: 0 (failed), otherwise size of the decoded frames
+ *
+ */
+size_t ffmpeg_decode_chunk(size_t cd_nelmts, const unsigned int cd_values[],
+                           const uint8_t *in, size_t in_size, FFH5Sink *sink,
+                           void (*error)(const char *msg))
+{
+    FFH5ChunkKey key;
+    size_t start = sink->size, out_size;
+
+    if (cd_nelmts < FFH5_CD_NELMTS)
+    {
+        error("Not enough auxiliary parameters\n");
+        return 0;
+    }
+
+    if (ffh5_chunkcache_get(cd_nelmts, cd_values, in, in_size, sink, &key))
+    {
+        FFH5_STATS_ADD(chunk_cache_hits, 1);
+        return key.size;
+    }
+    if (key.valid)
+        FFH5_STATS_ADD(chunk_cache_misses, 1);
+
+    out_size = ffmpeg_decode_chunk_range(cd_nelmts, cd_values, in, in_size, 0, cd_values[4], sink, error);
+
+    /* short decodes are not worth keeping */
+    if (out_size == key.size)
+        ffh5_chunkcache_put(&key, sink->data + start);
+    return out_size;
+}
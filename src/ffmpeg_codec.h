@@ -0,0 +1,205 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Chunk level encode/decode shared by the HDF5 filter and the native
+ * (python) entry point.
+ *
+ */
+
+#ifndef FFMPEG_CODEC_H
+#define FFMPEG_CODEC_H
+
+#include "ffmpeg_utils.h"
+
+/*
+ * Destination of encoded packets or decoded frames.  Output is written
+ * at data + size; grow (may be NULL for fixed buffers) must make room
+ * for at least min_capacity bytes and may move data.  Initializers may
+ * omit grows.
+ */
+typedef struct FFH5Sink
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    int (*grow)(struct FFH5Sink *sink, size_t min_capacity);
+    void *opaque;
+    size_t grows; /* times data that was already allocated had to grow */
+} FFH5Sink;
+
+/*
+ * Keyframes seen while encoding a chunk.  Chunks encoded with a gop size
+ * (cd_values[13]) end with a table of (frame, byte offset) pairs:
+ *
+ *   count x { uint32 frame; uint32 reserved; uint64 offset }
+ *   footer  { uint32 count; uint32 version; char magic[8] }
+ *
+ * Offsets are relative to the start of the chunk; the footer is the last
+ * FFH5_KEY_INDEX_FOOTER_SIZE bytes.
+ */
+#define FFH5_KEY_INDEX_MAGIC "FFH5KIDX"
+#define FFH5_KEY_INDEX_VERSION 1
+#define FFH5_KEY_INDEX_ENTRY_SIZE 16
+#define FFH5_KEY_INDEX_FOOTER_SIZE 16
+
+typedef struct FFH5KeyIndex
+{
+    size_t count;
+    size_t capacity;
+    uint32_t *frames;
+    size_t *offsets; /* sink offsets */
+} FFH5KeyIndex;
+
+/*
+ * Packets the encoder produced for a chunk, so decoders submit them with
+ * avcodec_send_packet instead of rediscovering their boundaries with
+ * av_parser_parse2.  Written when cd_values[17] asks for it (readers
+ * before the table would parse it as video) and for FFV1, directly
+ * behind the bitstream, before the padding record and the keyframe table:
+ *
+ *   count x { uint32 size; uint32 flags }
+ *   footer  { uint32 count; uint32 version; char magic[8] }
+ *
+ * flags carries AV_PKT_FLAG_KEY.  The sizes add up to the bitstream and
+ * there are at most depth packets; chunks without a valid table (written
+ * before it existed) are parsed as before.
+ */
+#define FFH5_PACKET_INDEX_MAGIC "FFH5PKTS"
+#define FFH5_PACKET_INDEX_VERSION 1
+#define FFH5_PACKET_INDEX_ENTRY_SIZE 8
+#define FFH5_PACKET_INDEX_FOOTER_SIZE 16
+
+typedef struct FFH5PacketIndex
+{
+    size_t count;
+    size_t capacity;
+    uint32_t *sizes;
+    uint32_t *flags;
+} FFH5PacketIndex;
+
+/*
+ * Frames the encoder cannot take at their size (odd sides with 4:2:0,
+ * below the minimum of NVENC / SVT-AV1) are padded to the coded size by
+ * replicating the last column and row, and cropped again on decode.
+ * Such chunks carry the coded size behind the bitstream, before the
+ * keyframe table if there is one:
+ *
+ *   { uint32 coded_width; uint32 coded_height; char magic[8] }
+ *
+ * Chunks that need no padding are unchanged.
+ */
+#define FFH5_PAD_MAGIC "FFH5PADS"
+#define FFH5_PAD_RECORD_SIZE 16
+/* largest padding a record may claim per side */
+#define FFH5_PAD_MAX 1024
+
+struct FFH5CodecEntry;
+
+/* make room for extra more bytes, returns 0 on success */
+int ffh5_sink_reserve(FFH5Sink *sink, size_t extra);
+
+/* grow callback for sinks whose data is malloc'd (release with free) */
+int ffh5_sink_realloc(FFH5Sink *sink, size_t min_capacity);
+
+/*
+ * Both append to sink and return the number of bytes produced, or 0 on
+ * failure.  The input buffer is never modified or freed; the sink keeps
+ * whatever memory it owns either way.
+ */
+size_t ffmpeg_encode_chunk(size_t cd_nelmts, const unsigned int cd_values[],
+                           const uint8_t *in, size_t in_size, FFH5Sink *sink,
+                           void (*error)(const char *msg));
+
+size_t ffmpeg_decode_chunk(size_t cd_nelmts, const unsigned int cd_values[],
+                           const uint8_t *in, size_t in_size, FFH5Sink *sink,
+                           void (*error)(const char *msg));
+
+/*
+ * Decode only frames [first, first + count) of a chunk, starting at the
+ * closest preceding keyframe when the chunk has a keyframe table.
+ */
+size_t ffmpeg_decode_chunk_range(size_t cd_nelmts, const unsigned int cd_values[],
+                                 const uint8_t *in, size_t in_size,
+                                 unsigned int first, unsigned int count,
+                                 FFH5Sink *sink, void (*error)(const char *msg));
+
+/*
+ * Convert one gray frame (rows linesize bytes apart) and send it to the
+ * encoder of entry, appending whatever packets come out to sink.  Frames
+ * may reference gray_ref when given, the caller must keep it alive until
+ * the encoder is flushed.  Returns 0 on success.
+ */
+int ffh5_encode_frame(struct FFH5CodecEntry *entry, const uint8_t *gray, int linesize, AVBufferRef *gray_ref,
+                      int64_t pts, FFH5Sink *sink, FFH5KeyIndex *keys, FFH5PacketIndex *packets,
+                      void (*error)(const char *msg));
+
+/*
+ * Append the keyframe table of keys behind a bitstream that started at
+ * sink offset start.  Returns 0 on success.
+ */
+int ffh5_write_key_index(FFH5Sink *sink, const FFH5KeyIndex *keys, size_t start);
+
+/* record one more packet, growing the table; returns 0 on success */
+int ffh5_packet_index_add(FFH5PacketIndex *packets, uint32_t size, uint32_t flags);
+
+/*
+ * Append the packet table behind a bitstream of at most max_count
+ * packets; larger tables are left out and the chunk is parsed on decode.
+ * Returns 0 on success.
+ */
+int ffh5_write_packet_index(FFH5Sink *sink, const FFH5PacketIndex *packets, size_t max_count);
+
+/*
+ * Size of the packet table at the end of a bitstream of size bytes
+ * (padding record and keyframe table removed, before more bytes of it
+ * in front of in) of a chunk of depth frames, 0 without one.  *entries
+ * receives the first entry.
+ */
+size_t ffh5_packet_index_size(const uint8_t *in, size_t size, size_t before, unsigned int depth,
+                              const uint8_t **entries, size_t *count);
+
+/*
+ * Non-zero when chunks of cd_values get a packet table: asked for with
+ * FFH5_FEATURE_PACKET_INDEX, and always with FFV1, which has no parser.
+ */
+int ffh5_packet_index_wanted(size_t cd_nelmts, const unsigned int cd_values[]);
+
+/*
+ * Non-zero for the encoders of cd_values[0] that only code intra frames
+ * (FFV1, lossless x264); their chunks always get a keyframe table.
+ */
+int ffh5_intra_only(unsigned int enc_id);
+
+/*
+ * Non-zero when the encoder of cd_values[0] codes every bit of the bit
+ * mode cd_values[5] (12 bit: x265 and FFV1, 16 bit: FFV1 only).
+ */
+int ffh5_bit_mode_supported(unsigned int enc_id, unsigned int bit_mode);
+
+/*
+ * Copy cd_values (at most FFH5_MAX_CD_VALUES of them) to coded with the
+ * frame size the encoder of cd_values[0] needs.  Returns 1 when frames
+ * have to be padded, 0 otherwise.
+ */
+int ffh5_coded_params(size_t cd_nelmts, const unsigned int cd_values[], unsigned int coded[]);
+
+/*
+ * Copy a width x height frame (rows linesize bytes apart) into a packed
+ * coded_width x coded_height one, replicating the last column and row.
+ */
+void ffh5_pad_frame(const uint8_t *src, size_t linesize, unsigned int width, unsigned int height,
+                    int bytes, uint8_t *dst, unsigned int coded_width, unsigned int coded_height);
+
+/* append the padding record of a padded chunk, returns 0 on success */
+int ffh5_write_pad_record(FFH5Sink *sink, unsigned int coded_width, unsigned int coded_height);
+
+/*
+ * Size of the padding record at the end of a bitstream of size bytes
+ * (keyframe table removed) with width x height frames, 0 without one.
+ */
+size_t ffh5_pad_record_size(const uint8_t *in, size_t size, unsigned int width, unsigned int height);
+
+/* bytes a decoded chunk occupies */
+size_t ffmpeg_decoded_size(const unsigned int cd_values[]);
+
+#endif // FFMPEG_CODEC_H
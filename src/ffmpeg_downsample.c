@@ -0,0 +1,193 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * 2x downsampling for the multi-resolution pyramids of the Python and
+ * ImageJ writers.
+ *
+ * Each output sample is the mean (rounded) or the maximum of a 2x2 block
+ * of a frame, or of a 2x2x2 block of two frames.  Odd edges replicate the
+ * last row, column or frame, so every block has the same size and the
+ * row loops are plain fixed-width sums / maxima that vectorize.  Output
+ * rows are split over the worker pool.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ffmpeg_h5filter.h"
+#include "ffmpeg_pool.h"
+
+/* output samples per task, below this threads cost more than they save */
+#define FFH5_DOWNSAMPLE_BLOCK (1 << 16)
+
+#define DS_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef struct DownJob
+{
+    int type;
+    int mode;
+    int z_factor;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t depth, height, width;
+    size_t out_height, out_width;
+    size_t rows_per_task, blocks_per_frame;
+} DownJob;
+
+/*
+ * one output row from the input rows a0, a1 (frame 0) and b0, b1 (frame 1,
+ * only read when z_factor is 2); rows and frames past the edge are passed
+ * as copies of the last one
+ */
+#define DEFINE_DOWNSAMPLE_ROW(suffix, T, ACC, ROUND4, ROUND8)                                          \
+    static void row_mean_##suffix(T *o, const T *a0, const T *a1, const T *b0, const T *b1, size_t w, \
+                                  int z_factor)                                                        \
+    {                                                                                                  \
+        size_t pairs = w / 2, x;                                                                       \
+                                                                                                       \
+        if (z_factor == 1)                                                                             \
+        {                                                                                              \
+            for (x = 0; x < pairs; x++)                                                                \
+                o[x] = (T)(((ACC)a0[2 * x] + a0[2 * x + 1] + a1[2 * x] + a1[2 * x + 1] + ROUND4) / 4); \
+            if (w & 1)                                                                                 \
+                o[pairs] = (T)(((ACC)a0[w - 1] + a0[w - 1] + a1[w - 1] + a1[w - 1] + ROUND4) / 4);     \
+            return;                                                                                    \
+        }                                                                                              \
+        for (x = 0; x < pairs; x++)                                                                    \
+            o[x] = (T)(((ACC)a0[2 * x] + a0[2 * x + 1] + a1[2 * x] + a1[2 * x + 1] + b0[2 * x] +       \
+                        b0[2 * x + 1] + b1[2 * x] + b1[2 * x + 1] + ROUND8) /                          \
+                       8);                                                                             \
+        if (w & 1)                                                                                     \
+            o[pairs] = (T)((((ACC)a0[w - 1] + a1[w - 1] + b0[w - 1] + b1[w - 1]) * 2 + ROUND8) / 8);   \
+    }                                                                                                  \
+                                                                                                       \
+    static void row_max_##suffix(T *o, const T *a0, const T *a1, const T *b0, const T *b1, size_t w,  \
+                                 int z_factor)                                                         \
+    {                                                                                                  \
+        size_t pairs = w / 2, x;                                                                       \
+        T m;                                                                                           \
+                                                                                                       \
+        for (x = 0; x < pairs; x++)                                                                    \
+        {                                                                                              \
+            m = DS_MAX(DS_MAX(a0[2 * x], a0[2 * x + 1]), DS_MAX(a1[2 * x], a1[2 * x + 1]));            \
+            if (z_factor == 2)                                                                         \
+                m = DS_MAX(m, DS_MAX(DS_MAX(b0[2 * x], b0[2 * x + 1]), DS_MAX(b1[2 * x], b1[2 * x + 1]))); \
+            o[x] = m;                                                                                  \
+        }                                                                                              \
+        if (w & 1)                                                                                     \
+        {                                                                                              \
+            m = DS_MAX(a0[w - 1], a1[w - 1]);                                                          \
+            if (z_factor == 2)                                                                         \
+                m = DS_MAX(m, DS_MAX(b0[w - 1], b1[w - 1]));                                           \
+            o[pairs] = m;                                                                              \
+        }                                                                                              \
+    }                                                                                                  \
+                                                                                                       \
+    static void downsample_rows_##suffix(const DownJob *job, size_t z, size_t y0, size_t y1)          \
+    {                                                                                                  \
+        size_t frame = job->height * job->width, w = job->width, y;                                    \
+        const T *f0 = (const T *)job->in + z * (size_t)job->z_factor * frame;                          \
+        const T *f1 = (job->z_factor == 2 && z * 2 + 1 < job->depth) ? f0 + frame : f0;                \
+        T *out = (T *)job->out + z * job->out_height * job->out_width;                                 \
+                                                                                                       \
+        for (y = y0; y < y1; y++)                                                                      \
+        {                                                                                              \
+            size_t r0 = 2 * y, r1 = (2 * y + 1 < job->height) ? 2 * y + 1 : 2 * y;                     \
+                                                                                                       \
+            if (job->mode == FFH5_DOWNSAMPLE_MAX)                                                      \
+                row_max_##suffix(out + y * job->out_width, f0 + r0 * w, f0 + r1 * w, f1 + r0 * w,      \
+                                 f1 + r1 * w, w, job->z_factor);                                       \
+            else                                                                                       \
+                row_mean_##suffix(out + y * job->out_width, f0 + r0 * w, f0 + r1 * w, f1 + r0 * w,     \
+                                  f1 + r1 * w, w, job->z_factor);                                      \
+        }                                                                                              \
+    }
+
+DEFINE_DOWNSAMPLE_ROW(u8, uint8_t, uint32_t, 2, 4)
+DEFINE_DOWNSAMPLE_ROW(u16, uint16_t, uint32_t, 2, 4)
+DEFINE_DOWNSAMPLE_ROW(f32, float, float, 0.0f, 0.0f)
+
+static void downsample_task(void *arg, int index)
+{
+    const DownJob *job = (const DownJob *)arg;
+    size_t z = (size_t)index / job->blocks_per_frame;
+    size_t y0 = ((size_t)index % job->blocks_per_frame) * job->rows_per_task;
+    size_t y1 = y0 + job->rows_per_task;
+
+    if (y1 > job->out_height)
+        y1 = job->out_height;
+
+    switch (job->type)
+    {
+    case FFH5_QUANT_UINT8:
+        downsample_rows_u8(job, z, y0, y1);
+        break;
+    case FFH5_QUANT_UINT16:
+        downsample_rows_u16(job, z, y0, y1);
+        break;
+    default:
+        downsample_rows_f32(job, z, y0, y1);
+        break;
+    }
+}
+
+/*
+ * Function:  ffmpeg_h5_downsample
+ * --------------------
+ * halve a volume in Y and X (and Z), see ffmpeg_h5filter.h
+ *
+ *  type: FFH5_QUANT_* sample type of in and out
+ *  mode: FFH5_DOWNSAMPLE_MEAN or FFH5_DOWNSAMPLE_MAX
+ *  *in: depth x height x width samples
+ *  depth, height, width: input shape
+ *  z_factor: 1 to keep the frames, 2 to also halve the depth
+ *  *out: ceil(depth / z_factor) x ceil(height / 2) x ceil(width / 2) samples
+ *  threads: threads to use, <= 0 for one per cpu core
+ *
+ *  return: 0 on success, -1 on bad arguments
+ *
+ */
+int ffmpeg_h5_downsample(int type, int mode, const void *in, size_t depth, size_t height, size_t width,
+                         int z_factor, void *out, int threads)
+{
+    DownJob job;
+    size_t out_depth, n_tasks;
+
+    if (type != FFH5_QUANT_UINT8 && type != FFH5_QUANT_UINT16 && type != FFH5_QUANT_FLOAT32)
+        return -1;
+    if ((mode != FFH5_DOWNSAMPLE_MEAN && mode != FFH5_DOWNSAMPLE_MAX) || (z_factor != 1 && z_factor != 2))
+        return -1;
+    if (depth == 0 || height == 0 || width == 0)
+        return 0;
+
+    job.type = type;
+    job.mode = mode;
+    job.z_factor = z_factor;
+    job.in = (const uint8_t *)in;
+    job.out = (uint8_t *)out;
+    job.depth = depth;
+    job.height = height;
+    job.width = width;
+    job.out_height = (height + 1) / 2;
+    job.out_width = (width + 1) / 2;
+
+    job.rows_per_task = FFH5_DOWNSAMPLE_BLOCK / job.out_width;
+    if (job.rows_per_task == 0)
+        job.rows_per_task = 1;
+    if (job.rows_per_task > job.out_height)
+        job.rows_per_task = job.out_height;
+    job.blocks_per_frame = (job.out_height + job.rows_per_task - 1) / job.rows_per_task;
+
+    out_depth = (depth + (size_t)z_factor - 1) / (size_t)z_factor;
+    n_tasks = out_depth * job.blocks_per_frame;
+    if (n_tasks > INT32_MAX)
+        return -1;
+
+    if (n_tasks == 1)
+        downsample_task(&job, 0);
+    else
+        ffh5_parallel_for((int)n_tasks, threads, downsample_task, &job);
+
+    return 0;
+}
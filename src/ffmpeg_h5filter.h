@@ -32,6 +32,446 @@ H5_DLLVAR H5Z_class_t ffmpeg_H5Filter[1];
  */
 int ffmpeg_register_h5filter(void);
 
+/* ---- ffmpeg_h5_clear_context_cache ----
+ *
+ * Free the encoder/decoder contexts cached by the calling thread.
+ * Contexts are kept between chunks to avoid reopening codecs; set
+ * H5FFMPEG_CONTEXT_CACHE=0 to disable the cache altogether.
+ *
+ */
+void ffmpeg_h5_clear_context_cache(void);
+
+/* ---- ffmpeg_h5_write_dataset_parallel ----
+ *
+ * Write a whole chunked dataset using the ffmpeg filter, encoding its
+ * chunks concurrently on up to threads threads (<= 0: one per core) and
+ * storing them with H5Dwrite_chunk.  buf holds the dataset in C order
+ * with elements laid out like the dataset type.  Files are identical in
+ * format to those written through the filter pipeline.
+ *
+ */
+herr_t ffmpeg_h5_write_dataset_parallel(hid_t dset, const void *buf, int threads);
+
+/* ---- ffmpeg_h5_read_dataset_parallel ----
+ *
+ * Read a whole chunked dataset using the ffmpeg filter with
+ * H5Dread_chunk, decoding its chunks concurrently into buf.
+ *
+ */
+herr_t ffmpeg_h5_read_dataset_parallel(hid_t dset, void *buf, int threads);
+
+/* ---- ffmpeg_h5_write_region_parallel / ffmpeg_h5_read_region_parallel ----
+ *
+ * Same for the region start / count of dset (NULL: the whole dataset),
+ * with buf holding just that region in C order.  The region must be made
+ * of whole chunks, except where it ends at the dataset edge, e.g. one
+ * z-chunk slab of a stack.
+ *
+ */
+herr_t ffmpeg_h5_write_region_parallel(hid_t dset, const hsize_t start[], const hsize_t count[],
+                                       const void *buf, int threads);
+
+herr_t ffmpeg_h5_read_region_parallel(hid_t dset, const hsize_t start[], const hsize_t count[], void *buf,
+                                      int threads);
+
+/* ---- ffmpeg_native ----
+ *
+ * Encode (flags 0) or decode (flags 1) one chunk of buf_size bytes
+ * outside of HDF5.  On success *buf, which must come from malloc, is
+ * freed and replaced by the output (release it with free) and its size
+ * is returned; on failure 0 is returned and *buf is left alone.
+ * ffmpeg_native_ex also takes the optional trailing parameters
+ * (cd_values[11] onwards).
+ *
+ */
+size_t ffmpeg_native(unsigned flags, const unsigned int cd_values[], size_t buf_size, void **buf);
+
+size_t ffmpeg_native_ex(unsigned flags, size_t cd_nelmts, const unsigned int cd_values[],
+                        size_t buf_size, void **buf);
+
+/* ---- ffmpeg_h5_encoder_open ----
+ *
+ * Incremental encoder for volumes larger than memory.  Frames (gray,
+ * cd_values[2] x cd_values[3], one or two bytes per sample) are pushed
+ * in any number of calls and the bitstream is pulled as the codec
+ * releases it, so memory is bounded by the codec's lookahead rather
+ * than the volume.  cd_values[4] is ignored; once finished, the
+ * bitstream decodes like a chunk of ffmpeg_h5_encoder_frames frames,
+ * keyframe table (cd_values[13]) included.
+ *
+ * push returns a negative value on failure.  pull hands out the bytes
+ * produced since the previous pull, valid until the next call on the
+ * encoder, and NULL when there are none.  finish flushes the codec,
+ * the tail is pulled afterwards.  close frees the encoder.
+ *
+ */
+typedef struct FFH5Encoder FFH5Encoder;
+
+FFH5Encoder *ffmpeg_h5_encoder_open(size_t cd_nelmts, const unsigned int cd_values[]);
+
+int ffmpeg_h5_encoder_push(FFH5Encoder *enc, const void *frames, size_t n_frames);
+
+const unsigned char *ffmpeg_h5_encoder_pull(FFH5Encoder *enc, size_t *size);
+
+int ffmpeg_h5_encoder_finish(FFH5Encoder *enc);
+
+unsigned long long ffmpeg_h5_encoder_frames(const FFH5Encoder *enc);
+
+void ffmpeg_h5_encoder_close(FFH5Encoder *enc);
+
+/* ---- ffmpeg_h5_decoder_open ----
+ *
+ * Incremental decoder, the mirror of ffmpeg_h5_encoder_open.  The bytes
+ * of a chunk of cd_values[4] frames (keyframe table included) are pushed
+ * in any number of calls.  Decoded frames are written in place to out,
+ * which holds out_size bytes (e.g. a memory mapped file), and/or passed
+ * to callback one at a time; with out NULL the frame handed to callback
+ * is only valid during the call.  A callback returning a negative value
+ * stops decoding.
+ *
+ * push and finish return a negative value on failure; finish flushes the
+ * codec.  Frames beyond out_size are dropped.
+ *
+ */
+typedef struct FFH5Decoder FFH5Decoder;
+
+typedef int (*FFH5FrameCallback)(void *opaque, unsigned long long index,
+                                 const unsigned char *frame, size_t size);
+
+FFH5Decoder *ffmpeg_h5_decoder_open(size_t cd_nelmts, const unsigned int cd_values[],
+                                    void *out, size_t out_size,
+                                    FFH5FrameCallback callback, void *opaque);
+
+int ffmpeg_h5_decoder_push(FFH5Decoder *dec, const void *data, size_t size);
+
+int ffmpeg_h5_decoder_finish(FFH5Decoder *dec);
+
+unsigned long long ffmpeg_h5_decoder_frames(const FFH5Decoder *dec);
+
+void ffmpeg_h5_decoder_close(FFH5Decoder *dec);
+
+/* ---- ffmpeg_h5_seed_ratio ----
+ *
+ * The output buffer of a chunk is sized from a running average of the
+ * compression ratios (raw / compressed) seen for the same encoder id,
+ * crf and bit mode.  Seed it when the ratio of a dataset is known up
+ * front; ffmpeg_h5_get_ratio returns the current estimate.
+ *
+ */
+void ffmpeg_h5_seed_ratio(unsigned int enc_id, unsigned int crf, unsigned int bit_mode, double ratio);
+
+double ffmpeg_h5_get_ratio(unsigned int enc_id, unsigned int crf, unsigned int bit_mode);
+
+/* ---- ffmpeg_h5_get_size_stats ----
+ *
+ * Output buffer statistics of the chunks encoded by this process:
+ * reallocs counts the times an output buffer had to grow beyond the
+ * size reserved from the ratio estimate.
+ *
+ */
+typedef struct FFH5SizeStats
+{
+    unsigned long long chunks;
+    unsigned long long reallocs;
+    unsigned long long reserved_bytes;
+    unsigned long long compressed_bytes;
+} FFH5SizeStats;
+
+void ffmpeg_h5_get_size_stats(FFH5SizeStats *stats);
+
+void ffmpeg_h5_reset_size_stats(void);
+
+/* ---- ffmpeg_h5_set_gpu_schedule ----
+ *
+ * Spread NVENC/CUVID chunks over the gpus listed in gpu_ids instead of
+ * the single gpu_id stored in cd_values[10].  policy picks the next gpu
+ * round-robin or the one with the fewest chunks in flight.  max_sessions
+ * caps the concurrent NVENC sessions per gpu (0: no cap); when every gpu
+ * is at the cap, chunks are encoded on the CPU with the software encoder
+ * of the same format if cpu_fallback is set, otherwise they wait.
+ * n_gpus = 0 turns scheduling off.  The initial schedule is read from
+ * H5FFMPEG_GPUS ("0,1,2,3"), H5FFMPEG_GPU_POLICY ("round_robin" or
+ * "least_loaded"), H5FFMPEG_NVENC_SESSIONS and H5FFMPEG_GPU_CPU_FALLBACK.
+ *
+ *  return: negative value (invalid arguments), otherwise success
+ *
+ */
+enum GpuSchedulePolicyEnum
+{
+    FFH5_SCHED_ROUND_ROBIN = 0,
+    FFH5_SCHED_LEAST_LOADED = 1,
+};
+
+int ffmpeg_h5_set_gpu_schedule(const unsigned int gpu_ids[], int n_gpus, int policy,
+                               int max_sessions, int cpu_fallback);
+
+/* ---- ffmpeg_h5_get_gpu_stats ----
+ *
+ * Per gpu state of the schedule: chunks in flight, open NVENC sessions
+ * (including the idle ones kept by the context cache) and chunks handled
+ * so far.  Fills at most max entries and returns the number of scheduled
+ * gpus; cpu_fallbacks, if not NULL, receives the number of chunks moved
+ * to a CPU encoder.
+ *
+ */
+typedef struct FFH5GpuStats
+{
+    unsigned int gpu_id;
+    int active_encoders;
+    int active_decoders;
+    int sessions;
+    unsigned long long chunks;
+} FFH5GpuStats;
+
+int ffmpeg_h5_get_gpu_stats(FFH5GpuStats stats[], int max, unsigned long long *cpu_fallbacks);
+
+/* ---- ffmpeg_h5_get_capabilities ----
+ *
+ * Devices and codecs available to this process, probed once in process
+ * (CUDA driver or av_hwdevice_ctx_create, avcodec_find_*_by_name) and
+ * cached.  encoders / decoders have bit (1 << id) set for every
+ * EncoderCodecEnum / DecoderCodecEnum id the linked FFmpeg resolves.
+ * Chunks stored with a CUVID or QSV decoder that is not available are
+ * decoded with the software decoder of the same format.
+ *
+ */
+typedef struct FFH5Capabilities
+{
+    int cuda_devices; /* 0 without driver or devices */
+    int qsv;          /* non-zero when a QSV device can be created */
+    unsigned int encoders;
+    unsigned int decoders;
+} FFH5Capabilities;
+
+void ffmpeg_h5_get_capabilities(FFH5Capabilities *caps);
+
+/* ---- ffmpeg_h5_set_chunk_cache ----
+ *
+ * Keep up to budget bytes of decoded chunks in memory, 0 turns the cache
+ * off.  Every whole-chunk decode (the HDF5 filter, the parallel reader,
+ * native calls) looks there first.  Chunks are keyed by a digest of
+ * their compressed bytes and decoding parameters, so a hot chunk is
+ * found whatever file, dataset or offset it is read from; entries are
+ * evicted least recently used first.
+ *
+ * With shared set, decoded chunks are published as POSIX shared memory
+ * objects instead, so every reader process on the node finds them.  Each
+ * process evicts the objects it created once they exceed its budget; the
+ * others outlive it until evicted or ffmpeg_h5_clear_chunk_cache.  Not
+ * available on Windows.  The initial setting is read from
+ * H5FFMPEG_CHUNK_CACHE (bytes, K/M/G suffixes allowed) and
+ * H5FFMPEG_CHUNK_CACHE_SHM=1.
+ *
+ *  return: negative value (shared memory not supported), otherwise success
+ *
+ */
+int ffmpeg_h5_set_chunk_cache(size_t budget, int shared);
+
+/* ---- ffmpeg_h5_clear_chunk_cache ----
+ *
+ * Drop the cached chunks, and unlink the shared memory objects created
+ * by this process.
+ *
+ */
+void ffmpeg_h5_clear_chunk_cache(void);
+
+/* ---- ffmpeg_h5_get_chunk_cache_stats ----
+ *
+ * Lookups that were served from the cache (hits) or had to decode
+ * (misses), chunks stored and evicted, and the bytes held by this
+ * process against its budget.  reset zeroes the counters.
+ *
+ */
+typedef struct FFH5ChunkCacheStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long inserts;
+    unsigned long long evictions;
+    size_t bytes;
+    size_t budget;
+    int shared;
+} FFH5ChunkCacheStats;
+
+void ffmpeg_h5_get_chunk_cache_stats(FFH5ChunkCacheStats *stats, int reset);
+
+/* ---- ffmpeg_h5_chunk_cache_settings ----
+ *
+ * HDF5's raw data chunk cache (H5Pset_chunk_cache) defaults to 1 MB and
+ * bypasses larger chunks, so every partial read of a video coded chunk
+ * decodes all of it again.  chunk_cache_settings sizes the cache of a
+ * dataset for how it is going to be read:
+ *  FFH5_ACCESS_SLICES  planes of the first axis in order (the default):
+ *                      one row of chunks across the other axes, fully
+ *                      read chunks preempted first (w0 1)
+ *  FFH5_ACCESS_RANDOM  partial reads anywhere: four rows of chunks, w0 0.75
+ *  FFH5_ACCESS_WHOLE   whole chunks read once: a single chunk
+ * capped at an eighth of the available memory (H5FFMPEG_RDCC_MAX=bytes
+ * overrides), never below HDF5's 1 MB, with about 100 hash slots per
+ * cached chunk.  H5FFMPEG_RDCC=0 disables the sizing (returns 0).
+ *
+ * ffmpeg_h5_configure_dapl applies the settings to dapl when the open
+ * dataset dset uses filter 32030 (returns 1, 0 for other datasets);
+ * ffmpeg_h5_open_dataset opens name under loc with them, as HDF5 only
+ * applies a dapl when the dataset is opened.  ffmpeg_h5_get_rdcc_stats
+ * reports how many datasets were sized and the last settings.
+ *
+ */
+enum FFH5AccessHint
+{
+    FFH5_ACCESS_SLICES = 0,
+    FFH5_ACCESS_RANDOM = 1,
+    FFH5_ACCESS_WHOLE = 2
+};
+
+typedef struct FFH5RdccSettings
+{
+    size_t nbytes;
+    size_t nslots;
+    double w0;
+} FFH5RdccSettings;
+
+typedef struct FFH5RdccStats
+{
+    unsigned long long datasets; /* settings computed */
+    FFH5RdccSettings last;
+    size_t chunk_bytes; /* of the last dataset */
+    int hint;           /* of the last dataset */
+    int enabled;
+    size_t max_nbytes; /* H5FFMPEG_RDCC_MAX, 0 when unset */
+} FFH5RdccStats;
+
+int ffmpeg_h5_chunk_cache_settings(int rank, const hsize_t dims[], const hsize_t chunks[], size_t type_size,
+                                   int hint, FFH5RdccSettings *settings);
+
+int ffmpeg_h5_configure_dapl(hid_t dset, hid_t dapl, int hint);
+
+hid_t ffmpeg_h5_open_dataset(hid_t loc, const char *name, int hint);
+
+void ffmpeg_h5_get_rdcc_stats(FFH5RdccStats *stats);
+
+/* ---- ffmpeg_h5_set_stats ----
+ *
+ * Hot path instrumentation, off by default (a single branch per probe).
+ * Once enabled, every thread accumulates monotonic time and call counts
+ * per stage plus byte, frame, realloc and cache counters; get_stats sums
+ * them over all threads, past and present.  Chunk stages include the
+ * finer ones.  Counts are approximate while chunks are in flight.
+ * H5FFMPEG_STATS=1 enables them at startup.
+ *
+ * With trace set, every timed stage is also recorded as a Chrome trace
+ * event ("chrome://tracing", Perfetto) and written by ffmpeg_h5_write_trace;
+ * H5FFMPEG_TRACE=file enables tracing and writes file at exit.
+ * ffmpeg_h5_set_stats returns the previous state.
+ *
+ */
+enum FFH5StatsStage
+{
+    FFH5_STAGE_ENCODE_CHUNK = 0, /* ffmpeg_encode_chunk */
+    FFH5_STAGE_DECODE_CHUNK,     /* ffmpeg_decode_chunk(_range) */
+    FFH5_STAGE_CODEC_OPEN,       /* context lookup, codec open on a miss */
+    FFH5_STAGE_PARSE,            /* av_parser_parse2 */
+    FFH5_STAGE_SEND,             /* avcodec_send_frame/packet */
+    FFH5_STAGE_RECEIVE,          /* avcodec_receive_packet/frame */
+    FFH5_STAGE_CONVERT,          /* gray <-> yuv (swscale, pixconv, gpu) */
+    FFH5_STAGE_COPY,             /* packet and frame copies */
+    FFH5_STAGE_H5_FILTER,        /* the HDF5 filter callback */
+    FFH5_STAGE_COUNT
+};
+
+typedef struct FFH5StageStats
+{
+    unsigned long long calls;
+    unsigned long long ns;
+} FFH5StageStats;
+
+typedef struct FFH5Stats
+{
+    FFH5StageStats stages[FFH5_STAGE_COUNT];
+    unsigned long long chunks_encoded;
+    unsigned long long chunks_decoded;
+    unsigned long long frames_encoded;
+    unsigned long long frames_decoded;
+    unsigned long long encode_bytes_in;  /* raw */
+    unsigned long long encode_bytes_out; /* compressed */
+    unsigned long long decode_bytes_in;  /* compressed */
+    unsigned long long decode_bytes_out; /* raw */
+    unsigned long long reallocs;         /* output buffers that had to grow */
+    unsigned long long context_hits;     /* codec contexts reused */
+    unsigned long long context_misses;   /* codec contexts opened */
+    unsigned long long chunk_cache_hits;
+    unsigned long long chunk_cache_misses;
+    unsigned long long trace_dropped; /* events beyond the per-thread limit */
+} FFH5Stats;
+
+int ffmpeg_h5_set_stats(int enabled, int trace);
+
+void ffmpeg_h5_get_stats(FFH5Stats *stats);
+
+void ffmpeg_h5_reset_stats(void);
+
+/* name of a stage ("encode_chunk", "parse", ...), NULL when out of range */
+const char *ffmpeg_h5_stage_name(int stage);
+
+/* returns 0 on success */
+int ffmpeg_h5_write_trace(const char *path);
+
+/* ---- ffmpeg_h5_quantize ----
+ *
+ * Intensity transform behind the norm / beta quantization of the Python
+ * frontend, applied to count samples:
+ *
+ *   y = clamp(pow(max((x - offset) * scale, 0), power) * post + add, lo, hi)
+ *
+ * in single precision, truncated to the output type.  Integer inputs go
+ * through a table of all 256 / 65536 values, float inputs are computed
+ * directly; both are split over up to threads threads (<= 0: one per
+ * cpu core).  in and out may be the same buffer when the types have the
+ * same size.  Returns 0 on success, -1 on bad types or out of memory.
+ *
+ */
+enum FFH5QuantType
+{
+    /* same values as the data_type attribute */
+    FFH5_QUANT_UINT8 = 0,
+    FFH5_QUANT_UINT16 = 1,
+    FFH5_QUANT_FLOAT32 = 2,
+};
+
+typedef struct FFH5Quant
+{
+    double offset;
+    double scale;
+    double power;
+    double post;
+    double add;
+    double lo;
+    double hi;
+} FFH5Quant;
+
+int ffmpeg_h5_quantize(const FFH5Quant *q, int in_type, const void *in, int out_type, void *out,
+                       size_t count, int threads);
+
+/* ---- ffmpeg_h5_downsample ----
+ *
+ * One level of a multi-resolution pyramid: the depth x height x width
+ * samples of in (FFH5_QUANT_* type) are reduced to the rounded mean or
+ * the maximum of each 2x2 block of a frame (z_factor 1) or 2x2x2 block of
+ * two frames (z_factor 2), written to out as ceil(depth / z_factor) x
+ * ceil(height / 2) x ceil(width / 2) samples of the same type.  Odd edges
+ * replicate the last row, column or frame.  Returns 0 on success, -1 on
+ * bad arguments.
+ *
+ */
+enum FFH5DownsampleMode
+{
+    FFH5_DOWNSAMPLE_MEAN = 0,
+    FFH5_DOWNSAMPLE_MAX = 1,
+};
+
+int ffmpeg_h5_downsample(int type, int mode, const void *in, size_t depth, size_t height, size_t width,
+                         int z_factor, void *out, int threads);
+
 /* Define enums */
 enum EncoderCodecEnum
 {
@@ -45,6 +485,9 @@ enum EncoderCodecEnum
     FFH5_ENC_RAV1E = 7,
     FFH5_ENC_AV1_NV = 8,
     FFH5_ENC_AV1_QSV = 9,
+    /* lossless intra only: every frame decodes on its own */
+    FFH5_ENC_FFV1 = 10,
+    FFH5_ENC_X264_LOSSLESS = 11,
 };
 enum DecoderCodecEnum
 {
@@ -57,6 +500,7 @@ enum DecoderCodecEnum
     FFH5_DEC_DAV1D = 6,
     FFH5_DEC_AV1_CUVID = 7,
     FFH5_DEC_AV1_QSV = 8,
+    FFH5_DEC_FFV1 = 9,
 };
 enum PresetIDEnum
 {
@@ -199,5 +643,12 @@ enum TuneTypeEnum
     FFH5_TUNE_AV1QSV_GAMESTREAMING = 707,
     FFH5_TUNE_AV1QSV_REMOTEGAMING = 708,
 };
+enum ThreadTypeEnum
+{
+    /* let the codec library decide */
+    FFH5_THREAD_AUTO = 0,
+    FFH5_THREAD_FRAME = 1,
+    FFH5_THREAD_SLICE = 2,
+};
 
 #endif // FFMPEG_H5FILTER_H
\ No newline at end of file
@@ -0,0 +1,508 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Parallel whole-dataset write/read.
+ *
+ * HDF5 runs the filter one chunk at a time on the calling thread.  Here
+ * chunks are encoded/decoded on the worker pool with the same code as
+ * ffmpeg_h5_filter and moved with H5Dwrite_chunk / H5Dread_chunk, so the
+ * result is an ordinary filter 32030 dataset.  Only the calling thread
+ * talks to HDF5, workers touch memory only.  Regions of whole chunks
+ * (a z-slab of a stack, say) go the same way for writers and readers
+ * that never hold the whole dataset, such as the ImageJ plugin.
+ *
+ */
+
+#include "ffmpeg_utils.h"
+#include "ffmpeg_codec.h"
+#include "ffmpeg_pool.h"
+
+/* chunks in flight per worker thread */
+#define PARALLEL_CHUNKS_PER_THREAD 2
+/* largest element (and fill value) size handled */
+#define PARALLEL_MAX_ELEMENT_SIZE 64
+
+typedef struct ParallelLayout
+{
+    int rank;
+    hsize_t dims[H5S_MAX_RANK];
+    hsize_t chunk[H5S_MAX_RANK];
+    hsize_t start[H5S_MAX_RANK]; /* region of the buffer */
+    hsize_t count[H5S_MAX_RANK];
+    hsize_t n_chunks_dim[H5S_MAX_RANK];
+    hsize_t n_chunks;
+    size_t elem_size;
+    size_t chunk_bytes;
+    size_t cd_nelmts;
+    unsigned int cd_values[FFH5_MAX_CD_VALUES];
+    uint8_t fill[PARALLEL_MAX_ELEMENT_SIZE];
+} ParallelLayout;
+
+typedef struct ParallelChunk
+{
+    hsize_t offset[H5S_MAX_RANK];
+    uint32_t filter_mask;
+    FFH5Sink data; /* compressed chunk as stored in the file */
+    int allocated; /* read: chunk exists in the file */
+    int failed;
+} ParallelChunk;
+
+typedef struct ParallelBatch
+{
+    const ParallelLayout *layout;
+    ParallelChunk *chunks;
+    uint8_t *buf;
+} ParallelBatch;
+
+/*
+ * Function:  get_layout
+ * --------------------
+ * collect chunk geometry and filter parameters of dset, which must be
+ * chunked with filter 32030 as its only filter
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+static int get_layout(hid_t dset, ParallelLayout *layout)
+{
+    hid_t dcpl = H5I_INVALID_HID, space = H5I_INVALID_HID, type = H5I_INVALID_HID;
+    unsigned int filter_flags;
+    H5Z_filter_t filter;
+    H5D_fill_value_t fill_status;
+    int d, ret = -1;
+
+    memset(layout, 0, sizeof(ParallelLayout));
+
+    dcpl = H5Dget_create_plist(dset);
+    space = H5Dget_space(dset);
+    type = H5Dget_type(dset);
+    if (dcpl < 0 || space < 0 || type < 0)
+    {
+        raise_ffmpeg_h5_error("Could not query dataset\n");
+        goto Finish;
+    }
+
+    if (H5Pget_layout(dcpl) != H5D_CHUNKED || H5Pget_nfilters(dcpl) != 1)
+    {
+        raise_ffmpeg_h5_error("Dataset must be chunked with the ffmpeg filter as only filter\n");
+        goto Finish;
+    }
+
+    layout->cd_nelmts = FFH5_MAX_CD_VALUES;
+    filter = H5Pget_filter2(dcpl, 0, &filter_flags, &layout->cd_nelmts, layout->cd_values, 0, NULL, NULL);
+    if (filter != FFMPEG_H5FILTER || layout->cd_nelmts < FFH5_CD_NELMTS)
+    {
+        raise_ffmpeg_h5_error("Dataset is not compressed with the ffmpeg filter\n");
+        goto Finish;
+    }
+    if (layout->cd_nelmts > FFH5_MAX_CD_VALUES)
+        layout->cd_nelmts = FFH5_MAX_CD_VALUES;
+
+    layout->rank = H5Pget_chunk(dcpl, H5S_MAX_RANK, layout->chunk);
+    if (layout->rank <= 0 || H5Sget_simple_extent_dims(space, layout->dims, NULL) != layout->rank)
+    {
+        raise_ffmpeg_h5_error("Could not get chunk layout\n");
+        goto Finish;
+    }
+
+    layout->elem_size = H5Tget_size(type);
+    if (layout->elem_size == 0 || layout->elem_size > PARALLEL_MAX_ELEMENT_SIZE)
+    {
+        raise_ffmpeg_h5_error("Unsupported dataset type\n");
+        goto Finish;
+    }
+
+    /* unallocated chunks read as the fill value, zero unless defined */
+    if (H5Pfill_value_defined(dcpl, &fill_status) >= 0 && fill_status != H5D_FILL_VALUE_UNDEFINED)
+        H5Pget_fill_value(dcpl, type, layout->fill);
+
+    layout->chunk_bytes = layout->elem_size;
+    for (d = 0; d < layout->rank; d++)
+        layout->chunk_bytes *= layout->chunk[d];
+
+    ret = 0;
+
+Finish:
+    if (type >= 0)
+        H5Tclose(type);
+    if (space >= 0)
+        H5Sclose(space);
+    if (dcpl >= 0)
+        H5Pclose(dcpl);
+    return ret;
+}
+
+/*
+ * Function:  set_region
+ * --------------------
+ * restrict the chunks handled to the region start / count, the whole
+ * dataset when start is NULL; the region must consist of whole chunks,
+ * except where it ends at the dataset edge
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+static int set_region(ParallelLayout *layout, const hsize_t start[], const hsize_t count[])
+{
+    int d;
+
+    layout->n_chunks = 1;
+    for (d = 0; d < layout->rank; d++)
+    {
+        layout->start[d] = start ? start[d] : 0;
+        layout->count[d] = start ? count[d] : layout->dims[d];
+
+        if (layout->start[d] % layout->chunk[d] != 0 || layout->start[d] + layout->count[d] > layout->dims[d] ||
+            ((layout->start[d] + layout->count[d]) % layout->chunk[d] != 0 &&
+             layout->start[d] + layout->count[d] != layout->dims[d]))
+        {
+            raise_ffmpeg_h5_error("Region is not aligned to the chunks of the dataset\n");
+            return -1;
+        }
+
+        layout->n_chunks_dim[d] = (layout->count[d] + layout->chunk[d] - 1) / layout->chunk[d];
+        layout->n_chunks *= layout->n_chunks_dim[d];
+    }
+    return 0;
+}
+
+/* logical offset of chunk number index of the region, C order */
+static void chunk_offset(const ParallelLayout *layout, hsize_t index, hsize_t offset[])
+{
+    int d;
+
+    for (d = layout->rank - 1; d >= 0; d--)
+    {
+        offset[d] = layout->start[d] + (index % layout->n_chunks_dim[d]) * layout->chunk[d];
+        index /= layout->n_chunks_dim[d];
+    }
+}
+
+/*
+ * Function:  copy_chunk
+ * --------------------
+ * copy the part of a chunk that lies inside the dataset between the
+ * chunk buffer and the region buffer, one contiguous row at a time
+ *
+ *  to_chunk: 1 gathers buf into chunk, 0 scatters chunk into buf
+ *
+ */
+static void copy_chunk(const ParallelLayout *layout, const hsize_t offset[],
+                       uint8_t *chunk, uint8_t *buf, int to_chunk)
+{
+    hsize_t extent[H5S_MAX_RANK], index[H5S_MAX_RANK] = {0};
+    size_t chunk_stride[H5S_MAX_RANK], buf_stride[H5S_MAX_RANK];
+    size_t row_bytes, chunk_pos, buf_pos;
+    int d, last = layout->rank - 1;
+
+    chunk_stride[last] = buf_stride[last] = layout->elem_size;
+    for (d = last; d >= 0; d--)
+    {
+        extent[d] = layout->start[d] + layout->count[d] - offset[d];
+        if (extent[d] > layout->chunk[d])
+            extent[d] = layout->chunk[d];
+        if (d > 0)
+        {
+            chunk_stride[d - 1] = chunk_stride[d] * layout->chunk[d];
+            buf_stride[d - 1] = buf_stride[d] * layout->count[d];
+        }
+    }
+    row_bytes = extent[last] * layout->elem_size;
+
+    while (1)
+    {
+        chunk_pos = 0;
+        buf_pos = (offset[last] - layout->start[last]) * buf_stride[last];
+        for (d = 0; d < last; d++)
+        {
+            chunk_pos += index[d] * chunk_stride[d];
+            buf_pos += (offset[d] - layout->start[d] + index[d]) * buf_stride[d];
+        }
+
+        if (to_chunk)
+            memcpy(chunk + chunk_pos, buf + buf_pos, row_bytes);
+        else
+            memcpy(buf + buf_pos, chunk + chunk_pos, row_bytes);
+
+        /* next row */
+        for (d = last - 1; d >= 0; d--)
+        {
+            if (++index[d] < extent[d])
+                break;
+            index[d] = 0;
+        }
+        if (d < 0)
+            break;
+    }
+}
+
+/* every element of the chunk lies inside the dataset */
+static int chunk_is_whole(const ParallelLayout *layout, const hsize_t offset[])
+{
+    int d;
+
+    for (d = 0; d < layout->rank; d++)
+        if (offset[d] + layout->chunk[d] > layout->dims[d])
+            return 0;
+    return 1;
+}
+
+static void write_task(void *arg, int index)
+{
+    ParallelBatch *batch = (ParallelBatch *)arg;
+    const ParallelLayout *layout = batch->layout;
+    ParallelChunk *chunk = &batch->chunks[index];
+    uint8_t *raw;
+
+    /* edge chunks are padded with zeros, like HDF5 does for the filter */
+    raw = chunk_is_whole(layout, chunk->offset) ? malloc(layout->chunk_bytes)
+                                                : calloc(1, layout->chunk_bytes);
+    if (!raw)
+    {
+        raise_ffmpeg_error("Out of memory occurred during encoding\n");
+        chunk->failed = 1;
+        return;
+    }
+
+    copy_chunk(layout, chunk->offset, raw, batch->buf, 1);
+
+    if (ffmpeg_encode_chunk(layout->cd_nelmts, layout->cd_values, raw, layout->chunk_bytes,
+                            &chunk->data, raise_ffmpeg_error) == 0)
+        chunk->failed = 1;
+
+    free(raw);
+}
+
+static void read_task(void *arg, int index)
+{
+    ParallelBatch *batch = (ParallelBatch *)arg;
+    const ParallelLayout *layout = batch->layout;
+    ParallelChunk *chunk = &batch->chunks[index];
+    FFH5Sink frames = {NULL, 0, 0, NULL, NULL};
+    size_t i;
+
+    if (!chunk->allocated || (chunk->filter_mask & 1))
+    {
+        /* never written (fill value) or stored without the filter */
+        if (!chunk->allocated)
+        {
+            chunk->data.data = malloc(layout->chunk_bytes);
+            if (!chunk->data.data)
+            {
+                chunk->failed = 1;
+                return;
+            }
+            for (i = 0; i < layout->chunk_bytes; i += layout->elem_size)
+                memcpy(chunk->data.data + i, layout->fill, layout->elem_size);
+        }
+        else if (chunk->data.size < layout->chunk_bytes)
+        {
+            raise_ffmpeg_error("Unfiltered chunk is truncated\n");
+            chunk->failed = 1;
+            return;
+        }
+        copy_chunk(layout, chunk->offset, chunk->data.data, batch->buf, 0);
+        return;
+    }
+
+    frames.data = malloc(layout->chunk_bytes);
+    frames.capacity = layout->chunk_bytes;
+    if (!frames.data)
+    {
+        raise_ffmpeg_error("Out of memory occurred during decoding\n");
+        chunk->failed = 1;
+        return;
+    }
+
+    if (ffmpeg_decode_chunk(layout->cd_nelmts, layout->cd_values, chunk->data.data, chunk->data.size,
+                            &frames, raise_ffmpeg_error) == 0)
+        chunk->failed = 1;
+    else
+    {
+        /* missing frames read as zero, same as the filter output */
+        memset(frames.data + frames.size, 0, frames.capacity - frames.size);
+        copy_chunk(layout, chunk->offset, frames.data, batch->buf, 0);
+    }
+
+    free(frames.data);
+}
+
+/* chunks handled per round, bounded so compressed data does not pile up */
+static int batch_capacity(const ParallelLayout *layout, int threads)
+{
+    hsize_t n = (hsize_t)((threads > 0) ? threads : ffh5_default_threads()) * PARALLEL_CHUNKS_PER_THREAD;
+
+    return (int)((n < layout->n_chunks) ? n : layout->n_chunks);
+}
+
+/*
+ * Function:  ffmpeg_h5_write_region_parallel
+ * --------------------
+ * encode the chunks of a region of dset concurrently and write the
+ * compressed chunks directly, bypassing the HDF5 filter pipeline
+ *
+ *  dset: chunked dataset using the ffmpeg filter
+ *  start, count: region of whole chunks, NULL for the whole dataset
+ *  *buf: the region, C order, elements laid out like the dataset type
+ *  threads: worker threads, <= 0 for one per core
+ *
+ *  return: negative value (failed), otherwise success
+ *
+ */
+herr_t ffmpeg_h5_write_region_parallel(hid_t dset, const hsize_t start[], const hsize_t count[],
+                                       const void *buf, int threads)
+{
+    ParallelLayout layout;
+    ParallelBatch batch = {&layout, NULL, (uint8_t *)buf};
+    hsize_t first;
+    int i, n, capacity;
+    herr_t ret = -1;
+
+    if (get_layout(dset, &layout) < 0 || set_region(&layout, start, count) < 0)
+        return -1;
+
+    capacity = batch_capacity(&layout, threads);
+    batch.chunks = calloc(capacity ? capacity : 1, sizeof(ParallelChunk));
+    if (!batch.chunks)
+    {
+        raise_ffmpeg_h5_error("Out of memory occurred during encoding\n");
+        return -1;
+    }
+
+    for (first = 0; first < layout.n_chunks; first += n)
+    {
+        n = (int)((layout.n_chunks - first < (hsize_t)capacity) ? layout.n_chunks - first : (hsize_t)capacity);
+
+        for (i = 0; i < n; i++)
+        {
+            memset(&batch.chunks[i], 0, sizeof(ParallelChunk));
+            batch.chunks[i].data.grow = ffh5_sink_realloc;
+            chunk_offset(&layout, first + i, batch.chunks[i].offset);
+        }
+
+        ffh5_parallel_for(n, threads, write_task, &batch);
+
+        /* commit in chunk order from this thread only */
+        for (i = 0; i < n; i++)
+        {
+            ParallelChunk *chunk = &batch.chunks[i];
+
+            if (chunk->failed)
+            {
+                raise_ffmpeg_h5_error("Could not encode chunk\n");
+                goto Finish;
+            }
+            if (H5Dwrite_chunk(dset, H5P_DEFAULT, 0, chunk->offset, chunk->data.size, chunk->data.data) < 0)
+            {
+                raise_ffmpeg_h5_error("Could not write chunk\n");
+                goto Finish;
+            }
+            free(chunk->data.data);
+            chunk->data.data = NULL;
+        }
+    }
+
+    ret = 0;
+
+Finish:
+    for (i = 0; i < capacity; i++)
+        free(batch.chunks[i].data.data);
+    free(batch.chunks);
+    return ret;
+}
+
+herr_t ffmpeg_h5_write_dataset_parallel(hid_t dset, const void *buf, int threads)
+{
+    return ffmpeg_h5_write_region_parallel(dset, NULL, NULL, buf, threads);
+}
+
+/*
+ * Function:  ffmpeg_h5_read_region_parallel
+ * --------------------
+ * read the compressed chunks of a region of dset directly and decode
+ * them concurrently into buf
+ *
+ *  dset: chunked dataset using the ffmpeg filter
+ *  start, count: region of whole chunks, NULL for the whole dataset
+ *  *buf: receives the region, C order
+ *  threads: worker threads, <= 0 for one per core
+ *
+ *  return: negative value (failed), otherwise success
+ *
+ */
+herr_t ffmpeg_h5_read_region_parallel(hid_t dset, const hsize_t start[], const hsize_t count[], void *buf,
+                                      int threads)
+{
+    ParallelLayout layout;
+    ParallelBatch batch = {&layout, NULL, (uint8_t *)buf};
+    hsize_t first, stored;
+    int i, n, capacity;
+    herr_t ret = -1;
+
+    if (get_layout(dset, &layout) < 0 || set_region(&layout, start, count) < 0)
+        return -1;
+
+    capacity = batch_capacity(&layout, threads);
+    batch.chunks = calloc(capacity ? capacity : 1, sizeof(ParallelChunk));
+    if (!batch.chunks)
+    {
+        raise_ffmpeg_h5_error("Out of memory occurred during decoding\n");
+        return -1;
+    }
+
+    for (first = 0; first < layout.n_chunks; first += n)
+    {
+        n = (int)((layout.n_chunks - first < (hsize_t)capacity) ? layout.n_chunks - first : (hsize_t)capacity);
+
+        /* fetch in chunk order from this thread only */
+        for (i = 0; i < n; i++)
+        {
+            ParallelChunk *chunk = &batch.chunks[i];
+
+            free(chunk->data.data);
+            memset(chunk, 0, sizeof(ParallelChunk));
+            chunk_offset(&layout, first + i, chunk->offset);
+
+            if (H5Dget_chunk_storage_size(dset, chunk->offset, &stored) < 0 || stored == 0)
+                continue;
+
+            chunk->data.data = malloc(stored);
+            if (!chunk->data.data)
+            {
+                raise_ffmpeg_h5_error("Out of memory occurred during decoding\n");
+                goto Finish;
+            }
+            chunk->data.size = chunk->data.capacity = stored;
+            if (H5Dread_chunk(dset, H5P_DEFAULT, chunk->offset, &chunk->filter_mask, chunk->data.data) < 0)
+            {
+                raise_ffmpeg_h5_error("Could not read chunk\n");
+                goto Finish;
+            }
+            chunk->allocated = 1;
+        }
+
+        ffh5_parallel_for(n, threads, read_task, &batch);
+
+        for (i = 0; i < n; i++)
+        {
+            if (batch.chunks[i].failed)
+            {
+                raise_ffmpeg_h5_error("Could not decode chunk\n");
+                goto Finish;
+            }
+        }
+    }
+
+    ret = 0;
+
+Finish:
+    for (i = 0; i < capacity; i++)
+        free(batch.chunks[i].data.data);
+    free(batch.chunks);
+    return ret;
+}
+
+herr_t ffmpeg_h5_read_dataset_parallel(hid_t dset, void *buf, int threads)
+{
+    return ffmpeg_h5_read_region_parallel(dset, NULL, NULL, buf, threads);
+}
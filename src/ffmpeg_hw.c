@@ -0,0 +1,433 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * GPU resident frames.
+ *
+ * Libavutil has no public way to move a single plane between host and
+ * device, so the CUDA driver is loaded through the ffnvcodec loader that
+ * FFmpeg's own CUDA support is built on, and planes are copied with
+ * cuMemcpy2D inside the device context FFmpeg created.
+ *
+ */
+
+#include "ffmpeg_hw.h"
+#include "ffmpeg_pixconv.h"
+#include "ffmpeg_thread.h"
+
+#if defined(__has_include)
+#if __has_include(<ffnvcodec/dynlink_loader.h>) && __has_include(<libavutil/hwcontext_cuda.h>)
+#define FFH5_HAVE_CUDA 1
+#endif
+#endif
+
+#ifdef FFH5_HAVE_CUDA
+
+#define FFNV_LOG_FUNC(logctx, msg, ...) av_log(logctx, AV_LOG_ERROR, msg, __VA_ARGS__)
+#define FFNV_DEBUG_LOG_FUNC(logctx, msg, ...) av_log(logctx, AV_LOG_DEBUG, msg, __VA_ARGS__)
+#include <ffnvcodec/dynlink_loader.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_cuda.h>
+
+struct FFH5HwFrames
+{
+    AVBufferRef *frames;
+    CUcontext cuda_ctx;
+    int conv;            /* FFH5_PIXCONV_NV12 or FFH5_PIXCONV_P010 */
+    int luma_bytes;      /* bytes per luma row */
+    CUdeviceptr chroma;  /* neutral chroma plane */
+    size_t chroma_pitch; /* bytes per chroma row */
+    int chroma_rows;
+    AVFrame *scratch; /* host luma of P010, which needs a shift */
+};
+
+static ffh5_once_t hw_once = FFH5_ONCE_INIT;
+static int hw_enabled = 0;
+static CudaFunctions *cu = NULL;
+
+static ffh5_mutex_t device_lock = FFH5_MUTEX_INIT;
+static AVBufferRef *devices[FFH5_HW_MAX_DEVICES];
+static int device_failed[FFH5_HW_MAX_DEVICES];
+
+static void hw_init(void)
+{
+    const char *env = getenv("H5FFMPEG_HWFRAMES");
+
+    if (env && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0 || strcmp(env, "false") == 0))
+        return;
+
+    /* no driver, no gpu frames; the codecs then report their own errors */
+    if (cuda_load_functions(&cu, NULL) < 0)
+    {
+        cu = NULL;
+        return;
+    }
+    hw_enabled = 1;
+}
+
+int ffh5_hw_enabled(void)
+{
+    ffh5_once(&hw_once, hw_init);
+    return hw_enabled;
+}
+
+/*
+ * Function:  ffh5_hw_device
+ * --------------------
+ * shared CUDA device context of a gpu, created on first use and kept for
+ * the lifetime of the process
+ *
+ *  gpu_id: cuda device index
+ *
+ *  return: new reference, NULL if the device cannot be opened
+ *
+ */
+AVBufferRef *ffh5_hw_device(unsigned int gpu_id)
+{
+    AVBufferRef *ref = NULL;
+    char device[16];
+
+    if (!ffh5_hw_enabled() || gpu_id >= FFH5_HW_MAX_DEVICES)
+        return NULL;
+
+    ffh5_mutex_lock(&device_lock);
+    if (!devices[gpu_id] && !device_failed[gpu_id])
+    {
+        snprintf(device, sizeof(device), "%u", gpu_id);
+        if (av_hwdevice_ctx_create(&devices[gpu_id], AV_HWDEVICE_TYPE_CUDA, device, NULL, 0) < 0)
+        {
+            devices[gpu_id] = NULL;
+            device_failed[gpu_id] = 1; /* do not retry for every chunk */
+        }
+    }
+    if (devices[gpu_id])
+        ref = av_buffer_ref(devices[gpu_id]);
+    ffh5_mutex_unlock(&device_lock);
+
+    return ref;
+}
+
+/* cuMemcpy2D between host and/or device memory, ctx must be current */
+static int copy_plane(CUmemorytype dst_type, void *dst, size_t dst_pitch,
+                      CUmemorytype src_type, const void *src, size_t src_pitch,
+                      size_t width_bytes, size_t rows)
+{
+    CUDA_MEMCPY2D cpy;
+
+    memset(&cpy, 0, sizeof(cpy));
+    cpy.srcMemoryType = src_type;
+    cpy.srcPitch = src_pitch;
+    if (src_type == CU_MEMORYTYPE_DEVICE)
+        cpy.srcDevice = (CUdeviceptr)src;
+    else
+        cpy.srcHost = src;
+
+    cpy.dstMemoryType = dst_type;
+    cpy.dstPitch = dst_pitch;
+    if (dst_type == CU_MEMORYTYPE_DEVICE)
+        cpy.dstDevice = (CUdeviceptr)dst;
+    else
+        cpy.dstHost = dst;
+
+    cpy.WidthInBytes = width_bytes;
+    cpy.Height = rows;
+
+    return (cu->cuMemcpy2D(&cpy) == CUDA_SUCCESS) ? 0 : -1;
+}
+
+static int push_context(CUcontext ctx) { return (cu->cuCtxPushCurrent(ctx) == CUDA_SUCCESS) ? 0 : -1; }
+
+static void pop_context(void)
+{
+    CUcontext dummy;
+
+    cu->cuCtxPopCurrent(&dummy);
+}
+
+/*
+ * Function:  ffh5_hw_frames_open
+ * --------------------
+ * create the device frame pool of an encoder and upload its neutral
+ * chroma plane once
+ *
+ *  gpu_id: cuda device index
+ *  sw_format: AV_PIX_FMT_NV12 or AV_PIX_FMT_P010
+ *  width: frame width
+ *  height: frame height
+ *
+ *  return: frame pool, NULL if unavailable
+ *
+ */
+FFH5HwFrames *ffh5_hw_frames_open(unsigned int gpu_id, enum AVPixelFormat sw_format, int width, int height)
+{
+    FFH5HwFrames *hw = NULL;
+    AVBufferRef *device = NULL;
+    AVHWFramesContext *frames;
+    AVFrame *chroma = NULL;
+    int bytes;
+
+    if (sw_format != AV_PIX_FMT_NV12 && sw_format != AV_PIX_FMT_P010)
+        return NULL;
+    bytes = (sw_format == AV_PIX_FMT_NV12) ? 1 : 2;
+
+    device = ffh5_hw_device(gpu_id);
+    if (!device)
+        return NULL;
+
+    hw = calloc(1, sizeof(FFH5HwFrames));
+    if (!hw)
+        goto Failure;
+    hw->conv = (sw_format == AV_PIX_FMT_NV12) ? FFH5_PIXCONV_NV12 : FFH5_PIXCONV_P010;
+    hw->luma_bytes = width * bytes;
+    hw->chroma_pitch = (size_t)((width + 1) >> 1) * 2 * bytes; /* interleaved u/v */
+    hw->chroma_rows = (height + 1) >> 1;
+    hw->cuda_ctx = ((AVCUDADeviceContext *)((AVHWDeviceContext *)device->data)->hwctx)->cuda_ctx;
+
+    hw->frames = av_hwframe_ctx_alloc(device);
+    if (!hw->frames)
+        goto Failure;
+    frames = (AVHWFramesContext *)hw->frames->data;
+    frames->format = AV_PIX_FMT_CUDA;
+    frames->sw_format = sw_format;
+    frames->width = width;
+    frames->height = height;
+    if (av_hwframe_ctx_init(hw->frames) < 0)
+        goto Failure;
+
+    /* host copies of both chroma and, for P010, the shifted luma */
+    chroma = av_frame_alloc();
+    hw->scratch = av_frame_alloc();
+    if (!chroma || !hw->scratch)
+        goto Failure;
+    chroma->format = hw->scratch->format = sw_format;
+    chroma->width = hw->scratch->width = width;
+    chroma->height = hw->scratch->height = height;
+    if (av_frame_get_buffer(chroma, 0) < 0 || ffh5_fill_chroma(hw->conv, chroma) < 0)
+        goto Failure;
+    if (hw->conv == FFH5_PIXCONV_P010 && av_frame_get_buffer(hw->scratch, 0) < 0)
+        goto Failure;
+
+    if (push_context(hw->cuda_ctx) < 0)
+        goto Failure;
+    if (cu->cuMemAlloc(&hw->chroma, hw->chroma_pitch * hw->chroma_rows) != CUDA_SUCCESS)
+    {
+        hw->chroma = 0;
+        pop_context();
+        goto Failure;
+    }
+    if (copy_plane(CU_MEMORYTYPE_DEVICE, (void *)hw->chroma, hw->chroma_pitch,
+                   CU_MEMORYTYPE_HOST, chroma->data[1], chroma->linesize[1],
+                   hw->chroma_pitch, hw->chroma_rows) < 0)
+    {
+        pop_context();
+        goto Failure;
+    }
+    pop_context();
+
+    av_frame_free(&chroma);
+    av_buffer_unref(&device);
+
+    return hw;
+
+Failure:
+    av_frame_free(&chroma);
+    av_buffer_unref(&device);
+    ffh5_hw_frames_close(hw);
+    return NULL;
+}
+
+void ffh5_hw_frames_close(FFH5HwFrames *hw)
+{
+    if (!hw)
+        return;
+    if (hw->chroma && push_context(hw->cuda_ctx) == 0)
+    {
+        cu->cuMemFree(hw->chroma);
+        pop_context();
+    }
+    av_frame_free(&hw->scratch);
+    av_buffer_unref(&hw->frames);
+    free(hw);
+}
+
+AVBufferRef *ffh5_hw_frames_ctx(FFH5HwFrames *hw)
+{
+    return av_buffer_ref(hw->frames);
+}
+
+/*
+ * Function:  ffh5_hw_frame_from_gray
+ * --------------------
+ * fill a device frame from one gray frame: luma is uploaded (shifted on
+ * the host first for P010), chroma is copied on the device
+ *
+ *  *hw: device frame pool
+ *  *gray: first gray row
+ *  linesize: bytes between gray rows
+ *  *frame: replaced by the device frame
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_hw_frame_from_gray(FFH5HwFrames *hw, const uint8_t *gray, int linesize, AVFrame *frame)
+{
+    const uint8_t *luma = gray;
+    int luma_linesize = linesize;
+    int ret;
+
+    av_frame_unref(frame);
+    ret = av_hwframe_get_buffer(hw->frames, frame, 0);
+    if (ret < 0)
+        return ret;
+
+    if (hw->conv == FFH5_PIXCONV_P010)
+    {
+        if (ffh5_gray_to_luma(hw->conv, gray, linesize, hw->scratch) < 0)
+            return -1;
+        luma = hw->scratch->data[0];
+        luma_linesize = hw->scratch->linesize[0];
+    }
+
+    if (push_context(hw->cuda_ctx) < 0)
+        return -1;
+    ret = copy_plane(CU_MEMORYTYPE_DEVICE, frame->data[0], frame->linesize[0],
+                     CU_MEMORYTYPE_HOST, luma, luma_linesize, hw->luma_bytes, frame->height);
+    if (ret == 0)
+        ret = copy_plane(CU_MEMORYTYPE_DEVICE, frame->data[1], frame->linesize[1],
+                         CU_MEMORYTYPE_DEVICE, (const void *)hw->chroma, hw->chroma_pitch,
+                         hw->chroma_pitch, hw->chroma_rows);
+    pop_context();
+
+    return ret;
+}
+
+/*
+ * Function:  ffh5_hw_luma_to_gray
+ * --------------------
+ * download the luma plane of a decoded CUDA frame
+ *
+ *  *src: decoded frame with hw_frames_ctx of sw_format NV12 or P010
+ *  *dst: first gray row
+ *  dst_linesize: bytes between gray rows
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_hw_luma_to_gray(const AVFrame *src, uint8_t *dst, int dst_linesize)
+{
+    AVHWFramesContext *frames;
+    AVFrame gray;
+    int bytes, ret;
+
+    if (!src->hw_frames_ctx || !cu)
+        return -1;
+    frames = (AVHWFramesContext *)src->hw_frames_ctx->data;
+    if (frames->sw_format != AV_PIX_FMT_NV12 && frames->sw_format != AV_PIX_FMT_P010)
+        return -1;
+    bytes = (frames->sw_format == AV_PIX_FMT_NV12) ? 1 : 2;
+
+    if (push_context(((AVCUDADeviceContext *)frames->device_ctx->hwctx)->cuda_ctx) < 0)
+        return -1;
+    ret = copy_plane(CU_MEMORYTYPE_HOST, dst, dst_linesize,
+                     CU_MEMORYTYPE_DEVICE, src->data[0], src->linesize[0],
+                     (size_t)src->width * bytes, src->height);
+    pop_context();
+    if (ret < 0 || bytes == 1)
+        return ret;
+
+    /* P010 keeps the samples in the high bits, shift them down in place */
+    memset(&gray, 0, sizeof(gray));
+    gray.format = AV_PIX_FMT_P010;
+    gray.width = src->width;
+    gray.height = src->height;
+    gray.data[0] = dst;
+    gray.linesize[0] = dst_linesize;
+    return ffh5_yuv_to_gray(FFH5_PIXCONV_P010, &gray, dst, dst_linesize);
+}
+
+/*
+ * Function:  ffh5_hw_device_count
+ * --------------------
+ * number of CUDA devices the driver reports, independent of
+ * H5FFMPEG_HWFRAMES
+ *
+ *  return: device count, 0 without driver or devices
+ *
+ */
+int ffh5_hw_device_count(void)
+{
+    CudaFunctions *funcs = NULL;
+    int count = 0;
+
+    if (cuda_load_functions(&funcs, NULL) < 0)
+        return 0;
+    if (funcs->cuInit(0) != CUDA_SUCCESS || funcs->cuDeviceGetCount(&count) != CUDA_SUCCESS)
+        count = 0;
+    cuda_free_functions(&funcs);
+    return count;
+}
+
+#else /* !FFH5_HAVE_CUDA */
+
+#include <libavutil/hwcontext.h>
+
+int ffh5_hw_enabled(void) { return 0; }
+
+/* without the loader headers devices are counted by opening them */
+int ffh5_hw_device_count(void)
+{
+    AVBufferRef *ref;
+    char device[16];
+    int count;
+
+    for (count = 0; count < FFH5_HW_MAX_DEVICES; count++)
+    {
+        ref = NULL;
+        snprintf(device, sizeof(device), "%d", count);
+        if (av_hwdevice_ctx_create(&ref, AV_HWDEVICE_TYPE_CUDA, device, NULL, 0) < 0)
+            break;
+        av_buffer_unref(&ref);
+    }
+    return count;
+}
+
+AVBufferRef *ffh5_hw_device(unsigned int gpu_id)
+{
+    (void)gpu_id;
+    return NULL;
+}
+
+FFH5HwFrames *ffh5_hw_frames_open(unsigned int gpu_id, enum AVPixelFormat sw_format, int width, int height)
+{
+    (void)gpu_id;
+    (void)sw_format;
+    (void)width;
+    (void)height;
+    return NULL;
+}
+
+void ffh5_hw_frames_close(FFH5HwFrames *hw) { (void)hw; }
+
+AVBufferRef *ffh5_hw_frames_ctx(FFH5HwFrames *hw)
+{
+    (void)hw;
+    return NULL;
+}
+
+int ffh5_hw_frame_from_gray(FFH5HwFrames *hw, const uint8_t *gray, int linesize, AVFrame *frame)
+{
+    (void)hw;
+    (void)gray;
+    (void)linesize;
+    (void)frame;
+    return -1;
+}
+
+int ffh5_hw_luma_to_gray(const AVFrame *src, uint8_t *dst, int dst_linesize)
+{
+    (void)src;
+    (void)dst;
+    (void)dst_linesize;
+    return -1;
+}
+
+#endif /* FFH5_HAVE_CUDA */
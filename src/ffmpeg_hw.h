@@ -0,0 +1,58 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * GPU resident frames for the NVENC encoders and CUVID decoders.
+ *
+ * One CUDA device context per gpu_id is shared by every codec context of
+ * the process.  Encoders get frames from a hw_frames_ctx whose luma is
+ * uploaded straight from the gray input and whose chroma is a device
+ * side copy of a neutral plane; decoders hand out device frames of which
+ * only luma is downloaded.  Everything is optional: without the CUDA
+ * loader headers at build time, without a driver at run time or with
+ * H5FFMPEG_HWFRAMES=0 the codecs keep using system memory frames.
+ *
+ */
+
+#ifndef FFMPEG_HW_H
+#define FFMPEG_HW_H
+
+#include "ffmpeg_utils.h"
+
+/* highest gpu_id a device context is kept for */
+#define FFH5_HW_MAX_DEVICES 64
+
+typedef struct FFH5HwFrames FFH5HwFrames;
+
+/* Non-zero when GPU resident frames can be used */
+int ffh5_hw_enabled(void);
+
+/* Number of CUDA devices, 0 without driver; probes, so callers cache it */
+int ffh5_hw_device_count(void);
+
+/* New reference to the CUDA device context of gpu_id, NULL if unavailable */
+AVBufferRef *ffh5_hw_device(unsigned int gpu_id);
+
+/*
+ * Device frame pool of sw_format (NV12 or P010) frames on gpu_id for an
+ * encoder.  NULL when unavailable; the caller falls back to system memory.
+ */
+FFH5HwFrames *ffh5_hw_frames_open(unsigned int gpu_id, enum AVPixelFormat sw_format, int width, int height);
+
+void ffh5_hw_frames_close(FFH5HwFrames *hw);
+
+/* New reference to the hw_frames_ctx to open the encoder with */
+AVBufferRef *ffh5_hw_frames_ctx(FFH5HwFrames *hw);
+
+/*
+ * Replace frame by a device frame holding one gray frame (rows linesize
+ * bytes apart) as luma and neutral chroma.  Returns 0 on success.
+ */
+int ffh5_hw_frame_from_gray(FFH5HwFrames *hw, const uint8_t *gray, int linesize, AVFrame *frame);
+
+/*
+ * Download the luma plane of a decoded device frame as gray rows
+ * dst_linesize bytes apart.  Returns 0 on success.
+ */
+int ffh5_hw_luma_to_gray(const AVFrame *src, uint8_t *dst, int dst_linesize);
+
+#endif // FFMPEG_HW_H
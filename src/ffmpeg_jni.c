@@ -0,0 +1,121 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * JNI entry points of the ImageJ/Fiji plugin
+ * (com.cailab.hdf5compression.FFH5Native).
+ *
+ * HDF5's Java binding runs the filter one chunk at a time on the calling
+ * thread.  These hand a region of whole chunks (a z-slab) to the parallel
+ * region writer / reader, so chunks are encoded and decoded on the worker
+ * pool.  Dataset ids come from the Java binding and are only valid when
+ * it and this library share one libhdf5; the Java side serializes calls
+ * with its own HDF5 calls.
+ *
+ */
+
+#include <jni.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ffmpeg_h5filter.h"
+
+/*
+ * Function:  region_call
+ * --------------------
+ * run the region writer (write 1) or reader (write 0) on a Java primitive
+ * array; the coding runs on a native copy of the slab, the array is only
+ * pinned for the copy, so the garbage collector is not held off for the
+ * whole encode or decode
+ *
+ *  return: 0 on success, -1 on failure
+ *
+ */
+static jint region_call(JNIEnv *env, int write, jlong dset, jlongArray start, jlongArray count, jobject buf,
+                        jlong buf_bytes, jint threads)
+{
+    hsize_t region_start[H5S_MAX_RANK], region_count[H5S_MAX_RANK], region_bytes;
+    jlong values[H5S_MAX_RANK];
+    jsize rank, d;
+    hid_t type;
+    void *data, *slab;
+    herr_t ret;
+
+    if (!start || !count || !buf)
+        return -1;
+    rank = (*env)->GetArrayLength(env, start);
+    if (rank <= 0 || rank > H5S_MAX_RANK || (*env)->GetArrayLength(env, count) != rank)
+        return -1;
+
+    (*env)->GetLongArrayRegion(env, start, 0, rank, values);
+    for (d = 0; d < rank; d++)
+        region_start[d] = (hsize_t)values[d];
+    (*env)->GetLongArrayRegion(env, count, 0, rank, values);
+    for (d = 0; d < rank; d++)
+        region_count[d] = (hsize_t)values[d];
+
+    /* the array must hold the whole region */
+    type = H5Dget_type((hid_t)dset);
+    if (type < 0)
+        return -1;
+    region_bytes = H5Tget_size(type);
+    H5Tclose(type);
+    for (d = 0; d < rank; d++)
+        region_bytes *= region_count[d];
+    if (buf_bytes < 0 || region_bytes > (hsize_t)buf_bytes || region_bytes > (hsize_t)SIZE_MAX)
+        return -1;
+
+    slab = malloc(region_bytes ? (size_t)region_bytes : 1);
+    if (!slab)
+        return -1;
+
+    if (write)
+    {
+        data = (*env)->GetPrimitiveArrayCritical(env, (jarray)buf, NULL);
+        if (!data)
+        {
+            free(slab);
+            return -1;
+        }
+        memcpy(slab, data, (size_t)region_bytes);
+        (*env)->ReleasePrimitiveArrayCritical(env, (jarray)buf, data, JNI_ABORT);
+
+        ret = ffmpeg_h5_write_region_parallel((hid_t)dset, region_start, region_count, slab, threads);
+    }
+    else
+    {
+        ret = ffmpeg_h5_read_region_parallel((hid_t)dset, region_start, region_count, slab, threads);
+        if (ret >= 0)
+        {
+            data = (*env)->GetPrimitiveArrayCritical(env, (jarray)buf, NULL);
+            if (data)
+            {
+                memcpy(data, slab, (size_t)region_bytes);
+                (*env)->ReleasePrimitiveArrayCritical(env, (jarray)buf, data, 0);
+            }
+            else
+                ret = -1;
+        }
+    }
+
+    free(slab);
+    return (ret < 0) ? -1 : 0;
+}
+
+JNIEXPORT jint JNICALL Java_com_cailab_hdf5compression_FFH5Native_writeRegion0(JNIEnv *env, jclass cls, jlong dset,
+                                                                                jlongArray start, jlongArray count,
+                                                                                jobject buf, jlong buf_bytes,
+                                                                                jint threads)
+{
+    (void)cls;
+    return region_call(env, 1, dset, start, count, buf, buf_bytes, threads);
+}
+
+JNIEXPORT jint JNICALL Java_com_cailab_hdf5compression_FFH5Native_readRegion0(JNIEnv *env, jclass cls, jlong dset,
+                                                                               jlongArray start, jlongArray count,
+                                                                               jobject buf, jlong buf_bytes,
+                                                                               jint threads)
+{
+    (void)cls;
+    return region_call(env, 0, dset, start, count, buf, buf_bytes, threads);
+}
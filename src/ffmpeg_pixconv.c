@@ -0,0 +1,487 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Gray <-> YUV conversions.
+ *
+ * Plain row copies and 8 bit fills go through memcpy/memset, which libc
+ * already vectorizes.  The 16 bit fills and the P010 shifts have AVX2
+ * (selected at runtime) and NEON versions with a scalar fallback.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+
+#include "ffmpeg_pixconv.h"
+#include "ffmpeg_thread.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define FFH5_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define FFH5_TARGET_AVX2
+#endif
+#define FFH5_HAVE_AVX2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define FFH5_HAVE_NEON 1
+#endif
+
+/* value of the neutral chroma sample */
+#define CHROMA_8 128
+#define CHROMA_10 512
+#define CHROMA_12 2048
+/* P010 keeps the 10 significant bits in the top of each 16 bit word */
+#define P010_SHIFT 6
+
+typedef void (*fill16_fn)(uint16_t *dst, uint16_t value, int n);
+typedef void (*shift16_fn)(uint16_t *dst, const uint16_t *src, int n);
+
+static void fill16_c(uint16_t *dst, uint16_t value, int n);
+static void shift_left16_c(uint16_t *dst, const uint16_t *src, int n);
+static void shift_right16_c(uint16_t *dst, const uint16_t *src, int n);
+
+/* scalar until pixconv_init picks the simd versions */
+static ffh5_once_t pixconv_once = FFH5_ONCE_INIT;
+static int pixconv_enabled = 1;
+static fill16_fn fill16 = fill16_c;
+static shift16_fn shift_left16 = shift_left16_c;
+static shift16_fn shift_right16 = shift_right16_c;
+
+static void fill16_c(uint16_t *dst, uint16_t value, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = value;
+}
+
+static void shift_left16_c(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = (uint16_t)(src[i] << P010_SHIFT);
+}
+
+static void shift_right16_c(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = src[i] >> P010_SHIFT;
+}
+
+#ifdef FFH5_HAVE_AVX2
+FFH5_TARGET_AVX2 static void fill16_avx2(uint16_t *dst, uint16_t value, int n)
+{
+    const __m256i v = _mm256_set1_epi16((short)value);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    fill16_c(dst + i, value, n - i);
+}
+
+FFH5_TARGET_AVX2 static void shift_left16_avx2(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *)(src + i)), P010_SHIFT));
+    shift_left16_c(dst + i, src + i, n - i);
+}
+
+FFH5_TARGET_AVX2 static void shift_right16_avx2(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(src + i)), P010_SHIFT));
+    shift_right16_c(dst + i, src + i, n - i);
+}
+#endif
+
+#ifdef FFH5_HAVE_NEON
+static void fill16_neon(uint16_t *dst, uint16_t value, int n)
+{
+    const uint16x8_t v = vdupq_n_u16(value);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, v);
+    fill16_c(dst + i, value, n - i);
+}
+
+static void shift_left16_neon(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, vshlq_n_u16(vld1q_u16(src + i), P010_SHIFT));
+    shift_left16_c(dst + i, src + i, n - i);
+}
+
+static void shift_right16_neon(uint16_t *dst, const uint16_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, vshrq_n_u16(vld1q_u16(src + i), P010_SHIFT));
+    shift_right16_c(dst + i, src + i, n - i);
+}
+#endif
+
+static void pixconv_init(void)
+{
+    const char *env = getenv("H5FFMPEG_PIXCONV");
+
+    if (env && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0 || strcmp(env, "false") == 0))
+        pixconv_enabled = 0;
+
+#if defined(FFH5_HAVE_AVX2)
+    if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+    {
+        fill16 = fill16_avx2;
+        shift_left16 = shift_left16_avx2;
+        shift_right16 = shift_right16_avx2;
+    }
+#elif defined(FFH5_HAVE_NEON)
+    fill16 = fill16_neon;
+    shift_left16 = shift_left16_neon;
+    shift_right16 = shift_right16_neon;
+#endif
+}
+
+/*
+ * Function:  ffh5_gray_format
+ * --------------------
+ * pixel format of the gray frames of a bit mode; samples of more than 8
+ * bits are stored in 16 bit words, right aligned
+ *
+ *  bit_mode: cd_values[5], 0: 8 bit, 1: 10 bit, 2: 12 bit, 3: 16 bit
+ *
+ *  return: AV_PIX_FMT_GRAY8, GRAY10, GRAY12 or GRAY16
+ *
+ */
+enum AVPixelFormat ffh5_gray_format(int bit_mode)
+{
+    switch (bit_mode)
+    {
+    case 0:
+        return AV_PIX_FMT_GRAY8;
+    case 2:
+        return AV_PIX_FMT_GRAY12;
+    case 3:
+        return AV_PIX_FMT_GRAY16;
+    default:
+        return AV_PIX_FMT_GRAY10;
+    }
+}
+
+/*
+ * Function:  ffh5_sample_format
+ * --------------------
+ * pixel format of the gray frames of a chunk: the one of its bit mode,
+ * except for 12 bit chunks of the legacy layout, whose frames hold
+ * gray10 samples that swscale scales to and from the coded depth
+ *
+ *  bit_mode: cd_values[5]
+ *  layout: cd_values[16], FFH5_LAYOUT_LEGACY when absent
+ *
+ *  return: AV_PIX_FMT_GRAY8, GRAY10, GRAY12 or GRAY16
+ *
+ */
+enum AVPixelFormat ffh5_sample_format(int bit_mode, unsigned int layout)
+{
+    if (bit_mode == 2 && layout != FFH5_LAYOUT_NATIVE)
+        return AV_PIX_FMT_GRAY10;
+    return ffh5_gray_format(bit_mode);
+}
+
+/* yuv format a conversion works on */
+static enum AVPixelFormat conv_format(int conv)
+{
+    switch (conv)
+    {
+    case FFH5_PIXCONV_YUV420P:
+        return AV_PIX_FMT_YUV420P;
+    case FFH5_PIXCONV_YUV420P10:
+        return AV_PIX_FMT_YUV420P10;
+    case FFH5_PIXCONV_NV12:
+        return AV_PIX_FMT_NV12;
+    case FFH5_PIXCONV_P010:
+        return AV_PIX_FMT_P010;
+    case FFH5_PIXCONV_GRAY8:
+        return AV_PIX_FMT_GRAY8;
+    case FFH5_PIXCONV_GRAY16:
+        return AV_PIX_FMT_GRAY16;
+    case FFH5_PIXCONV_YUV420P12:
+        return AV_PIX_FMT_YUV420P12;
+    case FFH5_PIXCONV_GRAY10:
+        return AV_PIX_FMT_GRAY10;
+    case FFH5_PIXCONV_GRAY12:
+        return AV_PIX_FMT_GRAY12;
+    default:
+        return AV_PIX_FMT_NONE;
+    }
+}
+
+/*
+ * Function:  ffh5_pixconv_select
+ * --------------------
+ * pick the dedicated conversion between a gray and a yuv format
+ *
+ *  gray: format of the gray frames, see ffh5_gray_format
+ *  yuv: pixel format of the codec, a gray format for 4:0:0 codecs; gray16
+ *       holds narrower samples unchanged
+ *
+ *  return: conversion id, FFH5_PIXCONV_NONE when swscale has to be used
+ *
+ */
+int ffh5_pixconv_select(enum AVPixelFormat gray, enum AVPixelFormat yuv)
+{
+    ffh5_once(&pixconv_once, pixconv_init);
+
+    if (!pixconv_enabled)
+        return FFH5_PIXCONV_NONE;
+
+    if (gray == AV_PIX_FMT_GRAY8)
+    {
+        if (yuv == AV_PIX_FMT_YUV420P)
+            return FFH5_PIXCONV_YUV420P;
+        if (yuv == AV_PIX_FMT_NV12)
+            return FFH5_PIXCONV_NV12;
+        if (yuv == AV_PIX_FMT_GRAY8)
+            return FFH5_PIXCONV_GRAY8;
+    }
+    else if (gray == AV_PIX_FMT_GRAY10)
+    {
+        if (yuv == AV_PIX_FMT_YUV420P10)
+            return FFH5_PIXCONV_YUV420P10;
+        if (yuv == AV_PIX_FMT_P010)
+            return FFH5_PIXCONV_P010;
+        if (yuv == AV_PIX_FMT_GRAY10)
+            return FFH5_PIXCONV_GRAY10;
+    }
+    else if (gray == AV_PIX_FMT_GRAY12)
+    {
+        if (yuv == AV_PIX_FMT_YUV420P12)
+            return FFH5_PIXCONV_YUV420P12;
+        if (yuv == AV_PIX_FMT_GRAY12)
+            return FFH5_PIXCONV_GRAY12;
+    }
+
+    if (yuv == AV_PIX_FMT_GRAY16 && gray != AV_PIX_FMT_GRAY8)
+        return FFH5_PIXCONV_GRAY16;
+
+    return FFH5_PIXCONV_NONE;
+}
+
+/*
+ * Function:  ffh5_pixconv_is_copy
+ * --------------------
+ * whether luma of conv stores the gray samples as they are, so a gray
+ * frame can serve as luma plane without conversion
+ *
+ *  conv: conversion from ffh5_pixconv_select
+ *
+ *  return: non-zero for plain copies
+ *
+ */
+int ffh5_pixconv_is_copy(int conv)
+{
+    return conv != FFH5_PIXCONV_NONE && conv != FFH5_PIXCONV_P010;
+}
+
+/*
+ * Function:  ffh5_pixconv_has_chroma
+ * --------------------
+ * whether frames of the format of conv carry chroma planes, which gray
+ * codecs do not
+ *
+ *  conv: conversion from ffh5_pixconv_select
+ *
+ *  return: non-zero for yuv formats
+ *
+ */
+int ffh5_pixconv_has_chroma(int conv)
+{
+    return conv != FFH5_PIXCONV_NONE && conv != FFH5_PIXCONV_GRAY8 && conv != FFH5_PIXCONV_GRAY10 &&
+           conv != FFH5_PIXCONV_GRAY12 && conv != FFH5_PIXCONV_GRAY16;
+}
+
+/*
+ * Function:  ffh5_pixconv_bytes
+ * --------------------
+ * bytes per sample of the luma plane of conv
+ *
+ *  conv: conversion from ffh5_pixconv_select
+ *
+ *  return: 1 or 2
+ *
+ */
+int ffh5_pixconv_bytes(int conv)
+{
+    return (conv == FFH5_PIXCONV_YUV420P || conv == FFH5_PIXCONV_NV12 || conv == FFH5_PIXCONV_GRAY8) ? 1 : 2;
+}
+
+/*
+ * Function:  ffh5_gray_to_luma
+ * --------------------
+ * pack a gray frame into the luma plane of a yuv frame
+ *
+ *  conv: conversion from ffh5_pixconv_select
+ *  *src: first gray row
+ *  src_linesize: bytes between gray rows
+ *  *dst: frame of the yuv format of conv with writable luma
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_gray_to_luma(int conv, const uint8_t *src, int src_linesize, AVFrame *dst)
+{
+    int width = dst->width, height = dst->height;
+    int y;
+
+    ffh5_once(&pixconv_once, pixconv_init);
+
+    if (conv == FFH5_PIXCONV_NONE || dst->format != conv_format(conv))
+        return -1;
+
+    for (y = 0; y < height; y++)
+    {
+        const uint8_t *row = src + (size_t)y * src_linesize;
+        uint8_t *luma = dst->data[0] + (size_t)y * dst->linesize[0];
+
+        switch (conv)
+        {
+        case FFH5_PIXCONV_YUV420P:
+        case FFH5_PIXCONV_NV12:
+        case FFH5_PIXCONV_GRAY8:
+            memcpy(luma, row, width);
+            break;
+        case FFH5_PIXCONV_YUV420P10:
+        case FFH5_PIXCONV_YUV420P12:
+        case FFH5_PIXCONV_GRAY10:
+        case FFH5_PIXCONV_GRAY12:
+        case FFH5_PIXCONV_GRAY16:
+            memcpy(luma, row, (size_t)width * 2);
+            break;
+        case FFH5_PIXCONV_P010:
+            shift_left16((uint16_t *)luma, (const uint16_t *)row, width);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Function:  ffh5_fill_chroma
+ * --------------------
+ * set the chroma planes of a yuv frame to the neutral value
+ *
+ *  conv: conversion from ffh5_pixconv_select
+ *  *dst: frame of the yuv format of conv with writable chroma
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_fill_chroma(int conv, AVFrame *dst)
+{
+    int chroma_width = (dst->width + 1) >> 1, chroma_height = (dst->height + 1) >> 1;
+    int y;
+
+    ffh5_once(&pixconv_once, pixconv_init);
+
+    if (conv == FFH5_PIXCONV_NONE || dst->format != conv_format(conv))
+        return -1;
+    if (!ffh5_pixconv_has_chroma(conv))
+        return 0;
+
+    for (y = 0; y < chroma_height; y++)
+    {
+        switch (conv)
+        {
+        case FFH5_PIXCONV_YUV420P:
+            memset(dst->data[1] + (size_t)y * dst->linesize[1], CHROMA_8, chroma_width);
+            memset(dst->data[2] + (size_t)y * dst->linesize[2], CHROMA_8, chroma_width);
+            break;
+        case FFH5_PIXCONV_YUV420P10:
+            fill16((uint16_t *)(dst->data[1] + (size_t)y * dst->linesize[1]), CHROMA_10, chroma_width);
+            fill16((uint16_t *)(dst->data[2] + (size_t)y * dst->linesize[2]), CHROMA_10, chroma_width);
+            break;
+        case FFH5_PIXCONV_YUV420P12:
+            fill16((uint16_t *)(dst->data[1] + (size_t)y * dst->linesize[1]), CHROMA_12, chroma_width);
+            fill16((uint16_t *)(dst->data[2] + (size_t)y * dst->linesize[2]), CHROMA_12, chroma_width);
+            break;
+        case FFH5_PIXCONV_NV12:
+            /* interleaved u/v */
+            memset(dst->data[1] + (size_t)y * dst->linesize[1], CHROMA_8, (size_t)chroma_width * 2);
+            break;
+        case FFH5_PIXCONV_P010:
+            fill16((uint16_t *)(dst->data[1] + (size_t)y * dst->linesize[1]),
+                   CHROMA_10 << P010_SHIFT, chroma_width * 2);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Function:  ffh5_yuv_to_gray
+ * --------------------
+ * extract the luma plane of a decoded frame
+ *
+ *  conv: conversion from ffh5_pixconv_select
+ *  *src: frame of the yuv format of conv
+ *  *dst: first gray row
+ *  dst_linesize: bytes between gray rows
+ *
+ *  return: 0 on success, negative value on failure
+ *
+ */
+int ffh5_yuv_to_gray(int conv, const AVFrame *src, uint8_t *dst, int dst_linesize)
+{
+    int width = src->width, height = src->height;
+    int y;
+
+    ffh5_once(&pixconv_once, pixconv_init);
+
+    if (conv == FFH5_PIXCONV_NONE || src->format != conv_format(conv))
+        return -1;
+
+    for (y = 0; y < height; y++)
+    {
+        const uint8_t *luma = src->data[0] + (size_t)y * src->linesize[0];
+        uint8_t *row = dst + (size_t)y * dst_linesize;
+
+        switch (conv)
+        {
+        case FFH5_PIXCONV_YUV420P:
+        case FFH5_PIXCONV_NV12:
+        case FFH5_PIXCONV_GRAY8:
+            memcpy(row, luma, width);
+            break;
+        case FFH5_PIXCONV_YUV420P10:
+        case FFH5_PIXCONV_YUV420P12:
+        case FFH5_PIXCONV_GRAY10:
+        case FFH5_PIXCONV_GRAY12:
+        case FFH5_PIXCONV_GRAY16:
+            memcpy(row, luma, (size_t)width * 2);
+            break;
+        case FFH5_PIXCONV_P010:
+            shift_right16((uint16_t *)row, (const uint16_t *)luma, width);
+            break;
+        }
+    }
+
+    return 0;
+}
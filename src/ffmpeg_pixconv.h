@@ -0,0 +1,85 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Gray <-> YUV conversions for the pixel formats the codecs are opened
+ * with.  The data is grayscale, so packing is a luma copy (or shift for
+ * P010) plus a constant chroma fill and unpacking is a luma extraction;
+ * codecs coding 4:0:0 (FFV1, and x265, rav1e or x264 when they list the
+ * gray format) take plain copies.  swscale is only used for the
+ * remaining format pairs.
+ *
+ */
+
+#ifndef FFMPEG_PIXCONV_H
+#define FFMPEG_PIXCONV_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+typedef enum PixConvEnum
+{
+    FFH5_PIXCONV_NONE = 0,  /* use swscale */
+    FFH5_PIXCONV_YUV420P,   /* gray8  <-> yuv420p */
+    FFH5_PIXCONV_YUV420P10, /* gray10 <-> yuv420p10 */
+    FFH5_PIXCONV_NV12,      /* gray8  <-> nv12 */
+    FFH5_PIXCONV_P010,      /* gray10 <-> p010 (msb aligned) */
+    FFH5_PIXCONV_GRAY8,     /* gray8  <-> gray8, no chroma */
+    FFH5_PIXCONV_GRAY16,    /* gray10/12/16 <-> gray16, no chroma */
+    FFH5_PIXCONV_YUV420P12, /* gray12 <-> yuv420p12 */
+    FFH5_PIXCONV_GRAY10,    /* gray10 <-> gray10, no chroma */
+    FFH5_PIXCONV_GRAY12,    /* gray12 <-> gray12, no chroma */
+} PixConvEnum;
+
+/* Gray format of the samples of a bit mode (cd_values[5]): 8, 10, 12 or 16 bit */
+enum AVPixelFormat ffh5_gray_format(int bit_mode);
+
+/*
+ * Sample layouts (cd_values[16]).  12 bit streams written without the
+ * flag were coded from gray10 frames scaled up by swscale and decode to
+ * gray10 again; FFH5_LAYOUT_NATIVE streams take and return gray12.
+ */
+#define FFH5_LAYOUT_LEGACY 0
+#define FFH5_LAYOUT_NATIVE 1
+
+/* Gray format of the frames a chunk holds, given its bit mode and layout */
+enum AVPixelFormat ffh5_sample_format(int bit_mode, unsigned int layout);
+
+/*
+ * Conversion between a gray format and a yuv format, FFH5_PIXCONV_NONE
+ * when there is no dedicated one or H5FFMPEG_PIXCONV=0 is set.
+ */
+int ffh5_pixconv_select(enum AVPixelFormat gray, enum AVPixelFormat yuv);
+
+/* Non-zero when the luma plane of conv holds gray samples unchanged */
+int ffh5_pixconv_is_copy(int conv);
+
+/* Non-zero when frames of the format of conv have chroma planes */
+int ffh5_pixconv_has_chroma(int conv);
+
+/* Bytes per luma sample of the format of conv */
+int ffh5_pixconv_bytes(int conv);
+
+/*
+ * Write one gray frame (src rows src_linesize bytes apart) into the luma
+ * plane of a frame of the yuv format of conv.
+ * Returns 0 on success, negative if dst does not have that format.
+ */
+int ffh5_gray_to_luma(int conv, const uint8_t *src, int src_linesize, AVFrame *dst);
+
+/*
+ * Fill the chroma planes of a frame of the yuv format of conv with the
+ * neutral value.
+ * Returns 0 on success, negative if dst does not have that format.
+ */
+int ffh5_fill_chroma(int conv, AVFrame *dst);
+
+/*
+ * Extract the luma plane of a decoded frame of the yuv format of conv
+ * as gray rows dst_linesize bytes apart.
+ * Returns 0 on success, negative if src does not have that format.
+ */
+int ffh5_yuv_to_gray(int conv, const AVFrame *src, uint8_t *dst, int dst_linesize);
+
+#endif // FFMPEG_PIXCONV_H
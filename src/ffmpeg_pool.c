@@ -0,0 +1,171 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Persistent worker pool.
+ *
+ * Workers are created on first use and kept for the lifetime of the
+ * process, which also keeps their per-thread codec context caches warm
+ * between batches.  One batch runs at a time; the submitting thread works
+ * on the batch too.
+ *
+ */
+
+#include <stdlib.h>
+
+#include <libavutil/cpu.h>
+
+#include "ffmpeg_pool.h"
+#include "ffmpeg_thread.h"
+
+typedef struct PoolJob
+{
+    ffh5_task_fn fn;
+    void *arg;
+    int n_tasks;
+    int next;        /* next task index to hand out */
+    int pending;     /* tasks not finished yet */
+    int max_helpers; /* workers allowed to join this batch */
+    int helpers;
+} PoolJob;
+
+static ffh5_mutex_t submit_lock = FFH5_MUTEX_INIT;
+static ffh5_mutex_t pool_lock = FFH5_MUTEX_INIT;
+static ffh5_cond_t pool_work = FFH5_COND_INIT;
+static ffh5_cond_t pool_done = FFH5_COND_INIT;
+
+static ffh5_thread_t workers[FFH5_POOL_MAX_THREADS];
+static int n_workers = 0;
+static int shutting_down = 0;
+static int exit_registered = 0;
+static PoolJob *current_job = NULL;
+static unsigned long generation = 0;
+
+/* pool_lock must be held, it is released while tasks run */
+static void run_tasks(PoolJob *job)
+{
+    int index;
+
+    while (job->next < job->n_tasks)
+    {
+        index = job->next++;
+        ffh5_mutex_unlock(&pool_lock);
+        job->fn(job->arg, index);
+        ffh5_mutex_lock(&pool_lock);
+        if (--job->pending == 0)
+            ffh5_cond_broadcast(&pool_done);
+    }
+}
+
+static FFH5_THREAD_RETURN worker_main(void *unused)
+{
+    unsigned long seen = 0;
+    PoolJob *job;
+
+    (void)unused;
+
+    ffh5_mutex_lock(&pool_lock);
+    while (1)
+    {
+        while (!shutting_down &&
+               (!current_job || seen == generation || current_job->helpers >= current_job->max_helpers))
+            ffh5_cond_wait(&pool_work, &pool_lock);
+
+        if (shutting_down)
+            break;
+
+        seen = generation;
+        job = current_job;
+        job->helpers++;
+        run_tasks(job);
+    }
+    ffh5_mutex_unlock(&pool_lock);
+
+    return FFH5_THREAD_RETURN_VALUE;
+}
+
+static void pool_shutdown(void)
+{
+    int i;
+
+    ffh5_mutex_lock(&pool_lock);
+    shutting_down = 1;
+    ffh5_cond_broadcast(&pool_work);
+    ffh5_mutex_unlock(&pool_lock);
+
+#ifndef _WIN32
+    /* on windows the other threads are already gone at this point and
+     * waiting on them under the loader lock could deadlock */
+    for (i = 0; i < n_workers; i++)
+        ffh5_thread_join(workers[i]);
+#else
+    (void)i;
+#endif
+    n_workers = 0;
+}
+
+int ffh5_default_threads(void)
+{
+    int n = av_cpu_count();
+    return (n > 0) ? n : 1;
+}
+
+void ffh5_parallel_for(int n_tasks, int n_threads, ffh5_task_fn fn, void *arg)
+{
+    PoolJob job;
+    int i;
+
+    if (n_tasks <= 0)
+        return;
+
+    if (n_threads <= 0)
+        n_threads = ffh5_default_threads();
+    if (n_threads > n_tasks)
+        n_threads = n_tasks;
+    if (n_threads > FFH5_POOL_MAX_THREADS)
+        n_threads = FFH5_POOL_MAX_THREADS;
+
+    if (n_threads == 1)
+    {
+        for (i = 0; i < n_tasks; i++)
+            fn(arg, i);
+        return;
+    }
+
+    ffh5_mutex_lock(&submit_lock);
+    ffh5_mutex_lock(&pool_lock);
+
+    if (!exit_registered)
+    {
+        atexit(pool_shutdown);
+        exit_registered = 1;
+    }
+
+    /* the caller is one of the n_threads */
+    while (!shutting_down && n_workers < n_threads - 1)
+    {
+        if (ffh5_thread_create(&workers[n_workers], worker_main, NULL) != 0)
+            break;
+        n_workers++;
+    }
+
+    job.fn = fn;
+    job.arg = arg;
+    job.n_tasks = n_tasks;
+    job.next = 0;
+    job.pending = n_tasks;
+    job.max_helpers = n_threads - 1;
+    job.helpers = 0;
+
+    current_job = &job;
+    generation++;
+    ffh5_cond_broadcast(&pool_work);
+
+    run_tasks(&job);
+    while (job.pending > 0)
+        ffh5_cond_wait(&pool_done, &pool_lock);
+
+    current_job = NULL;
+
+    ffh5_mutex_unlock(&pool_lock);
+    ffh5_mutex_unlock(&submit_lock);
+}
@@ -0,0 +1,27 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Persistent worker pool for running independent chunks in parallel.
+ *
+ */
+
+#ifndef FFMPEG_POOL_H
+#define FFMPEG_POOL_H
+
+/* hard upper bound of worker threads */
+#define FFH5_POOL_MAX_THREADS 256
+
+typedef void (*ffh5_task_fn)(void *arg, int index);
+
+/*
+ * Run fn(arg, i) for every i in [0, n_tasks) on up to n_threads threads,
+ * the calling thread included, and wait for all of them to finish.
+ * n_threads <= 0 uses one thread per cpu core.  Must not be called with
+ * an interpreter lock held if fn needs it.
+ */
+void ffh5_parallel_for(int n_tasks, int n_threads, ffh5_task_fn fn, void *arg);
+
+/* number of threads ffh5_parallel_for would use for n_threads <= 0 */
+int ffh5_default_threads(void);
+
+#endif // FFMPEG_POOL_H
@@ -0,0 +1,244 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Intensity quantization of the Python frontend (norm / beta datasets).
+ *
+ * Samples are transformed in one pass from the caller's array into the
+ * output array, no float intermediates of the whole volume.  8 and 16 bit
+ * inputs only have 256 / 65536 distinct values, so the transform is
+ * tabulated once and the samples are a table lookup; float inputs are
+ * computed per sample, without pow when power is 1 so the loop
+ * vectorizes.
+ *
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ffmpeg_h5filter.h"
+#include "ffmpeg_pool.h"
+
+/* samples per task, below this threads cost more than they save */
+#define FFH5_QUANT_BLOCK (1 << 18)
+
+typedef struct QuantParams
+{
+    float offset, scale, power, post, add, lo, hi;
+} QuantParams;
+
+typedef struct QuantJob
+{
+    const QuantParams *q;
+    int in_type;
+    const uint8_t *in;
+    int out_type;
+    uint8_t *out;
+    size_t count;
+    const void *table; /* of out_type, indexed by integer input */
+} QuantJob;
+
+static size_t type_size(int type)
+{
+    switch (type)
+    {
+    case FFH5_QUANT_UINT8:
+        return 1;
+    case FFH5_QUANT_UINT16:
+        return 2;
+    case FFH5_QUANT_FLOAT32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static inline float quant_value(const QuantParams *q, float x)
+{
+    float t = (x - q->offset) * q->scale;
+
+    /* also turns NaN into 0 */
+    if (!(t > 0.0f))
+        t = 0.0f;
+    if (q->power != 1.0f)
+        t = powf(t, q->power);
+    t = t * q->post + q->add;
+    if (t < q->lo)
+        t = q->lo;
+    if (t > q->hi)
+        t = q->hi;
+    return t;
+}
+
+/* store one value, truncating like numpy's astype */
+static inline void quant_store(int type, uint8_t *out, size_t i, float t)
+{
+    switch (type)
+    {
+    case FFH5_QUANT_UINT8:
+        out[i] = (uint8_t)(t < 0.0f ? 0.0f : (t > 255.0f ? 255.0f : t));
+        break;
+    case FFH5_QUANT_UINT16:
+        ((uint16_t *)out)[i] = (uint16_t)(t < 0.0f ? 0.0f : (t > 65535.0f ? 65535.0f : t));
+        break;
+    default:
+        ((float *)out)[i] = t;
+        break;
+    }
+}
+
+static void quant_float(const QuantJob *job, size_t begin, size_t end)
+{
+    const QuantParams *q = job->q;
+    const float *in = (const float *)job->in;
+    size_t i;
+
+    if (q->power != 1.0f)
+    {
+        for (i = begin; i < end; i++)
+            quant_store(job->out_type, job->out, i, quant_value(q, in[i]));
+        return;
+    }
+
+    /* same as quant_value without pow */
+    for (i = begin; i < end; i++)
+    {
+        float t = (in[i] - q->offset) * q->scale;
+
+        t = (t > 0.0f) ? t : 0.0f;
+        t = t * q->post + q->add;
+        t = (t < q->lo) ? q->lo : t;
+        t = (t > q->hi) ? q->hi : t;
+        quant_store(job->out_type, job->out, i, t);
+    }
+}
+
+/* in may alias out, each sample is read before it is written */
+static void quant_lookup(const QuantJob *job, size_t begin, size_t end)
+{
+    size_t i;
+
+    if (job->in_type == FFH5_QUANT_UINT8)
+    {
+        const uint8_t *in = job->in;
+
+        switch (job->out_type)
+        {
+        case FFH5_QUANT_UINT8:
+            for (i = begin; i < end; i++)
+                job->out[i] = ((const uint8_t *)job->table)[in[i]];
+            break;
+        case FFH5_QUANT_UINT16:
+            for (i = begin; i < end; i++)
+                ((uint16_t *)job->out)[i] = ((const uint16_t *)job->table)[in[i]];
+            break;
+        default:
+            for (i = begin; i < end; i++)
+                ((float *)job->out)[i] = ((const float *)job->table)[in[i]];
+            break;
+        }
+        return;
+    }
+
+    {
+        const uint16_t *in = (const uint16_t *)job->in;
+
+        switch (job->out_type)
+        {
+        case FFH5_QUANT_UINT8:
+            for (i = begin; i < end; i++)
+                job->out[i] = ((const uint8_t *)job->table)[in[i]];
+            break;
+        case FFH5_QUANT_UINT16:
+            for (i = begin; i < end; i++)
+                ((uint16_t *)job->out)[i] = ((const uint16_t *)job->table)[in[i]];
+            break;
+        default:
+            for (i = begin; i < end; i++)
+                ((float *)job->out)[i] = ((const float *)job->table)[in[i]];
+            break;
+        }
+    }
+}
+
+static void quant_task(void *arg, int index)
+{
+    const QuantJob *job = (const QuantJob *)arg;
+    size_t begin = (size_t)index * FFH5_QUANT_BLOCK;
+    size_t end = begin + FFH5_QUANT_BLOCK;
+
+    if (end > job->count)
+        end = job->count;
+    if (job->table)
+        quant_lookup(job, begin, end);
+    else
+        quant_float(job, begin, end);
+}
+
+/*
+ * Function:  ffmpeg_h5_quantize
+ * --------------------
+ * transform count samples of in into out, see ffmpeg_h5filter.h
+ *
+ *  *q: transform parameters
+ *  in_type, out_type: FFH5_QUANT_*
+ *  *in: input samples
+ *  *out: output samples (may be in for types of the same size)
+ *  count: number of samples
+ *  threads: threads to use, <= 0 for one per cpu core
+ *
+ *  return: 0 on success, -1 on failure
+ *
+ */
+int ffmpeg_h5_quantize(const FFH5Quant *q, int in_type, const void *in, int out_type, void *out,
+                       size_t count, int threads)
+{
+    QuantParams params;
+    QuantJob job;
+    void *table = NULL;
+    size_t n_tasks, entries, i;
+
+    if (!type_size(in_type) || !type_size(out_type))
+        return -1;
+    if (count == 0)
+        return 0;
+
+    params.offset = (float)q->offset;
+    params.scale = (float)q->scale;
+    params.power = (float)q->power;
+    params.post = (float)q->post;
+    params.add = (float)q->add;
+    params.lo = (float)q->lo;
+    params.hi = (float)q->hi;
+
+    job.q = &params;
+    job.in_type = in_type;
+    job.in = (const uint8_t *)in;
+    job.out_type = out_type;
+    job.out = (uint8_t *)out;
+    job.count = count;
+    job.table = NULL;
+
+    if (in_type != FFH5_QUANT_FLOAT32)
+    {
+        entries = (in_type == FFH5_QUANT_UINT8) ? 256 : 65536;
+        table = malloc(entries * type_size(out_type));
+        if (!table)
+            return -1;
+        for (i = 0; i < entries; i++)
+            quant_store(out_type, (uint8_t *)table, i, quant_value(&params, (float)i));
+        job.table = table;
+    }
+
+    n_tasks = (count + FFH5_QUANT_BLOCK - 1) / FFH5_QUANT_BLOCK;
+    if (n_tasks == 1)
+        quant_task(&job, 0);
+    else
+    {
+        /* INT_MAX tasks are 2^49 samples */
+        ffh5_parallel_for((int)n_tasks, threads, quant_task, &job);
+    }
+
+    free(table);
+    return 0;
+}
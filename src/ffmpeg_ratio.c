@@ -0,0 +1,190 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Compression ratio estimator.
+ *
+ * Ratios depend mostly on the codec, its crf and the bit depth, and
+ * chunks of one dataset tend to compress alike, so the average of the
+ * chunks seen so far is a good predictor for the next one.  Unknown
+ * combinations start from EXPECTED_CS_RATIO.
+ *
+ */
+
+#include "ffmpeg_ratio.h"
+#include "ffmpeg_thread.h"
+
+typedef struct RatioSlot
+{
+    int used;
+    unsigned int enc_id;
+    unsigned int crf;
+    unsigned int bit_mode;
+    double ratio;          /* raw / compressed */
+    unsigned long samples; /* observations, capped at FFH5_RATIO_WINDOW */
+    unsigned long last_use;
+} RatioSlot;
+
+static ffh5_mutex_t ratio_lock = FFH5_MUTEX_INIT;
+static RatioSlot slots[FFH5_RATIO_SLOTS];
+static unsigned long use_clock = 0;
+static FFH5SizeStats size_stats;
+
+/* ratio_lock must be held; returns the slot of the key, or the least
+ * recently used one (reset) when create is set, or NULL */
+static RatioSlot *find_slot(unsigned int enc_id, unsigned int crf, unsigned int bit_mode, int create)
+{
+    RatioSlot *victim = &slots[0];
+    int i;
+
+    for (i = 0; i < FFH5_RATIO_SLOTS; i++)
+    {
+        RatioSlot *slot = &slots[i];
+
+        if (slot->used && slot->enc_id == enc_id && slot->crf == crf && slot->bit_mode == bit_mode)
+        {
+            slot->last_use = ++use_clock;
+            return slot;
+        }
+        if (!slot->used || (victim->used && slot->last_use < victim->last_use))
+            victim = slot;
+    }
+
+    if (!create)
+        return NULL;
+
+    victim->used = 1;
+    victim->enc_id = enc_id;
+    victim->crf = crf;
+    victim->bit_mode = bit_mode;
+    victim->ratio = EXPECTED_CS_RATIO;
+    victim->samples = 0;
+    victim->last_use = ++use_clock;
+    return victim;
+}
+
+/*
+ * Function:  ffh5_ratio_reserve
+ * --------------------
+ * predict the output size of a chunk from the ratios seen so far
+ *
+ *  cd_values: auxiliary parameters
+ *  raw_size: size of the raw chunk
+ *
+ *  return: number of bytes to reserve
+ *
+ */
+size_t ffh5_ratio_reserve(const unsigned int cd_values[], size_t raw_size)
+{
+    RatioSlot *slot;
+    double ratio = EXPECTED_CS_RATIO;
+    size_t reserve;
+
+    ffh5_mutex_lock(&ratio_lock);
+    slot = find_slot(cd_values[0], cd_values[8], cd_values[5], 0);
+    if (slot)
+        ratio = slot->ratio;
+    ffh5_mutex_unlock(&ratio_lock);
+
+    reserve = (size_t)((double)raw_size / ratio * FFH5_RATIO_HEADROOM);
+    if (reserve < FFH5_RATIO_MIN_RESERVE)
+        reserve = FFH5_RATIO_MIN_RESERVE;
+    return reserve;
+}
+
+/*
+ * Function:  ffh5_ratio_observe
+ * --------------------
+ * fold an encoded chunk into the estimate and the size statistics
+ *
+ *  cd_values: auxiliary parameters
+ *  raw_size: size of the raw chunk
+ *  compressed_size: size of the encoded chunk
+ *  reserved: bytes reserved before encoding
+ *  grows: times the output grew beyond the reservation
+ *
+ */
+void ffh5_ratio_observe(const unsigned int cd_values[], size_t raw_size, size_t compressed_size,
+                        size_t reserved, size_t grows)
+{
+    RatioSlot *slot;
+    double ratio;
+
+    if (raw_size == 0 || compressed_size == 0)
+        return;
+    ratio = (double)raw_size / (double)compressed_size;
+
+    ffh5_mutex_lock(&ratio_lock);
+    slot = find_slot(cd_values[0], cd_values[8], cd_values[5], 1);
+    if (slot->samples < FFH5_RATIO_WINDOW)
+        slot->samples++;
+    /* cumulative average at first, exponential once the window is full */
+    slot->ratio += (ratio - slot->ratio) / (double)slot->samples;
+
+    size_stats.chunks++;
+    size_stats.reallocs += grows;
+    size_stats.reserved_bytes += reserved;
+    size_stats.compressed_bytes += compressed_size;
+    ffh5_mutex_unlock(&ratio_lock);
+}
+
+/*
+ * Function:  ffmpeg_h5_seed_ratio
+ * --------------------
+ * set the expected compression ratio of an (encoder, crf, bit mode)
+ *
+ *  enc_id: encoder id (cd_values[0])
+ *  crf: crf (cd_values[8])
+ *  bit_mode: bit mode (cd_values[5])
+ *  ratio: raw size / compressed size
+ *
+ */
+void ffmpeg_h5_seed_ratio(unsigned int enc_id, unsigned int crf, unsigned int bit_mode, double ratio)
+{
+    RatioSlot *slot;
+
+    if (!(ratio >= 1.0))
+        ratio = 1.0;
+
+    ffh5_mutex_lock(&ratio_lock);
+    slot = find_slot(enc_id, crf, bit_mode, 1);
+    slot->ratio = ratio;
+    /* a seed counts as one observation, real chunks take over quickly */
+    slot->samples = 1;
+    ffh5_mutex_unlock(&ratio_lock);
+}
+
+/*
+ * Function:  ffmpeg_h5_get_ratio
+ * --------------------
+ * current expected compression ratio of an (encoder, crf, bit mode)
+ *
+ *  return: raw size / compressed size, EXPECTED_CS_RATIO when unknown
+ *
+ */
+double ffmpeg_h5_get_ratio(unsigned int enc_id, unsigned int crf, unsigned int bit_mode)
+{
+    RatioSlot *slot;
+    double ratio = EXPECTED_CS_RATIO;
+
+    ffh5_mutex_lock(&ratio_lock);
+    slot = find_slot(enc_id, crf, bit_mode, 0);
+    if (slot)
+        ratio = slot->ratio;
+    ffh5_mutex_unlock(&ratio_lock);
+
+    return ratio;
+}
+
+void ffmpeg_h5_get_size_stats(FFH5SizeStats *stats)
+{
+    ffh5_mutex_lock(&ratio_lock);
+    *stats = size_stats;
+    ffh5_mutex_unlock(&ratio_lock);
+}
+
+void ffmpeg_h5_reset_size_stats(void)
+{
+    ffh5_mutex_lock(&ratio_lock);
+    memset(&size_stats, 0, sizeof(size_stats));
+    ffh5_mutex_unlock(&ratio_lock);
+}
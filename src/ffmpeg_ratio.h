@@ -0,0 +1,34 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Process wide running estimate of the compression ratio per
+ * (encoder, crf, bit mode), used to size the output of a chunk before
+ * encoding it.
+ *
+ */
+
+#ifndef FFMPEG_RATIO_H
+#define FFMPEG_RATIO_H
+
+#include "ffmpeg_utils.h"
+
+/* number of (encoder, crf, bit mode) combinations tracked */
+#define FFH5_RATIO_SLOTS 64
+/* observations after which the average turns into a moving average */
+#define FFH5_RATIO_WINDOW 16
+/* reserve this much more than the estimate, estimates are averages */
+#define FFH5_RATIO_HEADROOM 1.25
+/* lower bound of a reservation, covers stream headers */
+#define FFH5_RATIO_MIN_RESERVE 4096
+
+/* bytes to reserve for encoding raw_size bytes with cd_values */
+size_t ffh5_ratio_reserve(const unsigned int cd_values[], size_t raw_size);
+
+/*
+ * Record an encoded chunk: its raw and compressed sizes, the bytes
+ * reserved up front and how often the output had to grow afterwards.
+ */
+void ffh5_ratio_observe(const unsigned int cd_values[], size_t raw_size, size_t compressed_size,
+                        size_t reserved, size_t grows);
+
+#endif // FFMPEG_RATIO_H
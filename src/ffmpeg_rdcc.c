@@ -0,0 +1,319 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * HDF5 raw data chunk cache sizing for ffmpeg compressed datasets.
+ *
+ * HDF5 keeps decoded chunks per dataset in a cache of 1 MB by default and
+ * bypasses it for larger chunks, so a partial read of a video coded
+ * chunk (tens or hundreds of MB) decodes the whole chunk every time.
+ * Here the cache of a dataset is sized from its chunk shape, the memory
+ * available and how it is going to be read, see
+ * ffmpeg_h5_chunk_cache_settings.
+ *
+ * Environment variables (read once per process):
+ *  H5FFMPEG_RDCC=0                 leave HDF5's defaults
+ *  H5FFMPEG_RDCC_MAX=2G            cap per dataset (default: 1/8 of the
+ *                                  available memory)
+ *
+ */
+
+#include "ffmpeg_utils.h"
+#include "ffmpeg_thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/* HDF5's default, never go below it */
+#define RDCC_MIN_NBYTES (1024 * 1024)
+/* used when the available memory is unknown */
+#define RDCC_DEFAULT_MAX ((size_t)1 << 30)
+/* hash slots per cached chunk, as HDF5 recommends */
+#define RDCC_SLOTS_PER_CHUNK 100
+#define RDCC_MIN_SLOTS 521
+#define RDCC_MAX_SLOTS ((size_t)1 << 24)
+
+static ffh5_once_t rdcc_once = FFH5_ONCE_INIT;
+static ffh5_mutex_t rdcc_lock = FFH5_MUTEX_INIT;
+
+static int rdcc_enabled = 1;
+static size_t rdcc_max = 0;
+static FFH5RdccStats rdcc_stats;
+
+static void rdcc_init(void)
+{
+    const char *env;
+
+    env = getenv("H5FFMPEG_RDCC");
+    if (env && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0 || strcmp(env, "false") == 0))
+        rdcc_enabled = 0;
+
+    env = getenv("H5FFMPEG_RDCC_MAX");
+    if (env && *env)
+        rdcc_max = ffh5_parse_size(env);
+}
+
+/* physical memory not in use, 0 when unknown */
+static size_t available_memory(void)
+{
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return (size_t)status.ullAvailPhys;
+    return 0;
+#else
+    long page = sysconf(_SC_PAGESIZE);
+    long pages = -1;
+
+#if defined(_SC_AVPHYS_PAGES)
+    pages = sysconf(_SC_AVPHYS_PAGES);
+#elif defined(_SC_PHYS_PAGES)
+    /* total memory (macOS), scaled down with the rest */
+    pages = sysconf(_SC_PHYS_PAGES) / 2;
+#endif
+    if (page <= 0 || pages <= 0)
+        return 0;
+    return (size_t)page * (size_t)pages;
+#endif
+}
+
+static size_t next_prime(size_t n)
+{
+    size_t d;
+
+    if (n <= 2)
+        return 2;
+    n |= 1;
+    for (;; n += 2)
+    {
+        for (d = 3; d * d <= n; d += 2)
+            if (n % d == 0)
+                break;
+        if (d * d > n)
+            return n;
+    }
+}
+
+/*
+ * Function:  ffmpeg_h5_chunk_cache_settings
+ * --------------------
+ * size the HDF5 chunk cache of a chunked dataset, see ffmpeg_h5filter.h
+ *
+ *  rank: number of dimensions
+ *  dims, chunks: dataset and chunk shape
+ *  type_size: bytes per element
+ *  hint: FFH5_ACCESS_*
+ *  *settings: H5Pset_chunk_cache arguments
+ *
+ *  return: 1 when settings is filled in, 0 when disabled (H5FFMPEG_RDCC=0),
+ *          -1 on bad arguments
+ *
+ */
+int ffmpeg_h5_chunk_cache_settings(int rank, const hsize_t dims[], const hsize_t chunks[], size_t type_size,
+                                   int hint, FFH5RdccSettings *settings)
+{
+    double chunk_bytes, row = 1.0, total, wanted;
+    size_t cap, cached;
+    int d;
+
+    ffh5_once(&rdcc_once, rdcc_init);
+    if (rank <= 0 || rank > H5S_MAX_RANK || !dims || !chunks || type_size == 0 || !settings)
+        return -1;
+    if (hint < FFH5_ACCESS_SLICES || hint > FFH5_ACCESS_WHOLE)
+        return -1;
+    if (!rdcc_enabled)
+        return 0;
+
+    /* doubles, a product of chunk dimensions may not fit size_t */
+    chunk_bytes = (double)type_size;
+    for (d = 0; d < rank; d++)
+    {
+        if (chunks[d] == 0)
+            return -1;
+        chunk_bytes *= (double)chunks[d];
+        if (d > 0)
+            row *= (double)((dims[d] + chunks[d] - 1) / chunks[d]);
+    }
+    if (row < 1.0)
+        row = 1.0;
+    total = row * (double)((dims[0] + chunks[0] - 1) / chunks[0]);
+    if (total < 1.0)
+        total = 1.0;
+
+    switch (hint)
+    {
+    case FFH5_ACCESS_RANDOM:
+        /* rereads anywhere, keep whatever was read last */
+        wanted = 4.0 * row;
+        settings->w0 = 0.75;
+        break;
+    case FFH5_ACCESS_WHOLE:
+        wanted = 1.0;
+        settings->w0 = 1.0;
+        break;
+    default:
+        /* planes in order: one row of chunks, done with fully read ones first */
+        wanted = row;
+        settings->w0 = 1.0;
+        break;
+    }
+    if (wanted > total)
+        wanted = total;
+    wanted *= chunk_bytes;
+
+    cap = rdcc_max;
+    if (cap == 0)
+    {
+        cap = available_memory() / 8;
+        if (cap == 0)
+            cap = RDCC_DEFAULT_MAX;
+    }
+
+    settings->nbytes = (wanted < (double)cap) ? (size_t)wanted : cap;
+    if (settings->nbytes < RDCC_MIN_NBYTES)
+        settings->nbytes = RDCC_MIN_NBYTES;
+
+    cached = (size_t)((double)settings->nbytes / chunk_bytes);
+    if (cached < 1)
+        cached = 1;
+    settings->nslots = (cached > RDCC_MAX_SLOTS / RDCC_SLOTS_PER_CHUNK) ? RDCC_MAX_SLOTS
+                                                                         : cached * RDCC_SLOTS_PER_CHUNK;
+    if (settings->nslots < RDCC_MIN_SLOTS)
+        settings->nslots = RDCC_MIN_SLOTS;
+    settings->nslots = next_prime(settings->nslots);
+
+    ffh5_mutex_lock(&rdcc_lock);
+    rdcc_stats.datasets++;
+    rdcc_stats.last = *settings;
+    rdcc_stats.chunk_bytes = (chunk_bytes < (double)SIZE_MAX) ? (size_t)chunk_bytes : SIZE_MAX;
+    rdcc_stats.hint = hint;
+    ffh5_mutex_unlock(&rdcc_lock);
+
+    return 1;
+}
+
+/*
+ * Function:  ffmpeg_h5_configure_dapl
+ * --------------------
+ * set the chunk cache of dapl for the open dataset dset when it uses the
+ * ffmpeg filter
+ *
+ *  dset: open dataset
+ *  dapl: dataset access property list to change
+ *  hint: FFH5_ACCESS_*
+ *
+ *  return: 1 when dapl was changed, 0 when dset is not an ffmpeg dataset
+ *          or sizing is disabled, negative on error
+ *
+ */
+int ffmpeg_h5_configure_dapl(hid_t dset, hid_t dapl, int hint)
+{
+    hsize_t dims[H5S_MAX_RANK], chunks[H5S_MAX_RANK];
+    FFH5RdccSettings settings;
+    hid_t dcpl = H5I_INVALID_HID, space = H5I_INVALID_HID, type = H5I_INVALID_HID;
+    unsigned int flags;
+    size_t cd_nelmts = 0;
+    herr_t found;
+    int rank, ret = -1;
+
+    dcpl = H5Dget_create_plist(dset);
+    if (dcpl < 0)
+    {
+        raise_ffmpeg_h5_error("Could not query dataset\n");
+        goto Finish;
+    }
+
+    ret = 0;
+    if (H5Pget_layout(dcpl) != H5D_CHUNKED)
+        goto Finish;
+    H5E_BEGIN_TRY
+    {
+        found = H5Pget_filter_by_id2(dcpl, FFMPEG_H5FILTER, &flags, &cd_nelmts, NULL, 0, NULL, NULL);
+    }
+    H5E_END_TRY;
+    if (found < 0)
+        goto Finish;
+
+    ret = -1;
+    space = H5Dget_space(dset);
+    type = H5Dget_type(dset);
+    rank = H5Pget_chunk(dcpl, H5S_MAX_RANK, chunks);
+    if (space < 0 || type < 0 || rank <= 0 || H5Sget_simple_extent_dims(space, dims, NULL) != rank)
+    {
+        raise_ffmpeg_h5_error("Could not get chunk layout\n");
+        goto Finish;
+    }
+
+    ret = ffmpeg_h5_chunk_cache_settings(rank, dims, chunks, H5Tget_size(type), hint, &settings);
+    if (ret <= 0)
+        goto Finish;
+
+    if (H5Pset_chunk_cache(dapl, settings.nslots, settings.nbytes, settings.w0) < 0)
+    {
+        raise_ffmpeg_h5_error("Could not set the chunk cache\n");
+        ret = -1;
+    }
+
+Finish:
+    if (type >= 0)
+        H5Tclose(type);
+    if (space >= 0)
+        H5Sclose(space);
+    if (dcpl >= 0)
+        H5Pclose(dcpl);
+    return ret;
+}
+
+/*
+ * Function:  ffmpeg_h5_open_dataset
+ * --------------------
+ * H5Dopen2 with the chunk cache sized for ffmpeg compressed datasets
+ *
+ *  loc: file or group
+ *  name: dataset path relative to loc
+ *  hint: FFH5_ACCESS_*
+ *
+ *  return: dataset id, negative on failure
+ *
+ */
+hid_t ffmpeg_h5_open_dataset(hid_t loc, const char *name, int hint)
+{
+    hid_t dset, dapl;
+
+    dset = H5Dopen2(loc, name, H5P_DEFAULT);
+    if (dset < 0)
+        return dset;
+
+    dapl = H5Dget_access_plist(dset);
+    if (dapl < 0)
+        return dset;
+
+    /* the cache only takes effect when the dataset is opened with it */
+    if (ffmpeg_h5_configure_dapl(dset, dapl, hint) > 0)
+    {
+        H5Dclose(dset);
+        dset = H5Dopen2(loc, name, dapl);
+    }
+    H5Pclose(dapl);
+    return dset;
+}
+
+/*
+ * Function:  ffmpeg_h5_get_rdcc_stats
+ * --------------------
+ * chunk cache settings computed so far and the last of them
+ *
+ *  *stats: filled in
+ *
+ */
+void ffmpeg_h5_get_rdcc_stats(FFH5RdccStats *stats)
+{
+    ffh5_once(&rdcc_once, rdcc_init);
+    ffh5_mutex_lock(&rdcc_lock);
+    *stats = rdcc_stats;
+    stats->enabled = rdcc_enabled;
+    stats->max_nbytes = rdcc_max;
+    ffh5_mutex_unlock(&rdcc_lock);
+}
@@ -0,0 +1,405 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Multi-GPU chunk scheduler.
+ *
+ * Chunks fed to an NVENC encoder or CUVID decoder take a slot on one of
+ * the scheduled gpus for as long as they are coded, and cd_values[10]
+ * is rewritten to that gpu.  The NVENC session cap counts those slots;
+ * sessions the context cache keeps open beyond it are closed when their
+ * chunk finishes, so the cap holds once the process settles.  Streams
+ * encoded on the CPU fallback are ordinary streams of the same format,
+ * so they decode with the decoder stored in cd_values[1].
+ *
+ * Environment variables (read once per process, before the first call
+ * to ffmpeg_h5_set_gpu_schedule):
+ *  H5FFMPEG_GPUS=0,1,2,3                     gpus to schedule on (unset: off)
+ *  H5FFMPEG_GPU_POLICY=least_loaded          or round_robin (default)
+ *  H5FFMPEG_NVENC_SESSIONS=N                 NVENC sessions per gpu (0: no cap)
+ *  H5FFMPEG_GPU_CPU_FALLBACK=0               wait for a session instead
+ *
+ */
+
+#include "ffmpeg_sched.h"
+#include "ffmpeg_thread.h"
+
+/* slots carry the schedule generation so releases of an older schedule are ignored */
+#define SCHED_GENERATION_MASK 0xFFFFF
+
+typedef struct SchedGpu
+{
+    unsigned int gpu_id;
+    int encoders; /* chunks in flight */
+    int decoders;
+    unsigned long long chunks;
+} SchedGpu;
+
+static ffh5_once_t sched_once = FFH5_ONCE_INIT;
+static ffh5_mutex_t sched_lock = FFH5_MUTEX_INIT;
+static ffh5_cond_t sched_cond = FFH5_COND_INIT;
+
+static SchedGpu gpus[FFH5_SCHED_MAX_GPUS];
+static int gpu_count = 0;
+static int sched_policy = FFH5_SCHED_ROUND_ROBIN;
+static int sched_max_sessions = 0;
+static int sched_cpu_fallback = 1;
+static int next_gpu = 0;
+static int generation = 0;
+static unsigned long long cpu_fallbacks = 0;
+static int sessions[FFH5_SCHED_MAX_GPU_ID];
+
+/* sched_lock must be held */
+static void set_schedule(const unsigned int gpu_ids[], int n_gpus, int policy, int max_sessions,
+                         int cpu_fallback)
+{
+    int i;
+
+    memset(gpus, 0, sizeof(gpus));
+    for (i = 0; i < n_gpus; i++)
+        gpus[i].gpu_id = gpu_ids[i];
+    gpu_count = n_gpus;
+    sched_policy = policy;
+    sched_max_sessions = max_sessions;
+    sched_cpu_fallback = cpu_fallback;
+    next_gpu = 0;
+    generation = (generation + 1) & SCHED_GENERATION_MASK;
+
+    /* waiters re-evaluate against the new schedule */
+    ffh5_cond_broadcast(&sched_cond);
+}
+
+static void sched_init(void)
+{
+    unsigned int gpu_ids[FFH5_SCHED_MAX_GPUS];
+    int n_gpus = 0, policy = FFH5_SCHED_ROUND_ROBIN, max_sessions = 0, cpu_fallback = 1;
+    const char *env;
+    char *end;
+
+    env = getenv("H5FFMPEG_GPUS");
+    while (env && *env && n_gpus < FFH5_SCHED_MAX_GPUS)
+    {
+        unsigned long id = strtoul(env, &end, 10);
+
+        if (end == env || id >= FFH5_SCHED_MAX_GPU_ID)
+            break;
+        gpu_ids[n_gpus++] = (unsigned int)id;
+        env = (*end == ',') ? end + 1 : end;
+    }
+
+    env = getenv("H5FFMPEG_GPU_POLICY");
+    if (env && strcmp(env, "least_loaded") == 0)
+        policy = FFH5_SCHED_LEAST_LOADED;
+
+    env = getenv("H5FFMPEG_NVENC_SESSIONS");
+    if (env && *env && atoi(env) > 0)
+        max_sessions = atoi(env);
+
+    env = getenv("H5FFMPEG_GPU_CPU_FALLBACK");
+    if (env && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0 || strcmp(env, "false") == 0))
+        cpu_fallback = 0;
+
+    ffh5_mutex_lock(&sched_lock);
+    set_schedule(gpu_ids, n_gpus, policy, max_sessions, cpu_fallback);
+    ffh5_mutex_unlock(&sched_lock);
+}
+
+static int to_cpu(unsigned int params[]);
+
+static int is_nvenc(unsigned int enc_id)
+{
+    return enc_id == FFH5_ENC_H264_NV || enc_id == FFH5_ENC_HEVC_NV || enc_id == FFH5_ENC_AV1_NV;
+}
+
+static int is_cuvid(unsigned int dec_id)
+{
+    return dec_id == FFH5_DEC_H264_CUVID || dec_id == FFH5_DEC_HEVC_CUVID || dec_id == FFH5_DEC_AV1_CUVID;
+}
+
+/*
+ * Function:  pick_gpu
+ * --------------------
+ * choose the gpu for the next chunk, sched_lock must be held
+ *
+ *  is_encoder: the session cap only applies to encoders
+ *
+ *  return: index into gpus, negative value when every gpu is at the cap
+ *
+ */
+static int pick_gpu(int is_encoder)
+{
+    int i, k, load, best = -1, best_load = 0;
+
+    for (k = 0; k < gpu_count; k++)
+    {
+        i = (next_gpu + k) % gpu_count;
+        load = is_encoder ? gpus[i].encoders : gpus[i].decoders;
+
+        if (is_encoder && sched_max_sessions > 0 && load >= sched_max_sessions)
+            continue;
+        if (sched_policy == FFH5_SCHED_ROUND_ROBIN)
+        {
+            best = i;
+            break;
+        }
+        if (best < 0 || load < best_load)
+        {
+            best = i;
+            best_load = load;
+        }
+    }
+
+    /* round-robin moves past the gpu taken, least loaded rotates ties */
+    if (best >= 0)
+        next_gpu = (sched_policy == FFH5_SCHED_ROUND_ROBIN) ? (best + 1) % gpu_count
+                                                            : (next_gpu + 1) % gpu_count;
+    return best;
+}
+
+/*
+ * Function:  ffh5_sched_acquire
+ * --------------------
+ * place a chunk on a scheduled gpu, on the CPU when every NVENC session
+ * is taken and fallback is enabled, or wait for a session otherwise
+ *
+ *  is_encoder: 1 for encoding, 0 for decoding
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters of the chunk
+ *  params: receives the parameters to code the chunk with
+ *
+ *  return: slot for ffh5_sched_release, FFH5_SCHED_NONE if not on a gpu
+ *
+ */
+int ffh5_sched_acquire(int is_encoder, size_t cd_nelmts, const unsigned int cd_values[],
+                       unsigned int params[])
+{
+    size_t n = (cd_nelmts < FFH5_MAX_CD_VALUES) ? cd_nelmts : FFH5_MAX_CD_VALUES;
+    int index = -1, slot = FFH5_SCHED_NONE;
+
+    memset(params, 0, FFH5_MAX_CD_VALUES * sizeof(unsigned int));
+    memcpy(params, cd_values, n * sizeof(unsigned int));
+
+    if (n < FFH5_CD_NELMTS || !(is_encoder ? is_nvenc(params[0]) : is_cuvid(params[1])))
+        return FFH5_SCHED_NONE;
+
+    ffh5_once(&sched_once, sched_init);
+
+    ffh5_mutex_lock(&sched_lock);
+    while (gpu_count > 0)
+    {
+        index = pick_gpu(is_encoder);
+        if (index >= 0)
+            break;
+        if (sched_cpu_fallback && to_cpu(params))
+        {
+            cpu_fallbacks++;
+            break;
+        }
+        ffh5_cond_wait(&sched_cond, &sched_lock);
+    }
+    if (index >= 0)
+    {
+        if (is_encoder)
+            gpus[index].encoders++;
+        else
+            gpus[index].decoders++;
+        gpus[index].chunks++;
+        params[10] = gpus[index].gpu_id;
+        slot = generation * FFH5_SCHED_MAX_GPUS + index;
+    }
+    ffh5_mutex_unlock(&sched_lock);
+
+    return slot;
+}
+
+void ffh5_sched_release(int is_encoder, int slot)
+{
+    int index;
+
+    if (slot < 0)
+        return;
+    index = slot % FFH5_SCHED_MAX_GPUS;
+
+    ffh5_mutex_lock(&sched_lock);
+    if (slot / FFH5_SCHED_MAX_GPUS == generation && index < gpu_count)
+    {
+        if (is_encoder && gpus[index].encoders > 0)
+        {
+            gpus[index].encoders--;
+            ffh5_cond_signal(&sched_cond);
+        }
+        else if (!is_encoder && gpus[index].decoders > 0)
+            gpus[index].decoders--;
+    }
+    ffh5_mutex_unlock(&sched_lock);
+}
+
+/* preset of the software encoder for an NVENC preset, first is the fastest */
+static unsigned int map_preset(unsigned int preset, unsigned int nv_first, const unsigned int cpu_presets[7])
+{
+    if (preset < nv_first || preset > nv_first + 6)
+        return FFH5_PRESET_NONE;
+    return cpu_presets[preset - nv_first];
+}
+
+/*
+ * Function:  to_cpu
+ * --------------------
+ * switch params from an NVENC encoder to libx264, libx265 or SVT-AV1,
+ * which produce streams the same decoders read
+ *
+ *  return: 1 on success, 0 when there is no equivalent encoder
+ *
+ */
+static int to_cpu(unsigned int params[])
+{
+    static const unsigned int x264[7] = {
+        FFH5_PRESET_X264_VERYFAST, FFH5_PRESET_X264_FASTER, FFH5_PRESET_X264_FAST, FFH5_PRESET_X264_MEDIUM,
+        FFH5_PRESET_X264_SLOW, FFH5_PRESET_X264_SLOWER, FFH5_PRESET_X264_VERYSLOW};
+    static const unsigned int x265[7] = {
+        FFH5_PRESET_X265_VERYFAST, FFH5_PRESET_X265_FASTER, FFH5_PRESET_X265_FAST, FFH5_PRESET_X265_MEDIUM,
+        FFH5_PRESET_X265_SLOW, FFH5_PRESET_X265_SLOWER, FFH5_PRESET_X265_VERYSLOW};
+    static const unsigned int svtav1[7] = {
+        FFH5_PRESET_SVTAV1_VERYFAST, FFH5_PRESET_SVTAV1_MUCHFASTER, FFH5_PRESET_SVTAV1_FASTER,
+        FFH5_PRESET_SVTAV1_FAST, FFH5_PRESET_SVTAV1_MEDIUM, FFH5_PRESET_SVTAV1_SLOW,
+        FFH5_PRESET_SVTAV1_MUCHSLOWER};
+    char codec_name[50] = {0};
+    unsigned int enc_id, preset;
+
+    /* nvenc codes 12 bit input as P010, a software encoder would not */
+    if (params[5] > 1)
+        return 0;
+
+    switch (params[0])
+    {
+    case FFH5_ENC_H264_NV:
+        if (params[7] == FFH5_TUNE_H264NV_LOSSLESS)
+            return 0;
+        enc_id = FFH5_ENC_X264;
+        preset = map_preset(params[6], FFH5_PRESET_H264NV_FASTEST, x264);
+        break;
+    case FFH5_ENC_HEVC_NV:
+        if (params[7] == FFH5_TUNE_HEVCNV_LOSSLESS)
+            return 0;
+        enc_id = FFH5_ENC_X265;
+        preset = map_preset(params[6], FFH5_PRESET_HEVCNV_FASTEST, x265);
+        break;
+    case FFH5_ENC_AV1_NV:
+        if (params[7] == FFH5_TUNE_AV1NV_LOSSLESS)
+            return 0;
+        enc_id = FFH5_ENC_SVTAV1;
+        preset = map_preset(params[6], FFH5_PRESET_AV1NV_FASTEST, svtav1);
+        break;
+    default:
+        return 0;
+    }
+
+    /* builds without the software encoder keep waiting for a session */
+    find_encoder_name(enc_id, codec_name);
+    if (!avcodec_find_encoder_by_name(codec_name))
+        return 0;
+
+    params[0] = enc_id;
+    params[6] = preset;
+    params[7] = FFH5_TUNE_NONE; /* tunes are encoder specific */
+    return 1;
+}
+
+int ffh5_sched_fallback(unsigned int params[])
+{
+    int ret = 0;
+
+    ffh5_once(&sched_once, sched_init);
+
+    ffh5_mutex_lock(&sched_lock);
+    if (sched_cpu_fallback && to_cpu(params))
+    {
+        cpu_fallbacks++;
+        ret = 1;
+    }
+    ffh5_mutex_unlock(&sched_lock);
+
+    return ret;
+}
+
+void ffh5_sched_session(unsigned int gpu_id, int delta)
+{
+    if (gpu_id >= FFH5_SCHED_MAX_GPU_ID)
+        return;
+
+    ffh5_mutex_lock(&sched_lock);
+    sessions[gpu_id] += delta;
+    ffh5_mutex_unlock(&sched_lock);
+}
+
+int ffh5_sched_sessions_over(unsigned int gpu_id)
+{
+    int over;
+
+    if (gpu_id >= FFH5_SCHED_MAX_GPU_ID)
+        return 0;
+
+    ffh5_mutex_lock(&sched_lock);
+    over = gpu_count > 0 && sched_max_sessions > 0 && sessions[gpu_id] > sched_max_sessions;
+    ffh5_mutex_unlock(&sched_lock);
+
+    return over;
+}
+
+/*
+ * Function:  ffmpeg_h5_set_gpu_schedule
+ * --------------------
+ * replace the gpu schedule, see ffmpeg_h5filter.h
+ *
+ *  gpu_ids: gpus to spread chunks over
+ *  n_gpus: number of gpus, 0 disables scheduling
+ *  policy: FFH5_SCHED_ROUND_ROBIN or FFH5_SCHED_LEAST_LOADED
+ *  max_sessions: NVENC sessions per gpu, 0 for no cap
+ *  cpu_fallback: encode on the CPU instead of waiting for a session
+ *
+ *  return: negative value (invalid arguments), otherwise success
+ *
+ */
+int ffmpeg_h5_set_gpu_schedule(const unsigned int gpu_ids[], int n_gpus, int policy,
+                               int max_sessions, int cpu_fallback)
+{
+    int i;
+
+    if (n_gpus < 0 || n_gpus > FFH5_SCHED_MAX_GPUS || (n_gpus > 0 && !gpu_ids) || max_sessions < 0 ||
+        (policy != FFH5_SCHED_ROUND_ROBIN && policy != FFH5_SCHED_LEAST_LOADED))
+        return -1;
+    for (i = 0; i < n_gpus; i++)
+        if (gpu_ids[i] >= FFH5_SCHED_MAX_GPU_ID)
+            return -1;
+
+    /* the environment only provides the initial schedule */
+    ffh5_once(&sched_once, sched_init);
+
+    ffh5_mutex_lock(&sched_lock);
+    set_schedule(gpu_ids, n_gpus, policy, max_sessions, cpu_fallback != 0);
+    ffh5_mutex_unlock(&sched_lock);
+
+    return 0;
+}
+
+int ffmpeg_h5_get_gpu_stats(FFH5GpuStats stats[], int max, unsigned long long *cpu_fallback_count)
+{
+    int i;
+
+    ffh5_once(&sched_once, sched_init);
+
+    ffh5_mutex_lock(&sched_lock);
+    for (i = 0; i < gpu_count && i < max; i++)
+    {
+        stats[i].gpu_id = gpus[i].gpu_id;
+        stats[i].active_encoders = gpus[i].encoders;
+        stats[i].active_decoders = gpus[i].decoders;
+        stats[i].sessions = sessions[gpus[i].gpu_id];
+        stats[i].chunks = gpus[i].chunks;
+    }
+    if (cpu_fallback_count)
+        *cpu_fallback_count = cpu_fallbacks;
+    i = gpu_count;
+    ffh5_mutex_unlock(&sched_lock);
+
+    return i;
+}
@@ -0,0 +1,45 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Process wide assignment of NVENC/CUVID chunks to gpus, see
+ * ffmpeg_h5_set_gpu_schedule.
+ *
+ */
+
+#ifndef FFMPEG_SCHED_H
+#define FFMPEG_SCHED_H
+
+#include "ffmpeg_utils.h"
+
+/* gpus a schedule can hold */
+#define FFH5_SCHED_MAX_GPUS 16
+/* highest gpu_id whose NVENC sessions are counted */
+#define FFH5_SCHED_MAX_GPU_ID 64
+/* slot of a chunk that is not scheduled */
+#define FFH5_SCHED_NONE -1
+
+/*
+ * Copy cd_values into params (FFH5_MAX_CD_VALUES entries, missing ones
+ * zero) and rewrite its gpu_id, or its encoder/decoder id on CPU
+ * fallback.  Returns the slot to release, FFH5_SCHED_NONE when the chunk
+ * was not placed on a gpu.
+ */
+int ffh5_sched_acquire(int is_encoder, size_t cd_nelmts, const unsigned int cd_values[],
+                       unsigned int params[]);
+
+void ffh5_sched_release(int is_encoder, int slot);
+
+/*
+ * Rewrite the NVENC encoder of params to the software encoder of the
+ * same format when the schedule allows CPU fallback.  Returns 0 when it
+ * does not or there is no such encoder (e.g. lossless tunes).
+ */
+int ffh5_sched_fallback(unsigned int params[]);
+
+/* NVENC session opened (delta 1) or closed (delta -1) on gpu_id */
+void ffh5_sched_session(unsigned int gpu_id, int delta);
+
+/* Non-zero when gpu_id holds more NVENC sessions than the schedule allows */
+int ffh5_sched_sessions_over(unsigned int gpu_id);
+
+#endif // FFMPEG_SCHED_H
@@ -0,0 +1,428 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Hot path instrumentation.
+ *
+ * Every thread that runs a probe while statistics are on gets its own
+ * counters, so probes never contend; ffmpeg_h5_get_stats sums the live
+ * threads and those that already exited.  Trace events are appended
+ * under a global lock, tracing is a diagnostic mode and may slow down
+ * heavily threaded runs somewhat.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ffmpeg_stats.h"
+#include "ffmpeg_thread.h"
+
+#ifdef _WIN32
+#define stats_getpid() ((int)GetCurrentProcessId())
+#else
+#include <time.h>
+#include <unistd.h>
+#define stats_getpid() ((int)getpid())
+#endif
+
+/* per thread cap of trace events, about 24 MB */
+#define FFH5_TRACE_MAX_EVENTS (1u << 20)
+
+typedef struct TraceEvent
+{
+    uint64_t start;
+    uint64_t dur;
+    uint32_t stage;
+    uint32_t tid;
+} TraceEvent;
+
+typedef struct TraceBuffer
+{
+    TraceEvent *events;
+    size_t count;
+    size_t capacity;
+} TraceBuffer;
+
+typedef struct StatsThread
+{
+    FFH5Stats stats;
+    unsigned int tid;
+    TraceBuffer trace; /* guarded by stats_lock */
+    struct StatsThread *next;
+} StatsThread;
+
+volatile int ffh5_stats_state = -1;
+
+static ffh5_once_t stats_once = FFH5_ONCE_INIT;
+static ffh5_tls_key_t stats_key;
+static int stats_key_valid = 0;
+static volatile int trace_on = 0;
+static char *trace_path = NULL; /* H5FFMPEG_TRACE, written at exit */
+static uint64_t trace_origin = 0;
+
+static ffh5_mutex_t stats_lock = FFH5_MUTEX_INIT;
+static StatsThread *threads = NULL;
+static FFH5Stats retired;
+static TraceBuffer retired_trace;
+static unsigned int next_tid = 0;
+
+static const char *stage_names[FFH5_STAGE_COUNT] = {
+    "encode_chunk", "decode_chunk", "codec_open", "parse", "send",
+    "receive", "convert", "copy", "h5_filter",
+};
+
+uint64_t ffh5_now_ns(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ULL +
+           (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ULL / (uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* every field of FFH5Stats is an unsigned long long */
+static void add_stats(FFH5Stats *dst, const FFH5Stats *src)
+{
+    unsigned long long *d = (unsigned long long *)dst;
+    const unsigned long long *s = (const unsigned long long *)src;
+    size_t i;
+
+    for (i = 0; i < sizeof(FFH5Stats) / sizeof(unsigned long long); i++)
+        d[i] += s[i];
+}
+
+/* stats_lock must be held */
+static int trace_append(TraceBuffer *trace, const TraceEvent *events, size_t n, size_t limit)
+{
+    if (trace->count + n > trace->capacity)
+    {
+        size_t capacity = trace->capacity ? trace->capacity : 4096;
+        TraceEvent *grown;
+
+        while (capacity < trace->count + n)
+            capacity *= 2;
+        if (capacity > limit)
+            capacity = limit;
+        if (trace->count + n > capacity)
+            return -1;
+
+        grown = realloc(trace->events, capacity * sizeof(TraceEvent));
+        if (!grown)
+            return -1;
+        trace->events = grown;
+        trace->capacity = capacity;
+    }
+
+    memcpy(trace->events + trace->count, events, n * sizeof(TraceEvent));
+    trace->count += n;
+    return 0;
+}
+
+static void FFH5_TLS_CALLBACK stats_thread_exit(void *value)
+{
+    StatsThread *t = (StatsThread *)value, **link;
+
+    ffh5_mutex_lock(&stats_lock);
+    for (link = &threads; *link; link = &(*link)->next)
+    {
+        if (*link == t)
+        {
+            *link = t->next;
+            break;
+        }
+    }
+    add_stats(&retired, &t->stats);
+    /* keep the events of short lived threads for the trace */
+    if (t->trace.count > 0 &&
+        trace_append(&retired_trace, t->trace.events, t->trace.count, (size_t)-1) < 0)
+        retired.trace_dropped += t->trace.count;
+    ffh5_mutex_unlock(&stats_lock);
+
+    free(t->trace.events);
+    free(t);
+}
+
+static void stats_shutdown(void)
+{
+    if (trace_path)
+        ffmpeg_h5_write_trace(trace_path);
+
+    if (!stats_key_valid)
+        return;
+    stats_key_valid = 0;
+    ffh5_stats_state = 0;
+    ffh5_tls_delete(stats_key);
+}
+
+static void stats_init(void)
+{
+    const char *env;
+    int enabled = 0;
+
+    env = getenv("H5FFMPEG_STATS");
+    if (env && (strcmp(env, "1") == 0 || strcmp(env, "on") == 0 || strcmp(env, "true") == 0))
+        enabled = 1;
+
+    env = getenv("H5FFMPEG_TRACE");
+    if (env && *env)
+    {
+        trace_path = malloc(strlen(env) + 1);
+        if (trace_path)
+        {
+            strcpy(trace_path, env);
+            trace_on = 1;
+            enabled = 1;
+        }
+    }
+
+    trace_origin = ffh5_now_ns();
+
+    if (ffh5_tls_create(&stats_key, stats_thread_exit) == 0)
+    {
+        stats_key_valid = 1;
+        atexit(stats_shutdown);
+    }
+    else
+        enabled = 0;
+
+    ffh5_stats_state = enabled;
+}
+
+/*
+ * Function:  ffh5_stats_init
+ * --------------------
+ * read H5FFMPEG_STATS / H5FFMPEG_TRACE on first use
+ *
+ *  return: 1 when statistics are on, 0 otherwise
+ *
+ */
+int ffh5_stats_init(void)
+{
+    ffh5_once(&stats_once, stats_init);
+    return ffh5_stats_state > 0;
+}
+
+FFH5Stats *ffh5_stats_local(void)
+{
+    StatsThread *t;
+
+    if (!stats_key_valid)
+        return NULL;
+
+    t = (StatsThread *)ffh5_tls_get(stats_key);
+    if (t)
+        return &t->stats;
+
+    t = calloc(1, sizeof(StatsThread));
+    if (!t)
+        return NULL;
+    if (ffh5_tls_set(stats_key, t) != 0)
+    {
+        free(t);
+        return NULL;
+    }
+
+    ffh5_mutex_lock(&stats_lock);
+    t->tid = ++next_tid;
+    t->next = threads;
+    threads = t;
+    ffh5_mutex_unlock(&stats_lock);
+
+    return &t->stats;
+}
+
+/*
+ * Function:  ffh5_stats_stage
+ * --------------------
+ * account one run of a stage to the calling thread and record it as a
+ * trace event when tracing
+ *
+ *  stage: FFH5_STAGE_*
+ *  start: ffh5_now_ns() when the stage began
+ *
+ */
+void ffh5_stats_stage(int stage, uint64_t start)
+{
+    uint64_t end = ffh5_now_ns();
+    FFH5Stats *s = ffh5_stats_local();
+    StatsThread *t;
+    TraceEvent event;
+
+    if (!s)
+        return;
+    s->stages[stage].calls++;
+    s->stages[stage].ns += end - start;
+
+    if (!trace_on)
+        return;
+
+    /* stats is the first member */
+    t = (StatsThread *)s;
+    event.start = start;
+    event.dur = end - start;
+    event.stage = (uint32_t)stage;
+    event.tid = t->tid;
+
+    ffh5_mutex_lock(&stats_lock);
+    if (trace_append(&t->trace, &event, 1, FFH5_TRACE_MAX_EVENTS) < 0)
+        s->trace_dropped++;
+    ffh5_mutex_unlock(&stats_lock);
+}
+
+void ffh5_stats_chunk(int stage, uint64_t start, size_t in_size, size_t out_size)
+{
+    FFH5Stats *s;
+
+    ffh5_stats_stage(stage, start);
+    if (out_size == 0 || !(s = ffh5_stats_local()))
+        return;
+
+    if (stage == FFH5_STAGE_ENCODE_CHUNK)
+    {
+        s->chunks_encoded++;
+        s->encode_bytes_in += in_size;
+        s->encode_bytes_out += out_size;
+    }
+    else
+    {
+        s->chunks_decoded++;
+        s->decode_bytes_in += in_size;
+        s->decode_bytes_out += out_size;
+    }
+}
+
+/*
+ * Function:  ffmpeg_h5_set_stats
+ * --------------------
+ * turn statistics (and trace events) on or off
+ *
+ *  enabled: collect statistics
+ *  trace: also record trace events (needs enabled)
+ *
+ *  return: 1 when statistics were on before, 0 otherwise
+ *
+ */
+int ffmpeg_h5_set_stats(int enabled, int trace)
+{
+    int previous = ffh5_stats_init();
+
+    if (!stats_key_valid)
+        return previous;
+
+    trace_on = enabled && trace;
+    ffh5_stats_state = enabled ? 1 : 0;
+    return previous;
+}
+
+/*
+ * Function:  ffmpeg_h5_get_stats
+ * --------------------
+ * sum the counters of every thread, including those that exited
+ *
+ *  stats: filled in
+ *
+ */
+void ffmpeg_h5_get_stats(FFH5Stats *stats)
+{
+    StatsThread *t;
+
+    ffh5_stats_init();
+
+    ffh5_mutex_lock(&stats_lock);
+    *stats = retired;
+    for (t = threads; t; t = t->next)
+        add_stats(stats, &t->stats);
+    ffh5_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Function:  ffmpeg_h5_reset_stats
+ * --------------------
+ * zero all counters and drop the trace events recorded so far
+ *
+ */
+void ffmpeg_h5_reset_stats(void)
+{
+    StatsThread *t;
+
+    ffh5_stats_init();
+
+    ffh5_mutex_lock(&stats_lock);
+    memset(&retired, 0, sizeof(retired));
+    retired_trace.count = 0;
+    for (t = threads; t; t = t->next)
+    {
+        memset(&t->stats, 0, sizeof(t->stats));
+        t->trace.count = 0;
+    }
+    trace_origin = ffh5_now_ns();
+    ffh5_mutex_unlock(&stats_lock);
+}
+
+const char *ffmpeg_h5_stage_name(int stage)
+{
+    if (stage < 0 || stage >= FFH5_STAGE_COUNT)
+        return NULL;
+    return stage_names[stage];
+}
+
+static void write_events(FILE *f, const TraceBuffer *trace, int pid, int *first)
+{
+    size_t i;
+
+    for (i = 0; i < trace->count; i++)
+    {
+        const TraceEvent *e = &trace->events[i];
+        double ts = ((double)e->start - (double)trace_origin) / 1000.0;
+
+        fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"h5ffmpeg\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+                   "\"ts\":%.3f,\"dur\":%.3f}",
+                *first ? "" : ",", stage_names[e->stage], pid, e->tid, ts, (double)e->dur / 1000.0);
+        *first = 0;
+    }
+}
+
+/*
+ * Function:  ffmpeg_h5_write_trace
+ * --------------------
+ * write the trace events recorded so far as Chrome trace-event JSON
+ *
+ *  path: output file
+ *
+ *  return: 0 on success, -1 when the file cannot be written
+ *
+ */
+int ffmpeg_h5_write_trace(const char *path)
+{
+    FILE *f;
+    StatsThread *t;
+    int pid = stats_getpid(), first = 1, ret;
+
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+
+    ffh5_mutex_lock(&stats_lock);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    write_events(f, &retired_trace, pid, &first);
+    for (t = threads; t; t = t->next)
+        write_events(f, &t->trace, pid, &first);
+    fprintf(f, "\n]}\n");
+    ffh5_mutex_unlock(&stats_lock);
+
+    ret = ferror(f) ? -1 : 0;
+    if (fclose(f) != 0)
+        ret = -1;
+    return ret;
+}
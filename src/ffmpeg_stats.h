@@ -0,0 +1,60 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Per-thread hot path counters and stage timers, see ffmpeg_h5_set_stats.
+ * Probes cost a load and a branch while statistics are off.
+ *
+ */
+
+#ifndef FFMPEG_STATS_H
+#define FFMPEG_STATS_H
+
+#include <stdint.h>
+
+#include "ffmpeg_h5filter.h"
+
+/* -1 until H5FFMPEG_STATS has been read, then 0 (off) or 1 (on) */
+extern volatile int ffh5_stats_state;
+
+int ffh5_stats_init(void);
+
+static inline int ffh5_stats_on(void)
+{
+    int state = ffh5_stats_state;
+    return state > 0 || (state < 0 && ffh5_stats_init() > 0);
+}
+
+/* monotonic clock in nanoseconds */
+uint64_t ffh5_now_ns(void);
+
+/* counters of the calling thread, NULL when out of memory */
+FFH5Stats *ffh5_stats_local(void);
+
+/* account stage from start (ffh5_now_ns) to now */
+void ffh5_stats_stage(int stage, uint64_t start);
+
+/* account a chunk of stage FFH5_STAGE_ENCODE/DECODE_CHUNK; out_size 0 means it failed */
+void ffh5_stats_chunk(int stage, uint64_t start, size_t in_size, size_t out_size);
+
+/* start of a timed stage, 0 while statistics are off */
+#define FFH5_STATS_BEGIN() (ffh5_stats_on() ? ffh5_now_ns() : 0)
+
+#define FFH5_STATS_END(stage, start)            \
+    do                                          \
+    {                                           \
+        if (start)                              \
+            ffh5_stats_stage((stage), (start)); \
+    } while (0)
+
+#define FFH5_STATS_ADD(field, n)                    \
+    do                                              \
+    {                                               \
+        if (ffh5_stats_on())                        \
+        {                                           \
+            FFH5Stats *ffh5_s = ffh5_stats_local(); \
+            if (ffh5_s)                             \
+                ffh5_s->field += (n);               \
+        }                                           \
+    } while (0)
+
+#endif // FFMPEG_STATS_H
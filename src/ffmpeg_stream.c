@@ -0,0 +1,702 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Streaming encoder and decoder.
+ *
+ * The chunk API needs the whole volume in memory, plus its bitstream.
+ * Here one cached encoder context is held for the lifetime of a stream
+ * and fed frame by frame with the same conversion and encode() helper
+ * as ffmpeg_encode_chunk; the sink only holds the packets produced
+ * since the last pull.  The decoder writes frames to the caller's
+ * memory as decode() produces them, or hands them out one by one.
+ *
+ */
+
+#include "ffmpeg_utils.h"
+#include "ffmpeg_codec.h"
+#include "ffmpeg_cache.h"
+#include "ffmpeg_ratio.h"
+#include "ffmpeg_caps.h"
+#include "ffmpeg_sched.h"
+#include "ffmpeg_stats.h"
+
+#include <limits.h>
+
+struct FFH5Encoder
+{
+    unsigned int params[FFH5_MAX_CD_VALUES];
+    unsigned int coded[FFH5_MAX_CD_VALUES]; /* params at the coded frame size */
+    size_t cd_nelmts;
+    FFH5CodecEntry *entry;
+    int slot; /* gpu schedule slot */
+    size_t frame_size;
+    int linesize;
+    uint8_t *pad; /* one coded frame when frames are padded */
+    unsigned long long frames;
+    FFH5Sink sink;
+    size_t pulled; /* bytes handed out before sink.data */
+    FFH5KeyIndex keys;
+    FFH5KeyIndex *p_keys;
+    FFH5PacketIndex packets;
+    FFH5PacketIndex *p_packets;
+    int finished;
+    int failed;
+};
+
+/* acquire at the coded size, frames are padded by push when it differs */
+static FFH5CodecEntry *acquire_encoder(FFH5Encoder *enc)
+{
+    if (ffh5_coded_params(enc->cd_nelmts, enc->params, enc->coded))
+        return ffh5_acquire_encoder(enc->cd_nelmts, enc->coded, raise_ffmpeg_error);
+    return ffh5_acquire_encoder(enc->cd_nelmts, enc->params, raise_ffmpeg_error);
+}
+
+/*
+ * Function:  ffmpeg_h5_encoder_open
+ * --------------------
+ * acquire an encoder context for a stream of frames
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters, cd_values[4] is ignored
+ *
+ *  return: encoder, NULL on failure
+ *
+ */
+FFH5Encoder *ffmpeg_h5_encoder_open(size_t cd_nelmts, const unsigned int cd_values[])
+{
+    FFH5Encoder *enc;
+
+    if (cd_nelmts < FFH5_CD_NELMTS)
+    {
+        raise_ffmpeg_error("Not enough auxiliary parameters\n");
+        return NULL;
+    }
+    if (!ffh5_bit_mode_supported(cd_values[0], cd_values[5]))
+    {
+        raise_ffmpeg_error("Bit mode not supported by the encoder\n");
+        return NULL;
+    }
+
+    enc = calloc(1, sizeof(FFH5Encoder));
+    if (!enc)
+    {
+        raise_ffmpeg_error("Out of memory occurred during encoding\n");
+        return NULL;
+    }
+    enc->cd_nelmts = (cd_nelmts < FFH5_MAX_CD_VALUES) ? cd_nelmts : FFH5_MAX_CD_VALUES;
+    enc->slot = ffh5_sched_acquire(1, cd_nelmts, cd_values, enc->params);
+
+    enc->entry = acquire_encoder(enc);
+    if (!enc->entry && enc->slot != FFH5_SCHED_NONE && ffh5_sched_fallback(enc->params))
+        enc->entry = acquire_encoder(enc);
+    if (!enc->entry)
+        goto Failure;
+
+    enc->linesize = (enc->params[5] == 0) ? (int)enc->params[2] : (int)enc->params[2] * 2;
+    enc->frame_size = (size_t)enc->linesize * enc->params[3];
+    enc->sink.grow = ffh5_sink_realloc;
+
+    if (enc->coded[2] != enc->params[2] || enc->coded[3] != enc->params[3])
+    {
+        enc->pad = malloc((size_t)enc->coded[2] * enc->coded[3] * ((enc->params[5] == 0) ? 1 : 2));
+        if (!enc->pad)
+        {
+            raise_ffmpeg_error("Out of memory occurred during encoding\n");
+            goto Failure;
+        }
+    }
+
+    if ((enc->cd_nelmts > FFH5_CD_GOP_SIZE && enc->params[FFH5_CD_GOP_SIZE] > 0) ||
+        ffh5_intra_only(enc->params[0]))
+        enc->p_keys = &enc->keys;
+    if (ffh5_packet_index_wanted(enc->cd_nelmts, enc->params))
+        enc->p_packets = &enc->packets;
+
+    return enc;
+
+Failure:
+    ffmpeg_h5_encoder_close(enc);
+    return NULL;
+}
+
+/* grow the keyframe table so that n more frames cannot overflow it */
+static int reserve_keys(FFH5Encoder *enc, size_t n)
+{
+    FFH5KeyIndex *keys = &enc->keys;
+    size_t capacity = keys->capacity ? keys->capacity : 64;
+    uint32_t *frames;
+    size_t *offsets;
+
+    while (capacity < enc->frames + n)
+        capacity *= 2;
+    if (capacity == keys->capacity)
+        return 0;
+
+    frames = realloc(keys->frames, capacity * sizeof(uint32_t));
+    if (!frames)
+        return -1;
+    keys->frames = frames;
+    offsets = realloc(keys->offsets, capacity * sizeof(size_t));
+    if (!offsets)
+        return -1;
+    keys->offsets = offsets;
+    keys->capacity = capacity;
+    return 0;
+}
+
+/* keyframes record sink offsets, make the ones added since first absolute */
+static void rebase_keys(FFH5Encoder *enc, size_t first)
+{
+    size_t i;
+
+    for (i = first; i < enc->keys.count; i++)
+        enc->keys.offsets[i] += enc->pulled;
+}
+
+/*
+ * Function:  ffmpeg_h5_encoder_push
+ * --------------------
+ * encode n_frames consecutive gray frames
+ *
+ *  *enc: encoder
+ *  *frames: n_frames x height x width samples
+ *  n_frames: number of frames
+ *
+ *  return: negative value (failed), otherwise success
+ *
+ */
+int ffmpeg_h5_encoder_push(FFH5Encoder *enc, const void *frames, size_t n_frames)
+{
+    const uint8_t *p_data = (const uint8_t *)frames;
+    size_t i, first = enc->keys.count;
+
+    if (enc->failed || enc->finished)
+    {
+        raise_ffmpeg_error("Encoder is finished or failed\n");
+        return -1;
+    }
+
+    if (enc->p_keys && reserve_keys(enc, n_frames) < 0)
+    {
+        raise_ffmpeg_error("Out of memory occurred during encoding\n");
+        goto Failure;
+    }
+
+    for (i = 0; i < n_frames; i++)
+    {
+        int bytes = (enc->params[5] == 0) ? 1 : 2;
+
+        if (enc->pad)
+        {
+            ffh5_pad_frame(p_data, enc->linesize, enc->params[2], enc->params[3], bytes,
+                           enc->pad, enc->coded[2], enc->coded[3]);
+            if (ffh5_encode_frame(enc->entry, enc->pad, (int)enc->coded[2] * bytes, NULL, (int64_t)enc->frames,
+                                  &enc->sink, enc->p_keys, enc->p_packets, raise_ffmpeg_error) < 0)
+                goto Failure;
+        }
+        /* the caller may reuse frames once we return, so no in-place luma */
+        else if (ffh5_encode_frame(enc->entry, p_data, enc->linesize, NULL, (int64_t)enc->frames, &enc->sink,
+                                   enc->p_keys, enc->p_packets, raise_ffmpeg_error) < 0)
+            goto Failure;
+        p_data += enc->frame_size;
+        enc->frames++;
+    }
+
+    rebase_keys(enc, first);
+    return 0;
+
+Failure:
+    enc->failed = 1;
+    return -1;
+}
+
+const unsigned char *ffmpeg_h5_encoder_pull(FFH5Encoder *enc, size_t *size)
+{
+    *size = enc->sink.size;
+    if (enc->sink.size == 0)
+        return NULL;
+
+    /* the bytes stay in place until the sink is written again */
+    enc->pulled += enc->sink.size;
+    enc->sink.size = 0;
+    return enc->sink.data;
+}
+
+/*
+ * Function:  ffmpeg_h5_encoder_finish
+ * --------------------
+ * flush the codec and append the keyframe table, if any
+ *
+ *  return: negative value (failed), otherwise success
+ *
+ */
+int ffmpeg_h5_encoder_finish(FFH5Encoder *enc)
+{
+    FFH5CodecEntry *entry = enc->entry;
+    size_t first = enc->keys.count, total;
+
+    if (enc->failed || enc->finished)
+    {
+        raise_ffmpeg_error("Encoder is finished or failed\n");
+        return -1;
+    }
+    enc->finished = 1;
+
+    if (encode(entry->c, NULL, entry->pkt, &enc->sink, enc->p_keys, enc->p_packets) < 0)
+        goto Failure;
+    rebase_keys(enc, first);
+    if (entry->hw || entry->pixconv != FFH5_PIXCONV_NONE)
+        av_frame_unref(entry->dst_frame);
+
+    total = enc->pulled + enc->sink.size;
+    if (total == 0)
+    {
+        raise_ffmpeg_error("Encoder produced no data\n");
+        goto Failure;
+    }
+
+    if (enc->p_packets && ffh5_write_packet_index(&enc->sink, enc->p_packets, enc->frames) < 0)
+    {
+        raise_ffmpeg_error("Out of memory occurred during encoding\n");
+        goto Failure;
+    }
+
+    if (enc->pad && ffh5_write_pad_record(&enc->sink, enc->coded[2], enc->coded[3]) < 0)
+    {
+        raise_ffmpeg_error("Out of memory occurred during encoding\n");
+        goto Failure;
+    }
+
+    /* offsets are absolute already, the stream starts at 0 */
+    if (enc->p_keys && enc->keys.count > 0 && ffh5_write_key_index(&enc->sink, &enc->keys, 0) < 0)
+    {
+        raise_ffmpeg_error("Out of memory occurred during encoding\n");
+        goto Failure;
+    }
+
+    ffh5_ratio_observe(enc->params, enc->frames * enc->frame_size, total, 0, 0);
+    return 0;
+
+Failure:
+    enc->failed = 1;
+    return -1;
+}
+
+unsigned long long ffmpeg_h5_encoder_frames(const FFH5Encoder *enc)
+{
+    return enc->frames;
+}
+
+void ffmpeg_h5_encoder_close(FFH5Encoder *enc)
+{
+    if (!enc)
+        return;
+
+    /* contexts that were not drained cleanly are not cached */
+    ffh5_release_context(enc->entry, enc->finished && !enc->failed);
+    ffh5_sched_release(1, enc->slot);
+    free(enc->sink.data);
+    free(enc->pad);
+    free(enc->keys.frames);
+    free(enc->keys.offsets);
+    free(enc->packets.sizes);
+    free(enc->packets.flags);
+    free(enc);
+}
+
+struct FFH5Decoder
+{
+    unsigned int params[FFH5_MAX_CD_VALUES];
+    size_t cd_nelmts;
+    FFH5CodecEntry *entry;
+    int slot; /* gpu schedule slot */
+    size_t frame_size;
+    unsigned int depth;
+    unsigned long long frames;
+    FFH5Sink out; /* caller memory, or scratch frames with a callback */
+    size_t delivered; /* bytes of out handed to the callback */
+    FFH5FrameCallback callback;
+    void *opaque;
+    uint8_t *held; /* tail that may turn out to be the padding record and keyframe table */
+    size_t held_size;
+    size_t held_capacity;
+    size_t hold;
+    size_t fed; /* bytes passed to the parser */
+    int finished;
+    int failed;
+};
+
+/*
+ * Function:  ffmpeg_h5_decoder_open
+ * --------------------
+ * acquire a decoder context for a chunk pushed in pieces
+ *
+ *  cd_nelmts: number of auxiliary parameters
+ *  cd_values: auxiliary parameters, cd_values[4] frames are expected
+ *  *out: destination of the frames, NULL to only use callback
+ *  out_size: size of out
+ *  callback: called for every decoded frame, may be NULL when out is set
+ *  *opaque: passed to callback
+ *
+ *  return: decoder, NULL on failure
+ *
+ */
+FFH5Decoder *ffmpeg_h5_decoder_open(size_t cd_nelmts, const unsigned int cd_values[],
+                                    void *out, size_t out_size,
+                                    FFH5FrameCallback callback, void *opaque)
+{
+    FFH5Decoder *dec;
+
+    if (cd_nelmts < FFH5_CD_NELMTS)
+    {
+        raise_ffmpeg_error("Not enough auxiliary parameters\n");
+        return NULL;
+    }
+    if (cd_values[4] == 0 || (!out && !callback))
+    {
+        raise_ffmpeg_error("Decoder needs a depth and a destination\n");
+        return NULL;
+    }
+
+    dec = calloc(1, sizeof(FFH5Decoder));
+    if (!dec)
+    {
+        raise_ffmpeg_error("Out of memory occurred during decoding\n");
+        return NULL;
+    }
+    dec->cd_nelmts = (cd_nelmts < FFH5_MAX_CD_VALUES) ? cd_nelmts : FFH5_MAX_CD_VALUES;
+    dec->slot = ffh5_sched_acquire(0, cd_nelmts, cd_values, dec->params);
+    if (dec->slot == FFH5_SCHED_NONE)
+        ffh5_caps_decoder(dec->params);
+
+    dec->entry = ffh5_acquire_decoder(dec->cd_nelmts, dec->params, raise_ffmpeg_error);
+    if (!dec->entry)
+        goto Failure;
+
+    dec->depth = dec->params[4];
+    dec->frame_size = (size_t)dec->params[2] * dec->params[3] * ((dec->params[5] == 0) ? 1 : 2);
+    dec->callback = callback;
+    dec->opaque = opaque;
+    if (out)
+    {
+        dec->out.data = out;
+        dec->out.capacity = out_size;
+    }
+    else
+        dec->out.grow = ffh5_sink_realloc;
+
+    /* the largest trailer a chunk of depth frames can carry */
+    dec->hold = (size_t)dec->depth * FFH5_KEY_INDEX_ENTRY_SIZE + FFH5_KEY_INDEX_FOOTER_SIZE +
+                FFH5_PAD_RECORD_SIZE +
+                (size_t)dec->depth * FFH5_PACKET_INDEX_ENTRY_SIZE + FFH5_PACKET_INDEX_FOOTER_SIZE;
+    dec->held_capacity = dec->hold;
+    dec->held = malloc(dec->held_capacity);
+    if (!dec->held)
+    {
+        raise_ffmpeg_error("Out of memory occurred during decoding\n");
+        goto Failure;
+    }
+
+    return dec;
+
+Failure:
+    ffmpeg_h5_decoder_close(dec);
+    return NULL;
+}
+
+/* hand the frames decode() added to out to the callback */
+static int deliver_frames(FFH5Decoder *dec)
+{
+    while (dec->delivered + dec->frame_size <= dec->out.size)
+    {
+        if (dec->callback &&
+            dec->callback(dec->opaque, dec->frames, dec->out.data + dec->delivered, dec->frame_size) < 0)
+        {
+            raise_ffmpeg_error("Frame callback stopped decoding\n");
+            return -1;
+        }
+        dec->delivered += dec->frame_size;
+        dec->frames++;
+    }
+
+    /* scratch frames are not kept once handed out */
+    if (dec->out.grow)
+    {
+        dec->out.size = 0;
+        dec->delivered = 0;
+    }
+    return 0;
+}
+
+static int decode_packet(FFH5Decoder *dec, AVPacket *pkt)
+{
+    FFH5CodecEntry *entry = dec->entry;
+
+    if (decode(entry->c, entry->src_frame, pkt, entry->pixconv, &entry->sws_context, entry->dst_frame,
+               &dec->out, dec->frame_size, NULL) < 0)
+        return -1;
+    return deliver_frames(dec);
+}
+
+/* parse bitstream bytes into packets and decode them */
+static int feed_parser(FFH5Decoder *dec, const uint8_t *data, size_t size)
+{
+    FFH5CodecEntry *entry = dec->entry;
+    AVPacket *pkt = entry->pkt;
+    int ret;
+
+    dec->fed += size;
+    while (size > 0)
+    {
+        uint64_t t0 = FFH5_STATS_BEGIN();
+
+        ret = av_parser_parse2(entry->parser, entry->c, &pkt->data, &pkt->size,
+                               data, (size > INT_MAX) ? INT_MAX : (int)size,
+                               AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        FFH5_STATS_END(FFH5_STAGE_PARSE, t0);
+        if (ret < 0)
+        {
+            raise_ffmpeg_error("Packet not readable\n");
+            return -1;
+        }
+        data += ret;
+        size -= ret;
+
+        if (pkt->size && decode_packet(dec, pkt) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* make room for size held bytes, doubling */
+static int grow_held(FFH5Decoder *dec, size_t size)
+{
+    size_t capacity = dec->held_capacity * 2;
+    uint8_t *held;
+
+    if (capacity < size)
+        capacity = size;
+    held = realloc(dec->held, capacity);
+    if (!held)
+    {
+        raise_ffmpeg_error("Out of memory occurred during decoding\n");
+        return -1;
+    }
+    dec->held = held;
+    dec->held_capacity = capacity;
+    return 0;
+}
+
+/* decode the packets listed by the packet table of a chunk held whole */
+static int feed_packets(FFH5Decoder *dec, const uint8_t *packets, size_t n_packets)
+{
+    AVPacket *pkt = dec->entry->pkt;
+    const uint8_t *data = dec->held;
+    uint32_t packet_size, packet_flags;
+    size_t i;
+
+    for (i = 0; i < n_packets; i++)
+    {
+        memcpy(&packet_size, packets + i * FFH5_PACKET_INDEX_ENTRY_SIZE, 4);
+        memcpy(&packet_flags, packets + i * FFH5_PACKET_INDEX_ENTRY_SIZE + 4, 4);
+        pkt->data = (uint8_t *)data;
+        pkt->size = (int)packet_size;
+        pkt->flags = (int)(packet_flags & AV_PKT_FLAG_KEY);
+        if (decode_packet(dec, pkt) < 0)
+            return -1;
+        data += packet_size;
+    }
+    pkt->flags = 0;
+    return 0;
+}
+
+/*
+ * Function:  ffmpeg_h5_decoder_push
+ * --------------------
+ * decode the next size bytes of the chunk
+ *
+ *  *dec: decoder
+ *  *data: compressed bytes
+ *  size: number of bytes
+ *
+ *  return: negative value (failed), otherwise success
+ *
+ */
+int ffmpeg_h5_decoder_push(FFH5Decoder *dec, const void *data, size_t size)
+{
+    const uint8_t *p_data = (const uint8_t *)data;
+    size_t feed, from_held;
+
+    if (dec->failed || dec->finished)
+    {
+        raise_ffmpeg_error("Decoder is finished or failed\n");
+        return -1;
+    }
+
+    /* codecs without a parser (FFV1) need the packet table at the very end */
+    if (!dec->entry->parser)
+    {
+        if (dec->held_size + size > dec->held_capacity && grow_held(dec, dec->held_size + size) < 0)
+            goto Failure;
+        memcpy(dec->held + dec->held_size, p_data, size);
+        dec->held_size += size;
+        return 0;
+    }
+
+    /* the last hold bytes are kept back until finish tells whether they are a trailer */
+    if (dec->held_size + size > dec->hold)
+    {
+        feed = dec->held_size + size - dec->hold;
+        from_held = (feed < dec->held_size) ? feed : dec->held_size;
+
+        if (feed_parser(dec, dec->held, from_held) < 0 ||
+            feed_parser(dec, p_data, feed - from_held) < 0)
+            goto Failure;
+
+        memmove(dec->held, dec->held + from_held, dec->held_size - from_held);
+        dec->held_size -= from_held;
+        p_data += feed - from_held;
+        size -= feed - from_held;
+    }
+
+    memcpy(dec->held + dec->held_size, p_data, size);
+    dec->held_size += size;
+    return 0;
+
+Failure:
+    dec->failed = 1;
+    return -1;
+}
+
+/* size of the keyframe table at the end of the held bytes, 0 without one */
+static size_t held_key_index_size(const FFH5Decoder *dec)
+{
+    const uint8_t *footer, *entry;
+    uint32_t count, version, frame, prev_frame = 0;
+    uint64_t offset, prev_offset = 0;
+    size_t table_size, bitstream_size, i;
+
+    if (dec->held_size < FFH5_KEY_INDEX_FOOTER_SIZE)
+        return 0;
+
+    footer = dec->held + dec->held_size - FFH5_KEY_INDEX_FOOTER_SIZE;
+    if (memcmp(footer + 8, FFH5_KEY_INDEX_MAGIC, 8) != 0)
+        return 0;
+
+    memcpy(&count, footer, 4);
+    memcpy(&version, footer + 4, 4);
+    if (version != FFH5_KEY_INDEX_VERSION || count == 0 || count > dec->depth)
+        return 0;
+
+    table_size = (size_t)count * FFH5_KEY_INDEX_ENTRY_SIZE + FFH5_KEY_INDEX_FOOTER_SIZE;
+    if (table_size > dec->held_size)
+        return 0;
+    bitstream_size = dec->fed + dec->held_size - table_size;
+
+    /* same checks as ffmpeg_decode_chunk_range, offsets count from the first byte pushed */
+    entry = dec->held + dec->held_size - table_size;
+    for (i = 0; i < count; i++, entry += FFH5_KEY_INDEX_ENTRY_SIZE)
+    {
+        memcpy(&frame, entry, 4);
+        memcpy(&offset, entry + 8, 8);
+        if (frame >= dec->depth || offset >= bitstream_size ||
+            (i == 0 && (frame != 0 || offset != 0)) ||
+            (i > 0 && (frame <= prev_frame || offset <= prev_offset)))
+            return 0;
+        prev_frame = frame;
+        prev_offset = offset;
+    }
+    return table_size;
+}
+
+/*
+ * Function:  ffmpeg_h5_decoder_finish
+ * --------------------
+ * decode the held back bytes (without packet table, padding record and
+ * keyframe table) and flush the codec
+ *
+ *  return: negative value (failed), otherwise success
+ *
+ */
+int ffmpeg_h5_decoder_finish(FFH5Decoder *dec)
+{
+    const uint8_t *packets;
+    AVPacket *pkt;
+    size_t size, n_packets;
+
+    if (dec->failed || dec->finished)
+    {
+        raise_ffmpeg_error("Decoder is finished or failed\n");
+        return -1;
+    }
+    dec->finished = 1;
+    pkt = dec->entry->pkt;
+
+    size = dec->held_size - held_key_index_size(dec);
+    size -= ffh5_pad_record_size(dec->held, size, dec->params[2], dec->params[3]);
+    /* the packet table comes last, too late to spare a stream the parser */
+    size -= ffh5_packet_index_size(dec->held, size, dec->fed, dec->depth, &packets, &n_packets);
+    if (!dec->entry->parser)
+    {
+        /* the whole chunk is held, fed is 0 */
+        if (!packets)
+        {
+            raise_ffmpeg_error("Chunk has no packet table and the codec no parser\n");
+            goto Failure;
+        }
+        if (feed_packets(dec, packets, n_packets) < 0)
+            goto Failure;
+    }
+    else if (feed_parser(dec, dec->held, size) < 0)
+        goto Failure;
+
+    /* the parser still holds the last packet */
+    while (dec->entry->parser)
+    {
+        if (av_parser_parse2(dec->entry->parser, dec->entry->c, &pkt->data, &pkt->size,
+                             NULL, 0, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0) < 0)
+        {
+            raise_ffmpeg_error("Packet not readable\n");
+            goto Failure;
+        }
+        if (!pkt->size)
+            break;
+        if (decode_packet(dec, pkt) < 0)
+            goto Failure;
+    }
+
+    /* flush the decoder */
+    pkt->data = NULL;
+    pkt->size = 0;
+    if (decode_packet(dec, pkt) < 0)
+        goto Failure;
+
+    if (dec->frames == 0)
+    {
+        raise_ffmpeg_error("Decoder produced no frames\n");
+        goto Failure;
+    }
+    return 0;
+
+Failure:
+    dec->failed = 1;
+    return -1;
+}
+
+unsigned long long ffmpeg_h5_decoder_frames(const FFH5Decoder *dec)
+{
+    return dec->frames;
+}
+
+void ffmpeg_h5_decoder_close(FFH5Decoder *dec)
+{
+    if (!dec)
+        return;
+
+    ffh5_release_context(dec->entry, dec->finished && !dec->failed);
+    ffh5_sched_release(0, dec->slot);
+    if (dec->out.grow)
+        free(dec->out.data);
+    free(dec->held);
+    free(dec);
+}
@@ -0,0 +1,133 @@
+/*
+ * FFMPEG HDF5 filter
+ *
+ * Minimal portable threading primitives (once, thread-local storage,
+ * mutexes, condition variables and threads) used by the per-thread codec
+ * context cache and the worker pool.
+ *
+ */
+
+#ifndef FFMPEG_THREAD_H
+#define FFMPEG_THREAD_H
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+typedef INIT_ONCE ffh5_once_t;
+#define FFH5_ONCE_INIT INIT_ONCE_STATIC_INIT
+
+/* fiber local storage is used because, unlike TlsAlloc, it runs a destructor */
+typedef DWORD ffh5_tls_key_t;
+#define FFH5_TLS_CALLBACK WINAPI
+
+static BOOL CALLBACK ffh5_once_trampoline(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once;
+    (void)ctx;
+    ((void (*)(void))param)();
+    return TRUE;
+}
+
+static inline void ffh5_once(ffh5_once_t *once, void (*fn)(void))
+{
+    InitOnceExecuteOnce(once, ffh5_once_trampoline, (PVOID)fn, NULL);
+}
+
+static inline int ffh5_tls_create(ffh5_tls_key_t *key, void(FFH5_TLS_CALLBACK *dtor)(void *))
+{
+    *key = FlsAlloc((PFLS_CALLBACK_FUNCTION)dtor);
+    return (*key == FLS_OUT_OF_INDEXES) ? -1 : 0;
+}
+
+static inline void ffh5_tls_delete(ffh5_tls_key_t key) { FlsFree(key); }
+
+static inline void *ffh5_tls_get(ffh5_tls_key_t key) { return FlsGetValue(key); }
+
+static inline int ffh5_tls_set(ffh5_tls_key_t key, void *value)
+{
+    return FlsSetValue(key, value) ? 0 : -1;
+}
+
+typedef SRWLOCK ffh5_mutex_t;
+#define FFH5_MUTEX_INIT SRWLOCK_INIT
+typedef CONDITION_VARIABLE ffh5_cond_t;
+#define FFH5_COND_INIT CONDITION_VARIABLE_INIT
+
+static inline void ffh5_mutex_lock(ffh5_mutex_t *m) { AcquireSRWLockExclusive(m); }
+static inline void ffh5_mutex_unlock(ffh5_mutex_t *m) { ReleaseSRWLockExclusive(m); }
+static inline void ffh5_cond_wait(ffh5_cond_t *c, ffh5_mutex_t *m)
+{
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+static inline void ffh5_cond_signal(ffh5_cond_t *c) { WakeConditionVariable(c); }
+static inline void ffh5_cond_broadcast(ffh5_cond_t *c) { WakeAllConditionVariable(c); }
+
+typedef HANDLE ffh5_thread_t;
+#define FFH5_THREAD_RETURN DWORD WINAPI
+#define FFH5_THREAD_RETURN_VALUE 0
+
+static inline int ffh5_thread_create(ffh5_thread_t *t, DWORD(WINAPI *fn)(void *), void *arg)
+{
+    *t = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)fn, arg, 0, NULL);
+    return *t ? 0 : -1;
+}
+
+static inline void ffh5_thread_join(ffh5_thread_t t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+#else
+#include <pthread.h>
+
+typedef pthread_once_t ffh5_once_t;
+#define FFH5_ONCE_INIT PTHREAD_ONCE_INIT
+
+typedef pthread_key_t ffh5_tls_key_t;
+#define FFH5_TLS_CALLBACK
+
+static inline void ffh5_once(ffh5_once_t *once, void (*fn)(void)) { pthread_once(once, fn); }
+
+static inline int ffh5_tls_create(ffh5_tls_key_t *key, void (*dtor)(void *))
+{
+    return pthread_key_create(key, dtor);
+}
+
+static inline void ffh5_tls_delete(ffh5_tls_key_t key) { pthread_key_delete(key); }
+
+static inline void *ffh5_tls_get(ffh5_tls_key_t key) { return pthread_getspecific(key); }
+
+static inline int ffh5_tls_set(ffh5_tls_key_t key, void *value)
+{
+    return pthread_setspecific(key, value);
+}
+
+typedef pthread_mutex_t ffh5_mutex_t;
+#define FFH5_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+typedef pthread_cond_t ffh5_cond_t;
+#define FFH5_COND_INIT PTHREAD_COND_INITIALIZER
+
+static inline void ffh5_mutex_lock(ffh5_mutex_t *m) { pthread_mutex_lock(m); }
+static inline void ffh5_mutex_unlock(ffh5_mutex_t *m) { pthread_mutex_unlock(m); }
+static inline void ffh5_cond_wait(ffh5_cond_t *c, ffh5_mutex_t *m) { pthread_cond_wait(c, m); }
+static inline void ffh5_cond_signal(ffh5_cond_t *c) { pthread_cond_signal(c); }
+static inline void ffh5_cond_broadcast(ffh5_cond_t *c) { pthread_cond_broadcast(c); }
+
+typedef pthread_t ffh5_thread_t;
+#define FFH5_THREAD_RETURN void *
+#define FFH5_THREAD_RETURN_VALUE NULL
+
+static inline int ffh5_thread_create(ffh5_thread_t *t, void *(*fn)(void *), void *arg)
+{
+    return pthread_create(t, NULL, fn, arg);
+}
+
+static inline void ffh5_thread_join(ffh5_thread_t t) { pthread_join(t, NULL); }
+
+#endif
+
+#endif // FFMPEG_THREAD_H
@@ -1,4 +1,8 @@
 #include "ffmpeg_utils.h"
+#include "ffmpeg_codec.h"
+#include "ffmpeg_pixconv.h"
+#include "ffmpeg_hw.h"
+#include "ffmpeg_stats.h"
 
 /*
  * Function:  read_from_buffer
@@ -26,6 +30,41 @@ size_t read_from_buffer(uint8_t *buf, int buf_size, unsigned char **data, int *d
     return read_size;
 }
 
+/*
+ * Function:  ffh5_parse_size
+ * --------------------
+ * parse a byte count of an environment variable, "512M", "2G", "65536"
+ *
+ *  *s: number with an optional K, M or G suffix (powers of 1024)
+ *
+ *  returns: bytes, 0 when s is not a positive number
+ *
+ */
+size_t ffh5_parse_size(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    switch (*end)
+    {
+    case 'g':
+    case 'G':
+        v *= 1024;
+        /* fall through */
+    case 'm':
+    case 'M':
+        v *= 1024;
+        /* fall through */
+    case 'k':
+    case 'K':
+        v *= 1024;
+        break;
+    default:
+        break;
+    }
+    return (v > 0) ? (size_t)v : 0;
+}
+
 /*
  * Function:  find_encoder_name
  * --------------------
@@ -69,6 +108,12 @@ void find_encoder_name(int c_id, char *codec_name)
     case FFH5_ENC_AV1_QSV:
         strcpy(codec_name, "av1_qsv");
         break;
+    case FFH5_ENC_FFV1:
+        strcpy(codec_name, "ffv1");
+        break;
+    case FFH5_ENC_X264_LOSSLESS:
+        strcpy(codec_name, "libx264");
+        break;
 
     default:
         strcpy(codec_name, "libx264");
@@ -116,6 +161,9 @@ void find_decoder_name(int c_id, char *codec_name)
     case FFH5_DEC_AV1_QSV:
         strcpy(codec_name, "av1_qsv");
         break;
+    case FFH5_DEC_FFV1:
+        strcpy(codec_name, "ffv1");
+        break;
 
     default:
         strcpy(codec_name, "h264");
@@ -417,53 +465,72 @@ void find_tune(int t_id, char *tune)
  *  *enc_ctx: AVCodecContext
  *  *frame: frame to be encoded
  *  *pkt: pkt where data being compressed into
- *  *out_size: accumulated compressed pkts data size
- *  **out_data: compressed pkts data
- *  *expected_size: expected size of the compressed buffer
+ *  *out: sink the compressed pkts data is appended to
+ *  *keys: keyframe table to extend, or NULL
+ *  *packets: packet table to extend, or NULL
+ *
+ *  returns: 0 on success, negative value on failure
  *
  */
-void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
-                   size_t *out_size, uint8_t **out_data, size_t *expected_size)
+int encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt, struct FFH5Sink *out,
+           struct FFH5KeyIndex *keys, struct FFH5PacketIndex *packets)
 {
+    uint64_t t0 = FFH5_STATS_BEGIN();
     int ret;
-    size_t offset = 0;
-    size_t updated_size = 0;
 
     /* send the frame to the encoder */
-    // if (frame)
-    //     printf("Encode frame %3" PRId64 "\n", frame->pts);
-
     ret = avcodec_send_frame(enc_ctx, frame);
+    FFH5_STATS_END(FFH5_STAGE_SEND, t0);
     if (ret < 0)
+    {
         raise_ffmpeg_error("Error sending a frame for encoding\n");
+        return ret;
+    }
 
     while (ret >= 0)
     {
+        t0 = FFH5_STATS_BEGIN();
         ret = avcodec_receive_packet(enc_ctx, pkt);
+        FFH5_STATS_END(FFH5_STAGE_RECEIVE, t0);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            return;
+            return 0;
         if (ret < 0)
+        {
             raise_ffmpeg_error("Error during encoding\n");
+            return ret;
+        }
 
-        // printf("Encode/Write packet %3" PRId64 " (size=%9d)\n", pkt->pts, pkt->size);
-
-        offset = *out_size;
-        updated_size = *out_size + pkt->size;
+        if (ffh5_sink_reserve(out, pkt->size) < 0)
+        {
+            raise_ffmpeg_error("Out of memory occurred during encoding\n");
+            av_packet_unref(pkt);
+            return AVERROR(ENOMEM);
+        }
 
-        // each time exceeds memory block then realloc two times bigger block
-        if (updated_size > *expected_size)
+        /* remember where random access can start (frames are in order, no b-frames) */
+        if (keys && (pkt->flags & AV_PKT_FLAG_KEY) && keys->count < keys->capacity)
         {
-            *out_data = realloc(*out_data, updated_size * 2);
-            *expected_size = updated_size * 2;
+            keys->frames[keys->count] = (uint32_t)pkt->pts;
+            keys->offsets[keys->count] = out->size;
+            keys->count++;
         }
 
-        if (*out_data == NULL)
+        /* so decoders can skip the parser, see FFH5PacketIndex */
+        if (packets && ffh5_packet_index_add(packets, (uint32_t)pkt->size, (uint32_t)pkt->flags) < 0)
+        {
             raise_ffmpeg_error("Out of memory occurred during encoding\n");
+            av_packet_unref(pkt);
+            return AVERROR(ENOMEM);
+        }
 
-        memcpy(*out_data + offset, pkt->data, pkt->size);
-        *out_size = updated_size;
+        t0 = FFH5_STATS_BEGIN();
+        memcpy(out->data + out->size, pkt->data, pkt->size);
+        FFH5_STATS_END(FFH5_STAGE_COPY, t0);
+        out->size += pkt->size;
         av_packet_unref(pkt);
     }
+
+    return 0;
 }
 
 /*
@@ -474,51 +541,155 @@ void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
  *  *dec_ctx: AVCodecContext
  *  *src_frame: source frame where compressed pkt to be decoded
  *  *pkt: compressed pkt
- *  *sws_context: context of colorspace conversion
- *  *dst_frame: destination frame
- *  *out_size: accumulated destination frame data size
- *  *out_data: frame data took from destination frame
+ *  pixconv: dedicated luma extraction (FFH5_PIXCONV_*), tried before swscale;
+ *           frames of another format get the one of their own format
+ *  **sws_context: context of colorspace conversion, replaced when the
+ *                 frames are not of the format it was made for
+ *  *dst_frame: destination frame, only used when the frame rows in *out
+ *              are not aligned for swscale
+ *  *out: sink the frame data is appended to, frames beyond its
+ *        capacity are dropped
  *  frame_size: size of frame
+ *  *skip: number of leading frames to drop, counted down (may be NULL)
+ *
+ *  returns: 0 on success, negative value on failure
  *
  */
-void decode(AVCodecContext *dec_ctx, AVFrame *src_frame, AVPacket *pkt,
-                   struct SwsContext *sws_context, AVFrame *dst_frame,
-                   size_t *out_size, uint8_t *out_data, size_t frame_size)
+int decode(AVCodecContext *dec_ctx, AVFrame *src_frame, AVPacket *pkt,
+           int pixconv, struct SwsContext **sws_context, AVFrame *dst_frame,
+           struct FFH5Sink *out, size_t frame_size, int *skip)
 {
+    uint8_t *dst_data[4];
+    int dst_linesize[4];
+    uint64_t t0 = FFH5_STATS_BEGIN();
     int ret;
-    size_t offset = 0;
 
     ret = avcodec_send_packet(dec_ctx, pkt);
-
+    FFH5_STATS_END(FFH5_STAGE_SEND, t0);
     if (ret < 0)
+    {
         raise_ffmpeg_error("Error sending a pkt for decoding\n");
-
-    // printf("receiving packets %d\n", pkt->size);
+        return ret;
+    }
 
     while (ret >= 0)
     {
+        t0 = FFH5_STATS_BEGIN();
         ret = avcodec_receive_frame(dec_ctx, src_frame);
+        FFH5_STATS_END(FFH5_STAGE_RECEIVE, t0);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            return;
+            return 0;
         else if (ret < 0)
+        {
             raise_ffmpeg_error("Error receiving a frame for decoding\n");
+            return ret;
+        }
 
-        // printf("Decode frame %3d\n", dec_ctx->frame_number);
+        if (skip && *skip > 0)
+        {
+            /* decoded only to reach the first requested frame */
+            (*skip)--;
+            av_frame_unref(src_frame);
+            continue;
+        }
 
-        /* do colorspace conversion */
-        sws_scale_frame(sws_context, dst_frame, src_frame);
+        /* frames padded to the coded size (see ffh5_coded_params) lose the
+         * replicated columns and rows here, every conversion below then
+         * sees a frame of the output size */
+        if (src_frame->width >= dst_frame->width && src_frame->height >= dst_frame->height &&
+            (src_frame->width > dst_frame->width || src_frame->height > dst_frame->height))
+        {
+            src_frame->crop_right = src_frame->width - dst_frame->width;
+            src_frame->crop_bottom = src_frame->height - dst_frame->height;
+            ret = av_frame_apply_cropping(src_frame, AV_FRAME_CROP_UNALIGNED);
+            if (ret < 0)
+            {
+                av_frame_unref(src_frame);
+                raise_ffmpeg_error("Could not crop decoded frame\n");
+                return ret;
+            }
+        }
 
-        /* put to buffer */
-        offset = *out_size;
+        if (ffh5_sink_reserve(out, frame_size) < 0)
+        {
+            /* more frames than a fixed output holds (the chunk depth) */
+            av_frame_unref(src_frame);
+            continue;
+        }
+
+        /* do colorspace conversion straight into the output when swscale can write there */
+        t0 = FFH5_STATS_BEGIN();
+        av_image_fill_arrays(dst_data, dst_linesize, out->data + out->size,
+                             dst_frame->format, dst_frame->width, dst_frame->height, 1);
+        if (src_frame->hw_frames_ctx)
+        {
+            /* device frame, swscale cannot read it; download luma only */
+            ret = (src_frame->width == dst_frame->width && src_frame->height == dst_frame->height)
+                      ? ffh5_hw_luma_to_gray(src_frame, dst_data[0], dst_linesize[0])
+                      : -1;
+            av_frame_unref(src_frame);
+            FFH5_STATS_END(FFH5_STAGE_CONVERT, t0);
+            if (ret < 0)
+            {
+                raise_ffmpeg_error("Could not download decoded frame\n");
+                return AVERROR(EIO);
+            }
+        }
+        else if (src_frame->width == dst_frame->width && src_frame->height == dst_frame->height &&
+                 (ffh5_yuv_to_gray(pixconv, src_frame, dst_data[0], dst_linesize[0]) == 0 ||
+                  ffh5_yuv_to_gray(ffh5_pixconv_select(dst_frame->format, src_frame->format), src_frame,
+                                   dst_data[0], dst_linesize[0]) == 0))
+        {
+            /* gray data only lives in luma (4:0:0 streams: is all there is) */
+            av_frame_unref(src_frame);
+            FFH5_STATS_END(FFH5_STAGE_CONVERT, t0);
+        }
+        else if (!(*sws_context = sws_getCachedContext(*sws_context, src_frame->width, src_frame->height,
+                                                        src_frame->format, dst_frame->width, dst_frame->height,
+                                                        dst_frame->format, SWS_BILINEAR, NULL, NULL, NULL)))
+        {
+            av_frame_unref(src_frame);
+            raise_ffmpeg_error("Could not initialize conversion context\n");
+            return AVERROR(EINVAL);
+        }
+        else if (!((uintptr_t)dst_data[0] & (FFH5_SWS_ALIGN - 1)) && !(dst_linesize[0] & (FFH5_SWS_ALIGN - 1)))
+        {
+            ret = sws_scale(*sws_context, (const uint8_t *const *)src_frame->data, src_frame->linesize,
+                            0, src_frame->height, dst_data, dst_linesize);
+            av_frame_unref(src_frame);
+            FFH5_STATS_END(FFH5_STAGE_CONVERT, t0);
+            if (ret < 0)
+            {
+                raise_ffmpeg_error("Could not do colorspace conversion\n");
+                return ret;
+            }
+        }
+        else
+        {
+            /* unaligned rows (odd widths) go through dst_frame */
+            ret = sws_scale_frame(*sws_context, dst_frame, src_frame);
+            av_frame_unref(src_frame);
+            FFH5_STATS_END(FFH5_STAGE_CONVERT, t0);
+            if (ret < 0)
+            {
+                raise_ffmpeg_error("Could not do colorspace conversion\n");
+                return ret;
+            }
 
-        av_image_copy_to_buffer(out_data + offset,
-                                frame_size,
-                                (const uint8_t *const *)dst_frame->data,
-                                dst_frame->linesize,
-                                dst_frame->format,
-                                dst_frame->width,
-                                dst_frame->height,
-                                1);
-        *out_size += frame_size;
+            t0 = FFH5_STATS_BEGIN();
+            av_image_copy_to_buffer(out->data + out->size,
+                                    frame_size,
+                                    (const uint8_t *const *)dst_frame->data,
+                                    dst_frame->linesize,
+                                    dst_frame->format,
+                                    dst_frame->width,
+                                    dst_frame->height,
+                                    1);
+            FFH5_STATS_END(FFH5_STAGE_COPY, t0);
+        }
+        out->size += frame_size;
+        FFH5_STATS_ADD(frames_decoded, 1);
     }
-}
\ No newline at end of file
+
+    return 0;
+}
@@ -35,12 +35,39 @@ static inline char *stpcpy(char *dest, const char *src)
 
 #define EXPECTED_CS_RATIO 30
 
+/* number of auxiliary parameters written by the python/java frontends */
+#define FFH5_CD_NELMTS 11
+/* optional trailing parameters, zero (library default) when absent */
+#define FFH5_CD_THREADS 11
+#define FFH5_CD_THREAD_TYPE 12
+#define FFH5_CD_GOP_SIZE 13
+/* intra-frame tiles (AV1) or slices (H.264/HEVC), columns x rows */
+#define FFH5_CD_TILE_COLS 14
+#define FFH5_CD_TILE_ROWS 15
+/* sample layout of 12 bit data, see ffh5_sample_format */
+#define FFH5_CD_SAMPLE_LAYOUT 16
+/* FFH5_FEATURE_* bits of stream features older readers do not know */
+#define FFH5_CD_FEATURES 17
+/* packet table behind the bitstream, see FFH5PacketIndex */
+#define FFH5_FEATURE_PACKET_INDEX 0x1
+/* gray data coded as 4:0:0 where the encoder takes it */
+#define FFH5_FEATURE_MONOCHROME 0x2
+
+/* upper bound of auxiliary parameters understood by the filter */
+#define FFH5_MAX_CD_VALUES 32
+
+/* row alignment swscale needs to write frames in place */
+#define FFH5_SWS_ALIGN 16
+
 #define FFMPEG_FLAG_COMPRESS 0x0000
 
 void raise_ffmpeg_error(const char *msg);
 
 size_t read_from_buffer(uint8_t *buf, int buf_size, unsigned char **data, int *data_size);
 
+/* bytes of "512M", "2G", ... (K/M/G are powers of 1024), 0 when invalid */
+size_t ffh5_parse_size(const char *s);
+
 void find_encoder_name(int c_id, char *codec_name);
 
 void find_decoder_name(int c_id, char *codec_name);
@@ -49,11 +76,15 @@ void find_preset(int p_id, char *preset);
 
 void find_tune(int t_id, char *tune);
 
-void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
-                   size_t *out_size, uint8_t **out_data, size_t *expected_size);
+struct FFH5Sink;
+struct FFH5KeyIndex;
+struct FFH5PacketIndex;
+
+int encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt, struct FFH5Sink *out,
+           struct FFH5KeyIndex *keys, struct FFH5PacketIndex *packets);
 
-void decode(AVCodecContext *dec_ctx, AVFrame *src_frame, AVPacket *pkt,
-                   struct SwsContext *sws_context, AVFrame *dst_frame,
-                   size_t *out_size, uint8_t *out_data, size_t frame_size); 
+int decode(AVCodecContext *dec_ctx, AVFrame *src_frame, AVPacket *pkt,
+           int pixconv, struct SwsContext **sws_context, AVFrame *dst_frame,
+           struct FFH5Sink *out, size_t frame_size, int *skip);
 
 #endif // FFMPEG_UTILS_H
\ No newline at end of file
@@ -419,6 +419,41 @@ class TestBasicFunctionality(unittest.TestCase):
             print(f"{Fore.YELLOW}⚠ AV1 codec test skipped: {str(e)}{Style.RESET_ALL}")
             self.skipTest(f"AV1 codec test skipped: {str(e)}")
 
+    def test_codec_threads(self):
+        """Test the optional codec thread count / thread type parameters."""
+        # Defaults keep the historical 11 parameters
+        self.assertEqual(len(hf.x264()["compression_opts"]), 11)
+
+        compression_options = hf.x264(threads=2, thread_type="slice")
+        self.assertEqual(
+            compression_options["compression_opts"][11:],
+            (2, hf.ThreadType.SLICE),
+        )
+        with self.assertRaises(ValueError):
+            hf.x264(thread_type="pixel")
+
+        test_data = generate_3d_data(
+            width=self.width,
+            height=self.height,
+            depth=self.depth,
+            dtype=np.uint8,
+            pattern="random",
+            seed=self.seed,
+        )
+        print(
+            f"{Fore.BLUE}ℹ Compressing with H.264 codec (2 slice threads)...{Style.RESET_ALL}"
+        )
+
+        decompressed_data, compression_ratio, compressed_size, enc_time, dec_time = (
+            compress_and_decompress(test_data, compression_options)
+        )
+
+        psnr = calculate_psnr(test_data, decompressed_data)
+        self.print_result_table([("H.264 (threads=2)", psnr, compression_ratio)])
+
+        self.assertEqual(test_data.shape, decompressed_data.shape)
+        self.assertGreater(psnr, self.min_psnr_8bit)
+
 
 if __name__ == "__main__":
     runner = ColoredTestRunner(verbosity=1)
@@ -244,6 +244,283 @@ class TestIntegration(unittest.TestCase):
             f"{Fore.GREEN}✓ All chunk sizes provide acceptable quality (PSNR > 40 dB){Style.RESET_ALL}"
         )
 
+    def test_auto_chunks(self):
+        """Test the chunk planner and chunks="auto-ffmpeg"."""
+        shape = (400, 1024, 1024)
+
+        slices = hf.plan_chunks(shape, np.uint8, "libx264", access="slice")
+        self.assertEqual(slices[1:], shape[1:])
+        self.assertLessEqual(slices[0], 16)
+
+        tiles = hf.plan_chunks(shape, np.uint8, "libx264", access="tile")
+        self.assertLess(tiles[1], shape[1])
+        self.assertEqual(tiles[1] % 2, 0)
+
+        volume = hf.plan_chunks(shape, np.uint8, "libx264", access="volume", threads=8)
+        count = np.prod([-(-s // c) for s, c in zip(shape, volume)])
+        self.assertGreaterEqual(count, 16)
+
+        # hardware encoders need aligned frames above their minimum size
+        nvenc = hf.plan_chunks((64, 1000, 1000), np.uint8, "h264_nvenc", access="tile")
+        self.assertEqual(nvenc[1] % 16, 0)
+        self.assertGreaterEqual(nvenc[2], 160)
+
+        h5_file = os.path.join(self.temp_dir, "test_auto_chunks.h5")
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset(
+                "data",
+                data=self.test_data_8bit,
+                chunks="auto-ffmpeg",
+                chunk_access="slice",
+                **hf.x264(crf=23),
+            )
+
+        with h5py.File(h5_file, "r") as f:
+            dataset = f["data"]
+            self.assertEqual(dataset.chunks[1:], (self.height, self.width))
+            psnr = calculate_psnr(self.test_data_8bit, dataset[:])
+
+        self.assertGreater(psnr, 40.0)
+        print(f"{Fore.GREEN}✓ Planned chunks {tiles} (tile), {volume} (volume){Style.RESET_ALL}")
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+    def test_parallel_write_read(self):
+        """Test parallel chunk encode/decode through direct chunk I/O."""
+        h5_file = os.path.join(self.temp_dir, "test_parallel.h5")
+        # depth 50 is not a multiple of 16, so the last chunk is padded
+        chunks = (16, 128, 128)
+
+        with h5py.File(h5_file, "w") as f:
+            dataset = f.create_dataset(
+                "data",
+                shape=self.test_data_8bit.shape,
+                dtype=np.uint8,
+                chunks=chunks,
+                **hf.x264(crf=23),
+            )
+            hf.write_dataset_parallel(dataset, self.test_data_8bit, threads=4)
+
+        with h5py.File(h5_file, "r") as f:
+            dataset = f["data"]
+            # regular filter pipeline reads what the parallel writer stored
+            filtered = dataset[:]
+            parallel = hf.read_dataset_parallel(dataset, threads=4)
+
+        np.testing.assert_array_equal(filtered, parallel)
+        psnr = calculate_psnr(self.test_data_8bit, parallel)
+        ratio = self.test_data_8bit.nbytes / os.path.getsize(h5_file)
+        self.print_result_table(
+            [("Parallel chunks", psnr, ratio, os.path.getsize(h5_file) / 1024)]
+        )
+        self.assertGreater(psnr, 40.0)
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+    def test_pyramid(self):
+        """Test pyramid levels written by create_dataset and the parallel writer."""
+        from h5ffmpeg.pyramid import _downsample_numpy
+
+        h5_file = os.path.join(self.temp_dir, "test_pyramid.h5")
+        # odd sizes take the replicated edges of the kernel
+        volume = self.test_data_8bit[:, :255, :253]
+        for mode in ("mean", "max"):
+            np.testing.assert_array_equal(
+                hf.downsample(volume, mode), _downsample_numpy(volume, mode, False)
+            )
+        np.testing.assert_array_equal(
+            hf.downsample(volume, z=True), _downsample_numpy(volume, "mean", True)
+        )
+
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset("data", data=self.test_data_8bit, pyramid=2, **hf.x264(crf=23))
+            dataset = f.create_dataset(
+                "parallel", shape=self.test_data_8bit.shape, dtype=np.uint8,
+                chunks=(16, 128, 128), pyramid=True, pyramid_mode="max", **hf.x264(crf=23),
+            )
+            hf.write_dataset_parallel(dataset, self.test_data_8bit, threads=4)
+
+        with h5py.File(h5_file, "r") as f:
+            levels = hf.pyramid_levels(f["data"])
+            self.assertEqual(
+                [d.shape for d in levels],
+                [(50, 256, 256), (50, 128, 128), (50, 64, 64)],
+            )
+            expected = hf.downsample(hf.downsample(self.test_data_8bit))
+            self.assertGreater(calculate_psnr(expected, levels[2][:]), 35.0)
+
+            # down to frames of at least 32 pixels
+            levels = hf.pyramid_levels(f["parallel"])
+            self.assertEqual(levels[-1].shape, (50, 32, 32))
+            self.assertEqual(levels[1].chunks, (16, 128, 128))
+            expected = hf.downsample(self.test_data_8bit, "max")
+            self.assertGreater(calculate_psnr(expected, levels[1][:]), 35.0)
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+    def test_read_frames(self):
+        """Test z-range reads of chunks written with a keyframe index."""
+        h5_file = os.path.join(self.temp_dir, "test_read_frames.h5")
+
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset(
+                "data",
+                data=self.test_data_8bit,
+                chunks=(25, 128, 128),
+                **hf.x264(crf=23, gop_size=5),
+            )
+
+        with h5py.File(h5_file, "r") as f:
+            dataset = f["data"]
+            full = dataset[:]
+            # spans the chunk boundary at z = 25
+            frames = hf.read_frames(dataset, 22, 28)
+
+        np.testing.assert_array_equal(frames, full[22:28])
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE and hf.has_codec("ffv1"), "ffv1 not available")
+    def test_lossless_intra(self):
+        """Test that FFV1 chunks read back bit-exact, uint16 unquantized, slice by slice."""
+        h5_file = os.path.join(self.temp_dir, "test_ffv1.h5")
+        # odd frame sizes need no padding for gray
+        data_16bit = self.test_data_16bit[:, :127, :129]
+
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset("data_8bit", data=self.test_data_8bit, chunks=(25, 128, 128), **hf.ffv1())
+            f.create_dataset("data_16bit", data=data_16bit, chunks=(25, 127, 129), **hf.ffv1())
+
+        with h5py.File(h5_file, "r") as f:
+            np.testing.assert_array_equal(f["data_8bit"][:], self.test_data_8bit)
+            self.assertNotIn("bit", f["data_16bit"].attrs)
+            np.testing.assert_array_equal(f["data_16bit"][:], data_16bit)
+            # every frame is a keyframe, ranges start anywhere
+            np.testing.assert_array_equal(hf.read_frames(f["data_16bit"], 22, 28), data_16bit[22:28])
+
+        # datasets created from shape and dtype get the bit mode of the dtype
+        with h5py.File(h5_file, "w") as f:
+            dset = f.create_dataset("data_8bit", shape=self.test_data_8bit.shape, dtype=np.uint8,
+                                    chunks=(25, 128, 128), **hf.ffv1())
+            dset[:] = self.test_data_8bit
+            dset = f.create_dataset("data_16bit", shape=data_16bit.shape, dtype=np.uint16,
+                                    chunks=(25, 127, 129), **hf.ffv1())
+            dset[:] = data_16bit
+
+        with h5py.File(h5_file, "r") as f:
+            np.testing.assert_array_equal(f["data_8bit"][:], self.test_data_8bit)
+            np.testing.assert_array_equal(f["data_16bit"][:], data_16bit)
+
+        # lossless x264 would scale 12/16 bit samples down to 10 bit
+        with self.assertRaises(ValueError):
+            hf.x264_lossless(bit_mode=hf.BitMode.BIT_12)
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE and hf.has_codec("libx265"), "libx265 not available")
+    def test_high_bit_modes(self):
+        """Test the 12 bit mode of x265 and that codecs without 12/16 bit reject them."""
+        h5_file = os.path.join(self.temp_dir, "test_high_bit.h5")
+
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset(
+                "data_12bit", data=self.test_data_16bit, chunks=(25, 128, 128),
+                **hf.x265(crf=10, bit_mode=hf.BitMode.BIT_12),
+            )
+
+        with h5py.File(h5_file, "r") as f:
+            self.assertEqual(f["data_12bit"].attrs["bit"], 12)
+            self.assertGreater(calculate_psnr(self.test_data_16bit, f["data_12bit"][:]), 40.0)
+
+        # their pixel formats would keep only the top 10 or 12 bits
+        with self.assertRaises(ValueError):
+            hf.x265(bit_mode=hf.BitMode.BIT_16)
+        with self.assertRaises(ValueError):
+            hf.x264(bit_mode=hf.BitMode.BIT_12)
+        with self.assertRaises(ValueError):
+            hf.compress_native(self.test_data_16bit, codec="libsvtav1", bit_mode=hf.BitMode.BIT_16)
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+    def test_prefetch(self):
+        """Test slice loops served from read-ahead decoded chunk rows."""
+        h5_file = os.path.join(self.temp_dir, "test_prefetch.h5")
+
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset(
+                "data", data=self.test_data_8bit, chunks=(8, 128, 128), **hf.x264(crf=23)
+            )
+
+        with h5py.File(h5_file, "r") as f:
+            dataset = f["data"]
+            full = dataset[:]
+
+            with hf.prefetch(dataset, depth=2) as data:
+                frames = [data[z] for z in range(0, len(data), 3)]
+                # every chunk row decoded once, ahead of the loop
+                self.assertEqual(data.stats()["decoded"], 7)
+                self.assertGreater(data.stats()["hits"], 10)
+                np.testing.assert_array_equal(data[45:20:-1], full[45:20:-1])
+                np.testing.assert_array_equal(data[5:30:4, 10:20], full[5:30:4, 10:20])
+                np.testing.assert_array_equal(data[-1], full[-1])
+            np.testing.assert_array_equal(np.stack(frames), full[::3])
+
+            frames = list(hf.iter_slices(dataset, 7, 50, 2))
+            np.testing.assert_array_equal(np.stack(frames), full[7:50:2])
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+    def test_hdf5_chunk_cache(self):
+        """Test that ffmpeg datasets open with a chunk cache their chunks fit in."""
+        h5_file = os.path.join(self.temp_dir, "test_rdcc.h5")
+        # 2 x 2 chunks of 8 MB per row, HDF5's 1 MB cache holds none of them
+        shape, chunks = (64, 1024, 1024), (32, 512, 512)
+
+        slices = hf.hdf5_chunk_cache_settings(shape, chunks, 1)
+        self.assertEqual(slices["nbytes"], 4 * 32 * 512 * 512)
+        self.assertEqual(slices["w0"], 1.0)
+        self.assertGreaterEqual(slices["nslots"], 400)
+        tiles = hf.hdf5_chunk_cache_settings(shape, chunks, 1, "tile")
+        # four rows wanted, the dataset only has two
+        self.assertEqual(tiles["nbytes"], 8 * 32 * 512 * 512)
+        volume = hf.hdf5_chunk_cache_settings(shape, chunks, 1, "volume")
+        self.assertEqual(volume["nbytes"], 32 * 512 * 512)
+        with self.assertRaises(ValueError):
+            hf.hdf5_chunk_cache_settings(shape, chunks, 1, "sideways")
+
+        with h5py.File(h5_file, "w") as f:
+            f.create_dataset("data", data=self.test_data_8bit, chunks=(25, 256, 256), **hf.x264(crf=23))
+            f.create_dataset("plain", data=self.test_data_8bit, chunks=(25, 256, 256))
+
+        with h5py.File(h5_file, "r") as f:
+            _nslots, nbytes, w0 = f["data"].id.get_access_plist().get_chunk_cache()
+            self.assertEqual(nbytes, max(25 * 256 * 256, 1024 * 1024))
+            np.testing.assert_array_equal(f["data"][3], f["data"][:][3])
+            self.assertEqual(hf.stats()["hdf5_chunk_cache"]["access"], "slice")
+
+            self.assertGreaterEqual(
+                hf.open_dataset(f, "data", "tile").id.get_access_plist().get_chunk_cache()[1], nbytes
+            )
+            # other datasets keep HDF5's defaults
+            plain = f["plain"].id.get_access_plist().get_chunk_cache()
+            self.assertEqual(plain[1], f.id.get_access_plist().get_cache()[2])
+
+    @unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+    def test_streaming_write(self):
+        """Test writing a dataset from a stream of single frames."""
+        h5_file = os.path.join(self.temp_dir, "test_streaming.h5")
+
+        with h5py.File(h5_file, "w") as f:
+            # 50 slices leave a padded last chunk row, 100 pixels padded tiles
+            dataset = f.create_dataset(
+                "data",
+                shape=self.test_data_8bit.shape,
+                dtype=np.uint8,
+                chunks=(16, 100, 100),
+                **hf.x264(crf=23),
+            )
+            written = hf.write_dataset_streaming(dataset, iter(self.test_data_8bit))
+            self.assertEqual(written, self.test_data_8bit.shape[0])
+
+        with h5py.File(h5_file, "r") as f:
+            dataset = f["data"]
+            filtered = dataset[:]
+            parallel = hf.read_dataset_parallel(dataset, threads=4)
+
+        np.testing.assert_array_equal(filtered, parallel)
+        self.assertGreater(calculate_psnr(self.test_data_8bit, filtered), 40.0)
+
     def test_partial_reads(self):
         """Test partial dataset reads."""
         # Create a temporary HDF5 file
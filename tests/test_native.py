@@ -0,0 +1,531 @@
+"""
+Tests for the native (non-HDF5) FFMPEG API.
+
+This module covers compress_native/decompress_native and the batched
+compress_many/decompress_many entry points.
+"""
+
+import io
+import json
+import os
+import tempfile
+import unittest
+import threading
+import numpy as np
+import h5ffmpeg as hf
+import sys
+import colorama
+from colorama import Fore, Style
+from h5ffmpeg.utils import calculate_psnr
+
+# Initialize colorama
+colorama.init(autoreset=True)
+
+# Import test utilities
+from test_utils import generate_3d_data
+
+from colored_test import ColoredTestRunner, print_summary
+
+
+@unittest.skipUnless(hf.NATIVE_AVAILABLE, "native functions not available")
+class TestNativeFunctionality(unittest.TestCase):
+    """
+    Test the native compress/decompress functions.
+    """
+
+    def setUp(self):
+        """Set up test parameters."""
+        self.width = 128
+        self.height = 128
+        self.depth = 16
+        self.seed = 42
+        self.min_psnr_8bit = 25.0  # dB
+
+        test_name = self._testMethodName
+        print(f"\n{Fore.CYAN}{Style.BRIGHT}▶ Running: {test_name}{Style.RESET_ALL}")
+
+    def make_volume(self, depth=None, pattern="gradient", dtype=np.uint8):
+        return generate_3d_data(
+            width=self.width,
+            height=self.height,
+            depth=depth or self.depth,
+            dtype=dtype,
+            pattern=pattern,
+            seed=self.seed,
+        )
+
+    def test_native_roundtrip(self):
+        """Test compress_native followed by decompress_native."""
+        data = self.make_volume()
+        compressed = hf.compress_native(data, codec="libx264", crf=18)
+        decompressed = hf.decompress_native(compressed)
+
+        self.assertEqual(data.shape, decompressed.shape)
+        self.assertEqual(data.dtype, decompressed.dtype)
+        self.assertGreater(calculate_psnr(data, decompressed), self.min_psnr_8bit)
+
+    def test_decompress_into_out(self):
+        """Test decoding into a caller-provided array and from a memoryview."""
+        data = self.make_volume()
+        compressed = hf.compress_native(data, codec="libx264", crf=18)
+
+        out = np.empty_like(data)
+        result = hf.decompress_native(memoryview(compressed), out=out)
+        self.assertIs(result, out)
+        np.testing.assert_array_equal(out, hf.decompress_native(compressed))
+
+        with self.assertRaises(ValueError):
+            hf.decompress_native(compressed, out=np.empty((1, 1, 1), dtype=np.uint8))
+        with self.assertRaises(TypeError):
+            hf.decompress_native(compressed, out=out[:, ::2])
+
+    def test_decode_frame_range(self):
+        """Test decoding a z-range from the nearest keyframe."""
+        data = self.make_volume()
+        blob = hf.compress_native(data, codec="libx264", crf=18, gop_size=4)
+        full = hf.decompress_native(blob)
+
+        # closed gops: decoding from keyframe 8 matches the full decode
+        part = hf.decompress_native(blob, frames=(9, 12))
+        self.assertEqual(part.shape, (3, self.height, self.width))
+        np.testing.assert_array_equal(part, full[9:12])
+
+        with self.assertRaises(ValueError):
+            hf.decompress_native(blob, frames=(10, self.depth + 1))
+
+    def test_odd_frame_size(self):
+        """Test that frames the codec cannot take are padded and cropped again."""
+        data = self.make_volume()[:, :61, :77].copy()
+        blob = hf.compress_native(data, codec="libx264", crf=18, gop_size=4)
+        self.assertIn(b"FFH5PADS", blob)
+
+        decompressed = hf.decompress_native(blob)
+        self.assertEqual(decompressed.shape, data.shape)
+        self.assertGreater(calculate_psnr(data, decompressed), self.min_psnr_8bit)
+        np.testing.assert_array_equal(hf.decompress_native(blob, frames=(9, 12)), decompressed[9:12])
+
+        buf = io.BytesIO()
+        hf.compress_stream(iter(data), buf, codec="libx264", crf=18, gop_size=4)
+        np.testing.assert_array_equal(hf.decompress_stream(buf.getvalue()), decompressed)
+
+        # even sizes stay unpadded
+        self.assertNotIn(b"FFH5PADS", hf.compress_native(self.make_volume(), codec="libx264", crf=18))
+
+    def test_tiles(self):
+        """Test that tiled/sliced frames are stored as cd_values[14:16] and decode."""
+        from h5ffmpeg.ffmpeg_filter import encoder_cd_values
+
+        cd_values = encoder_cd_values(self.width, self.height, self.depth, codec="libx264", tiles=(2, 2))
+        self.assertEqual(len(cd_values), 16)
+        self.assertEqual(cd_values[14:], (2, 2))
+        self.assertEqual(len(encoder_cd_values(self.width, self.height, self.depth, codec="libx264")), 11)
+        with self.assertRaises(ValueError):
+            encoder_cd_values(self.width, self.height, self.depth, tiles=(0, 65))
+
+        data = self.make_volume()
+        for codec in ("libx264", "libsvtav1"):
+            blob = hf.compress_native(data, codec=codec, crf=18, tiles=(2, 2))
+            decompressed = hf.decompress_native(blob, tiles=(2, 2))
+            self.assertGreater(calculate_psnr(data, decompressed), self.min_psnr_8bit)
+            np.testing.assert_array_equal(hf.decompress_native(blob), decompressed)
+
+    def test_packet_index(self):
+        """Test that indexed chunks decode without the parser, like legacy ones."""
+        import struct
+        from h5ffmpeg import _ffmpeg_filter
+        from h5ffmpeg.ffmpeg_filter import _native_call_args
+
+        data = self.make_volume()
+        blob = hf.compress_native(data, codec="libx264", crf=18, features=hf.Feature.PACKET_INDEX)
+        self.assertEqual(blob[-8:], b"FFH5PKTS")
+
+        # opt-in, default chunks stay readable by 2.4
+        self.assertNotIn(b"FFH5PKTS", hf.compress_native(data, codec="libx264", crf=18))
+        with self.assertRaises(ValueError):
+            hf.compress_native(data, codec="libx264", features=0x80)
+
+        was_enabled = hf.enable_stats()
+        try:
+            hf.reset_stats()
+            result = hf.decompress_native(blob)
+            self.assertEqual(hf.stats()["stages"]["parse"]["calls"], 0)
+        finally:
+            hf.enable_stats(was_enabled)
+        self.assertGreater(calculate_psnr(data, result), self.min_psnr_8bit)
+
+        # without the table the chunk is parsed as before
+        cd_values, _, payload = _native_call_args(1, blob)
+        count = struct.unpack("I", blob[-16:-12])[0]
+        legacy = bytes(payload)[: -(count * 8 + 16)]
+        np.testing.assert_array_equal(
+            _ffmpeg_filter.ffmpeg_native_c(1, cd_values, len(legacy), legacy), result
+        )
+
+    def test_trailers_stripped(self):
+        """Test that a chunk without its trailers is the plain bitstream older readers parse."""
+        import struct
+        from h5ffmpeg import _ffmpeg_filter
+        from h5ffmpeg.ffmpeg_filter import _native_call_args
+
+        data = self.make_volume()
+        blob = hf.compress_native(data, codec="libx264", crf=18, gop_size=4, features=hf.Feature.ALL)
+        self.assertEqual(blob[-8:], b"FFH5KIDX")
+        self.assertIn(b"FFH5PKTS", blob)
+        full = hf.decompress_native(blob)
+
+        cd_values, _, payload = _native_call_args(1, blob)
+        payload = bytes(payload)
+        entry_sizes = {b"FFH5KIDX": 16, b"FFH5PKTS": 8}
+        while payload[-8:] in (b"FFH5KIDX", b"FFH5PADS", b"FFH5PKTS"):
+            magic = payload[-8:]
+            count = struct.unpack("I", payload[-16:-12])[0] if magic != b"FFH5PADS" else 0
+            payload = payload[: -(count * entry_sizes.get(magic, 0) + 16)]
+        self.assertNotIn(b"FFH5PKTS", payload)
+
+        was_enabled = hf.enable_stats()
+        try:
+            hf.reset_stats()
+            legacy = _ffmpeg_filter.ffmpeg_native_c(1, cd_values, len(payload), payload)
+            self.assertGreater(hf.stats()["stages"]["parse"]["calls"], 0)
+        finally:
+            hf.enable_stats(was_enabled)
+        np.testing.assert_array_equal(legacy, full)
+
+    @unittest.skipUnless(hf.has_codec("libx265"), "libx265 not available")
+    def test_monochrome_feature(self):
+        """Test that 4:0:0 coding is recorded in cd_values[17] and only used when asked for."""
+        from h5ffmpeg.ffmpeg_filter import encoder_cd_values
+
+        data = self.make_volume()
+        self.assertEqual(len(encoder_cd_values(self.width, self.height, self.depth, codec="libx265")), 11)
+        cd_values = encoder_cd_values(self.width, self.height, self.depth, codec="libx265",
+                                      features=hf.Feature.MONOCHROME)
+        self.assertEqual(cd_values[17], hf.Feature.MONOCHROME)
+
+        gray = hf.compress_native(data, codec="libx265", crf=18, features=hf.Feature.MONOCHROME)
+        yuv = hf.compress_native(data, codec="libx265", crf=18)
+        self.assertNotEqual(gray, yuv)
+        for blob in (gray, yuv):
+            self.assertGreater(calculate_psnr(data, hf.decompress_native(blob)), self.min_psnr_8bit)
+
+    @unittest.skipUnless(hf.has_codec("libx265"), "libx265 not available")
+    def test_legacy_12bit_layout(self):
+        """Test that 12 bit chunks without the sample layout decode to the 10 bit scale."""
+        from h5ffmpeg import _ffmpeg_filter
+        from h5ffmpeg.ffmpeg_filter import encoder_cd_values
+
+        data = self.make_volume(dtype=np.uint16)
+        cd_values = encoder_cd_values(self.width, self.height, self.depth, codec="libx265", crf=10,
+                                      bit_mode=hf.BitMode.BIT_12)
+        self.assertEqual(cd_values[16], hf.SampleLayout.NATIVE)
+
+        # written like before the flag existed: 11 parameters, 10 bit samples
+        data10 = data >> 6
+        blob = _ffmpeg_filter.ffmpeg_native_c(0, cd_values[:11], data10.nbytes, data10)
+        decoded = hf.decompress_native(blob)
+        self.assertLessEqual(int(decoded.max()), 1023)
+        self.assertLess(np.abs(decoded.astype(np.int32) - data10).mean(), 4)
+
+        data12 = data >> 4
+        blob = hf.compress_native(data12, codec="libx265", crf=10, bit_mode=hf.BitMode.BIT_12)
+        decoded = hf.decompress_native(blob)
+        self.assertGreater(int(decoded.max()), 1023)
+        self.assertLess(np.abs(decoded.astype(np.int32) - data12).mean(), 16)
+
+    def test_ratio_estimate(self):
+        """Test that encoded chunks update the seeded ratio estimate."""
+        data = self.make_volume()
+        hf.size_stats(reset=True)
+        hf.seed_compression_ratio(5.0, codec="libx264", crf=31)
+        self.assertAlmostEqual(hf.expected_compression_ratio(codec="libx264", crf=31), 5.0)
+
+        hf.compress_native(data, codec="libx264", crf=31)
+        stats = hf.size_stats()
+        self.assertEqual(stats["chunks"], 1)
+        self.assertGreater(stats["compressed_bytes"], 0)
+
+        # the seed counts as one observation
+        observed = data.nbytes / stats["compressed_bytes"]
+        self.assertAlmostEqual(
+            hf.expected_compression_ratio(codec="libx264", crf=31), (5.0 + observed) / 2
+        )
+
+    def test_gpu_scheduler(self):
+        """Test the gpu schedule configuration and that CPU codecs bypass it."""
+        self.assertEqual(hf.configure_gpu_scheduler([0, 1], policy="least_loaded"), [0, 1])
+        try:
+            stats = hf.gpu_scheduler_stats()
+            self.assertEqual([gpu["gpu_id"] for gpu in stats["gpus"]], [0, 1])
+
+            data = self.make_volume()
+            result = hf.decompress_native(hf.compress_native(data, codec="libx264", crf=18))
+            self.assertGreater(calculate_psnr(data, result), self.min_psnr_8bit)
+            stats = hf.gpu_scheduler_stats()
+            self.assertEqual(sum(gpu["chunks"] for gpu in stats["gpus"]), 0)
+            self.assertEqual(stats["cpu_fallbacks"], 0)
+
+            with self.assertRaises(ValueError):
+                hf.configure_gpu_scheduler([0], policy="random")
+            with self.assertRaises(ValueError):
+                hf.configure_gpu_scheduler([0], max_sessions=-1)
+        finally:
+            hf.disable_gpu_scheduler()
+        self.assertEqual(hf.gpu_scheduler_stats()["gpus"], [])
+
+    def test_capabilities(self):
+        """Test the cached capability registry and the CUVID decoder fallback."""
+        from h5ffmpeg import _ffmpeg_filter
+        from h5ffmpeg.constants import DecoderCodec
+        from h5ffmpeg.ffmpeg_filter import _native_call_args
+
+        caps = hf.capabilities()
+        self.assertEqual(caps, hf.capabilities())
+        self.assertIn("libx264", caps["encoders"])
+        self.assertIn("h264", caps["decoders"])
+        self.assertTrue(hf.has_codec("h264", encoder=False))
+        self.assertEqual(hf.detect_available_gpus()["nvidia"], caps["cuda_devices"])
+
+        if caps["cuda_devices"] and "h264_cuvid" in caps["decoders"]:
+            self.skipTest("CUVID is available, nothing falls back")
+        data = self.make_volume()
+        blob = hf.compress_native(data, codec="libx264", crf=18)
+        cd_values, buf_size, payload = _native_call_args(1, blob)
+        cd_values = (cd_values[0], DecoderCodec.H264_CUVID) + tuple(cd_values[2:])
+        result = _ffmpeg_filter.ffmpeg_native_c(1, cd_values, buf_size, payload)
+        np.testing.assert_array_equal(result, hf.decompress_native(blob))
+
+    def test_stream_encoder(self):
+        """Test that frames streamed one at a time decode like compress_native."""
+        data = self.make_volume()
+        expected = hf.decompress_native(hf.compress_native(data, codec="libx264", crf=18, gop_size=4))
+
+        buf = io.BytesIO()
+        shape = hf.compress_stream(iter(data), buf, codec="libx264", crf=18, gop_size=4)
+        self.assertEqual(shape, data.shape)
+        blob = buf.getvalue()
+        np.testing.assert_array_equal(hf.decompress_native(blob), expected)
+        np.testing.assert_array_equal(hf.decompress_native(blob, frames=(9, 12)), expected[9:12])
+
+        with hf.StreamEncoder(self.width, self.height, codec="libx264", crf=18) as enc:
+            with self.assertRaises(ValueError):
+                enc.push(np.zeros((1, self.height, self.width + 1), dtype=np.uint8))
+            enc.push(data[:5])
+            enc.push(data[5])
+        self.assertEqual(enc.frames, 6)
+        with self.assertRaises(ValueError):
+            enc.push(data[6])
+
+    def test_stream_decoder(self):
+        """Test decoding in pieces into a caller buffer and through a callback."""
+        data = self.make_volume()
+        blob = hf.compress_native(data, codec="libx264", crf=18, gop_size=4)
+        expected = hf.decompress_native(blob)
+
+        # small reads split packets and the keyframe table
+        out = np.empty_like(data)
+        saved = hf.stream.READ_BLOCK_SIZE
+        hf.stream.READ_BLOCK_SIZE = 1000
+        try:
+            result = hf.decompress_stream(io.BytesIO(blob), out=out)
+        finally:
+            hf.stream.READ_BLOCK_SIZE = saved
+        self.assertIs(result, out)
+        np.testing.assert_array_equal(out, expected)
+
+        frames = {}
+        count = hf.decompress_stream(blob, callback=lambda i, frame: frames.setdefault(i, frame))
+        self.assertEqual(count, self.depth)
+        np.testing.assert_array_equal(np.stack([frames[i] for i in range(count)]), expected)
+
+        def stop(index, frame):
+            raise KeyError(index)
+
+        with self.assertRaises(KeyError):
+            hf.decompress_stream(blob, callback=stop)
+        with self.assertRaises(ValueError):
+            hf.decompress_stream(blob, out=np.empty((1, self.height, self.width), dtype=np.uint8))
+
+    def test_chunk_cache(self):
+        """Test that a repeated decode is served from the decoded chunk cache."""
+        data = self.make_volume()
+        blob = hf.compress_native(data, codec="libx264", crf=18)
+        expected = hf.decompress_native(blob)
+
+        backends = [False] if sys.platform.startswith("win") else [False, True]
+        for shared in backends:
+            hf.configure_chunk_cache("64M", shared=shared)
+            try:
+                hf.chunk_cache_stats(reset=True)
+                np.testing.assert_array_equal(hf.decompress_native(blob), expected)
+                np.testing.assert_array_equal(hf.decompress_native(blob), expected)
+                stats = hf.chunk_cache_stats()
+                self.assertEqual((stats["misses"], stats["hits"], stats["inserts"]), (1, 1, 1))
+                self.assertEqual(stats["bytes"], data.nbytes)
+                self.assertEqual(stats["shared"], shared)
+
+                # a smaller budget evicts what no longer fits
+                hf.configure_chunk_cache(data.nbytes - 1, shared=shared)
+                self.assertEqual(hf.chunk_cache_stats()["bytes"], 0)
+            finally:
+                hf.clear_chunk_cache()
+                hf.configure_chunk_cache(0)
+
+        with self.assertRaises(ValueError):
+            hf.configure_chunk_cache(-1)
+
+    def test_hot_path_stats(self):
+        """Test the per-stage counters and the Chrome trace of a roundtrip."""
+        data = self.make_volume()
+        previous = hf.enable_stats(trace=True)
+        try:
+            hf.reset_stats()
+            blob = hf.compress_native(data, codec="libx264", crf=18)
+            hf.decompress_native(blob)
+            stats = hf.stats()
+
+            self.assertEqual((stats["chunks_encoded"], stats["chunks_decoded"]), (1, 1))
+            self.assertEqual(stats["frames_encoded"], data.shape[0])
+            self.assertEqual(stats["frames_decoded"], data.shape[0])
+            self.assertEqual(stats["encode_bytes_in"], data.nbytes)
+            self.assertEqual(stats["decode_bytes_out"], data.nbytes)
+            self.assertEqual(stats["context_hits"] + stats["context_misses"], 2)
+            for name in ("encode_chunk", "decode_chunk", "codec_open", "parse", "send", "receive"):
+                self.assertGreater(stats["stages"][name]["calls"], 0, name)
+            # chunk stages include the finer ones
+            self.assertGreaterEqual(stats["stages"]["decode_chunk"]["seconds"],
+                                    stats["stages"]["parse"]["seconds"])
+
+            fd, path = tempfile.mkstemp(suffix=".json")
+            os.close(fd)
+            try:
+                hf.write_trace(path)
+                with open(path) as f:
+                    events = json.load(f)["traceEvents"]
+            finally:
+                os.remove(path)
+            self.assertIn("decode_chunk", {e["name"] for e in events})
+            self.assertTrue(all(e["ph"] == "X" and e["dur"] >= 0 for e in events))
+        finally:
+            hf.enable_stats(previous)
+            hf.reset_stats()
+
+        # nothing is counted while statistics are off
+        hf.compress_native(data, codec="libx264", crf=18)
+        if not previous:
+            self.assertEqual(hf.stats()["chunks_encoded"], 0)
+
+    def test_bench_suite(self):
+        """Test a small benchmark sweep and the baseline comparison."""
+        from h5ffmpeg import bench
+
+        report = bench.run_suite(
+            data=["stripes"], codecs=["libx264"], crfs=[18, 28],
+            chunks=[(16, 64, 64), (32, 40, 64)], size=(32, 64, 64), repeat=1,
+        )
+        cases = report["cases"]
+        self.assertEqual(len(cases), 4)
+        for case in cases:
+            self.assertNotIn("error", case)
+            self.assertGreater(case["encode_mbps"], 0)
+            self.assertGreater(case["ratio"], 1)
+            self.assertGreater(case["psnr"], self.min_psnr_8bit)
+            self.assertEqual(set(case["stages"]), {"gather", "encode", "decode", "scatter"})
+
+        self.assertEqual(bench.compare(report, report), [])
+        faster = {"cases": [dict(c, encode_mbps=c["encode_mbps"] * 2) for c in cases]}
+        regressions = bench.compare(report, faster, tolerance=0.1)
+        self.assertEqual([r[1] for r in regressions], ["encode_mbps"] * 4)
+
+    def test_tune_encoder(self):
+        """Test the parameter tuner meets a quality target and caches its result."""
+        vol = self.make_volume(depth=32, pattern="stripes")
+        cache = os.path.join(tempfile.mkdtemp(), "tune.json")
+        kwargs = dict(
+            min_psnr=self.min_psnr_8bit, codecs=["libx264"], presets=["ultrafast", "veryfast"],
+            crfs=[20, 30, 40], chunks=(16, 64, 64), num_patches=2, cache=cache,
+        )
+
+        result = hf.tune_encoder(vol, **kwargs)
+        self.assertTrue(result.met)
+        self.assertFalse(result.cached)
+        self.assertGreaterEqual(result.best.psnr, self.min_psnr_8bit)
+        self.assertIn(result.best, result.pareto)
+        # the highest ratio among the probes meeting the target
+        feasible = [p for p in result.probes if p.psnr >= self.min_psnr_8bit]
+        self.assertEqual(result.best.ratio, max(p.ratio for p in feasible))
+        self.assertEqual(result.compression_opts["compression"], hf.FFMPEG_ID)
+
+        hf.tuner._memory_cache.clear()
+        again = hf.tune_encoder(vol, **kwargs)
+        self.assertTrue(again.cached)
+        self.assertEqual(again.best.to_dict(), result.best.to_dict())
+
+    def test_compress_many_matches_single(self):
+        """Test that batched compression decodes like single compression."""
+        volumes = [self.make_volume(depth=d) for d in (4, 8, 12, 16)]
+
+        blobs = hf.compress_many(volumes, threads=4, codec="libx264", crf=18)
+        self.assertEqual(len(blobs), len(volumes))
+
+        decoded = hf.decompress_many(blobs, threads=4)
+        for volume, blob, result in zip(volumes, blobs, decoded):
+            self.assertEqual(volume.shape, result.shape)
+            np.testing.assert_array_equal(hf.decompress_native(blob), result)
+            self.assertGreater(calculate_psnr(volume, result), self.min_psnr_8bit)
+
+    def test_compress_many_empty(self):
+        """Test that empty batches return empty lists."""
+        self.assertEqual(hf.compress_many([], codec="libx264"), [])
+        self.assertEqual(hf.decompress_many([]), [])
+
+    def test_threads_run_concurrently(self):
+        """Test native calls from several Python threads."""
+        volumes = [self.make_volume(pattern="random") for _ in range(4)]
+        results = [None] * len(volumes)
+
+        def work(i):
+            blob = hf.compress_native(volumes[i], codec="libx264", crf=23)
+            results[i] = hf.decompress_native(blob)
+
+        threads = [threading.Thread(target=work, args=(i,)) for i in range(len(volumes))]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        for volume, result in zip(volumes, results):
+            self.assertIsNotNone(result)
+            self.assertEqual(volume.shape, result.shape)
+
+    def test_quantize_matches_numpy(self):
+        """Test the native intensity transform against the numpy formula."""
+        rng = np.random.default_rng(0)
+        volume = rng.normal(100, 40, size=(8, 300, 300)).astype(np.float32)
+        lo, hi = volume.min(), volume.max()
+        beta = 0.7
+
+        expected = np.clip((volume - lo) / (hi - lo), 0, None) ** np.float32(beta) * 65535
+        expected = np.clip(expected, 0, 65535).astype(np.uint16)
+        result = hf.quantize_intensity(
+            volume, np.uint16, offset=lo, scale=1 / (hi - lo), power=beta, post=65535,
+            lo=0, hi=65535, threads=4,
+        )
+        self.assertEqual(result.dtype, np.uint16)
+        self.assertLessEqual(np.abs(result.astype(np.int32) - expected).max(), 1)
+
+        # integer inputs use a lookup table, in place when the sizes match
+        raw = rng.integers(0, 4096, size=(4, 64, 64), dtype=np.uint16)
+        expected = np.clip(raw.astype(np.float32) ** np.float32(1 / beta), 0, 65535)
+        out = hf.quantize_intensity(raw, np.uint16, power=1 / beta, lo=0, hi=65535, out=raw)
+        self.assertIs(out, raw)
+        self.assertLessEqual(np.abs(out.astype(np.int64) - expected.astype(np.int64)).max(), 1)
+
+
+if __name__ == "__main__":
+    runner = ColoredTestRunner(verbosity=1)
+    result = runner.run(
+        unittest.TestLoader().loadTestsFromTestCase(TestNativeFunctionality)
+    )
+    print_summary("NATIVE TESTS", result)
+
+    sys.exit(not result.wasSuccessful())